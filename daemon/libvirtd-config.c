@@ -281,6 +281,9 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
     data->max_requests = 20;
     data->max_client_requests = 5;
 
+    data->client_weight = 1;
+    data->client_readonly_weight = 1;
+
     data->log_buffer_size = 64;
 
     data->audit_level = 1;
@@ -349,6 +352,13 @@ daemonConfigFree(struct daemonConfig *data)
     }
     VIR_FREE(data->sasl_allowed_username_list);
 
+    tmp = data->client_weight_list;
+    while (tmp && *tmp) {
+        VIR_FREE(*tmp);
+        tmp++;
+    }
+    VIR_FREE(data->client_weight_list);
+
     VIR_FREE(data->key_file);
     VIR_FREE(data->ca_file);
     VIR_FREE(data->cert_file);
@@ -429,6 +439,12 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     GET_CONF_INT(conf, filename, max_requests);
     GET_CONF_INT(conf, filename, max_client_requests);
 
+    GET_CONF_INT(conf, filename, client_weight);
+    GET_CONF_INT(conf, filename, client_readonly_weight);
+    if (remoteConfigGetStringList(conf, "client_weight_list",
+                                  &data->client_weight_list, filename) < 0)
+        goto error;
+
     GET_CONF_INT(conf, filename, audit_level);
     GET_CONF_INT(conf, filename, audit_logging);
 
@@ -67,6 +67,10 @@ struct daemonConfig {
     int max_requests;
     int max_client_requests;
 
+    int client_weight;
+    int client_readonly_weight;
+    char **client_weight_list;
+
     int log_level;
     char *log_filters;
     char *log_outputs;
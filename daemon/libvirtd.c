@@ -51,6 +51,7 @@
 #include "virnetlink.h"
 #include "virnetserver.h"
 #include "remote.h"
+#include "stateshm.h"
 #include "remote_driver.h"
 #include "virhook.h"
 #include "viraudit.h"
@@ -1286,6 +1287,11 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* Hand log messages off to a dedicated thread, now that we won't
+     * fork any more */
+    if (virLogStartWriter() < 0)
+        VIR_WARN("Failed to start log writer thread, logging synchronously");
+
     /* Ensure the rundir exists (on tmpfs on some systems) */
     if (privileged) {
         run_dir = strdup(LOCALSTATEDIR "/run/libvirt");
@@ -1327,6 +1333,12 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    /* Domain state snapshots for local clients live next to the sockets */
+    if (daemonStateShmInit(run_dir) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     if (!(srv = virNetServerNew(config->min_workers,
                                 config->max_workers,
                                 config->prio_workers,
@@ -1343,6 +1355,14 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    if (virNetServerSetDispatchWeights(srv,
+                                       MAX(config->client_weight, 0),
+                                       MAX(config->client_readonly_weight, 0),
+                                       (const char *const *)config->client_weight_list) < 0) {
+        ret = VIR_DAEMON_ERR_CONFIG;
+        goto cleanup;
+    }
+
     /* Beyond this point, nothing should rely on using
      * getuid/geteuid() == 0, for privilege level checks.
      */
@@ -1514,7 +1534,10 @@ cleanup:
 
     daemonConfigFree(config);
 
+    daemonStateShmShutdown();
     virStateCleanup();
 
+    virLogStopWriter();
+
     return ret;
 }
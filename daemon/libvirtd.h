@@ -43,6 +43,8 @@
 
 typedef struct daemonClientStream daemonClientStream;
 typedef daemonClientStream *daemonClientStreamPtr;
+typedef struct daemonStateShm daemonStateShm;
+typedef daemonStateShm *daemonStateShmPtr;
 typedef struct daemonClientPrivate daemonClientPrivate;
 typedef daemonClientPrivate *daemonClientPrivatePtr;
 
@@ -65,6 +67,9 @@ struct daemonClientPrivate {
 
     daemonClientStreamPtr streams;
     bool keepalive_supported;
+    bool stream_credit; /* client grants credit for stream data */
+    bool stream_sparse; /* client takes holes in stream data */
+    daemonStateShmPtr stateShm; /* domain state snapshot handed out */
 };
 
 # if WITH_SASL
@@ -37,6 +37,7 @@
 #include "virlog.h"
 #include "virutil.h"
 #include "stream.h"
+#include "stateshm.h"
 #include "viruuid.h"
 #include "libvirt/libvirt-qemu.h"
 #include "libvirt/libvirt-lxc.h"
@@ -682,6 +683,8 @@ void remoteClientFreeFunc(void *data)
         virConnectClose(priv->conn);
     }
 
+    daemonStateShmRelease(priv->stateShm);
+
     VIR_FREE(priv);
 }
 
@@ -3728,6 +3731,25 @@ static int remoteDispatchSupportsFeature(
         goto done;
     }
 
+    /* Asking for this feature means the client will grant credit
+     * for the data of the streams opened from now on */
+    if (args->feature == VIR_DRV_FEATURE_STREAM_CREDIT) {
+        virMutexLock(&priv->lock);
+        priv->stream_credit = true;
+        virMutexUnlock(&priv->lock);
+        supported = 1;
+        goto done;
+    }
+
+    /* Likewise, holes may be sent in place of zeros from now on */
+    if (args->feature == VIR_DRV_FEATURE_STREAM_SPARSE) {
+        virMutexLock(&priv->lock);
+        priv->stream_sparse = true;
+        virMutexUnlock(&priv->lock);
+        supported = 1;
+        goto done;
+    }
+
     if (!priv->conn) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
         goto cleanup;
@@ -3735,6 +3757,7 @@ static int remoteDispatchSupportsFeature(
 
     switch (args->feature) {
     case VIR_DRV_FEATURE_FD_PASSING:
+    case VIR_DRV_FEATURE_STATE_SHM:
         supported = 1;
         break;
 
@@ -4662,6 +4685,82 @@ cleanup:
     return rv;
 }
 
+static int
+remoteDispatchConnectOpenStateShm(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                  virNetServerClientPtr client,
+                                  virNetMessagePtr msg,
+                                  virNetMessageErrorPtr rerr,
+                                  remote_connect_open_state_shm_args *args)
+{
+    int rv = -1;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+    char *uri = NULL;
+    int fd = -1;
+    size_t i;
+
+    virMutexLock(&priv->lock);
+
+    if (args->flags) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("unsupported flags (0x%x)"), args->flags);
+        goto cleanup;
+    }
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    /* The snapshot is for read-only clients, and only a UNIX socket
+     * can pass its file descriptor */
+    if (!virNetServerClientGetReadonly(client) ||
+        !virNetServerClientIsLocal(client)) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("state snapshots are only available to read-only "
+                         "clients on a local socket"));
+        goto cleanup;
+    }
+
+    if (!priv->stateShm) {
+        if (!(uri = virConnectGetURI(priv->conn)))
+            goto cleanup;
+
+        if (!(priv->stateShm = daemonStateShmAcquire(uri)))
+            goto cleanup;
+    }
+
+    if ((fd = daemonStateShmGetFD(priv->stateShm)) < 0)
+        goto cleanup;
+
+    /* We shouldn't have received any from the client,
+     * but in case they're playing games with us, prevent
+     * a resource leak
+     */
+    for (i = 0 ; i < msg->nfds ; i++)
+        VIR_FORCE_CLOSE(msg->fds[i]);
+    VIR_FREE(msg->fds);
+    msg->nfds = 0;
+
+    if (VIR_ALLOC_N(msg->fds, 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    msg->fds[0] = fd;
+    msg->nfds = 1;
+    fd = -1;
+
+    rv = 1;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(uri);
+    return rv;
+}
+
 static int
 remoteDispatchDomainGetJobStats(virNetServerPtr server ATTRIBUTE_UNUSED,
                                 virNetServerClientPtr client,
@@ -4706,6 +4805,114 @@ cleanup:
     return rv;
 }
 
+static int
+remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       remote_connect_get_all_domain_stats_args *args,
+                                       remote_connect_get_all_domain_stats_ret *ret)
+{
+    int rv = -1;
+    int i;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+    virDomainStatsRecordPtr *retStats = NULL;
+    int nrecords = 0;
+    virDomainPtr *doms = NULL;
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (args->doms.doms_len) {
+        /* The list is passed on NULL terminated */
+        if (VIR_ALLOC_N(doms, args->doms.doms_len + 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        for (i = 0; i < args->doms.doms_len; i++) {
+            if (!(doms[i] = get_nonnull_domain(priv->conn,
+                                               args->doms.doms_val[i])))
+                goto cleanup;
+        }
+
+        if ((nrecords = virDomainListGetStats(doms, args->stats,
+                                              &retStats, args->flags)) < 0)
+            goto cleanup;
+    } else {
+        if ((nrecords = virConnectGetAllDomainStats(priv->conn,
+                                                    args->stats,
+                                                    &retStats,
+                                                    args->flags)) < 0)
+            goto cleanup;
+    }
+
+    if (nrecords > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of domain stats records is %d, "
+                         "which exceeds max limit: %d"),
+                       nrecords, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (nrecords) {
+        if (VIR_ALLOC_N(ret->retStats.retStats_val, nrecords) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        ret->retStats.retStats_len = nrecords;
+
+        for (i = 0; i < nrecords; i++) {
+            remote_domain_stats_record *dst = ret->retStats.retStats_val + i;
+
+            if (retStats[i]->nparams > REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Number of stats entries for domain '%s' "
+                                 "is %d, which exceeds max limit: %d"),
+                               retStats[i]->dom->name, retStats[i]->nparams,
+                               REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX);
+                goto cleanup;
+            }
+
+            make_nonnull_domain(&dst->dom, retStats[i]->dom);
+
+            if (remoteSerializeTypedParameters(retStats[i]->params,
+                                               retStats[i]->nparams,
+                                               &dst->params.params_val,
+                                               &dst->params.params_len,
+                                               VIR_TYPED_PARAM_STRING_OKAY) < 0)
+                goto cleanup;
+        }
+    } else {
+        ret->retStats.retStats_len = 0;
+        ret->retStats.retStats_val = NULL;
+    }
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        xdr_free((xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+                 (char *) ret);
+    }
+
+    virDomainStatsRecordListFree(retStats);
+    if (doms) {
+        for (i = 0; i < args->doms.doms_len; i++) {
+            if (doms[i])
+                virDomainFree(doms[i]);
+        }
+        VIR_FREE(doms);
+    }
+
+    return rv;
+}
+
 /*----- Helpers. -----*/
 
 /* get_nonnull_domain and get_nonnull_network turn an on-wire
@@ -0,0 +1,504 @@
+/*
+ * stateshm.c: publish domain state to local clients in shared memory
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include "stateshm.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virobject.h"
+#include "virshmstate.h"
+#include "virtime.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/* Lifecycle events trigger a refresh, this only bounds how old
+ * the CPU time and balloon values can get */
+#define DAEMON_STATE_SHM_INTERVAL 1000
+
+/* Refreshes for events are at least this far apart, so that a burst
+ * of them, such as from starting many domains, costs one refresh
+ * rather than one per domain */
+#define DAEMON_STATE_SHM_COALESCE 100
+
+/*
+ * There is one publisher per connection URI, shared by all the
+ * clients which asked for a snapshot of that URI. It has its own
+ * read-only connection and a thread refreshing the snapshot, so
+ * slow drivers never hold up the event loop or RPC workers.
+ */
+struct daemonStateShm {
+    virObjectLockable parent;
+
+    /* Immutable once published in the list */
+    char *uri;
+    virShmStatePtr state;
+    int rofd;
+
+    /* Owned by the refresh thread */
+    virThread thread;
+    virConnectPtr conn;
+    int callbackID;
+
+    /* Protected by the object lock */
+    virCond cond;
+    bool dirty;
+    bool quit;
+    bool exited; /* The refresh thread only needs joining */
+
+    /* Protected by daemonStateShmLock */
+    size_t users;
+};
+
+static virClassPtr daemonStateShmClass;
+static virMutex daemonStateShmLock;
+static daemonStateShmPtr *daemonStateShmList;
+static size_t daemonStateShmCount;
+static daemonStateShmPtr *daemonStateShmStopped;
+static size_t daemonStateShmStoppedCount;
+static char *daemonStateShmDir;
+
+static void daemonStateShmDispose(void *obj);
+
+
+int
+daemonStateShmInit(const char *rundir)
+{
+    if (!(daemonStateShmClass = virClassNew(virClassForObjectLockable(),
+                                            "daemonStateShm",
+                                            sizeof(daemonStateShm),
+                                            daemonStateShmDispose)))
+        return -1;
+
+    if (virMutexInit(&daemonStateShmLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+
+    if (!(daemonStateShmDir = strdup(rundir))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+daemonStateShmDispose(void *obj)
+{
+    daemonStateShmPtr shm = obj;
+
+    VIR_DEBUG("shm=%p uri=%s", shm, NULLSTR(shm->uri));
+
+    virShmStateClose(shm->state);
+    VIR_FORCE_CLOSE(shm->rofd);
+    virCondDestroy(&shm->cond);
+    VIR_FREE(shm->uri);
+}
+
+
+static int
+daemonStateShmLifecycle(virConnectPtr conn ATTRIBUTE_UNUSED,
+                        virDomainPtr dom ATTRIBUTE_UNUSED,
+                        int event ATTRIBUTE_UNUSED,
+                        int detail ATTRIBUTE_UNUSED,
+                        void *opaque)
+{
+    daemonStateShmPtr shm = opaque;
+
+    virObjectLock(shm);
+    shm->dirty = true;
+    virCondSignal(&shm->cond);
+    virObjectUnlock(shm);
+
+    return 0;
+}
+
+
+static void
+daemonStateShmRefresh(daemonStateShmPtr shm)
+{
+    virDomainPtr *doms = NULL;
+    virShmStateDomainPtr domains = NULL;
+    size_t ndomains = 0;
+    int ndoms;
+    int i;
+
+    if ((ndoms = virConnectListAllDomains(shm->conn, &doms, 0)) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Unable to list domains of %s: %s", shm->uri,
+                 err && err->message ? err->message : "unknown error");
+        goto cleanup;
+    }
+
+    if (ndoms && VIR_ALLOC_N(domains, ndoms) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < ndoms ; i++) {
+        virShmStateDomainPtr cur = &domains[ndomains];
+        const char *name = virDomainGetName(doms[i]);
+        virDomainInfo info;
+
+        /* Skip domains which went away since they were listed,
+         * clients looking them up fall back to RPC */
+        if (virDomainGetInfo(doms[i], &info) < 0 ||
+            virDomainGetState(doms[i], &cur->state, &cur->reason, 0) < 0 ||
+            virDomainGetUUID(doms[i], cur->uuid) < 0)
+            continue;
+
+        cur->id = (int) virDomainGetID(doms[i]);
+        if (!virStrcpyStatic(cur->name, name)) {
+            ignore_value(virStrncpy(cur->name, name, sizeof(cur->name) - 1,
+                                    sizeof(cur->name)));
+            cur->flags |= VIR_SHM_STATE_DOMAIN_NAME_TRUNCATED;
+        }
+        cur->nrVirtCpu = info.nrVirtCpu;
+        cur->maxMem = info.maxMem;
+        cur->memory = info.memory;
+        cur->cpuTime = info.cpuTime;
+        ndomains++;
+    }
+
+    virShmStatePublish(shm->state, domains, ndomains);
+
+cleanup:
+    for (i = 0 ; i < ndoms ; i++)
+        virDomainFree(doms[i]);
+    VIR_FREE(doms);
+    VIR_FREE(domains);
+    virResetLastError();
+}
+
+
+static void
+daemonStateShmWorker(void *opaque)
+{
+    daemonStateShmPtr shm = opaque;
+
+    virObjectLock(shm);
+    while (!shm->quit) {
+        unsigned long long last;
+
+        shm->dirty = false;
+        virObjectUnlock(shm);
+
+        daemonStateShmRefresh(shm);
+
+        virObjectLock(shm);
+
+        /* Clients stop trusting the snapshot soon after this */
+        if (virTimeMillisNow(&last) < 0) {
+            VIR_WARN("Unable to read clock, no longer publishing state of %s",
+                     shm->uri);
+            break;
+        }
+
+        while (!shm->dirty && !shm->quit) {
+            if (virCondWaitUntil(&shm->cond, &shm->parent.lock,
+                                 last + DAEMON_STATE_SHM_INTERVAL) < 0)
+                break;
+        }
+
+        /* Hold off refreshing for an event until it is far enough
+         * from the last refresh, letting the events which follow it
+         * come in first */
+        while (shm->dirty && !shm->quit) {
+            if (virCondWaitUntil(&shm->cond, &shm->parent.lock,
+                                 last + DAEMON_STATE_SHM_COALESCE) < 0)
+                break;
+        }
+    }
+    virObjectUnlock(shm);
+
+    if (shm->callbackID != -1)
+        virConnectDomainEventDeregisterAny(shm->conn, shm->callbackID);
+    virConnectClose(shm->conn);
+    shm->conn = NULL;
+
+    virObjectLock(shm);
+    shm->exited = true;
+    virObjectUnlock(shm);
+}
+
+
+static daemonStateShmPtr
+daemonStateShmNew(const char *uri)
+{
+    daemonStateShmPtr shm;
+
+    if (!(shm = virObjectLockableNew(daemonStateShmClass)))
+        return NULL;
+
+    shm->rofd = -1;
+    shm->callbackID = -1;
+
+    if (virCondInit(&shm->cond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize condition variable"));
+        goto error;
+    }
+
+    if (!(shm->uri = strdup(uri))) {
+        virReportOOMError();
+        goto error;
+    }
+
+    if (!(shm->state = virShmStateNew(daemonStateShmDir, &shm->rofd)))
+        goto error;
+
+    if (!(shm->conn = virConnectOpenReadOnly(uri)))
+        goto error;
+
+    /* Without lifecycle events the periodic refresh has to do */
+    shm->callbackID =
+        virConnectDomainEventRegisterAny(shm->conn, NULL,
+                                         VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                         VIR_DOMAIN_EVENT_CALLBACK(daemonStateShmLifecycle),
+                                         virObjectRef(shm),
+                                         virObjectFreeCallback);
+    if (shm->callbackID < 0) {
+        virObjectUnref(shm);
+        virResetLastError();
+    }
+
+    /* The thread closes the connection, and is joined by whoever
+     * drops the last reference */
+    if (virThreadCreate(&shm->thread, true, daemonStateShmWorker, shm) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot create state refresh thread"));
+        goto error;
+    }
+
+    return shm;
+
+error:
+    if (shm->callbackID != -1)
+        virConnectDomainEventDeregisterAny(shm->conn, shm->callbackID);
+    if (shm->conn)
+        virConnectClose(shm->conn);
+    shm->conn = NULL;
+    virObjectUnref(shm);
+    return NULL;
+}
+
+
+static void
+daemonStateShmJoin(daemonStateShmPtr shm)
+{
+    virThreadJoin(&shm->thread);
+    virObjectUnref(shm);
+}
+
+
+/*
+ * Tell the refresh thread of @shm to quit. It may be in the middle of
+ * a slow refresh, so it is only joined later on. Must be called with
+ * daemonStateShmLock held.
+ */
+static void
+daemonStateShmStopLocked(daemonStateShmPtr shm)
+{
+    VIR_DEBUG("No longer publishing domain state of %s", shm->uri);
+
+    virObjectLock(shm);
+    shm->quit = true;
+    virCondSignal(&shm->cond);
+    virObjectUnlock(shm);
+
+    if (VIR_APPEND_ELEMENT_COPY(daemonStateShmStopped,
+                                daemonStateShmStoppedCount, shm) < 0) {
+        virReportOOMError();
+        daemonStateShmJoin(shm);
+    }
+}
+
+
+/* Join the refresh threads which are done. Must be called with
+ * daemonStateShmLock held. */
+static void
+daemonStateShmReapLocked(void)
+{
+    size_t i = 0;
+
+    while (i < daemonStateShmStoppedCount) {
+        daemonStateShmPtr shm = daemonStateShmStopped[i];
+        bool exited;
+
+        virObjectLock(shm);
+        exited = shm->exited;
+        virObjectUnlock(shm);
+
+        if (!exited) {
+            i++;
+            continue;
+        }
+
+        VIR_DELETE_ELEMENT(daemonStateShmStopped, i,
+                           daemonStateShmStoppedCount);
+        daemonStateShmJoin(shm);
+    }
+}
+
+
+/**
+ * daemonStateShmAcquire:
+ * @uri: canonical URI of the connection to publish
+ *
+ * Find the publisher for @uri, starting one if needed. Each
+ * successful call must be paired with daemonStateShmRelease.
+ *
+ * Returns the publisher, or NULL on error
+ */
+daemonStateShmPtr
+daemonStateShmAcquire(const char *uri)
+{
+    daemonStateShmPtr shm = NULL;
+    size_t i;
+
+    if (!daemonStateShmDir) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("domain state snapshots are not available"));
+        return NULL;
+    }
+
+    virMutexLock(&daemonStateShmLock);
+
+    daemonStateShmReapLocked();
+
+    for (i = 0 ; i < daemonStateShmCount ; i++) {
+        if (STREQ(daemonStateShmList[i]->uri, uri)) {
+            shm = daemonStateShmList[i];
+            goto cleanup;
+        }
+    }
+
+    VIR_DEBUG("Publishing domain state of %s", uri);
+    if (!(shm = daemonStateShmNew(uri)))
+        goto cleanup;
+
+    if (VIR_APPEND_ELEMENT_COPY(daemonStateShmList,
+                                daemonStateShmCount, shm) < 0) {
+        virReportOOMError();
+        daemonStateShmStopLocked(shm);
+        shm = NULL;
+        goto cleanup;
+    }
+
+cleanup:
+    if (shm)
+        shm->users++;
+    virMutexUnlock(&daemonStateShmLock);
+    return shm;
+}
+
+
+/**
+ * daemonStateShmGetFD:
+ * @shm: the publisher
+ *
+ * Returns a new read-only descriptor of the snapshot, which the
+ * caller must close, or -1 on error
+ */
+int
+daemonStateShmGetFD(daemonStateShmPtr shm)
+{
+    int fd;
+
+    if ((fd = dup(shm->rofd)) < 0)
+        virReportSystemError(errno, "%s",
+                             _("cannot duplicate state file descriptor"));
+
+    return fd;
+}
+
+
+void
+daemonStateShmRelease(daemonStateShmPtr shm)
+{
+    size_t i;
+
+    /* Once shut down, the publisher has already been stopped */
+    if (!shm || !daemonStateShmDir)
+        return;
+
+    virMutexLock(&daemonStateShmLock);
+
+    if (shm->users && --shm->users) {
+        virMutexUnlock(&daemonStateShmLock);
+        return;
+    }
+
+    for (i = 0 ; i < daemonStateShmCount ; i++) {
+        if (daemonStateShmList[i] == shm) {
+            VIR_DELETE_ELEMENT(daemonStateShmList, i, daemonStateShmCount);
+            break;
+        }
+    }
+
+    daemonStateShmStopLocked(shm);
+    daemonStateShmReapLocked();
+
+    virMutexUnlock(&daemonStateShmLock);
+}
+
+
+/**
+ * daemonStateShmShutdown:
+ *
+ * Stop all the publishers and wait for their refresh threads, which
+ * use the drivers, to be done. Must be called before the drivers are
+ * cleaned up.
+ */
+void
+daemonStateShmShutdown(void)
+{
+    size_t i;
+
+    if (!daemonStateShmDir)
+        return;
+
+    virMutexLock(&daemonStateShmLock);
+
+    for (i = 0 ; i < daemonStateShmCount ; i++)
+        daemonStateShmStopLocked(daemonStateShmList[i]);
+    VIR_FREE(daemonStateShmList);
+    daemonStateShmCount = 0;
+
+    for (i = 0 ; i < daemonStateShmStoppedCount ; i++)
+        daemonStateShmJoin(daemonStateShmStopped[i]);
+    VIR_FREE(daemonStateShmStopped);
+    daemonStateShmStoppedCount = 0;
+
+    VIR_FREE(daemonStateShmDir);
+
+    virMutexUnlock(&daemonStateShmLock);
+    virMutexDestroy(&daemonStateShmLock);
+}
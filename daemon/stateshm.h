@@ -0,0 +1,38 @@
+/*
+ * stateshm.h: publish domain state to local clients in shared memory
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef __LIBVIRTD_STATE_SHM_H__
+# define __LIBVIRTD_STATE_SHM_H__
+
+# include "libvirtd.h"
+
+int daemonStateShmInit(const char *rundir);
+
+daemonStateShmPtr daemonStateShmAcquire(const char *uri);
+
+int daemonStateShmGetFD(daemonStateShmPtr shm);
+
+void daemonStateShmRelease(daemonStateShmPtr shm);
+
+void daemonStateShmShutdown(void);
+
+#endif /* __LIBVIRTD_STATE_SHM_H__ */
@@ -50,6 +50,15 @@ struct daemonClientStream {
     virNetMessagePtr rx;
     int tx;
 
+    /* With credit based flow control, no more than 'credit' bytes
+     * of data in total may be sent to the client */
+    bool hasCredit;
+    unsigned long long sent;
+    unsigned long long credit;
+
+    /* Holes in the data are passed as such, rather than as zeros */
+    bool sparse;
+
     daemonClientStreamPtr next;
 };
 
@@ -70,13 +79,20 @@ daemonStreamHandleAbort(virNetServerClientPtr client,
 
 
 
+/* Whether the client has room for more data */
+static bool
+daemonStreamHasCredit(daemonClientStream *stream)
+{
+    return !stream->hasCredit || stream->sent < stream->credit;
+}
+
 static void
 daemonStreamUpdateEvents(daemonClientStream *stream)
 {
     int newEvents = 0;
     if (stream->rx)
         newEvents |= VIR_STREAM_EVENT_WRITABLE;
-    if (stream->tx && !stream->recvEOF)
+    if (stream->tx && !stream->recvEOF && daemonStreamHasCredit(stream))
         newEvents |= VIR_STREAM_EVENT_READABLE;
 
     virStreamEventUpdateCallback(stream->st, newEvents);
@@ -142,7 +158,11 @@ daemonStreamEvent(virStreamPtr st, int events, void *opaque)
 
     if (!stream->closed && !stream->recvEOF &&
         (events & (VIR_STREAM_EVENT_READABLE))) {
-        events = events & ~(VIR_STREAM_EVENT_READABLE);
+        /* A single read may leave data behind, in particular when
+         * the client's credit runs short, so the hangup is only
+         * acted upon once it comes without anything to read */
+        events = events & ~(VIR_STREAM_EVENT_READABLE |
+                            VIR_STREAM_EVENT_HANGUP);
         if (daemonStreamHandleRead(client, stream) < 0) {
             daemonRemoveClientStream(client, stream);
             virNetServerClientClose(client);
@@ -255,6 +275,38 @@ cleanup:
 }
 
 
+/*
+ * Raise the limit on the data sent to the client to what @msg
+ * grants.  The message is freed, unless it is malformed.
+ *
+ * Returns 1 if the message was processed, -1 on fatal client error
+ */
+static int
+daemonStreamHandleCredit(daemonClientStream *stream,
+                         virNetMessagePtr msg)
+{
+    virNetStreamCredit credit;
+
+    memset(&credit, 0, sizeof(credit));
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamCredit,
+                                   &credit) < 0)
+        return -1;
+    virNetMessageFree(msg);
+
+    VIR_DEBUG("stream=%p sent=%llu credit=%llu limit=%llu",
+              stream, stream->sent, stream->credit,
+              (unsigned long long) credit.limit);
+
+    if (stream->hasCredit && credit.limit > stream->credit) {
+        stream->credit = credit.limit;
+        if (!stream->closed)
+            daemonStreamUpdateEvents(stream);
+    }
+
+    return 1;
+}
+
+
 /*
  * @client: a locked client object
  *
@@ -273,7 +325,9 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_CREDIT &&
+        msg->header.type != VIR_NET_STREAM_HOLE)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -287,6 +341,17 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
               client, stream->rx, msg->header.proc,
               msg->header.serial, msg->header.status);
 
+    if (msg->header.type == VIR_NET_STREAM_CREDIT) {
+        ret = daemonStreamHandleCredit(stream, msg);
+        goto cleanup;
+    }
+
+    if (msg->header.type == VIR_NET_STREAM_HOLE && !stream->sparse) {
+        VIR_WARN("Unexpected stream hole from client=%p", client);
+        ret = -1;
+        goto cleanup;
+    }
+
     virNetMessageQueuePush(&stream->rx, msg);
     daemonStreamUpdateEvents(stream);
     ret = 1;
@@ -330,6 +395,14 @@ daemonCreateClientStream(virNetServerClientPtr client,
     stream->filterID = -1;
     stream->st = st;
 
+    virMutexLock(&priv->lock);
+    if (priv->stream_credit) {
+        stream->hasCredit = true;
+        stream->credit = VIR_NET_STREAM_CREDIT_INITIAL;
+    }
+    stream->sparse = priv->stream_sparse;
+    virMutexUnlock(&priv->lock);
+
     return stream;
 }
 
@@ -542,6 +615,56 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Skip the hole the client sent in the stream.
+ *
+ * Returns:
+ *   -1  if fatal error occurred
+ *    0  if message was fully processed
+ *    1  if message is still being processed
+ */
+static int
+daemonStreamHandleHole(virNetServerClientPtr client,
+                       daemonClientStream *stream,
+                       virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    size_t length = msg->bufferLength;
+    int ret;
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%d",
+              client, stream, msg->header.proc, msg->header.serial);
+
+    memset(&data, 0, sizeof(data));
+    ret = virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                     &data);
+    /* Leave the message as it was, in case it must be decoded again */
+    msg->bufferLength = length;
+
+    if (ret == 0)
+        ret = virStreamSendHole(stream->st, data.length, data.flags);
+
+    if (ret == -2) {
+        /* Blocking, so indicate we have more todo later */
+        return 1;
+    } else if (ret < 0) {
+        virNetMessageError rerr;
+
+        memset(&rerr, 0, sizeof(rerr));
+
+        VIR_INFO("Stream send hole failed");
+        stream->closed = 1;
+        return virNetServerProgramSendReplyError(stream->prog,
+                                                 client,
+                                                 msg,
+                                                 &rerr,
+                                                 &msg->header);
+    }
+
+    return 0;
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -646,7 +769,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -701,6 +827,7 @@ static int
 daemonStreamHandleRead(virNetServerClientPtr client,
                        daemonClientStream *stream)
 {
+    virNetMessagePtr msg;
     char *buffer;
     size_t bufferLen = VIR_NET_MESSAGE_PAYLOAD_MAX;
     int ret;
@@ -720,50 +847,89 @@ daemonStreamHandleRead(virNetServerClientPtr client,
     if (!stream->tx)
         return 0;
 
-    if (VIR_ALLOC_N(buffer, bufferLen) < 0)
+    /* Don't send more than the client has room for */
+    if (stream->hasCredit) {
+        if (stream->sent >= stream->credit)
+            return 0;
+        if (bufferLen > stream->credit - stream->sent)
+            bufferLen = stream->credit - stream->sent;
+    }
+
+    if (!(msg = virNetMessageNew(false)))
         return -1;
 
-    ret = virStreamRecv(stream->st, buffer, bufferLen);
-    if (ret == -2) {
-        /* Should never get this, since we're only called when we know
-         * we're readable, but hey things change... */
-        ret = 0;
-    } else if (ret < 0) {
-        virNetMessagePtr msg;
-        virNetMessageError rerr;
+    /* Read straight into the message so the data needn't be
+     * copied again when it is encoded */
+    if (!(buffer = virNetMessageReservePayloadRaw(msg, bufferLen))) {
+        virNetMessageFree(msg);
+        return -1;
+    }
 
-        memset(&rerr, 0, sizeof(rerr));
+    if (stream->sparse)
+        ret = virStreamRecvFlags(stream->st, buffer, bufferLen,
+                                 VIR_STREAM_RECV_STOP_AT_HOLE);
+    else
+        ret = virStreamRecv(stream->st, buffer, bufferLen);
+
+    if (ret == -3) {
+        long long length;
+
+        /* Send the hole on its own, in place of the data */
+        if (virStreamRecvHole(stream->st, &length, 0) < 0) {
+            virNetMessageError rerr;
+
+            memset(&rerr, 0, sizeof(rerr));
 
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
-        else
             ret = virNetServerProgramSendStreamError(remoteProgram,
                                                      client,
                                                      msg,
                                                      &rerr,
                                                      stream->procedure,
                                                      stream->serial);
-    } else {
-        virNetMessagePtr msg;
-        stream->tx = 0;
-        if (ret == 0)
-            stream->recvEOF = 1;
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
-
-        if (msg) {
+        } else {
+            stream->tx = 0;
             msg->cb = daemonStreamMessageFinished;
             msg->opaque = stream;
             stream->refs++;
-            ret = virNetServerProgramSendStreamData(remoteProgram,
+            ret = virNetServerProgramSendStreamHole(remoteProgram,
                                                     client,
                                                     msg,
                                                     stream->procedure,
                                                     stream->serial,
-                                                    buffer, ret);
+                                                    length, 0);
         }
+    } else if (ret == -2) {
+        /* Should never get this, since we're only called when we know
+         * we're readable, but hey things change... */
+        virNetMessageFree(msg);
+        ret = 0;
+    } else if (ret < 0) {
+        virNetMessageError rerr;
+
+        memset(&rerr, 0, sizeof(rerr));
+
+        ret = virNetServerProgramSendStreamError(remoteProgram,
+                                                 client,
+                                                 msg,
+                                                 &rerr,
+                                                 stream->procedure,
+                                                 stream->serial);
+    } else {
+        stream->tx = 0;
+        stream->sent += ret;
+        if (ret == 0)
+            stream->recvEOF = 1;
+
+        msg->cb = daemonStreamMessageFinished;
+        msg->opaque = stream;
+        stream->refs++;
+        ret = virNetServerProgramSendStreamData(remoteProgram,
+                                                client,
+                                                msg,
+                                                stream->procedure,
+                                                stream->serial,
+                                                buffer, ret);
     }
 
-    VIR_FREE(buffer);
     return ret;
 }
@@ -338,6 +338,18 @@ foreach my $drv (keys %{$groups{"virDriver"}->{drivers}}) {
 }
 
 
+# virDomainListGetStats shares the driver method used by
+# virConnectGetAllDomainStats, so has the same versioning
+$groups{virDriver}->{apis}->{"domainListGetStats"} = "virDomainListGetStats";
+
+foreach my $drv (keys %{$groups{"virDriver"}->{drivers}}) {
+    my $statsVersStr = $groups{"virDriver"}->{drivers}->{$drv}->{"connectGetAllDomainStats"};
+    next unless defined $statsVersStr;
+
+    $groups{"virDriver"}->{drivers}->{$drv}->{"domainListGetStats"} = $statsVersStr;
+}
+
+
 # Finally we generate the HTML file with the tables
 
 print <<EOF;
@@ -216,6 +216,41 @@
 
         return retlist
 
+    def getAllDomainStats(self, stats = 0, flags = 0):
+        """Query statistics for all domains on a given connection and
+        returns a list of (domain, stats dictionary) tuples"""
+        ret = libvirtmod.virConnectGetAllDomainStats(self._o, stats, flags)
+        if ret is None:
+            raise libvirtError("virConnectGetAllDomainStats() failed", conn=self)
+
+        retlist = list()
+        for elem in ret:
+            record = (virDomain(self, _obj=elem[0]) , elem[1])
+            retlist.append(record)
+
+        return retlist
+
+    def domainListGetStats(self, doms, stats = 0, flags = 0):
+        """Query statistics for the given domains and returns a list
+        of (domain, stats dictionary) tuples"""
+        domlist = list()
+        for dom in doms:
+            if not isinstance(dom, virDomain):
+                raise libvirtError("domain list contains non-domain elements", conn=self)
+
+            domlist.append(dom._o)
+
+        ret = libvirtmod.virDomainListGetStats(self._o, domlist, stats, flags)
+        if ret is None:
+            raise libvirtError("virDomainListGetStats() failed", conn=self)
+
+        retlist = list()
+        for elem in ret:
+            record = (virDomain(self, _obj=elem[0]) , elem[1])
+            retlist.append(record)
+
+        return retlist
+
     def listAllStoragePools(self, flags):
         """Returns a list of storage pool objects"""
         ret = libvirtmod.virConnectListAllStoragePools(self._o, flags)
@@ -2111,6 +2111,139 @@ cleanup:
     return py_retval;
 }
 
+static PyObject *
+convertDomainStatsRecord(virDomainStatsRecordPtr *records,
+                         int nrecords)
+{
+    PyObject *py_retval;
+    PyObject *py_record;
+    PyObject *py_record_domain = NULL;
+    PyObject *py_record_stats = NULL;
+    int i;
+
+    if (!(py_retval = PyList_New(nrecords)))
+        return NULL;
+
+    for (i = 0; i < nrecords; i++) {
+        if (!(py_record = PyTuple_New(2)))
+            goto error;
+
+        if (PyList_SetItem(py_retval, i, py_record) < 0)
+            goto error;
+
+        /* python steals the pointer */
+        if (!(py_record_domain = libvirt_virDomainPtrWrap(records[i]->dom)))
+            goto error;
+        records[i]->dom = NULL;
+
+        if (PyTuple_SetItem(py_record, 0, py_record_domain) < 0) {
+            py_record_domain = NULL;
+            goto error;
+        }
+
+        if (!(py_record_stats = getPyVirTypedParameter(records[i]->params,
+                                                       records[i]->nparams)))
+            goto error;
+
+        if (PyTuple_SetItem(py_record, 1, py_record_stats) < 0) {
+            py_record_stats = NULL;
+            goto error;
+        }
+
+        py_record_domain = NULL;
+        py_record_stats = NULL;
+    }
+
+    return py_retval;
+
+error:
+    Py_XDECREF(py_retval);
+    Py_XDECREF(py_record_domain);
+    Py_XDECREF(py_record_stats);
+    return NULL;
+}
+
+static PyObject *
+libvirt_virConnectGetAllDomainStats(PyObject *self ATTRIBUTE_UNUSED,
+                                    PyObject *args)
+{
+    PyObject *pyobj_conn;
+    PyObject *py_retval;
+    virConnectPtr conn;
+    virDomainStatsRecordPtr *records;
+    int nrecords;
+    unsigned int flags;
+    unsigned int stats;
+
+    if (!PyArg_ParseTuple(args, (char *)"Oii:virConnectGetAllDomainStats",
+                          &pyobj_conn, &stats, &flags))
+        return NULL;
+    conn = (virConnectPtr) PyvirConnect_Get(pyobj_conn);
+
+    LIBVIRT_BEGIN_ALLOW_THREADS;
+    nrecords = virConnectGetAllDomainStats(conn, stats, &records, flags);
+    LIBVIRT_END_ALLOW_THREADS;
+
+    if (nrecords < 0)
+        return VIR_PY_NONE;
+
+    if (!(py_retval = convertDomainStatsRecord(records, nrecords)))
+        py_retval = VIR_PY_NONE;
+
+    virDomainStatsRecordListFree(records);
+
+    return py_retval;
+}
+
+static PyObject *
+libvirt_virDomainListGetStats(PyObject *self ATTRIBUTE_UNUSED,
+                              PyObject *args)
+{
+    PyObject *pyobj_conn;
+    PyObject *py_retval;
+    PyObject *py_domlist;
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainPtr *doms = NULL;
+    int nrecords;
+    int ndoms;
+    int i;
+    unsigned int flags;
+    unsigned int stats;
+
+    if (!PyArg_ParseTuple(args, (char *)"OOii:virDomainListGetStats",
+                          &pyobj_conn, &py_domlist, &stats, &flags))
+        return NULL;
+
+    if (!PyList_Check(py_domlist))
+        return VIR_PY_NONE;
+
+    ndoms = PyList_Size(py_domlist);
+
+    if (VIR_ALLOC_N(doms, ndoms + 1) < 0)
+        return PyErr_NoMemory();
+
+    for (i = 0; i < ndoms; i++)
+        doms[i] = PyvirDomain_Get(PyList_GetItem(py_domlist, i));
+
+    LIBVIRT_BEGIN_ALLOW_THREADS;
+    nrecords = virDomainListGetStats(doms, stats, &records, flags);
+    LIBVIRT_END_ALLOW_THREADS;
+
+    if (nrecords < 0) {
+        py_retval = VIR_PY_NONE;
+        goto cleanup;
+    }
+
+    if (!(py_retval = convertDomainStatsRecord(records, nrecords)))
+        py_retval = VIR_PY_NONE;
+
+cleanup:
+    virDomainStatsRecordListFree(records);
+    VIR_FREE(doms);
+
+    return py_retval;
+}
+
 static PyObject *
 libvirt_virConnectListDefinedDomains(PyObject *self ATTRIBUTE_UNUSED,
                                      PyObject *args) {
@@ -3346,6 +3479,38 @@ libvirt_virStorageVolGetInfo(PyObject *self ATTRIBUTE_UNUSED, PyObject *args) {
     return py_retval;
 }
 
+static PyObject *
+libvirt_virStorageVolGetJobInfo(PyObject *self ATTRIBUTE_UNUSED,
+                                PyObject *args) {
+    PyObject *py_retval;
+    int c_retval;
+    virStorageVolPtr vol;
+    PyObject *pyobj_vol;
+    unsigned int flags;
+    virStorageVolJobInfo info;
+
+    if (!PyArg_ParseTuple(args, (char *)"Oi:virStorageVolGetJobInfo",
+                          &pyobj_vol, &flags))
+        return NULL;
+    vol = (virStorageVolPtr) PyvirStorageVol_Get(pyobj_vol);
+
+    LIBVIRT_BEGIN_ALLOW_THREADS;
+    c_retval = virStorageVolGetJobInfo(vol, &info, flags);
+    LIBVIRT_END_ALLOW_THREADS;
+    if (c_retval < 0)
+        return VIR_PY_NONE;
+
+    if ((py_retval = PyList_New(6)) == NULL)
+        return VIR_PY_NONE;
+    PyList_SetItem(py_retval, 0, libvirt_intWrap((int) info.type));
+    PyList_SetItem(py_retval, 1, libvirt_intWrap((int) info.state));
+    PyList_SetItem(py_retval, 2, libvirt_ulonglongWrap(info.timeElapsed));
+    PyList_SetItem(py_retval, 3, libvirt_ulonglongWrap(info.dataTotal));
+    PyList_SetItem(py_retval, 4, libvirt_ulonglongWrap(info.dataProcessed));
+    PyList_SetItem(py_retval, 5, libvirt_ulonglongWrap(info.rate));
+    return py_retval;
+}
+
 static PyObject *
 libvirt_virStoragePoolGetUUID(PyObject *self ATTRIBUTE_UNUSED, PyObject *args) {
     PyObject *py_retval;
@@ -6652,6 +6817,8 @@ static PyMethodDef libvirtMethods[] = {
     {(char *) "virConnectListDomainsID", libvirt_virConnectListDomainsID, METH_VARARGS, NULL},
     {(char *) "virConnectListDefinedDomains", libvirt_virConnectListDefinedDomains, METH_VARARGS, NULL},
     {(char *) "virConnectListAllDomains", libvirt_virConnectListAllDomains, METH_VARARGS, NULL},
+    {(char *) "virConnectGetAllDomainStats", libvirt_virConnectGetAllDomainStats, METH_VARARGS, NULL},
+    {(char *) "virDomainListGetStats", libvirt_virDomainListGetStats, METH_VARARGS, NULL},
     {(char *) "virConnectDomainEventRegister", libvirt_virConnectDomainEventRegister, METH_VARARGS, NULL},
     {(char *) "virConnectDomainEventDeregister", libvirt_virConnectDomainEventDeregister, METH_VARARGS, NULL},
     {(char *) "virConnectDomainEventRegisterAny", libvirt_virConnectDomainEventRegisterAny, METH_VARARGS, NULL},
@@ -6713,6 +6880,7 @@ static PyMethodDef libvirtMethods[] = {
     {(char *) "virStoragePoolListAllVolumes", libvirt_virStoragePoolListAllVolumes, METH_VARARGS, NULL},
     {(char *) "virStoragePoolGetInfo", libvirt_virStoragePoolGetInfo, METH_VARARGS, NULL},
     {(char *) "virStorageVolGetInfo", libvirt_virStorageVolGetInfo, METH_VARARGS, NULL},
+    {(char *) "virStorageVolGetJobInfo", libvirt_virStorageVolGetJobInfo, METH_VARARGS, NULL},
     {(char *) "virStoragePoolGetUUID", libvirt_virStoragePoolGetUUID, METH_VARARGS, NULL},
     {(char *) "virStoragePoolGetUUIDString", libvirt_virStoragePoolGetUUIDString, METH_VARARGS, NULL},
     {(char *) "virStoragePoolLookupByUUID", libvirt_virStoragePoolLookupByUUID, METH_VARARGS, NULL},
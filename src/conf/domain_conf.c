@@ -45,12 +45,15 @@
 #include "virstoragefile.h"
 #include "virfile.h"
 #include "virbitmap.h"
+#include "virhashcode.h"
 #include "count-one-bits.h"
 #include "secret_conf.h"
 #include "netdev_vport_profile_conf.h"
 #include "netdev_bandwidth_conf.h"
 #include "netdev_vlan_conf.h"
 #include "device_conf.h"
+#include "virthreadpool.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -60,11 +63,28 @@ verify(VIR_DOMAIN_VIRT_LAST <= 32);
 
 
 struct _virDomainObjList {
-    virObjectLockable parent;
+    virObject parent;
+
+    /* Lookups and listing only need to read the hash tables, so they
+     * can run in parallel. Listing must use virHashForEachReadOnly,
+     * as virHashForEach marks the table it iterates over. Anything
+     * changing the tables must hold the lock for write */
+    virRWLock lock;
 
     /* uuid string -> virDomainObj  mapping
      * for O(1), lockless lookup-by-uuid */
     virHashTable *objs;
+
+    /* name -> virDomainObj mapping for O(1) lookup-by-name,
+     * borrowing the references held by 'objs' */
+    virHashTable *objsName;
+
+    /* id -> virDomainObj mapping for O(1) lookup-by-id. Drivers assign
+     * and clear domain IDs without going through the list, so this is
+     * only a hint which is verified on use and refreshed on a miss.
+     * Each object has at most one entry, borrowing the reference held
+     * by 'objs' like 'objsName' does */
+    virHashTable *objsID;
 };
 
 /* Private flags used internally by virDomainSaveStatus and
@@ -726,7 +746,7 @@ static int virDomainObjOnceInit(void)
                                           virDomainObjDispose)))
         return -1;
 
-    if (!(virDomainObjListClass = virClassNew(virClassForObjectLockable(),
+    if (!(virDomainObjListClass = virClassNew(virClassForObject(),
                                               "virDomainObjList",
                                               sizeof(virDomainObjList),
                                               virDomainObjListDispose)))
@@ -804,6 +824,22 @@ virDomainObjListDataFree(void *payload, const void *name ATTRIBUTE_UNUSED)
     virObjectUnref(obj);
 }
 
+static uint32_t virDomainObjListIDCode(const void *name, uint32_t seed)
+{
+    unsigned long id = (unsigned long)(intptr_t)name;
+    return virHashCodeGen(&id, sizeof(id), seed);
+}
+static bool virDomainObjListIDEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+static void *virDomainObjListIDCopy(const void *name)
+{
+    return (void*)name;
+}
+
+#define ID_KEY(id) ((void *)(intptr_t)(id))
+
 virDomainObjListPtr virDomainObjListNew(void)
 {
     virDomainObjListPtr doms;
@@ -811,10 +847,24 @@ virDomainObjListPtr virDomainObjListNew(void)
     if (virDomainObjInitialize() < 0)
         return NULL;
 
-    if (!(doms = virObjectLockableNew(virDomainObjListClass)))
+    if (!(doms = virObjectNew(virDomainObjListClass)))
+        return NULL;
+
+    if (virRWLockInit(&doms->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize domain list lock"));
+        virObjectUnref(doms);
         return NULL;
+    }
 
-    if (!(doms->objs = virHashCreate(50, virDomainObjListDataFree))) {
+    if (!(doms->objs = virHashCreate(50, virDomainObjListDataFree)) ||
+        !(doms->objsName = virHashCreate(50, NULL)) ||
+        !(doms->objsID = virHashCreateFull(50,
+                                           NULL,
+                                           virDomainObjListIDCode,
+                                           virDomainObjListIDEqual,
+                                           virDomainObjListIDCopy,
+                                           NULL))) {
         virObjectUnref(doms);
         return NULL;
     }
@@ -827,7 +877,10 @@ static void virDomainObjListDispose(void *obj)
 {
     virDomainObjListPtr doms = obj;
 
+    virHashFree(doms->objsID);
+    virHashFree(doms->objsName);
     virHashFree(doms->objs);
+    virRWLockDestroy(&doms->lock);
 }
 
 
@@ -847,15 +900,64 @@ static int virDomainObjListSearchID(const void *payload,
     return want;
 }
 
+static int virDomainObjListSearchObj(const void *payload,
+                                     const void *name ATTRIBUTE_UNUSED,
+                                     const void *data)
+{
+    return payload == data;
+}
+
+/*
+ * Returns the object locked if it still has the ID it was
+ * indexed under, NULL otherwise
+ */
+static virDomainObjPtr
+virDomainObjListFindByIDIndex(virDomainObjListPtr doms,
+                              int id)
+{
+    virDomainObjPtr obj;
+
+    if (!(obj = virHashLookup(doms->objsID, ID_KEY(id))))
+        return NULL;
+
+    virObjectLock(obj);
+    if (!virDomainObjIsActive(obj) ||
+        obj->def->id != id) {
+        virObjectUnlock(obj);
+        return NULL;
+    }
+
+    return obj;
+}
+
 virDomainObjPtr virDomainObjListFindByID(const virDomainObjListPtr doms,
                                          int id)
 {
     virDomainObjPtr obj;
-    virObjectLock(doms);
-    obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id);
+
+    virRWLockRead(&doms->lock);
+    obj = virDomainObjListFindByIDIndex(doms, id);
+    virRWLockUnlock(&doms->lock);
+
     if (obj)
-        virObjectLock(obj);
-    virObjectUnlock(doms);
+        return obj;
+
+    /* The index is stale or has never seen this ID, so fall back to
+     * the full scan and remember the result for next time */
+    virRWLockWrite(&doms->lock);
+    if (!(obj = virDomainObjListFindByIDIndex(doms, id))) {
+        /* Whatever was indexed under this ID has stopped since */
+        virHashRemoveEntry(doms->objsID, ID_KEY(id));
+
+        if ((obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id))) {
+            virObjectLock(obj);
+            /* Forget the ID the domain had before it was restarted */
+            virHashRemoveSet(doms->objsID, virDomainObjListSearchObj, obj);
+            if (virHashAddEntry(doms->objsID, ID_KEY(id), obj) < 0)
+                virResetLastError();
+        }
+    }
+    virRWLockUnlock(&doms->lock);
     return obj;
 }
 
@@ -866,39 +968,26 @@ virDomainObjPtr virDomainObjListFindByUUID(const virDomainObjListPtr doms,
     char uuidstr[VIR_UUID_STRING_BUFLEN];
     virDomainObjPtr obj;
 
-    virObjectLock(doms);
     virUUIDFormat(uuid, uuidstr);
 
+    virRWLockRead(&doms->lock);
     obj = virHashLookup(doms->objs, uuidstr);
     if (obj)
         virObjectLock(obj);
-    virObjectUnlock(doms);
+    virRWLockUnlock(&doms->lock);
     return obj;
 }
 
-static int virDomainObjListSearchName(const void *payload,
-                                      const void *name ATTRIBUTE_UNUSED,
-                                      const void *data)
-{
-    virDomainObjPtr obj = (virDomainObjPtr)payload;
-    int want = 0;
-
-    virObjectLock(obj);
-    if (STREQ(obj->def->name, (const char *)data))
-        want = 1;
-    virObjectUnlock(obj);
-    return want;
-}
-
 virDomainObjPtr virDomainObjListFindByName(const virDomainObjListPtr doms,
                                            const char *name)
 {
     virDomainObjPtr obj;
-    virObjectLock(doms);
-    obj = virHashSearch(doms->objs, virDomainObjListSearchName, name);
+
+    virRWLockRead(&doms->lock);
+    obj = virHashLookup(doms->objsName, name);
     if (obj)
         virObjectLock(obj);
-    virObjectUnlock(doms);
+    virRWLockUnlock(&doms->lock);
     return obj;
 }
 
@@ -1969,7 +2058,7 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
                               oldDef);
     } else {
         /* UUID does not match, but if a name matches, refuse it */
-        if ((vm = virHashSearch(doms->objs, virDomainObjListSearchName, def->name))) {
+        if ((vm = virHashLookup(doms->objsName, def->name))) {
             virObjectLock(vm);
             virUUIDFormat(vm->def->uuid, uuidstr);
             virReportError(VIR_ERR_OPERATION_FAILED,
@@ -1987,6 +2076,11 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
             virObjectUnref(vm);
             return NULL;
         }
+
+        if (virHashAddEntry(doms->objsName, def->name, vm) < 0) {
+            virHashRemoveEntry(doms->objs, uuidstr);
+            return NULL;
+        }
     }
 cleanup:
     return vm;
@@ -2006,9 +2100,9 @@ virDomainObjPtr virDomainObjListAdd(virDomainObjListPtr doms,
 {
     virDomainObjPtr ret;
 
-    virObjectLock(doms);
+    virRWLockWrite(&doms->lock);
     ret = virDomainObjListAddLocked(doms, caps, def, flags, oldDef);
-    virObjectUnlock(doms);
+    virRWLockUnlock(&doms->lock);
     return ret;
 }
 
@@ -2130,13 +2224,24 @@ void virDomainObjListRemove(virDomainObjListPtr doms,
                             virDomainObjPtr dom)
 {
     char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *name;
 
     virUUIDFormat(dom->def->uuid, uuidstr);
+    if (!(name = strdup(dom->def->name)))
+        virReportOOMError();
     virObjectUnlock(dom);
 
-    virObjectLock(doms);
+    virRWLockWrite(&doms->lock);
+    /* The ID the object was indexed under may have changed since */
+    virHashRemoveSet(doms->objsID, virDomainObjListSearchObj, dom);
+    if (name)
+        virHashRemoveEntry(doms->objsName, name);
+    else
+        virHashRemoveSet(doms->objsName, virDomainObjListSearchObj, dom);
     virHashRemoveEntry(doms->objs, uuidstr);
-    virObjectUnlock(doms);
+    virRWLockUnlock(&doms->lock);
+
+    VIR_FREE(name);
 }
 
 static int
@@ -15087,12 +15192,18 @@ char *
 virDomainDefFormat(virDomainDefPtr def, unsigned int flags)
 {
     virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *xml;
 
     virCheckFlags(DUMPXML_FLAGS, NULL);
+
+    /* Large definitions would otherwise regrow the buffer on every call */
+    virBufferUseScratch(&buf);
     if (virDomainDefFormatInternal(def, flags, &buf) < 0)
         return NULL;
 
-    return virBufferContentAndReset(&buf);
+    if (!(xml = virBufferContentAndReset(&buf)))
+        virReportOOMError();
+    return xml;
 }
 
 
@@ -15102,10 +15213,13 @@ virDomainObjFormat(virCapsPtr caps,
                    unsigned int flags)
 {
     virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *xml;
     int state;
     int reason;
     int i;
 
+    virBufferUseScratch(&buf);
+
     state = virDomainObjGetState(obj, &reason);
     virBufferAsprintf(&buf, "<domstatus state='%s' reason='%s' pid='%lld'>\n",
                       virDomainStateTypeToString(state),
@@ -15132,7 +15246,9 @@ virDomainObjFormat(virCapsPtr caps,
     if (virBufferError(&buf))
         goto no_memory;
 
-    return virBufferContentAndReset(&buf);
+    if (!(xml = virBufferContentAndReset(&buf)))
+        goto no_memory;
+    return xml;
 
 no_memory:
     virReportOOMError();
@@ -15268,98 +15384,210 @@ cleanup:
 }
 
 
+/* Upper limit of threads parsing the XML files of a directory */
+#define VIR_DOMAIN_LOAD_WORKERS_MAX 8
+
+typedef struct _virDomainObjListLoadJob virDomainObjListLoadJob;
+typedef virDomainObjListLoadJob *virDomainObjListLoadJobPtr;
+struct _virDomainObjListLoadJob {
+    char *name;
+    /* filled in by virDomainObjListLoadParse */
+    virDomainDefPtr def;
+    int autostart;
+    virDomainObjPtr obj;
+};
+
+typedef struct _virDomainObjListLoadData virDomainObjListLoadData;
+typedef virDomainObjListLoadData *virDomainObjListLoadDataPtr;
+struct _virDomainObjListLoadData {
+    virCapsPtr caps;
+    const char *configDir;
+    const char *autostartDir;
+    int liveStatus;
+    unsigned int expectedVirtTypes;
+
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+};
+
+
+/*
+ * Parse the config or status file of a single domain, without touching
+ * the domain list. Called from the worker threads.
+ */
+static void
+virDomainObjListLoadParse(virDomainObjListLoadJobPtr job,
+                          virDomainObjListLoadDataPtr data)
+{
+    char *configFile = NULL, *autostartLink = NULL;
+
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    VIR_INFO("Loading config file '%s.xml'", job->name);
+
+    if ((configFile = virDomainConfigFile(data->configDir, job->name)) == NULL)
+        goto cleanup;
+
+    if (data->liveStatus) {
+        job->obj = virDomainObjParseFile(data->caps, configFile,
+                                         data->expectedVirtTypes,
+                                         VIR_DOMAIN_XML_INTERNAL_STATUS |
+                                         VIR_DOMAIN_XML_INTERNAL_ACTUAL_NET |
+                                         VIR_DOMAIN_XML_INTERNAL_PCI_ORIG_STATES);
+        /* The object is locked again by the thread inserting it */
+        if (job->obj)
+            virObjectUnlock(job->obj);
+        goto cleanup;
+    }
+
+    if (!(job->def = virDomainDefParseFile(data->caps, configFile,
+                                           data->expectedVirtTypes,
+                                           VIR_DOMAIN_XML_INACTIVE)))
+        goto cleanup;
+
+    if ((autostartLink = virDomainConfigFile(data->autostartDir,
+                                             job->name)) == NULL ||
+        (job->autostart = virFileLinkPointsTo(autostartLink,
+                                              configFile)) < 0) {
+        virDomainDefFree(job->def);
+        job->def = NULL;
+    }
+
+cleanup:
+    VIR_FREE(configFile);
+    VIR_FREE(autostartLink);
+}
+
+
+static void
+virDomainObjListLoadWorker(void *jobdata, void *opaque)
+{
+    virDomainObjListLoadJobPtr job = jobdata;
+    virDomainObjListLoadDataPtr data = opaque;
+
+    virDomainObjListLoadParse(job, data);
+
+    virMutexLock(&data->lock);
+    if (--data->pending == 0)
+        virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/*
+ * Parse all the jobs, spread across a few threads if there are many.
+ */
+static void
+virDomainObjListLoadParseAll(virDomainObjListLoadJobPtr jobs,
+                             size_t njobs,
+                             virDomainObjListLoadDataPtr data)
+{
+    virThreadPoolPtr pool = NULL;
+    size_t nworkers = MIN(njobs, VIR_DOMAIN_LOAD_WORKERS_MAX);
+    size_t i;
+
+    if (nworkers > 1 &&
+        virMutexInit(&data->lock) == 0) {
+        if (virCondInit(&data->cond) < 0) {
+            virMutexDestroy(&data->lock);
+        } else {
+            pool = virThreadPoolNew(nworkers, nworkers, 0,
+                                    virDomainObjListLoadWorker, data);
+            if (!pool) {
+                virCondDestroy(&data->cond);
+                virMutexDestroy(&data->lock);
+            }
+        }
+    }
+
+    if (!pool) {
+        for (i = 0 ; i < njobs ; i++)
+            virDomainObjListLoadParse(&jobs[i], data);
+        return;
+    }
+
+    virMutexLock(&data->lock);
+    for (i = 0 ; i < njobs ; i++) {
+        data->pending++;
+        if (virThreadPoolSendJob(pool, 0, &jobs[i]) < 0) {
+            data->pending--;
+            virMutexUnlock(&data->lock);
+            virDomainObjListLoadParse(&jobs[i], data);
+            virMutexLock(&data->lock);
+        }
+    }
+    while (data->pending > 0)
+        ignore_value(virCondWait(&data->cond, &data->lock));
+    virMutexUnlock(&data->lock);
+
+    virThreadPoolFree(pool);
+    virCondDestroy(&data->cond);
+    virMutexDestroy(&data->lock);
+}
+
+
 static virDomainObjPtr
 virDomainObjListLoadConfig(virDomainObjListPtr doms,
                            virCapsPtr caps,
-                           const char *configDir,
-                           const char *autostartDir,
-                           const char *name,
-                           unsigned int expectedVirtTypes,
+                           virDomainObjListLoadJobPtr job,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
 {
-    char *configFile = NULL, *autostartLink = NULL;
-    virDomainDefPtr def = NULL;
     virDomainObjPtr dom;
-    int autostart;
     virDomainDefPtr oldDef = NULL;
 
-    if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
-        goto error;
-    if (!(def = virDomainDefParseFile(caps, configFile, expectedVirtTypes,
-                                      VIR_DOMAIN_XML_INACTIVE)))
-        goto error;
-
-    if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
-        goto error;
-
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
-        goto error;
-
-    if (!(dom = virDomainObjListAddLocked(doms, caps, def, 0, &oldDef)))
-        goto error;
+    if (!(dom = virDomainObjListAddLocked(doms, caps, job->def, 0, &oldDef)))
+        return NULL;
+    job->def = NULL;
 
-    dom->autostart = autostart;
+    dom->autostart = job->autostart;
 
     if (notify)
         (*notify)(dom, oldDef == NULL, opaque);
 
     virDomainDefFree(oldDef);
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
     return dom;
-
-error:
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
-    virDomainDefFree(def);
-    return NULL;
 }
 
 static virDomainObjPtr
 virDomainObjListLoadStatus(virDomainObjListPtr doms,
-                           virCapsPtr caps,
-                           const char *statusDir,
-                           const char *name,
-                           unsigned int expectedVirtTypes,
+                           virDomainObjListLoadJobPtr job,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
 {
-    char *statusFile = NULL;
-    virDomainObjPtr obj = NULL;
+    virDomainObjPtr obj = job->obj;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
-
-    if (!(obj = virDomainObjParseFile(caps, statusFile, expectedVirtTypes,
-                                      VIR_DOMAIN_XML_INTERNAL_STATUS |
-                                      VIR_DOMAIN_XML_INTERNAL_ACTUAL_NET |
-                                      VIR_DOMAIN_XML_INTERNAL_PCI_ORIG_STATES)))
-        goto error;
-
+    virObjectLock(obj);
     virUUIDFormat(obj->def->uuid, uuidstr);
 
-    if (virHashLookup(doms->objs, uuidstr) != NULL) {
+    if (virHashLookup(doms->objs, uuidstr) != NULL ||
+        virHashLookup(doms->objsName, obj->def->name) != NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unexpected domain %s already exists"),
                        obj->def->name);
-        goto error;
+        virObjectUnlock(obj);
+        return NULL;
     }
 
-    if (virHashAddEntry(doms->objs, uuidstr, obj) < 0)
-        goto error;
+    if (virHashAddEntry(doms->objs, uuidstr, obj) < 0) {
+        virObjectUnlock(obj);
+        return NULL;
+    }
+    job->obj = NULL;
+
+    if (virHashAddEntry(doms->objsName, obj->def->name, obj) < 0) {
+        /* drops the only reference */
+        virObjectUnlock(obj);
+        virHashRemoveEntry(doms->objs, uuidstr);
+        return NULL;
+    }
 
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
-
-error:
-    virObjectUnref(obj);
-    VIR_FREE(statusFile);
-    return NULL;
 }
 
 int
@@ -15374,9 +15602,23 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
 {
     DIR *dir;
     struct dirent *entry;
+    virDomainObjListLoadJobPtr jobs = NULL;
+    size_t njobs = 0;
+    virDomainObjListLoadData data = {
+        .caps = caps,
+        .configDir = configDir,
+        .autostartDir = autostartDir,
+        .liveStatus = liveStatus,
+        .expectedVirtTypes = expectedVirtTypes,
+    };
+    unsigned long long start = 0, scanned = 0, parsed = 0, loaded = 0;
+    size_t i;
+    int ret = -1;
 
     VIR_INFO("Scanning for configs in %s", configDir);
 
+    ignore_value(virTimeMillisNow(&start));
+
     if (!(dir = opendir(configDir))) {
         if (errno == ENOENT)
             return 0;
@@ -15386,10 +15628,8 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
         return -1;
     }
 
-    virObjectLock(doms);
-
     while ((entry = readdir(dir))) {
-        virDomainObjPtr dom;
+        virDomainObjListLoadJob job = { NULL };
 
         if (entry->d_name[0] == '.')
             continue;
@@ -15397,26 +15637,33 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
-        if (liveStatus)
-            dom = virDomainObjListLoadStatus(doms,
-                                             caps,
-                                             configDir,
-                                             entry->d_name,
-                                             expectedVirtTypes,
-                                             notify,
-                                             opaque);
-        else
-            dom = virDomainObjListLoadConfig(doms,
-                                             caps,
-                                             configDir,
-                                             autostartDir,
-                                             entry->d_name,
-                                             expectedVirtTypes,
-                                             notify,
-                                             opaque);
+        if (!(job.name = strdup(entry->d_name)) ||
+            VIR_APPEND_ELEMENT(jobs, njobs, job) < 0) {
+            VIR_FREE(job.name);
+            virReportOOMError();
+            closedir(dir);
+            goto cleanup;
+        }
+    }
+
+    closedir(dir);
+    ignore_value(virTimeMillisNow(&scanned));
+
+    /* The files are parsed in parallel; the domain list is only
+     * modified afterwards, in directory order */
+    virDomainObjListLoadParseAll(jobs, njobs, &data);
+    ignore_value(virTimeMillisNow(&parsed));
+
+    virRWLockWrite(&doms->lock);
+
+    for (i = 0 ; i < njobs ; i++) {
+        virDomainObjPtr dom = NULL;
+
+        if (jobs[i].obj)
+            dom = virDomainObjListLoadStatus(doms, &jobs[i], notify, opaque);
+        else if (jobs[i].def)
+            dom = virDomainObjListLoadConfig(doms, caps, &jobs[i],
+                                             notify, opaque);
         if (dom) {
             virObjectUnlock(dom);
             if (!liveStatus)
@@ -15424,9 +15671,24 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
         }
     }
 
-    closedir(dir);
-    virObjectUnlock(doms);
-    return 0;
+    virRWLockUnlock(&doms->lock);
+    ignore_value(virTimeMillisNow(&loaded));
+
+    VIR_INFO("Loaded %zu config files from %s: scan %llums, "
+             "parse %llums, insert %llums",
+             njobs, configDir, scanned - start,
+             parsed - scanned, loaded - parsed);
+
+    ret = 0;
+
+cleanup:
+    for (i = 0 ; i < njobs ; i++) {
+        VIR_FREE(jobs[i].name);
+        virDomainDefFree(jobs[i].def);
+        virObjectUnref(jobs[i].obj);
+    }
+    VIR_FREE(jobs);
+    return ret;
 }
 
 int
@@ -15562,12 +15824,14 @@ virDomainObjListNumOfDomains(virDomainObjListPtr doms,
                              int active)
 {
     int count = 0;
-    virObjectLock(doms);
+    virRWLockRead(&doms->lock);
     if (active)
-        virHashForEach(doms->objs, virDomainObjListCountActive, &count);
+        virHashForEachReadOnly(doms->objs, virDomainObjListCountActive,
+                               &count);
     else
-        virHashForEach(doms->objs, virDomainObjListCountInactive, &count);
-    virObjectUnlock(doms);
+        virHashForEachReadOnly(doms->objs, virDomainObjListCountInactive,
+                               &count);
+    virRWLockUnlock(&doms->lock);
     return count;
 }
 
@@ -15596,9 +15860,9 @@ virDomainObjListGetActiveIDs(virDomainObjListPtr doms,
                              int maxids)
 {
     struct virDomainIDData data = { 0, maxids, ids };
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListCopyActiveIDs, &data);
-    virObjectUnlock(doms);
+    virRWLockRead(&doms->lock);
+    virHashForEachReadOnly(doms->objs, virDomainObjListCopyActiveIDs, &data);
+    virRWLockUnlock(&doms->lock);
     return data.numids;
 }
 
@@ -15638,9 +15902,10 @@ virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
 {
     struct virDomainNameData data = { 0, 0, maxnames, names };
     int i;
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListCopyInactiveNames, &data);
-    virObjectUnlock(doms);
+    virRWLockRead(&doms->lock);
+    virHashForEachReadOnly(doms->objs, virDomainObjListCopyInactiveNames,
+                           &data);
+    virRWLockUnlock(&doms->lock);
     if (data.oom) {
         virReportOOMError();
         goto cleanup;
@@ -15680,9 +15945,9 @@ virDomainObjListForEach(virDomainObjListPtr doms,
     struct virDomainListIterData data = {
         callback, opaque, 0,
     };
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListHelper, &data);
-    virObjectUnlock(doms);
+    virRWLockRead(&doms->lock);
+    virHashForEachReadOnly(doms->objs, virDomainObjListHelper, &data);
+    virRWLockUnlock(&doms->lock);
     return data.ret;
 }
 
@@ -16463,7 +16728,7 @@ virDomainObjListExport(virDomainObjListPtr doms,
 
     struct virDomainListData data = { conn, NULL, flags, 0, false };
 
-    virObjectLock(doms);
+    virRWLockRead(&doms->lock);
     if (domains) {
         if (VIR_ALLOC_N(data.domains, virHashSize(doms->objs) + 1) < 0) {
             virReportOOMError();
@@ -16471,7 +16736,7 @@ virDomainObjListExport(virDomainObjListPtr doms,
         }
     }
 
-    virHashForEach(doms->objs, virDomainListPopulate, &data);
+    virHashForEachReadOnly(doms->objs, virDomainListPopulate, &data);
 
     if (data.error)
         goto cleanup;
@@ -16493,7 +16758,7 @@ cleanup:
     }
 
     VIR_FREE(data.domains);
-    virObjectUnlock(doms);
+    virRWLockUnlock(&doms->lock);
     return ret;
 }
 
@@ -28,6 +28,8 @@
 #include "datatypes.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "viratomic.h"
+#include "virthreadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -50,6 +52,23 @@ struct _virDomainEventQueue {
     virDomainEventPtr *events;
 };
 
+/* Upper limit of events waiting for delivery to a single connection */
+#define VIR_DOMAIN_EVENT_CONN_QUEUE_MAX 1024
+
+/* Workers delivering events of asynchronous event states */
+#define VIR_DOMAIN_EVENT_WORKERS_MAX 4
+
+struct _virDomainEventConnQueue {
+    virConnectPtr conn;
+    virDomainEventQueue queue;
+    /* Flag if a worker is delivering the queue */
+    bool dispatching;
+    unsigned long long dropped;
+    unsigned long long coalesced;
+};
+typedef struct _virDomainEventConnQueue virDomainEventConnQueue;
+typedef virDomainEventConnQueue *virDomainEventConnQueuePtr;
+
 struct _virDomainEventState {
     /* The list of domain event callbacks */
     virDomainEventCallbackListPtr callbacks;
@@ -57,8 +76,15 @@ struct _virDomainEventState {
     virDomainEventQueuePtr queue;
     /* Timer for flushing events queue */
     int timer;
-    /* Flag if we're in process of dispatching */
-    bool isDispatching;
+    /* Number of threads in process of dispatching */
+    unsigned int dispatching;
+    unsigned int flags;
+    /* Per connection queues, only used with VIR_DOMAIN_EVENT_STATE_ASYNC */
+    virThreadPoolPtr workers;
+    virDomainEventConnQueuePtr *connQueues;
+    size_t nconnQueues;
+    unsigned long long dropped;
+    unsigned long long coalesced;
     virMutex lock;
 };
 
@@ -75,6 +101,8 @@ struct _virDomainEventCallback {
 
 struct _virDomainEvent {
     int eventID;
+    /* Events are shared between the queues of all connections */
+    volatile int refs;
 
     virDomainMeta dom;
 
@@ -141,8 +169,10 @@ virDomainEventCallbackListFree(virDomainEventCallbackListPtr list)
         virFreeCallback freecb = list->callbacks[i]->freecb;
         if (freecb)
             (*freecb)(list->callbacks[i]->opaque);
+        virObjectUnref(list->callbacks[i]->conn);
         VIR_FREE(list->callbacks[i]);
     }
+    VIR_FREE(list->callbacks);
     VIR_FREE(list);
 }
 
@@ -476,6 +506,9 @@ void virDomainEventFree(virDomainEventPtr event)
     if (!event)
         return;
 
+    if (!virAtomicIntDecAndTest(&event->refs))
+        return;
+
     switch (event->eventID) {
     case VIR_DOMAIN_EVENT_ID_IO_ERROR_REASON:
     case VIR_DOMAIN_EVENT_ID_IO_ERROR:
@@ -573,6 +606,24 @@ virDomainEventQueueNew(void)
     return ret;
 }
 
+static void
+virDomainEventConnQueueFree(virDomainEventConnQueuePtr cq)
+{
+    if (!cq)
+        return;
+
+    if (cq->dropped)
+        VIR_WARN("Dropped %llu events for connection %p, coalesced %llu",
+                 cq->dropped, cq->conn, cq->coalesced);
+    else if (cq->coalesced)
+        VIR_INFO("Coalesced %llu events for connection %p",
+                 cq->coalesced, cq->conn);
+
+    virDomainEventQueueClear(&cq->queue);
+    virObjectUnref(cq->conn);
+    VIR_FREE(cq);
+}
+
 static void
 virDomainEventStateLock(virDomainEventStatePtr state)
 {
@@ -594,9 +645,21 @@ virDomainEventStateUnlock(virDomainEventStatePtr state)
 void
 virDomainEventStateFree(virDomainEventStatePtr state)
 {
+    int i;
+
     if (!state)
         return;
 
+    /* waits for the workers to finish delivering events */
+    virThreadPoolFree(state->workers);
+    for (i = 0 ; i < state->nconnQueues ; i++)
+        virDomainEventConnQueueFree(state->connQueues[i]);
+    VIR_FREE(state->connQueues);
+
+    if (state->dropped || state->coalesced)
+        VIR_INFO("Dropped %llu and coalesced %llu events in total",
+                 state->dropped, state->coalesced);
+
     virDomainEventCallbackListFree(state->callbacks);
     virDomainEventQueueFree(state->queue);
 
@@ -609,6 +672,7 @@ virDomainEventStateFree(virDomainEventStatePtr state)
 
 
 static void virDomainEventStateFlush(virDomainEventStatePtr state);
+static void virDomainEventStateWorker(void *jobdata, void *opaque);
 
 static void
 virDomainEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
@@ -623,9 +687,30 @@ virDomainEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
  */
 virDomainEventStatePtr
 virDomainEventStateNew(void)
+{
+    return virDomainEventStateNewFull(0);
+}
+
+/**
+ * virDomainEventStateNewFull:
+ * @flags: bitwise-OR of virDomainEventStateFlags
+ *
+ * With VIR_DOMAIN_EVENT_STATE_ASYNC, events are not delivered from the
+ * event loop, but from worker threads with a bounded queue for each
+ * connection, so that a slow connection doesn't delay the others. The
+ * callbacks must then be safe to call from any thread. With
+ * VIR_DOMAIN_EVENT_STATE_COALESCE in addition, an event still waiting
+ * in such a queue is dropped when a newer event of the same domain
+ * supersedes it.
+ */
+virDomainEventStatePtr
+virDomainEventStateNewFull(unsigned int flags)
 {
     virDomainEventStatePtr state = NULL;
 
+    virCheckFlags(VIR_DOMAIN_EVENT_STATE_ASYNC |
+                  VIR_DOMAIN_EVENT_STATE_COALESCE, NULL);
+
     if (VIR_ALLOC(state) < 0) {
         virReportOOMError();
         goto error;
@@ -647,6 +732,13 @@ virDomainEventStateNew(void)
         goto error;
 
     state->timer = -1;
+    state->flags = flags;
+
+    if ((flags & VIR_DOMAIN_EVENT_STATE_ASYNC) &&
+        !(state->workers = virThreadPoolNew(0, VIR_DOMAIN_EVENT_WORKERS_MAX, 0,
+                                            virDomainEventStateWorker,
+                                            state)))
+        goto error;
 
     return state;
 
@@ -668,6 +760,7 @@ static virDomainEventPtr virDomainEventNewInternal(int eventID,
     }
 
     event->eventID = eventID;
+    event->refs = 1;
     if (!(event->dom.name = strdup(name))) {
         virReportOOMError();
         VIR_FREE(event);
@@ -1437,13 +1530,255 @@ virDomainEventStateDispatchFunc(virConnectPtr conn,
 }
 
 
+/*
+ * Check whether @event makes @old obsolete, i.e. both report the
+ * current value of the same property of the same domain.
+ */
+static bool
+virDomainEventSupersedes(virDomainEventPtr event,
+                         virDomainEventPtr old)
+{
+    if (event->eventID != old->eventID ||
+        memcmp(event->dom.uuid, old->dom.uuid, VIR_UUID_BUFLEN) != 0)
+        return false;
+
+    switch (event->eventID) {
+    case VIR_DOMAIN_EVENT_ID_RTC_CHANGE:
+    case VIR_DOMAIN_EVENT_ID_BALLOON_CHANGE:
+        return true;
+
+    case VIR_DOMAIN_EVENT_ID_BLOCK_JOB:
+        /* only repeated reports of the very same job status */
+        return STREQ(event->data.blockJob.path, old->data.blockJob.path) &&
+               event->data.blockJob.type == old->data.blockJob.type &&
+               event->data.blockJob.status == old->data.blockJob.status;
+    }
+
+    return false;
+}
+
+
+static virDomainEventConnQueuePtr
+virDomainEventStateGetConnQueue(virDomainEventStatePtr state,
+                                virConnectPtr conn)
+{
+    virDomainEventConnQueuePtr cq;
+    int i;
+
+    for (i = 0 ; i < state->nconnQueues ; i++) {
+        if (state->connQueues[i]->conn == conn)
+            return state->connQueues[i];
+    }
+
+    if (VIR_ALLOC(cq) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+    cq->conn = virObjectRef(conn);
+
+    if (VIR_APPEND_ELEMENT(state->connQueues, state->nconnQueues, cq) < 0) {
+        virDomainEventConnQueueFree(cq);
+        virReportOOMError();
+        return NULL;
+    }
+
+    return state->connQueues[state->nconnQueues - 1];
+}
+
+
+/*
+ * Add @event to the queue of a connection, taking a reference on it
+ */
+static void
+virDomainEventConnQueuePush(virDomainEventStatePtr state,
+                            virDomainEventConnQueuePtr cq,
+                            virDomainEventPtr event)
+{
+    virDomainEventQueuePtr queue = &cq->queue;
+    int i;
+
+    if (state->flags & VIR_DOMAIN_EVENT_STATE_COALESCE) {
+        for (i = queue->count - 1 ; i >= 0 ; i--) {
+            if (!virDomainEventSupersedes(event, queue->events[i]))
+                continue;
+
+            virDomainEventFree(queue->events[i]);
+            if (i < (queue->count - 1))
+                memmove(queue->events + i,
+                        queue->events + i + 1,
+                        sizeof(*(queue->events)) *
+                                (queue->count - (i + 1)));
+            queue->count--;
+            cq->coalesced++;
+            state->coalesced++;
+            break;
+        }
+    }
+
+    if (queue->count >= VIR_DOMAIN_EVENT_CONN_QUEUE_MAX) {
+        if (cq->dropped++ == 0)
+            VIR_WARN("Too many pending events for connection %p, "
+                     "dropping events", cq->conn);
+        state->dropped++;
+        return;
+    }
+
+    if (virDomainEventQueuePush(queue, event) < 0) {
+        cq->dropped++;
+        state->dropped++;
+        return;
+    }
+    virAtomicIntInc(&event->refs);
+}
+
+
+/*
+ * Free the queues of connections which don't have any callbacks left
+ */
+static void
+virDomainEventStatePruneConnQueues(virDomainEventStatePtr state)
+{
+    int i, j;
+
+    for (i = 0 ; i < state->nconnQueues ; i++) {
+        virDomainEventConnQueuePtr cq = state->connQueues[i];
+        bool used = false;
+
+        if (cq->dispatching)
+            continue;
+
+        for (j = 0 ; j < state->callbacks->count ; j++) {
+            if (state->callbacks->callbacks[j]->conn == cq->conn &&
+                !state->callbacks->callbacks[j]->deleted) {
+                used = true;
+                break;
+            }
+        }
+        if (used)
+            continue;
+
+        virDomainEventConnQueueFree(cq);
+        VIR_DELETE_ELEMENT(state->connQueues, i, state->nconnQueues);
+        i--;
+    }
+}
+
+
+/*
+ * Distribute the queued events to the queues of the connections having
+ * callbacks for them, and have the workers deliver them
+ */
+static void
+virDomainEventStateFlushAsync(virDomainEventStatePtr state,
+                              virDomainEventQueuePtr queue)
+{
+    virDomainEventCallbackListPtr callbacks = state->callbacks;
+    int i, j, k;
+
+    for (i = 0 ; i < queue->count ; i++) {
+        virDomainEventPtr event = queue->events[i];
+
+        for (j = 0 ; j < callbacks->count ; j++) {
+            virConnectPtr conn = callbacks->callbacks[j]->conn;
+            virDomainEventConnQueuePtr cq;
+
+            if (!virDomainEventDispatchMatchCallback(event,
+                                                     callbacks->callbacks[j]))
+                continue;
+
+            /* queue the event only once for each connection */
+            for (k = 0 ; k < j ; k++) {
+                if (callbacks->callbacks[k]->conn == conn &&
+                    virDomainEventDispatchMatchCallback(event,
+                                                        callbacks->callbacks[k]))
+                    break;
+            }
+            if (k < j)
+                continue;
+
+            if (!(cq = virDomainEventStateGetConnQueue(state, conn)))
+                continue;
+
+            virDomainEventConnQueuePush(state, cq, event);
+        }
+    }
+    virDomainEventQueueClear(queue);
+
+    for (i = 0 ; i < state->nconnQueues ; i++) {
+        virDomainEventConnQueuePtr cq = state->connQueues[i];
+
+        if (cq->dispatching || cq->queue.count == 0)
+            continue;
+
+        if (virThreadPoolSendJob(state->workers, 0, cq) < 0) {
+            VIR_WARN("Failed to dispatch events for connection %p",
+                     cq->conn);
+            continue;
+        }
+        cq->dispatching = true;
+    }
+}
+
+
+/*
+ * Deliver the events queued for a single connection
+ */
+static void
+virDomainEventStateWorker(void *jobdata, void *opaque)
+{
+    virDomainEventConnQueuePtr cq = jobdata;
+    virDomainEventStatePtr state = opaque;
+    virDomainEventCallbackListPtr callbacks = state->callbacks;
+
+    virDomainEventStateLock(state);
+    state->dispatching++;
+
+    while (cq->queue.count > 0) {
+        virDomainEventQueue tempQueue = cq->queue;
+        int i, j;
+
+        cq->queue.count = 0;
+        cq->queue.events = NULL;
+
+        for (i = 0 ; i < tempQueue.count ; i++) {
+            virDomainEventPtr event = tempQueue.events[i];
+            /* Callbacks added while the lock is dropped are not called,
+               none are removed while we're dispatching */
+            int cbCount = callbacks->count;
+
+            for (j = 0 ; j < cbCount ; j++) {
+                if (callbacks->callbacks[j]->conn != cq->conn ||
+                    !virDomainEventDispatchMatchCallback(event,
+                                                         callbacks->callbacks[j]))
+                    continue;
+
+                virDomainEventStateDispatchFunc(callbacks->callbacks[j]->conn,
+                                                event,
+                                                callbacks->callbacks[j]->cb,
+                                                callbacks->callbacks[j]->opaque,
+                                                state);
+            }
+        }
+        virDomainEventQueueClear(&tempQueue);
+    }
+
+    cq->dispatching = false;
+
+    if (--state->dispatching == 0)
+        virDomainEventCallbackListPurgeMarked(state->callbacks);
+    virDomainEventStatePruneConnQueues(state);
+
+    virDomainEventStateUnlock(state);
+}
+
+
 static void
 virDomainEventStateFlush(virDomainEventStatePtr state)
 {
     virDomainEventQueue tempQueue;
 
     virDomainEventStateLock(state);
-    state->isDispatching = true;
+    state->dispatching++;
 
     /* Copy the queue, so we're reentrant safe when dispatchFunc drops the
      * driver lock */
@@ -1453,15 +1788,18 @@ virDomainEventStateFlush(virDomainEventStatePtr state)
     state->queue->events = NULL;
     virEventUpdateTimeout(state->timer, -1);
 
-    virDomainEventQueueDispatch(&tempQueue,
-                                state->callbacks,
-                                virDomainEventStateDispatchFunc,
-                                state);
+    if (state->flags & VIR_DOMAIN_EVENT_STATE_ASYNC)
+        virDomainEventStateFlushAsync(state, &tempQueue);
+    else
+        virDomainEventQueueDispatch(&tempQueue,
+                                    state->callbacks,
+                                    virDomainEventStateDispatchFunc,
+                                    state);
 
     /* Purge any deleted callbacks */
-    virDomainEventCallbackListPurgeMarked(state->callbacks);
+    if (--state->dispatching == 0)
+        virDomainEventCallbackListPurgeMarked(state->callbacks);
 
-    state->isDispatching = false;
     virDomainEventStateUnlock(state);
 }
 
@@ -1593,7 +1931,7 @@ virDomainEventStateDeregister(virConnectPtr conn,
     int ret;
 
     virDomainEventStateLock(state);
-    if (state->isDispatching)
+    if (state->dispatching)
         ret = virDomainEventCallbackListMarkDelete(conn,
                                                    state->callbacks, callback);
     else
@@ -1606,6 +1944,8 @@ virDomainEventStateDeregister(virConnectPtr conn,
         virDomainEventQueueClear(state->queue);
     }
 
+    virDomainEventStatePruneConnQueues(state);
+
     virDomainEventStateUnlock(state);
     return ret;
 }
@@ -1630,7 +1970,7 @@ virDomainEventStateDeregisterID(virConnectPtr conn,
     int ret;
 
     virDomainEventStateLock(state);
-    if (state->isDispatching)
+    if (state->dispatching)
         ret = virDomainEventCallbackListMarkDeleteID(conn,
                                                      state->callbacks, callbackID);
     else
@@ -1644,11 +1984,35 @@ virDomainEventStateDeregisterID(virConnectPtr conn,
         virDomainEventQueueClear(state->queue);
     }
 
+    virDomainEventStatePruneConnQueues(state);
+
     virDomainEventStateUnlock(state);
     return ret;
 }
 
 
+/**
+ * virDomainEventStateGetStats:
+ * @state: domain event state
+ * @dropped: filled with the number of dropped events
+ * @coalesced: filled with the number of coalesced events
+ *
+ * Report how many events were not delivered to a connection, either
+ * because its queue was full or because newer events superseded them,
+ * summed over all connections since @state was created.
+ */
+void
+virDomainEventStateGetStats(virDomainEventStatePtr state,
+                            unsigned long long *dropped,
+                            unsigned long long *coalesced)
+{
+    virDomainEventStateLock(state);
+    *dropped = state->dropped;
+    *coalesced = state->coalesced;
+    virDomainEventStateUnlock(state);
+}
+
+
 /**
  * virDomainEventStateEventID:
  * @conn: connection associated with the callback
@@ -134,9 +134,18 @@ virDomainEventPtr virDomainEventPMSuspendDiskNewFromDom(virDomainPtr dom);
 
 void virDomainEventFree(virDomainEventPtr event);
 
+typedef enum {
+    /* deliver events from worker threads, with a queue per connection */
+    VIR_DOMAIN_EVENT_STATE_ASYNC    = (1 << 0),
+    /* drop queued events superseded by newer ones */
+    VIR_DOMAIN_EVENT_STATE_COALESCE = (1 << 1),
+} virDomainEventStateFlags;
+
 void virDomainEventStateFree(virDomainEventStatePtr state);
 virDomainEventStatePtr
 virDomainEventStateNew(void);
+virDomainEventStatePtr
+virDomainEventStateNewFull(unsigned int flags);
 
 void
 virDomainEventStateQueue(virDomainEventStatePtr state,
@@ -167,6 +176,11 @@ virDomainEventStateDeregisterID(virConnectPtr conn,
                                 virDomainEventStatePtr state,
                                 int callbackID)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void
+virDomainEventStateGetStats(virDomainEventStatePtr state,
+                            unsigned long long *dropped,
+                            unsigned long long *coalesced)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
 int
 virDomainEventStateEventID(virConnectPtr conn,
                            virDomainEventStatePtr state,
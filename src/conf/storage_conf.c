@@ -44,6 +44,7 @@
 #include "virutil.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -301,9 +302,112 @@ virStorageVolDefFree(virStorageVolDefPtr def) {
     VIR_FREE(def->backingStore.perms.label);
     VIR_FREE(def->backingStore.timestamps);
     virStorageEncryptionFree(def->backingStore.encryption);
+    virStorageVolJobFree(def->job);
     VIR_FREE(def);
 }
 
+
+virStorageVolJobPtr
+virStorageVolJobNew(int type,
+                    unsigned long long total)
+{
+    virStorageVolJobPtr job;
+
+    if (VIR_ALLOC(job) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virMutexInit(&job->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize mutex"));
+        VIR_FREE(job);
+        return NULL;
+    }
+
+    if (virTimeMillisNow(&job->started) < 0) {
+        virMutexDestroy(&job->lock);
+        VIR_FREE(job);
+        return NULL;
+    }
+
+    job->type = type;
+    job->state = VIR_STORAGE_VOL_JOB_STATE_RUNNING;
+    job->total = total;
+
+    return job;
+}
+
+
+void
+virStorageVolJobFree(virStorageVolJobPtr job)
+{
+    if (!job)
+        return;
+
+    virMutexDestroy(&job->lock);
+    VIR_FREE(job);
+}
+
+
+/*
+ * Adds @processed bytes to the progress of @job. This is called
+ * without the pool lock, by whichever thread is doing the work.
+ */
+void
+virStorageVolJobUpdate(virStorageVolJobPtr job,
+                       unsigned long long processed)
+{
+    virMutexLock(&job->lock);
+    job->processed += processed;
+    virMutexUnlock(&job->lock);
+}
+
+
+void
+virStorageVolJobEnd(virStorageVolJobPtr job, bool success)
+{
+    virMutexLock(&job->lock);
+    if (virTimeMillisNow(&job->ended) < 0)
+        job->ended = job->started;
+    if (success) {
+        job->state = VIR_STORAGE_VOL_JOB_STATE_COMPLETED;
+        job->processed = job->total;
+    } else {
+        job->state = VIR_STORAGE_VOL_JOB_STATE_FAILED;
+    }
+    virMutexUnlock(&job->lock);
+}
+
+
+void
+virStorageVolJobGetInfo(virStorageVolJobPtr job,
+                        virStorageVolJobInfoPtr info)
+{
+    unsigned long long now;
+
+    memset(info, 0, sizeof(*info));
+    if (!job)
+        return;
+
+    virMutexLock(&job->lock);
+    info->type = job->type;
+    info->state = job->state;
+    info->dataTotal = job->total;
+    info->dataProcessed = job->processed;
+
+    if (job->ended)
+        now = job->ended;
+    else if (virTimeMillisNow(&now) < 0)
+        now = job->started;
+    if (now > job->started)
+        info->timeElapsed = now - job->started;
+    virMutexUnlock(&job->lock);
+
+    if (info->timeElapsed)
+        info->rate = info->dataProcessed * 1000 / info->timeElapsed;
+}
+
 void
 virStoragePoolSourceClear(virStoragePoolSourcePtr source)
 {
@@ -368,6 +472,9 @@ virStoragePoolObjFree(virStoragePoolObjPtr obj) {
         return;
 
     virStoragePoolObjClearVols(obj);
+    virHashFree(obj->volumes.objsName);
+    virHashFree(obj->volumes.objsKey);
+    virHashFree(obj->volumes.objsPath);
 
     virStoragePoolDefFree(obj->def);
     virStoragePoolDefFree(obj->newDef);
@@ -1463,6 +1570,11 @@ void
 virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 {
     unsigned int i;
+
+    virHashRemoveAll(pool->volumes.objsName);
+    virHashRemoveAll(pool->volumes.objsKey);
+    virHashRemoveAll(pool->volumes.objsPath);
+
     for (i = 0 ; i < pool->volumes.count ; i++)
         virStorageVolDefFree(pool->volumes.objs[i]);
 
@@ -1470,40 +1582,192 @@ virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
     pool->volumes.count = 0;
 }
 
-virStorageVolDefPtr
-virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
-                          const char *key) {
+
+/*
+ * Keys and paths are not guaranteed to be unique within a pool (eg
+ * multipath SCSI LUNs sharing a serial), so only the first volume
+ * added for a given value is indexed, matching what a linear scan
+ * of the list would find.
+ */
+static int
+virStorageVolDefListIndex(virHashTablePtr table,
+                          const char *name,
+                          virStorageVolDefPtr vol)
+{
+    if (!name || virHashLookup(table, name))
+        return 0;
+
+    return virHashAddEntry(table, name, vol);
+}
+
+
+static void
+virStorageVolDefListUnindex(virHashTablePtr table,
+                            const char *name,
+                            virStorageVolDefPtr vol)
+{
+    if (name && virHashLookup(table, name) == vol)
+        virHashRemoveEntry(table, name);
+}
+
+
+/*
+ * Drop the entry of @vol for @value from the key index, or from the
+ * path index if !@byKey. If another volume shares @value, it takes
+ * over the entry.
+ */
+static void
+virStorageVolDefListUnindexShared(virStorageVolDefListPtr vols,
+                                  bool byKey,
+                                  const char *value,
+                                  virStorageVolDefPtr vol)
+{
+    virHashTablePtr table = byKey ? vols->objsKey : vols->objsPath;
     unsigned int i;
 
-    for (i = 0 ; i < pool->volumes.count ; i++)
-        if (STREQ(pool->volumes.objs[i]->key, key))
-            return pool->volumes.objs[i];
+    if (!value || virHashLookup(table, value) != vol)
+        return;
 
-    return NULL;
+    virHashRemoveEntry(table, value);
+    for (i = 0 ; i < vols->count ; i++) {
+        virStorageVolDefPtr other = vols->objs[i];
+
+        if (other != vol &&
+            STREQ_NULLABLE(byKey ? other->key : other->target.path, value)) {
+            ignore_value(virHashAddEntry(table, value, other));
+            break;
+        }
+    }
 }
 
-virStorageVolDefPtr
-virStorageVolDefFindByPath(virStoragePoolObjPtr pool,
-                           const char *path) {
+
+/**
+ * virStoragePoolObjAddVol:
+ * @pool: locked storage pool object
+ * @vol: volume definition to add
+ *
+ * Append @vol to the list of volumes in @pool and index it by name,
+ * key and path. On success @pool owns @vol, on failure the caller
+ * keeps ownership.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr vols = &pool->volumes;
+
+    if (VIR_REALLOC_N(vols->objs, vols->count + 1) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (virStorageVolDefListIndex(vols->objsName, vol->name, vol) < 0 ||
+        virStorageVolDefListIndex(vols->objsKey, vol->key, vol) < 0 ||
+        virStorageVolDefListIndex(vols->objsPath, vol->target.path, vol) < 0) {
+        virStorageVolDefListUnindex(vols->objsName, vol->name, vol);
+        virStorageVolDefListUnindex(vols->objsKey, vol->key, vol);
+        virStorageVolDefListUnindex(vols->objsPath, vol->target.path, vol);
+        return -1;
+    }
+
+    vols->objs[vols->count++] = vol;
+    return 0;
+}
+
+
+/**
+ * virStoragePoolObjRemoveVol:
+ * @pool: locked storage pool object
+ * @vol: volume definition to remove
+ *
+ * Remove @vol from the list of volumes in @pool and from its
+ * indexes. Ownership of @vol passes back to the caller.
+ */
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr vols = &pool->volumes;
     unsigned int i;
 
-    for (i = 0 ; i < pool->volumes.count ; i++)
-        if (STREQ(pool->volumes.objs[i]->target.path, path))
-            return pool->volumes.objs[i];
+    for (i = 0 ; i < vols->count ; i++) {
+        if (vols->objs[i] == vol)
+            break;
+    }
 
-    return NULL;
+    if (i == vols->count)
+        return;
+
+    if (i < (vols->count - 1))
+        memmove(vols->objs + i, vols->objs + i + 1,
+                sizeof(*(vols->objs)) * (vols->count - (i + 1)));
+
+    if (VIR_REALLOC_N(vols->objs, vols->count - 1) < 0) {
+        ; /* Failure to reduce memory allocation isn't fatal */
+    }
+    vols->count--;
+
+    virStorageVolDefListUnindex(vols->objsName, vol->name, vol);
+    virStorageVolDefListUnindexShared(vols, true, vol->key, vol);
+    virStorageVolDefListUnindexShared(vols, false, vol->target.path, vol);
+}
+
+
+/**
+ * virStoragePoolObjRekeyVol:
+ * @pool: locked storage pool object
+ * @vol: volume definition owned by @pool
+ * @oldkey: key @vol had when it was last indexed
+ * @oldpath: path @vol had when it was last indexed
+ *
+ * Move @vol in the key and path indexes of @pool after refreshing it
+ * changed either of them, as the network backends do.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virStoragePoolObjRekeyVol(virStoragePoolObjPtr pool,
+                          virStorageVolDefPtr vol,
+                          const char *oldkey,
+                          const char *oldpath)
+{
+    virStorageVolDefListPtr vols = &pool->volumes;
+
+    if (STRNEQ_NULLABLE(oldkey, vol->key)) {
+        virStorageVolDefListUnindexShared(vols, true, oldkey, vol);
+        if (virStorageVolDefListIndex(vols->objsKey, vol->key, vol) < 0)
+            return -1;
+    }
+
+    if (STRNEQ_NULLABLE(oldpath, vol->target.path)) {
+        virStorageVolDefListUnindexShared(vols, false, oldpath, vol);
+        if (virStorageVolDefListIndex(vols->objsPath,
+                                      vol->target.path, vol) < 0)
+            return -1;
+    }
+
+    return 0;
 }
 
+
 virStorageVolDefPtr
-virStorageVolDefFindByName(virStoragePoolObjPtr pool,
-                           const char *name) {
-    unsigned int i;
+virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
+                          const char *key) {
+    return virHashLookup(pool->volumes.objsKey, key);
+}
 
-    for (i = 0 ; i < pool->volumes.count ; i++)
-        if (STREQ(pool->volumes.objs[i]->name, name))
-            return pool->volumes.objs[i];
+virStorageVolDefPtr
+virStorageVolDefFindByPath(virStoragePoolObjPtr pool,
+                           const char *path) {
+    return virHashLookup(pool->volumes.objsPath, path);
+}
 
-    return NULL;
+virStorageVolDefPtr
+virStorageVolDefFindByName(virStoragePoolObjPtr pool,
+                           const char *name) {
+    return virHashLookup(pool->volumes.objsName, name);
 }
 
 virStoragePoolObjPtr
@@ -1535,6 +1799,15 @@ virStoragePoolObjAssignDef(virStoragePoolObjListPtr pools,
     }
     virStoragePoolObjLock(pool);
     pool->active = 0;
+
+    if (!(pool->volumes.objsName = virHashCreate(50, NULL)) ||
+        !(pool->volumes.objsKey = virHashCreate(50, NULL)) ||
+        !(pool->volumes.objsPath = virHashCreate(50, NULL))) {
+        virStoragePoolObjUnlock(pool);
+        virStoragePoolObjFree(pool);
+        return NULL;
+    }
+
     pool->def = def;
 
     if (VIR_REALLOC_N(pools->objs, pools->count+1) < 0) {
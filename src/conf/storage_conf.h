@@ -28,6 +28,7 @@
 # include "virutil.h"
 # include "storage_encryption_conf.h"
 # include "virthread.h"
+# include "virhash.h"
 
 # include <libxml/tree.h>
 
@@ -96,6 +97,23 @@ struct _virStorageVolTarget {
 };
 
 
+/*
+ * Progress of a long running operation on a volume, such as a wipe
+ */
+typedef struct _virStorageVolJob virStorageVolJob;
+typedef virStorageVolJob *virStorageVolJobPtr;
+struct _virStorageVolJob {
+    virMutex lock;
+
+    int type; /* virStorageVolJobType enum */
+    int state; /* virStorageVolJobState enum */
+
+    unsigned long long started; /* ms since the epoch */
+    unsigned long long ended; /* ms since the epoch, 0 while running */
+    unsigned long long total; /* bytes */
+    unsigned long long processed; /* bytes */
+};
+
 typedef struct _virStorageVolDef virStorageVolDef;
 typedef virStorageVolDef *virStorageVolDefPtr;
 struct _virStorageVolDef {
@@ -104,6 +122,7 @@ struct _virStorageVolDef {
     int type; /* virStorageVolType enum */
 
     unsigned int building;
+    virStorageVolJobPtr job; /* Last job started on the volume, or NULL */
 
     unsigned long long allocation; /* bytes */
     unsigned long long capacity; /* bytes */
@@ -118,6 +137,11 @@ typedef virStorageVolDefList *virStorageVolDefListPtr;
 struct _virStorageVolDefList {
     unsigned int count;
     virStorageVolDefPtr *objs;
+
+    /* Lookup indexes into @objs, which owns the volumes */
+    virHashTablePtr objsName;
+    virHashTablePtr objsKey;
+    virHashTablePtr objsPath;
 };
 
 
@@ -326,6 +350,9 @@ struct _virStoragePoolObjList {
 
 
 
+typedef struct _virStorageWipeJob virStorageWipeJob;
+typedef virStorageWipeJob *virStorageWipeJobPtr;
+
 typedef struct _virStorageDriverState virStorageDriverState;
 typedef virStorageDriverState *virStorageDriverStatePtr;
 
@@ -336,6 +363,10 @@ struct _virStorageDriverState {
 
     char *configDir;
     char *autostartDir;
+
+    /* Wipes running in the background, joined once they are done */
+    virStorageWipeJobPtr *wipeJobs;
+    size_t nwipeJobs;
 };
 
 typedef struct _virStoragePoolSourceList virStoragePoolSourceList;
@@ -370,6 +401,16 @@ virStorageVolDefPtr virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                                                const char *name);
 
 void virStoragePoolObjClearVols(virStoragePoolObjPtr pool);
+int virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                            virStorageVolDefPtr vol)
+    ATTRIBUTE_RETURN_CHECK;
+void virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                                virStorageVolDefPtr vol);
+int virStoragePoolObjRekeyVol(virStoragePoolObjPtr pool,
+                              virStorageVolDefPtr vol,
+                              const char *oldkey,
+                              const char *oldpath)
+    ATTRIBUTE_RETURN_CHECK;
 
 virStoragePoolDefPtr virStoragePoolDefParseString(const char *xml);
 virStoragePoolDefPtr virStoragePoolDefParseFile(const char *filename);
@@ -396,6 +437,15 @@ int virStoragePoolObjSaveDef(virStorageDriverStatePtr driver,
 int virStoragePoolObjDeleteDef(virStoragePoolObjPtr pool);
 
 void virStorageVolDefFree(virStorageVolDefPtr def);
+
+virStorageVolJobPtr virStorageVolJobNew(int type,
+                                        unsigned long long total);
+void virStorageVolJobFree(virStorageVolJobPtr job);
+void virStorageVolJobUpdate(virStorageVolJobPtr job,
+                            unsigned long long processed);
+void virStorageVolJobEnd(virStorageVolJobPtr job, bool success);
+void virStorageVolJobGetInfo(virStorageVolJobPtr job,
+                             virStorageVolJobInfoPtr info);
 void virStoragePoolSourceClear(virStoragePoolSourcePtr source);
 void virStoragePoolSourceFree(virStoragePoolSourcePtr source);
 void virStoragePoolDefFree(virStoragePoolDefPtr def);
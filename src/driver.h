@@ -941,6 +941,14 @@ typedef int
                                     int **fdlist,
                                     unsigned int flags);
 
+typedef int
+    (*virDrvConnectGetAllDomainStats)(virConnectPtr conn,
+                                      virDomainPtr *doms,
+                                      unsigned int ndoms,
+                                      unsigned int stats,
+                                      virDomainStatsRecordPtr **retStats,
+                                      unsigned int flags);
+
 /**
  * _virDriver:
  *
@@ -1138,6 +1146,7 @@ struct _virDriver {
     virDrvDomainFSTrim                  domainFSTrim;
     virDrvDomainSendProcessSignal       domainSendProcessSignal;
     virDrvDomainLxcOpenNamespace        domainLxcOpenNamespace;
+    virDrvConnectGetAllDomainStats      connectGetAllDomainStats;
 };
 
 typedef int
@@ -1462,6 +1471,11 @@ typedef int
                                    unsigned long long capacity,
                                    unsigned int flags);
 
+typedef int
+        (*virDrvStorageVolGetJobInfo) (virStorageVolPtr vol,
+                                       virStorageVolJobInfoPtr info,
+                                       unsigned int flags);
+
 typedef int
         (*virDrvStoragePoolIsActive)(virStoragePoolPtr pool);
 typedef int
@@ -1528,6 +1542,7 @@ struct _virStorageDriver {
     virDrvStorageVolResize                  volResize;
     virDrvStoragePoolIsActive               poolIsActive;
     virDrvStoragePoolIsPersistent           poolIsPersistent;
+    virDrvStorageVolGetJobInfo              volGetJobInfo;
 };
 
 # ifdef WITH_LIBVIRTD
@@ -1699,6 +1714,16 @@ typedef int (*virDrvStreamSend)(virStreamPtr st,
 typedef int (*virDrvStreamRecv)(virStreamPtr st,
                                 char *data,
                                 size_t nbytes);
+typedef int (*virDrvStreamRecvFlags)(virStreamPtr st,
+                                     char *data,
+                                     size_t nbytes,
+                                     unsigned int flags);
+typedef int (*virDrvStreamSendHole)(virStreamPtr st,
+                                    long long length,
+                                    unsigned int flags);
+typedef int (*virDrvStreamRecvHole)(virStreamPtr st,
+                                    long long *length,
+                                    unsigned int flags);
 
 typedef int (*virDrvStreamEventAddCallback)(virStreamPtr stream,
                                             int events,
@@ -1716,6 +1741,9 @@ typedef int (*virDrvStreamAbort)(virStreamPtr st);
 struct _virStreamDriver {
     virDrvStreamSend                streamSend;
     virDrvStreamRecv                streamRecv;
+    virDrvStreamRecvFlags           streamRecvFlags;
+    virDrvStreamSendHole            streamSendHole;
+    virDrvStreamRecvHole            streamRecvHole;
     virDrvStreamEventAddCallback    streamAddCallback;
     virDrvStreamEventUpdateCallback streamUpdateCallback;
     virDrvStreamEventRemoveCallback streamRemoveCallback;
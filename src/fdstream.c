@@ -51,6 +51,13 @@ struct virFDStreamData {
     unsigned long long offset;
     unsigned long long length;
 
+    /* Sparse streams are split into records by the I/O helper */
+    bool sparse;
+    char hdr[VIR_FILE_SPARSE_RECORD_HEADER_LEN];
+    size_t hdrLen; /* header bytes read, or still to be written */
+    int recType;
+    unsigned long long recLeft; /* bytes left in the current record */
+
     int watch;
     int events;         /* events the stream callback is subscribed for */
     bool cbRemoved;
@@ -348,6 +355,96 @@ virFDStreamAbort(virStreamPtr st)
     return virFDStreamCloseInt(st, true);
 }
 
+static void
+virFDStreamEncodeHeader(struct virFDStreamData *fdst,
+                        int type,
+                        unsigned long long length)
+{
+    virFileSparseRecordEncode(fdst->hdr, type, length);
+    fdst->hdrLen = sizeof(fdst->hdr);
+}
+
+
+/*
+ * Write out what is left of the current record header.
+ *
+ * Returns 0 when done, -2 if the pipe is full, -1 on error
+ */
+static int
+virFDStreamWriteHeader(struct virFDStreamData *fdst)
+{
+    while (fdst->hdrLen) {
+        ssize_t done = write(fdst->fd,
+                             fdst->hdr + sizeof(fdst->hdr) - fdst->hdrLen,
+                             fdst->hdrLen);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return -2;
+            virReportSystemError(errno, "%s",
+                                 _("cannot write to stream"));
+            return -1;
+        }
+        fdst->hdrLen -= done;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Read the header of the next record, unless in the middle of one.
+ *
+ * Returns 1 if in a record, 0 at the end of the stream, -2 if no
+ * data is pending, -1 on error
+ */
+static int
+virFDStreamReadHeader(struct virFDStreamData *fdst)
+{
+    unsigned long long length;
+    int type;
+
+    while (fdst->recLeft == 0) {
+        ssize_t got = read(fdst->fd, fdst->hdr + fdst->hdrLen,
+                           sizeof(fdst->hdr) - fdst->hdrLen);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return -2;
+            virReportSystemError(errno, "%s",
+                                 _("cannot read from stream"));
+            return -1;
+        }
+        if (got == 0) {
+            if (fdst->hdrLen == 0)
+                return 0;
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("truncated record in sparse stream"));
+            return -1;
+        }
+
+        fdst->hdrLen += got;
+        if (fdst->hdrLen < sizeof(fdst->hdr))
+            continue;
+        fdst->hdrLen = 0;
+
+        if (virFileSparseRecordDecode(fdst->hdr, &type, &length) < 0 ||
+            length > LLONG_MAX) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("malformed record type %d length %llu in sparse stream"),
+                           type, length);
+            return -1;
+        }
+        fdst->recType = type;
+        fdst->recLeft = length;
+    }
+
+    return 1;
+}
+
+
 static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 {
     struct virFDStreamData *fdst = st->privateData;
@@ -379,6 +476,24 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    /* Each write starts a data record, unless the data of an
+     * interrupted one is still to come */
+    if (fdst->sparse) {
+        if (!fdst->recLeft) {
+            if (!nbytes) {
+                ret = 0;
+                goto cleanup;
+            }
+            virFDStreamEncodeHeader(fdst, VIR_FILE_SPARSE_RECORD_DATA, nbytes);
+            fdst->recType = VIR_FILE_SPARSE_RECORD_DATA;
+            fdst->recLeft = nbytes;
+        }
+        if ((ret = virFDStreamWriteHeader(fdst)) < 0)
+            goto cleanup;
+        if (fdst->recLeft < nbytes)
+            nbytes = fdst->recLeft;
+    }
+
 retry:
     ret = write(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -391,20 +506,81 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot write to stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->sparse)
+            fdst->recLeft -= ret;
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
+cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
 
 
-static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+static int virFDStreamSendHole(virStreamPtr st,
+                               long long length,
+                               unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (!fdst->sparse) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("stream does not support holes"));
+        goto cleanup;
+    }
+
+    if (fdst->recLeft) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("data of the previous write is still to be sent"));
+        goto cleanup;
+    }
+
+    /* Unless retrying a hole whose header didn't fit in the pipe */
+    if (!fdst->hdrLen) {
+        if (fdst->length &&
+            (unsigned long long) length > fdst->length - fdst->offset) {
+            virReportSystemError(ENOSPC, "%s",
+                                 _("cannot write to stream"));
+            goto cleanup;
+        }
+        virFDStreamEncodeHeader(fdst, VIR_FILE_SPARSE_RECORD_HOLE, length);
+    }
+
+    if ((ret = virFDStreamWriteHeader(fdst)) < 0)
+        goto cleanup;
+
+    if (fdst->length)
+        fdst->offset += length;
+
+cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int virFDStreamReadFlags(virStreamPtr st,
+                               char *bytes,
+                               size_t nbytes,
+                               unsigned int flags)
 {
     struct virFDStreamData *fdst = st->privateData;
     int ret;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (nbytes > INT_MAX) {
         virReportSystemError(ERANGE, "%s",
                              _("Too many bytes to read from stream"));
@@ -429,6 +605,24 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->sparse) {
+        if ((ret = virFDStreamReadHeader(fdst)) <= 0)
+            goto cleanup;
+        if (fdst->recLeft < nbytes)
+            nbytes = fdst->recLeft;
+
+        /* Holes read as zeros, unless the caller handles them */
+        if (fdst->recType == VIR_FILE_SPARSE_RECORD_HOLE) {
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                ret = -3;
+                goto cleanup;
+            }
+            memset(bytes, 0, nbytes);
+            ret = nbytes;
+            goto done;
+        }
+    }
+
 retry:
     ret = read(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -441,18 +635,71 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot read from stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+        goto cleanup;
     }
 
+    if (fdst->sparse && ret == 0 && nbytes) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("truncated record in sparse stream"));
+        ret = -1;
+        goto cleanup;
+    }
+
+done:
+    if (fdst->sparse)
+        fdst->recLeft -= ret;
+    if (fdst->length)
+        fdst->offset += ret;
+
+cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
 
 
+static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+{
+    return virFDStreamReadFlags(st, bytes, nbytes, 0);
+}
+
+
+static int virFDStreamRecvHole(virStreamPtr st,
+                               long long *length,
+                               unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    *length = 0;
+    if (fdst->sparse &&
+        fdst->recType == VIR_FILE_SPARSE_RECORD_HOLE &&
+        fdst->recLeft) {
+        *length = fdst->recLeft;
+        if (fdst->length)
+            fdst->offset += fdst->recLeft;
+        fdst->recLeft = 0;
+    }
+
+    virMutexUnlock(&fdst->lock);
+    return 0;
+}
+
+
 static virStreamDriver virFDStreamDrv = {
     .streamSend = virFDStreamWrite,
     .streamRecv = virFDStreamRead,
+    .streamRecvFlags = virFDStreamReadFlags,
+    .streamSendHole = virFDStreamSendHole,
+    .streamRecvHole = virFDStreamRecvHole,
     .streamFinish = virFDStreamClose,
     .streamAbort = virFDStreamAbort,
     .streamAddCallback = virFDStreamAddCallback,
@@ -464,12 +711,13 @@ static int virFDStreamOpenInternal(virStreamPtr st,
                                    int fd,
                                    virCommandPtr cmd,
                                    int errfd,
-                                   unsigned long long length)
+                                   unsigned long long length,
+                                   bool sparse)
 {
     struct virFDStreamData *fdst;
 
-    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu",
-              st, fd, cmd, errfd, length);
+    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu sparse=%d",
+              st, fd, cmd, errfd, length, sparse);
 
     if ((st->flags & VIR_STREAM_NONBLOCK) &&
         virSetNonBlock(fd) < 0)
@@ -484,6 +732,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
     fdst->cmd = cmd;
     fdst->errfd = errfd;
     fdst->length = length;
+    fdst->sparse = sparse;
     if (virMutexInit(&fdst->lock) < 0) {
         VIR_FREE(fdst);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -501,7 +750,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
 int virFDStreamOpen(virStreamPtr st,
                     int fd)
 {
-    return virFDStreamOpenInternal(st, fd, NULL, -1, 0);
+    return virFDStreamOpenInternal(st, fd, NULL, -1, 0, false);
 }
 
 
@@ -546,7 +795,7 @@ int virFDStreamConnectUNIX(virStreamPtr st,
         goto error;
     } while ((++i <= timeout*5) && (usleep(.2 * 1000000) <= 0));
 
-    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0) < 0)
+    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0, false) < 0)
         goto error;
     return 0;
 
@@ -571,7 +820,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             unsigned long long offset,
                             unsigned long long length,
                             int oflags,
-                            int mode)
+                            int mode,
+                            bool sparse)
 {
     int fd = -1;
     int childfd = -1;
@@ -579,8 +829,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     virCommandPtr cmd = NULL;
     int errfd = -1;
 
-    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o",
-              st, path, oflags, offset, length, mode);
+    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o sparse=%d",
+              st, path, oflags, offset, length, mode, sparse);
 
     if (oflags & O_CREAT)
         fd = open(path, oflags, mode);
@@ -631,9 +881,10 @@ virFDStreamOpenFileInternal(virStreamPtr st,
             goto error;
         }
 
-        cmd = virCommandNewArgList(LIBEXECDIR "/libvirt_iohelper",
-                                   path,
-                                   NULL);
+        cmd = virCommandNew(LIBEXECDIR "/libvirt_iohelper");
+        if (sparse)
+            virCommandAddArg(cmd, "-s");
+        virCommandAddArg(cmd, path);
         virCommandAddArgFormat(cmd, "%llu", length);
         virCommandTransferFD(cmd, fd);
         virCommandAddArgFormat(cmd, "%d", fd);
@@ -653,9 +904,13 @@ virFDStreamOpenFileInternal(virStreamPtr st,
             goto error;
 
         VIR_FORCE_CLOSE(childfd);
+    } else {
+        /* Without the helper, holes are neither looked for nor
+         * recreated, the stream simply carries zeros */
+        sparse = false;
     }
 
-    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length) < 0)
+    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length, sparse) < 0)
         goto error;
 
     return 0;
@@ -684,7 +939,28 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0);
+                                       oflags, 0, false);
+}
+
+/*
+ * Like virFDStreamOpenFile, but holes in the file are read as such,
+ * and the holes sent are recreated, when the I/O helper is used.
+ */
+int virFDStreamOpenSparseFile(virStreamPtr st,
+                              const char *path,
+                              unsigned long long offset,
+                              unsigned long long length,
+                              int oflags)
+{
+    if (oflags & O_CREAT) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Attempt to create %s without specifying mode"),
+                       path);
+        return -1;
+    }
+    return virFDStreamOpenFileInternal(st, path,
+                                       offset, length,
+                                       oflags, 0, true);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -696,7 +972,7 @@ int virFDStreamCreateFile(virStreamPtr st,
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags | O_CREAT, mode);
+                                       oflags | O_CREAT, mode, false);
 }
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
@@ -110,6 +110,24 @@ enum {
      * Support for offline migration.
      */
     VIR_DRV_FEATURE_MIGRATION_OFFLINE = 12,
+
+    /*
+     * Remote party supports credit based flow control of streams
+     * (i.e., the VIR_NET_STREAM_CREDIT message).
+     */
+    VIR_DRV_FEATURE_STREAM_CREDIT = 13,
+
+    /*
+     * Remote party supports holes in stream data
+     * (i.e., the VIR_NET_STREAM_HOLE message).
+     */
+    VIR_DRV_FEATURE_STREAM_SPARSE = 14,
+
+    /*
+     * Remote party can hand out a shared memory snapshot of
+     * domain state (i.e., REMOTE_PROC_CONNECT_OPEN_STATE_SHM).
+     */
+    VIR_DRV_FEATURE_STATE_SHM = 15,
 };
 
 
@@ -1202,7 +1202,10 @@ libxlStartup(bool privileged,
     }
     VIR_FREE(log_file);
 
-    libxl_driver->domainEventState = virDomainEventStateNew();
+    /* events are relayed to remote clients, which is safe from any thread */
+    libxl_driver->domainEventState =
+        virDomainEventStateNewFull(VIR_DOMAIN_EVENT_STATE_ASYNC |
+                                   VIR_DOMAIN_EVENT_STATE_COALESCE);
     if (!libxl_driver->domainEventState)
         goto error;
 
@@ -1445,7 +1445,10 @@ static int lxcStartup(bool privileged,
     if (!(lxc_driver->domains = virDomainObjListNew()))
         goto cleanup;
 
-    lxc_driver->domainEventState = virDomainEventStateNew();
+    /* events are relayed to remote clients, which is safe from any thread */
+    lxc_driver->domainEventState =
+        virDomainEventStateNewFull(VIR_DOMAIN_EVENT_STATE_ASYNC |
+                                   VIR_DOMAIN_EVENT_STATE_COALESCE);
     if (!lxc_driver->domainEventState)
         goto cleanup;
 
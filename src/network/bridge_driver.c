@@ -338,7 +338,11 @@ firewalld_dbus_filter_bridge(DBusConnection *connection ATTRIBUTE_UNUSED,
                                "Reloaded"))
     {
         VIR_DEBUG("Reload in bridge_driver because of firewalld.");
+        /* Runs in the event loop, not in an API call holding the lock
+         * which guards the networks and the iptables context */
+        networkDriverLock(_driverState);
         networkReloadIptablesRules(_driverState);
+        networkDriverUnlock(_driverState);
     }
 
     return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
@@ -1944,20 +1948,6 @@ networkAddGeneralIptablesRules(struct network_driver *driver,
         goto err2;
     }
 
-    /* If we are doing local DHCP service on this network, attempt to
-     * add a rule that will fixup the checksum of DHCP response
-     * packets back to the guests (but report failure without
-     * aborting, since not all iptables implementations support it).
-     */
-
-    if (ipv4def && (ipv4def->nranges || ipv4def->nhosts) &&
-        (iptablesAddOutputFixUdpChecksum(driver->iptables,
-                                         network->def->bridge, 68) < 0)) {
-        VIR_WARN("Could not add rule to fixup DHCP response checksums "
-                 "on network '%s'.", network->def->name);
-        VIR_WARN("May need to update iptables package & kernel to support CHECKSUM rule.");
-    }
-
     /* allow DNS requests through to dnsmasq */
     if (iptablesAddTcpInput(driver->iptables, AF_INET,
                             network->def->bridge, 53) < 0) {
@@ -2042,6 +2032,36 @@ err1:
     return -1;
 }
 
+/* If we are doing local DHCP service on this network, attempt to
+ * add a rule that will fixup the checksum of DHCP response
+ * packets back to the guests (but report failure without
+ * aborting, since not all iptables implementations support it).
+ * This must not run inside a transaction, where its failure would
+ * take all the other rules out again.
+ */
+static void
+networkAddChecksumFixupIptablesRule(struct network_driver *driver,
+                                    virNetworkObjPtr network)
+{
+    int ii;
+    virNetworkIpDefPtr ipv4def;
+
+    for (ii = 0;
+         (ipv4def = virNetworkDefGetIpByIndex(network->def, AF_INET, ii));
+         ii++) {
+        if (ipv4def->nranges || ipv4def->nhosts || ipv4def->tftproot)
+            break;
+    }
+
+    if (ipv4def && (ipv4def->nranges || ipv4def->nhosts) &&
+        (iptablesAddOutputFixUdpChecksum(driver->iptables,
+                                         network->def->bridge, 68) < 0)) {
+        VIR_WARN("Could not add rule to fixup DHCP response checksums "
+                 "on network '%s'.", network->def->name);
+        VIR_WARN("May need to update iptables package & kernel to support CHECKSUM rule.");
+    }
+}
+
 static void
 networkRemoveGeneralIptablesRules(struct network_driver *driver,
                                   virNetworkObjPtr network)
@@ -2116,11 +2136,16 @@ networkAddIptablesRules(struct network_driver *driver,
 {
     int ii;
     virNetworkIpDefPtr ipdef;
-    virErrorPtr orig_error;
+
+    /* Collect all the rules and apply them in one go. Nothing touches
+     * the firewall until the commit, which takes out whatever it added
+     * if a rule fails, so there is nothing to clean up here.
+     */
+    iptablesTransactionBegin(driver->iptables);
 
     /* Add "once per network" rules */
     if (networkAddGeneralIptablesRules(driver, network) < 0)
-        return -1;
+        goto err;
 
     for (ii = 0;
          (ipdef = virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, ii));
@@ -2130,24 +2155,15 @@ networkAddIptablesRules(struct network_driver *driver,
             goto err;
         }
     }
-    return 0;
 
-err:
-    /* store the previous error message before attempting removal of rules */
-    orig_error = virSaveLastError();
+    if (iptablesTransactionCommit(driver->iptables) < 0)
+        return -1;
 
-    /* The final failed call to networkAddIpSpecificIptablesRules will
-     * have removed any rules it created, but we need to remove those
-     * added for previous IP addresses.
-     */
-    while ((--ii >= 0) &&
-           (ipdef = virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, ii))) {
-        networkRemoveIpSpecificIptablesRules(driver, network, ipdef);
-    }
-    networkRemoveGeneralIptablesRules(driver, network);
+    networkAddChecksumFixupIptablesRule(driver, network);
+    return 0;
 
-    /* return the original error */
-    virSetError(orig_error);
+err:
+    iptablesTransactionAbort(driver->iptables);
     return -1;
 }
 
@@ -2159,12 +2175,16 @@ networkRemoveIptablesRules(struct network_driver *driver,
     int ii;
     virNetworkIpDefPtr ipdef;
 
+    iptablesTransactionBegin(driver->iptables);
+
     for (ii = 0;
          (ipdef = virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, ii));
          ii++) {
         networkRemoveIpSpecificIptablesRules(driver, network, ipdef);
     }
     networkRemoveGeneralIptablesRules(driver, network);
+
+    ignore_value(iptablesTransactionCommit(driver->iptables));
 }
 
 static void
@@ -83,6 +83,10 @@
 static char *ebtables_cmd_path;
 static char *iptables_cmd_path;
 static char *ip6tables_cmd_path;
+static char *iptables_restore_cmd_path;
+static char *ip6tables_restore_cmd_path;
+static bool iptables_restore_wait;
+static bool ip6tables_restore_wait;
 static char *grep_cmd_path;
 
 #define PRINT_ROOT_CHAIN(buf, prefix, ifname) \
@@ -194,7 +198,16 @@ static void ebiptablesDriverShutdown(void);
 static int ebtablesCleanAll(const char *ifname);
 static int ebiptablesAllTeardown(const char *ifname);
 
-static virMutex execCLIMutex;
+/*
+ * Scripts that only touch the chains of a single interface take this
+ * lock shared if all the tools serialize access to the kernel tables
+ * themselves (execCLIConcurrent); everything else takes it exclusively.
+ * The same goes for iptables-restore runs, which must also take the
+ * xtables lock (--wait) to run shared.
+ * Interfaces are serialized against themselves by virNWFilterLockIface.
+ */
+static virRWLock execCLILock;
+static bool execCLIConcurrent;
 
 struct ushort_map {
     unsigned short attr;
@@ -2771,6 +2784,42 @@ ebiptablesDisplayRuleInstance(void *_inst)
 }
 
 
+static int
+ebiptablesRunCLI(virBufferPtr buf, bool exclusive,
+                 int *status, char **outbuf)
+{
+    int rc = -1;
+    virCommandPtr cmd;
+
+    if (status)
+         *status = 0;
+
+    if (!virBufferError(buf) && !virBufferUse(buf))
+        return 0;
+
+    if (outbuf)
+        VIR_FREE(*outbuf);
+
+    cmd = virCommandNewArgList("/bin/sh", "-c", NULL);
+    virCommandAddArgBuffer(cmd, buf);
+    if (outbuf)
+        virCommandSetOutputBuffer(cmd, outbuf);
+
+    if (exclusive || !execCLIConcurrent)
+        virRWLockWrite(&execCLILock);
+    else
+        virRWLockRead(&execCLILock);
+
+    rc = virCommandRun(cmd, status);
+
+    virRWLockUnlock(&execCLILock);
+
+    virCommandFree(cmd);
+
+    return rc;
+}
+
+
 /**
  * ebiptablesExecCLI:
  * @buf : pointer to virBuffer containing the string with the commands to
@@ -2788,38 +2837,164 @@ ebiptablesDisplayRuleInstance(void *_inst)
  *
  * Execute a sequence of commands (held in the given buffer) as a /bin/sh
  * script and return the status of the execution in *status (if status is
- * NULL, then the script must exit with status 0).
+ * NULL, then the script must exit with status 0). The commands must only
+ * modify the chains of a single interface; scripts of other interfaces
+ * may run concurrently.
  */
 static int
 ebiptablesExecCLI(virBufferPtr buf,
                   int *status, char **outbuf)
 {
-    int rc = -1;
-    virCommandPtr cmd;
+    return ebiptablesRunCLI(buf, false, status, outbuf);
+}
 
-    if (status)
-         *status = 0;
 
-    if (!virBufferError(buf) && !virBufferUse(buf))
-        return 0;
+/**
+ * ebiptablesExecCLIExclusive:
+ *
+ * Like ebiptablesExecCLI, but for scripts modifying chains shared by
+ * all interfaces; no other script runs at the same time.
+ */
+static int
+ebiptablesExecCLIExclusive(virBufferPtr buf,
+                           int *status, char **outbuf)
+{
+    return ebiptablesRunCLI(buf, true, status, outbuf);
+}
 
-    if (outbuf)
-        VIR_FREE(*outbuf);
 
-    cmd = virCommandNewArgList("/bin/sh", "-c", NULL);
-    virCommandAddArgBuffer(cmd, buf);
-    if (outbuf)
-        virCommandSetOutputBuffer(cmd, outbuf);
+/**
+ * iptablesCompileRules:
+ * @buf: buffer receiving the iptables-restore input
+ * @nruleInstances: number of rule instances
+ * @inst: the rule instances
+ * @ruleType: RT_IPTABLES or RT_IP6TABLES
+ *
+ * Translate the command templates of all rule instances of the given
+ * type into the input for a single 'iptables-restore --noflush' run
+ * appending the rules to the filter table.
+ *
+ * Returns 0 on success, -1 if a rule needs the shell (e.g., because it
+ * references a shell variable) and has to be applied via a script.
+ */
+int
+iptablesCompileRules(virBufferPtr buf,
+                     int nruleInstances,
+                     ebiptablesRuleInstPtr *inst,
+                     enum RuleType ruleType)
+{
+    virBuffer cmd = VIR_BUFFER_INITIALIZER;
+    char *s = NULL;
+    const char *start, *end;
+    int i;
+    int ret = -1;
 
-    virMutexLock(&execCLIMutex);
+    virBufferAddLit(buf, "*filter\n");
 
-    rc = virCommandRun(cmd, status);
+    for (i = 0; i < nruleInstances; i++) {
+        if (inst[i]->ruleType != ruleType)
+            continue;
 
-    virMutexUnlock(&execCLIMutex);
+        virBufferAsprintf(&cmd, inst[i]->commandTemplate, 'A', "");
+        if (virBufferError(&cmd))
+            goto cleanup;
+        s = virBufferContentAndReset(&cmd);
 
+        if (!(start = STRSKIP(s, CMD_DEF_PRE "$IPT ")) ||
+            !(end = strchr(start, '\'')) ||
+            STRNEQ(end, CMD_DEF_POST CMD_SEPARATOR CMD_EXEC) ||
+            strcspn(start, "$`\\\n") < (size_t)(end - start))
+            goto cleanup;
+
+        virBufferAdd(buf, start, end - start);
+        virBufferAddLit(buf, "\n");
+        VIR_FREE(s);
+    }
+
+    virBufferAddLit(buf, "COMMIT\n");
+
+    if (virBufferError(buf))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(s);
+    virBufferFreeAndReset(&cmd);
+
+    return ret;
+}
+
+
+/**
+ * iptablesRestoreRules:
+ * @restore_cmd_path: path to iptables-restore or ip6tables-restore
+ * @wait: whether the tool supports --wait
+ * @nruleInstances: number of rule instances
+ * @inst: the rule instances
+ * @ruleType: RT_IPTABLES or RT_IP6TABLES
+ *
+ * Append all rules of the given type to the (temporary) chains of an
+ * interface with a single iptables-restore run instead of spawning one
+ * iptables process per rule.
+ *
+ * Returns 0 on success, -1 if the rules could not be restored and the
+ * caller has to fall back to applying them via a script.
+ */
+static int
+iptablesRestoreRules(const char *restore_cmd_path,
+                     bool wait,
+                     int nruleInstances,
+                     ebiptablesRuleInstPtr *inst,
+                     enum RuleType ruleType)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virCommandPtr cmd = NULL;
+    char *input = NULL;
+    int status;
+    int rc;
+    int ret = -1;
+
+    if (!restore_cmd_path)
+        return -1;
+
+    if (iptablesCompileRules(&buf, nruleInstances, inst, ruleType) < 0) {
+        virBufferFreeAndReset(&buf);
+        return -1;
+    }
+
+    input = virBufferContentAndReset(&buf);
+
+    cmd = virCommandNewArgList(restore_cmd_path, "--noflush", NULL);
+    if (wait)
+        virCommandAddArg(cmd, "--wait");
+    virCommandSetInputBuffer(cmd, input);
+
+    /* iptables-restore replaces the whole table; it may only run
+       alongside other tools if they all hold the xtables lock */
+    if (wait && execCLIConcurrent)
+        virRWLockRead(&execCLILock);
+    else
+        virRWLockWrite(&execCLILock);
+
+    rc = virCommandRun(cmd, &status);
+
+    virRWLockUnlock(&execCLILock);
+
+    if (rc < 0 || status != 0) {
+        VIR_DEBUG("%s failed, applying the rules one by one",
+                  restore_cmd_path);
+        virResetLastError();
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
     virCommandFree(cmd);
+    VIR_FREE(input);
 
-    return rc;
+    return ret;
 }
 
 
@@ -3803,36 +3978,34 @@ ebiptablesApplyNewRules(const char *ifname,
 
         iptablesCreateBaseChains(&buf);
 
-        if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
+        if (ebiptablesExecCLIExclusive(&buf, NULL, &errmsg) < 0)
             goto tear_down_tmpebchains;
 
         NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
 
         iptablesCreateTmpRootChains(&buf, ifname);
-
-        if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
-           goto tear_down_tmpiptchains;
-
-        NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
-
         iptablesLinkTmpRootChains(&buf, ifname);
         iptablesSetupVirtInPost(&buf, ifname);
         if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
            goto tear_down_tmpiptchains;
 
-        NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
+        if (iptablesRestoreRules(iptables_restore_cmd_path,
+                                 iptables_restore_wait,
+                                 nruleInstances, inst, RT_IPTABLES) < 0) {
+            NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
+
+            for (i = 0; i < nruleInstances; i++) {
+                sa_assert(inst);
+                if (inst[i]->ruleType == RT_IPTABLES)
+                    iptablesInstCommand(&buf,
+                                        inst[i]->commandTemplate,
+                                        'A', -1, 1);
+            }
 
-        for (i = 0; i < nruleInstances; i++) {
-            sa_assert(inst);
-            if (inst[i]->ruleType == RT_IPTABLES)
-                iptablesInstCommand(&buf,
-                                    inst[i]->commandTemplate,
-                                    'A', -1, 1);
+            if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
+               goto tear_down_tmpiptchains;
         }
 
-        if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
-           goto tear_down_tmpiptchains;
-
         iptablesCheckBridgeNFCallEnabled(false);
     }
 
@@ -3844,34 +4017,32 @@ ebiptablesApplyNewRules(const char *ifname,
 
         iptablesCreateBaseChains(&buf);
 
-        if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
+        if (ebiptablesExecCLIExclusive(&buf, NULL, &errmsg) < 0)
             goto tear_down_tmpiptchains;
 
         NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
 
         iptablesCreateTmpRootChains(&buf, ifname);
-
-        if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
-           goto tear_down_tmpip6tchains;
-
-        NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
-
         iptablesLinkTmpRootChains(&buf, ifname);
         iptablesSetupVirtInPost(&buf, ifname);
         if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
            goto tear_down_tmpip6tchains;
 
-        NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
+        if (iptablesRestoreRules(ip6tables_restore_cmd_path,
+                                 ip6tables_restore_wait,
+                                 nruleInstances, inst, RT_IP6TABLES) < 0) {
+            NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
 
-        for (i = 0; i < nruleInstances; i++) {
-            if (inst[i]->ruleType == RT_IP6TABLES)
-                iptablesInstCommand(&buf,
-                                    inst[i]->commandTemplate,
-                                    'A', -1, 1);
-        }
+            for (i = 0; i < nruleInstances; i++) {
+                if (inst[i]->ruleType == RT_IP6TABLES)
+                    iptablesInstCommand(&buf,
+                                        inst[i]->commandTemplate,
+                                        'A', -1, 1);
+            }
 
-        if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
-           goto tear_down_tmpip6tchains;
+            if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
+               goto tear_down_tmpip6tchains;
+        }
 
         iptablesCheckBridgeNFCallEnabled(true);
     }
@@ -4232,9 +4403,103 @@ ebiptablesDriverInitCLITools(void)
     if (!ip6tables_cmd_path)
         VIR_WARN("Could not find 'ip6tables' executable");
 
+    /* optional; rules are applied one by one without them */
+    iptables_restore_cmd_path = virFindFileInPath("iptables-restore");
+    ip6tables_restore_cmd_path = virFindFileInPath("ip6tables-restore");
+
     return 0;
 }
 
+/*
+ * ebiptablesDriverCLIAccepts
+ *
+ * Test whether the CLI tool succeeds when run with the given option
+ * and arguments.
+ */
+static bool
+ebiptablesDriverCLIAccepts(const char *cmd_path,
+                           const char *option,
+                           const char *args)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    int status;
+
+    virBufferAsprintf(&buf, "%s %s %s >/dev/null 2>&1\n",
+                      cmd_path, option, args);
+
+    if (ebiptablesExecCLI(&buf, &status, NULL) < 0 || status != 0) {
+        VIR_INFO("'%s' does not support '%s'", cmd_path, option);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * ebiptablesDriverProbeCLIOption
+ *
+ * Test whether the CLI tool accepts the given option and if so, have
+ * all its invocations use it.
+ */
+static bool
+ebiptablesDriverProbeCLIOption(char **cmd_path,
+                               const char *option,
+                               const char *args)
+{
+    char *path;
+
+    if (!*cmd_path)
+        return true;
+
+    if (!ebiptablesDriverCLIAccepts(*cmd_path, option, args))
+        return false;
+
+    if (virAsprintf(&path, "%s %s", *cmd_path, option) < 0) {
+        virReportOOMError();
+        return false;
+    }
+
+    VIR_FREE(*cmd_path);
+    *cmd_path = path;
+
+    return true;
+}
+
+/*
+ * ebiptablesDriverProbeCLILocking
+ *
+ * Check whether all CLI tools serialize access to the kernel tables
+ * themselves, in which case the scripts of different interfaces can run
+ * concurrently. The restore tools are checked separately; the ones
+ * that can't wait for the lock still run exclusively.
+ */
+static bool
+ebiptablesDriverProbeCLILocking(void)
+{
+    bool ebtLocking, iptLocking, ip6tLocking;
+
+    if (iptables_restore_cmd_path)
+        iptables_restore_wait =
+            ebiptablesDriverCLIAccepts(iptables_restore_cmd_path, "--wait",
+                                       "--noflush --test </dev/null");
+    if (ip6tables_restore_cmd_path)
+        ip6tables_restore_wait =
+            ebiptablesDriverCLIAccepts(ip6tables_restore_cmd_path, "--wait",
+                                       "--noflush --test </dev/null");
+
+    ebtLocking = ebiptablesDriverProbeCLIOption(&ebtables_cmd_path,
+                                                "--concurrent",
+                                                "-t nat -L");
+    iptLocking = ebiptablesDriverProbeCLIOption(&iptables_cmd_path,
+                                                "-w",
+                                                "-n -L FORWARD");
+    ip6tLocking = ebiptablesDriverProbeCLIOption(&ip6tables_cmd_path,
+                                                 "-w",
+                                                 "-n -L FORWARD");
+
+    return ebtLocking && iptLocking && ip6tLocking;
+}
+
 /*
  * ebiptablesDriverTestCLITools
  *
@@ -4307,10 +4572,12 @@ ebiptablesDriverTestCLITools(void)
 static int
 ebiptablesDriverInit(bool privileged)
 {
+    bool firewalld = true;
+
     if (!privileged)
         return 0;
 
-    if (virMutexInit(&execCLIMutex) < 0)
+    if (virRWLockInit(&execCLILock) < 0)
         return -EINVAL;
 
     grep_cmd_path = virFindFileInPath("grep");
@@ -4320,12 +4587,19 @@ ebiptablesDriverInit(bool privileged)
      * if not, we just fall back to eb/iptables command
      * line tools.
      */
-    if (ebiptablesDriverInitWithFirewallD() < 0)
+    if (ebiptablesDriverInitWithFirewallD() < 0) {
         ebiptablesDriverInitCLITools();
+        firewalld = false;
+    }
 
     /* make sure tools are available and work */
     ebiptablesDriverTestCLITools();
 
+    /* firewalld serializes the passthrough commands itself */
+    execCLIConcurrent = firewalld || ebiptablesDriverProbeCLILocking();
+    VIR_INFO("firewall scripts of different interfaces %s run concurrently",
+             execCLIConcurrent ? "will" : "will not");
+
     /* ip(6)tables support needs awk & grep, ebtables doesn't */
     if ((iptables_cmd_path != NULL || ip6tables_cmd_path != NULL) &&
         !grep_cmd_path) {
@@ -4354,5 +4628,10 @@ ebiptablesDriverShutdown(void)
     VIR_FREE(ebtables_cmd_path);
     VIR_FREE(iptables_cmd_path);
     VIR_FREE(ip6tables_cmd_path);
+    VIR_FREE(iptables_restore_cmd_path);
+    VIR_FREE(ip6tables_restore_cmd_path);
+    iptables_restore_wait = false;
+    ip6tables_restore_wait = false;
+    execCLIConcurrent = false;
     ebiptables_driver.flags = 0;
 }
@@ -23,6 +23,8 @@
 #ifndef VIR_NWFILTER_EBTABLES_DRIVER_H__
 # define VIR_NWFILTER_EBTABLES_DRIVER_H__
 
+# include "virbuffer.h"
+
 # define MAX_CHAINNAME_LENGTH  32 /* see linux/netfilter_bridge/ebtables.h */
 
 enum RuleType {
@@ -44,6 +46,11 @@ struct _ebiptablesRuleInst {
 
 extern virNWFilterTechDriver ebiptables_driver;
 
+int iptablesCompileRules(virBufferPtr buf,
+                         int nruleInstances,
+                         ebiptablesRuleInstPtr *inst,
+                         enum RuleType ruleType);
+
 # define EBIPTABLES_DRIVER_ID "ebiptables"
 
 # define IPTABLES_MAX_COMMENT_LENGTH  256
@@ -38,6 +38,8 @@
 #include "virbitmap.h"
 #include "virnodesuspend.h"
 #include "qemu_monitor.h"
+#include "virxml.h"
+#include "sha256.h"
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -219,6 +221,7 @@ struct _virQEMUCaps {
 
     char *binary;
     time_t mtime;
+    off_t size;
 
     virBitmapPtr flags;
 
@@ -239,6 +242,7 @@ struct _virQEMUCapsCache {
     virMutex lock;
     virHashTablePtr binaries;
     char *libDir;
+    char *cacheDir;
     char *runDir;
     uid_t runUid;
     gid_t runGid;
@@ -2506,6 +2510,7 @@ virQEMUCapsPtr virQEMUCapsNewForBinary(const char *binary,
         goto error;
     }
     qemuCaps->mtime = sb.st_mtime;
+    qemuCaps->size = sb.st_size;
 
     /* Make sure the binary we are about to try exec'ing exists.
      * Technically we could catch the exec() failure, but that's
@@ -2545,7 +2550,406 @@ bool virQEMUCapsIsValid(virQEMUCapsPtr qemuCaps)
     if (stat(qemuCaps->binary, &sb) < 0)
         return false;
 
-    return sb.st_mtime == qemuCaps->mtime;
+    return sb.st_mtime == qemuCaps->mtime &&
+        sb.st_size == qemuCaps->size;
+}
+
+
+/*
+ * Parsing a doc that looks like
+ *
+ * <qemuCaps version='1'>
+ *   <binary path='/usr/bin/qemu-kvm' mtime='1360000000' size='4096000'/>
+ *   <libvirtVersion>1000002</libvirtVersion>
+ *   <usedQMP/>
+ *   <flag name='foo'/>
+ *   <flag name='bar'/>
+ *   ...
+ *   <version>1002000</version>
+ *   <kvmVersion>0</kvmVersion>
+ *   <arch>x86_64</arch>
+ *   <cpu name='pentium3'/>
+ *   ...
+ *   <machine name='pc-1.0' alias='pc'/>
+ *   ...
+ * </qemuCaps>
+ *
+ * The binary key and libvirt version are returned to the caller, which
+ * decides whether the data is still usable for the binary on disk.
+ */
+static int
+virQEMUCapsParseCacheCtxt(virQEMUCapsPtr qemuCaps,
+                          xmlXPathContextPtr ctxt,
+                          unsigned long *libvirtVersion)
+{
+    xmlNodePtr *nodes = NULL;
+    char *str = NULL;
+    long long mtime;
+    unsigned long long size;
+    unsigned int version;
+    int n;
+    size_t i;
+    int ret = -1;
+
+    if (!xmlStrEqual(ctxt->node->name, BAD_CAST "qemuCaps")) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("unexpected root element <%s>, "
+                         "expecting <qemuCaps>"),
+                       ctxt->node->name);
+        goto cleanup;
+    }
+
+    if (virXPathUInt("string(./@version)", ctxt, &version) < 0 ||
+        version != QEMU_CAPS_CACHE_VERSION) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing or unsupported qemu capabilities "
+                         "cache version"));
+        goto cleanup;
+    }
+
+    if ((qemuCaps->binary = virXPathString("string(./binary/@path)", ctxt))) {
+        if (virXPathLongLong("string(./binary/@mtime)", ctxt, &mtime) < 0 ||
+            virXPathULongLong("string(./binary/@size)", ctxt, &size) < 0) {
+            virReportError(VIR_ERR_XML_ERROR, "%s",
+                           _("missing binary timestamp or size in qemu "
+                             "capabilities cache"));
+            goto cleanup;
+        }
+        qemuCaps->mtime = mtime;
+        qemuCaps->size = size;
+    }
+
+    if (virXPathULong("string(./libvirtVersion)", ctxt, libvirtVersion) < 0) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing libvirt version in qemu capabilities "
+                         "cache"));
+        goto cleanup;
+    }
+
+    qemuCaps->usedQMP = virXPathBoolean("count(./usedQMP) > 0", ctxt) > 0;
+
+    if ((n = virXPathNodeSet("./flag", ctxt, &nodes)) < 0)
+        goto cleanup;
+    for (i = 0 ; i < n ; i++) {
+        int flag;
+
+        if (!(str = virXMLPropString(nodes[i], "name"))) {
+            virReportError(VIR_ERR_XML_ERROR, "%s",
+                           _("missing flag name in qemu capabilities cache"));
+            goto cleanup;
+        }
+        if ((flag = virQEMUCapsTypeFromString(str)) < 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("unknown qemu capabilities flag %s"), str);
+            goto cleanup;
+        }
+        VIR_FREE(str);
+        virQEMUCapsSet(qemuCaps, flag);
+    }
+    VIR_FREE(nodes);
+
+    if (virXPathUInt("string(./version)", ctxt, &qemuCaps->version) < 0) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing version in qemu capabilities cache"));
+        goto cleanup;
+    }
+
+    if (virXPathUInt("string(./kvmVersion)", ctxt, &qemuCaps->kvmVersion) < 0) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing kvmVersion in qemu capabilities cache"));
+        goto cleanup;
+    }
+
+    if ((str = virXPathString("string(./arch)", ctxt)) &&
+        (qemuCaps->arch = virArchFromString(str)) == VIR_ARCH_NONE) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("unknown arch %s in qemu capabilities cache"), str);
+        goto cleanup;
+    }
+    VIR_FREE(str);
+
+    if ((n = virXPathNodeSet("./cpu", ctxt, &nodes)) < 0)
+        goto cleanup;
+    if (n > 0) {
+        if (VIR_ALLOC_N(qemuCaps->cpuDefinitions, n) < 0)
+            goto no_memory;
+        qemuCaps->ncpuDefinitions = n;
+
+        for (i = 0 ; i < n ; i++) {
+            if (!(qemuCaps->cpuDefinitions[i] = virXMLPropString(nodes[i],
+                                                                 "name"))) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("missing cpu name in qemu capabilities "
+                                 "cache"));
+                goto cleanup;
+            }
+        }
+    }
+    VIR_FREE(nodes);
+
+    if ((n = virXPathNodeSet("./machine", ctxt, &nodes)) < 0)
+        goto cleanup;
+    if (n > 0) {
+        if (VIR_ALLOC_N(qemuCaps->machineTypes, n) < 0 ||
+            VIR_ALLOC_N(qemuCaps->machineAliases, n) < 0)
+            goto no_memory;
+        qemuCaps->nmachineTypes = n;
+
+        for (i = 0 ; i < n ; i++) {
+            if (!(qemuCaps->machineTypes[i] = virXMLPropString(nodes[i],
+                                                               "name"))) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("missing machine name in qemu "
+                                 "capabilities cache"));
+                goto cleanup;
+            }
+            qemuCaps->machineAliases[i] = virXMLPropString(nodes[i], "alias");
+        }
+    }
+
+    ret = 0;
+cleanup:
+    VIR_FREE(str);
+    VIR_FREE(nodes);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
+
+/* Only for use by test suite */
+int
+virQEMUCapsParseCacheString(virQEMUCapsPtr qemuCaps,
+                            const char *xml,
+                            unsigned long *libvirtVersion)
+{
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt = NULL;
+    int ret = -1;
+
+    if (!(doc = virXMLParseStringCtxt(xml, _("(qemu_capabilities)"), &ctxt)))
+        return -1;
+
+    ret = virQEMUCapsParseCacheCtxt(qemuCaps, ctxt, libvirtVersion);
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+    return ret;
+}
+
+
+char *
+virQEMUCapsFormatCache(virQEMUCapsPtr qemuCaps)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAsprintf(&buf, "<qemuCaps version='%d'>\n",
+                      QEMU_CAPS_CACHE_VERSION);
+
+    if (qemuCaps->binary) {
+        virBufferEscapeString(&buf, "  <binary path='%s'",
+                              qemuCaps->binary);
+        virBufferAsprintf(&buf, " mtime='%lld' size='%llu'/>\n",
+                          (long long)qemuCaps->mtime,
+                          (unsigned long long)qemuCaps->size);
+    }
+    virBufferAsprintf(&buf, "  <libvirtVersion>%lu</libvirtVersion>\n",
+                      (unsigned long)LIBVIR_VERSION_NUMBER);
+
+    if (qemuCaps->usedQMP)
+        virBufferAddLit(&buf, "  <usedQMP/>\n");
+
+    for (i = 0 ; i < QEMU_CAPS_LAST ; i++) {
+        if (virQEMUCapsGet(qemuCaps, i)) {
+            virBufferAsprintf(&buf, "  <flag name='%s'/>\n",
+                              virQEMUCapsTypeToString(i));
+        }
+    }
+
+    virBufferAsprintf(&buf, "  <version>%u</version>\n",
+                      qemuCaps->version);
+    virBufferAsprintf(&buf, "  <kvmVersion>%u</kvmVersion>\n",
+                      qemuCaps->kvmVersion);
+    if (qemuCaps->arch != VIR_ARCH_NONE)
+        virBufferAsprintf(&buf, "  <arch>%s</arch>\n",
+                          virArchToString(qemuCaps->arch));
+
+    for (i = 0 ; i < qemuCaps->ncpuDefinitions ; i++) {
+        virBufferEscapeString(&buf, "  <cpu name='%s'/>\n",
+                              qemuCaps->cpuDefinitions[i]);
+    }
+
+    for (i = 0 ; i < qemuCaps->nmachineTypes ; i++) {
+        virBufferEscapeString(&buf, "  <machine name='%s'",
+                              qemuCaps->machineTypes[i]);
+        if (qemuCaps->machineAliases[i])
+            virBufferEscapeString(&buf, " alias='%s'",
+                                  qemuCaps->machineAliases[i]);
+        virBufferAddLit(&buf, "/>\n");
+    }
+
+    virBufferAddLit(&buf, "</qemuCaps>\n");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static const char hex[] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                            '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+
+/*
+ * The cache file name is derived from a hash of the binary path,
+ * so that any emulator path maps to a flat, fixed length name
+ */
+static char *
+virQEMUCapsCacheFileName(virQEMUCapsCachePtr cache,
+                         const char *binary)
+{
+    unsigned char buf[SHA256_DIGEST_SIZE];
+    char digest[(SHA256_DIGEST_SIZE * 2) + 1];
+    char *ret;
+    size_t i;
+
+    if (!(sha256_buffer(binary, strlen(binary), buf))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to compute sha256 checksum"));
+        return NULL;
+    }
+
+    for (i = 0 ; i < SHA256_DIGEST_SIZE ; i++) {
+        digest[i*2] = hex[(buf[i] >> 4) & 0xf];
+        digest[(i*2)+1] = hex[buf[i] & 0xf];
+    }
+    digest[SHA256_DIGEST_SIZE * 2] = '\0';
+
+    if (virAsprintf(&ret, "%s/%s.xml", cache->cacheDir, digest) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Try to load capabilities for @binary from the on-disk cache.
+ * A cache file is only used if the binary path, modification time
+ * and size all match the binary currently on disk, and it was
+ * written by the same libvirt version. Any problem with the cache
+ * file is not fatal, it merely causes the binary to be probed again.
+ *
+ * Returns the capabilities, or NULL if there is no usable cache file
+ */
+static virQEMUCapsPtr
+virQEMUCapsCacheLoad(virQEMUCapsCachePtr cache,
+                     const char *binary)
+{
+    virQEMUCapsPtr qemuCaps = NULL;
+    xmlDocPtr doc = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    char *filename = NULL;
+    unsigned long libvirtVersion;
+    struct stat sb;
+    virErrorPtr err;
+
+    if (!cache->cacheDir)
+        return NULL;
+
+    if (!(filename = virQEMUCapsCacheFileName(cache, binary)))
+        goto error;
+
+    if (!virFileExists(filename)) {
+        VIR_DEBUG("No cached capabilities '%s' for '%s'", filename, binary);
+        goto cleanup;
+    }
+
+    if (stat(binary, &sb) < 0) {
+        VIR_DEBUG("Cannot stat %s, ignoring cached capabilities", binary);
+        goto discard;
+    }
+
+    if (!(doc = virXMLParseFileCtxt(filename, &ctxt)))
+        goto error;
+
+    if (!(qemuCaps = virQEMUCapsNew()))
+        goto error;
+
+    if (virQEMUCapsParseCacheCtxt(qemuCaps, ctxt, &libvirtVersion) < 0)
+        goto error;
+
+    if (STRNEQ_NULLABLE(qemuCaps->binary, binary) ||
+        qemuCaps->mtime != sb.st_mtime ||
+        qemuCaps->size != sb.st_size ||
+        libvirtVersion != LIBVIR_VERSION_NUMBER) {
+        VIR_DEBUG("Outdated cached capabilities '%s' for '%s'",
+                  filename, binary);
+        goto discard;
+    }
+
+    VIR_DEBUG("Loaded cached capabilities %p for '%s' from '%s'",
+              qemuCaps, binary, filename);
+
+cleanup:
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+    VIR_FREE(filename);
+    return qemuCaps;
+
+error:
+    err = virGetLastError();
+    VIR_WARN("Failed to load cached capabilities '%s' for '%s': %s",
+             NULLSTR(filename), binary,
+             err ? err->message : "<unknown problem>");
+    virResetLastError();
+discard:
+    if (filename)
+        unlink(filename);
+    virObjectUnref(qemuCaps);
+    qemuCaps = NULL;
+    goto cleanup;
+}
+
+
+/*
+ * Store freshly probed capabilities in the on-disk cache. Failure
+ * is only logged, since the in-memory copy is still valid.
+ */
+static void
+virQEMUCapsCacheSave(virQEMUCapsCachePtr cache,
+                     virQEMUCapsPtr qemuCaps)
+{
+    char *filename = NULL;
+    char *xml = NULL;
+
+    if (!cache->cacheDir)
+        return;
+
+    if (!(filename = virQEMUCapsCacheFileName(cache, qemuCaps->binary)) ||
+        !(xml = virQEMUCapsFormatCache(qemuCaps)) ||
+        virXMLSaveFile(filename, NULL, NULL, xml) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Failed to save cached capabilities for '%s': %s",
+                 qemuCaps->binary,
+                 err ? err->message : "<unknown problem>");
+        virResetLastError();
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Saved cached capabilities %p for '%s' to '%s'",
+              qemuCaps, qemuCaps->binary, filename);
+
+cleanup:
+    VIR_FREE(filename);
+    VIR_FREE(xml);
 }
 
 
@@ -2558,6 +2962,7 @@ virQEMUCapsHashDataFree(void *payload, const void *key ATTRIBUTE_UNUSED)
 
 virQEMUCapsCachePtr
 virQEMUCapsCacheNew(const char *libDir,
+                    const char *cacheDir,
                     uid_t runUid,
                     gid_t runGid)
 {
@@ -2582,6 +2987,19 @@ virQEMUCapsCacheNew(const char *libDir,
         goto error;
     }
 
+    if (cacheDir) {
+        if (virAsprintf(&cache->cacheDir, "%s/capabilities", cacheDir) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        if (virFileMakePath(cache->cacheDir) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to create cache directory '%s'"),
+                                 cache->cacheDir);
+            goto error;
+        }
+    }
+
     cache->runUid = runUid;
     cache->runGid = runGid;
 
@@ -2606,12 +3024,22 @@ virQEMUCapsCacheLookup(virQEMUCapsCachePtr cache, const char *binary)
         virHashRemoveEntry(cache->binaries, binary);
         ret = NULL;
     }
+    if (!ret &&
+        (ret = virQEMUCapsCacheLoad(cache, binary))) {
+        VIR_DEBUG("Caching loaded capabilities %p for %s",
+                  ret, binary);
+        if (virHashAddEntry(cache->binaries, binary, ret) < 0) {
+            virObjectUnref(ret);
+            ret = NULL;
+        }
+    }
     if (!ret) {
         VIR_DEBUG("Creating capabilities for %s",
                   binary);
         ret = virQEMUCapsNewForBinary(binary, cache->libDir,
                                       cache->runUid, cache->runGid);
         if (ret) {
+            virQEMUCapsCacheSave(cache, ret);
             VIR_DEBUG("Caching capabilities %p for %s",
                       ret, binary);
             if (virHashAddEntry(cache->binaries, binary, ret) < 0) {
@@ -2649,6 +3077,7 @@ virQEMUCapsCacheFree(virQEMUCapsCachePtr cache)
         return;
 
     VIR_FREE(cache->libDir);
+    VIR_FREE(cache->cacheDir);
     virHashFree(cache->binaries);
     virMutexDestroy(&cache->lock);
     VIR_FREE(cache);
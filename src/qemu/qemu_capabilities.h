@@ -175,6 +175,9 @@ enum virQEMUCapsFlags {
     QEMU_CAPS_LAST,                   /* this must always be the last item */
 };
 
+/* Bump whenever the layout of the on-disk capabilities cache changes */
+# define QEMU_CAPS_CACHE_VERSION 1
+
 typedef struct _virQEMUCaps virQEMUCaps;
 typedef virQEMUCaps *virQEMUCapsPtr;
 
@@ -223,8 +226,11 @@ int virQEMUCapsGetMachineTypesCaps(virQEMUCapsPtr qemuCaps,
 
 bool virQEMUCapsIsValid(virQEMUCapsPtr qemuCaps);
 
+char *virQEMUCapsFormatCache(virQEMUCapsPtr qemuCaps);
+
 
 virQEMUCapsCachePtr virQEMUCapsCacheNew(const char *libDir,
+                                        const char *cacheDir,
                                         uid_t uid, gid_t gid);
 virQEMUCapsPtr virQEMUCapsCacheLookup(virQEMUCapsCachePtr cache,
                                       const char *binary);
@@ -248,6 +254,10 @@ int virQEMUCapsParseHelpStr(const char *qemu,
                             bool check_yajl);
 /* Only for use by test suite */
 int virQEMUCapsParseDeviceStr(virQEMUCapsPtr qemuCaps, const char *str);
+/* Only for use by test suite */
+int virQEMUCapsParseCacheString(virQEMUCapsPtr qemuCaps,
+                                const char *xml,
+                                unsigned long *libvirtVersion);
 
 VIR_ENUM_DECL(virQEMUCaps);
 
@@ -578,7 +578,10 @@ qemuStartup(bool privileged,
         goto error;
 
     /* Init domain events */
-    qemu_driver->domainEventState = virDomainEventStateNew();
+    /* events are relayed to remote clients, which is safe from any thread */
+    qemu_driver->domainEventState =
+        virDomainEventStateNewFull(VIR_DOMAIN_EVENT_STATE_ASYNC |
+                                   VIR_DOMAIN_EVENT_STATE_COALESCE);
     if (!qemu_driver->domainEventState)
         goto error;
 
@@ -714,6 +717,7 @@ qemuStartup(bool privileged,
     }
 
     qemu_driver->qemuCapsCache = virQEMUCapsCacheNew(cfg->libDir,
+                                                     cfg->cacheDir,
                                                      run_uid,
                                                      run_gid);
     if (!qemu_driver->qemuCapsCache)
@@ -2436,6 +2440,8 @@ typedef enum {
      */
     QEMU_SAVE_FORMAT_XZ = 3,
     QEMU_SAVE_FORMAT_LZOP = 4,
+    /* Independently compressed chunks, handled by libvirt_iohelper */
+    QEMU_SAVE_FORMAT_PARALLEL = 5,
     /* Note: add new members only at the end.
        These values are used in the on-disk format.
        Do not change or re-use numbers. */
@@ -2449,7 +2455,8 @@ VIR_ENUM_IMPL(qemuSaveCompression, QEMU_SAVE_FORMAT_LAST,
               "gzip",
               "bzip2",
               "xz",
-              "lzop")
+              "lzop",
+              "parallel")
 
 typedef struct _virQEMUSaveHeader virQEMUSaveHeader;
 typedef virQEMUSaveHeader *virQEMUSaveHeaderPtr;
@@ -2501,15 +2508,21 @@ endjob:
 static const char *
 qemuCompressProgramName(int compress)
 {
-    return (compress == QEMU_SAVE_FORMAT_RAW ? NULL :
-            qemuSaveCompressionTypeToString(compress));
+    switch (compress) {
+    case QEMU_SAVE_FORMAT_RAW:
+        return NULL;
+    case QEMU_SAVE_FORMAT_PARALLEL:
+        return LIBEXECDIR "/libvirt_iohelper";
+    default:
+        return qemuSaveCompressionTypeToString(compress);
+    }
 }
 
 static virCommandPtr
 qemuCompressGetCommand(virQEMUSaveFormat compression)
 {
     virCommandPtr ret = NULL;
-    const char *prog = qemuSaveCompressionTypeToString(compression);
+    const char *prog = qemuCompressProgramName(compression);
 
     if (!prog) {
         virReportError(VIR_ERR_OPERATION_FAILED,
@@ -2905,7 +2918,11 @@ static bool qemuCompressProgramAvailable(virQEMUSaveFormat compress)
 
     if (compress == QEMU_SAVE_FORMAT_RAW)
         return true;
-    prog = qemuSaveCompressionTypeToString(compress);
+#if !WITH_ZLIB
+    if (compress == QEMU_SAVE_FORMAT_PARALLEL)
+        return false;
+#endif
+    prog = qemuCompressProgramName(compress);
     c = virFindFileInPath(prog);
     if (!c)
         return false;
@@ -4322,6 +4339,22 @@ cleanup:
     return ret;
 }
 
+/* The vCPUs only run while the whole domain does */
+static int
+qemuDomainGetVcpuState(virDomainObjPtr vm)
+{
+    switch ((virDomainState) virDomainObjGetState(vm, NULL)) {
+    case VIR_DOMAIN_RUNNING:
+        return VIR_VCPU_RUNNING;
+    case VIR_DOMAIN_BLOCKED:
+    case VIR_DOMAIN_PAUSED:
+    case VIR_DOMAIN_PMSUSPENDED:
+        return VIR_VCPU_BLOCKED;
+    default:
+        return VIR_VCPU_OFFLINE;
+    }
+}
+
 static int
 qemuDomainGetVcpus(virDomainPtr dom,
                    virVcpuInfoPtr info,
@@ -4361,7 +4394,7 @@ qemuDomainGetVcpus(virDomainPtr dom,
             memset(info, 0, sizeof(*info) * maxinfo);
             for (i = 0 ; i < maxinfo ; i++) {
                 info[i].number = i;
-                info[i].state = VIR_VCPU_RUNNING;
+                info[i].state = qemuDomainGetVcpuState(vm);
 
                 if (priv->vcpupids != NULL &&
                     qemuGetProcessInfo(&(info[i].cpuTime),
@@ -14943,6 +14976,528 @@ cleanup:
     return ret;
 }
 
+
+enum qemuDomainStatsFlags {
+    QEMU_DOMAIN_STATS_HAVE_JOB = (1 << 0), /* job is entered, monitor can be
+                                              accessed */
+};
+
+#define QEMU_ADD_PARAM(type, record, maxparams, name, value)               \
+    do {                                                                   \
+        if (virTypedParamsAdd ## type(&(record)->params,                   \
+                                      &(record)->nparams,                  \
+                                      maxparams,                           \
+                                      name,                                \
+                                      value) < 0)                          \
+            return -1;                                                     \
+    } while (0)
+
+#define QEMU_ADD_INDEXED_PARAM(type, record, maxparams, group, num, name,  \
+                               value)                                      \
+    do {                                                                   \
+        char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];                     \
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,                 \
+                 "%s.%d.%s", group, num, name);                            \
+        QEMU_ADD_PARAM(type, record, maxparams, param_name, value);        \
+    } while (0)
+
+static int
+qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr dom,
+                        virDomainStatsRecordPtr record,
+                        int *maxparams,
+                        unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    int state;
+    int reason;
+
+    state = virDomainObjGetState(dom, &reason);
+
+    QEMU_ADD_PARAM(Int, record, maxparams, "state.state", state);
+    QEMU_ADD_PARAM(Int, record, maxparams, "state.reason", reason);
+
+    return 0;
+}
+
+/* Read from the cgroup, so no job is needed */
+static int
+qemuDomainGetStatsCpu(virQEMUDriverPtr driver,
+                      virDomainObjPtr dom,
+                      virDomainStatsRecordPtr record,
+                      int *maxparams,
+                      unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr group = NULL;
+    unsigned long long cpu_time;
+    unsigned long long user;
+    unsigned long long sys;
+    int ret = -1;
+
+    if (!virDomainObjIsActive(dom) ||
+        !qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPUACCT))
+        return 0;
+
+    /* Missing stats are left out rather than failing the whole query */
+    if (virCgroupForDomain(driver->cgroup, dom->def->name, &group, 0) != 0)
+        return 0;
+
+    if (virCgroupGetCpuacctUsage(group, &cpu_time) == 0 &&
+        virTypedParamsAddULLong(&record->params, &record->nparams,
+                                maxparams, "cpu.time", cpu_time) < 0)
+        goto cleanup;
+
+    if (virCgroupGetCpuacctStat(group, &user, &sys) == 0 &&
+        (virTypedParamsAddULLong(&record->params, &record->nparams,
+                                 maxparams, "cpu.user", user) < 0 ||
+         virTypedParamsAddULLong(&record->params, &record->nparams,
+                                 maxparams, "cpu.system", sys) < 0))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virCgroupFree(&group);
+    return ret;
+}
+
+static int
+qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          virDomainStatsRecordPtr record,
+                          int *maxparams,
+                          unsigned int privflags)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    unsigned long long cur_balloon = dom->def->mem.cur_balloon;
+    unsigned long long balloon;
+    int err;
+
+    if (dom->def->memballoon &&
+        dom->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_NONE) {
+        cur_balloon = dom->def->mem.max_balloon;
+    } else if ((privflags & QEMU_DOMAIN_STATS_HAVE_JOB) &&
+               virDomainObjIsActive(dom) &&
+               !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BALLOON_EVENT)) {
+        qemuDomainObjEnterMonitor(driver, dom);
+        err = qemuMonitorGetBalloonInfo(priv->mon, &balloon);
+        qemuDomainObjExitMonitor(driver, dom);
+
+        if (err < 0)
+            virResetLastError();
+        else if (err == 0)
+            cur_balloon = dom->def->mem.max_balloon;
+        else
+            cur_balloon = balloon;
+    }
+
+    QEMU_ADD_PARAM(ULLong, record, maxparams, "balloon.current", cur_balloon);
+    QEMU_ADD_PARAM(ULLong, record, maxparams, "balloon.maximum",
+                   dom->def->mem.max_balloon);
+
+    return 0;
+}
+
+/* Read from /proc, so no job is needed */
+static int
+qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                       virDomainObjPtr dom,
+                       virDomainStatsRecordPtr record,
+                       int *maxparams,
+                       unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    int i;
+
+    QEMU_ADD_PARAM(UInt, record, maxparams, "vcpu.current",
+                   (unsigned int) dom->def->vcpus);
+    QEMU_ADD_PARAM(UInt, record, maxparams, "vcpu.maximum",
+                   (unsigned int) dom->def->maxvcpus);
+
+    if (!virDomainObjIsActive(dom) || !priv->vcpupids)
+        return 0;
+
+    for (i = 0 ; i < priv->nvcpupids ; i++) {
+        unsigned long long cpuTime;
+
+        QEMU_ADD_INDEXED_PARAM(Int, record, maxparams, "vcpu", i, "state",
+                               qemuDomainGetVcpuState(dom));
+
+        if (qemuGetProcessInfo(&cpuTime, NULL, NULL,
+                               dom->pid, priv->vcpupids[i]) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "vcpu", i, "time",
+                               cpuTime);
+    }
+
+    return 0;
+}
+
+#ifdef __linux__
+/* Read from /proc, so no job is needed */
+static int
+qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                            virDomainObjPtr dom,
+                            virDomainStatsRecordPtr record,
+                            int *maxparams,
+                            unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    int i;
+    struct _virDomainInterfaceStats tmp;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    QEMU_ADD_PARAM(UInt, record, maxparams, "net.count",
+                   (unsigned int) dom->def->nnets);
+
+    for (i = 0 ; i < dom->def->nnets ; i++) {
+        virDomainNetDefPtr net = dom->def->nets[i];
+
+        if (!net->ifname)
+            continue;
+
+        QEMU_ADD_INDEXED_PARAM(String, record, maxparams, "net", i, "name",
+                               net->ifname);
+
+        if (linuxDomainInterfaceStats(net->ifname, &tmp) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "net", i,
+                               "rx.bytes", tmp.rx_bytes);
+        QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "net", i,
+                               "rx.pkts", tmp.rx_packets);
+        QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "net", i,
+                               "rx.errs", tmp.rx_errs);
+        QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "net", i,
+                               "rx.drop", tmp.rx_drop);
+        QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "net", i,
+                               "tx.bytes", tmp.tx_bytes);
+        QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "net", i,
+                               "tx.pkts", tmp.tx_packets);
+        QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "net", i,
+                               "tx.errs", tmp.tx_errs);
+        QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "net", i,
+                               "tx.drop", tmp.tx_drop);
+    }
+
+    return 0;
+}
+#endif
+
+/* Only a negative value means the statistic was not available */
+#define QEMU_ADD_BLOCK_PARAM(record, maxparams, num, name, value)          \
+    do {                                                                   \
+        if ((value) >= 0)                                                  \
+            QEMU_ADD_INDEXED_PARAM(ULLong, record, maxparams, "block",     \
+                                   num, name, value);                      \
+    } while (0)
+
+static int
+qemuDomainGetStatsOneBlock(virDomainStatsRecordPtr record,
+                           int *maxparams,
+                           int num,
+                           qemuBlockStatsPtr entry)
+{
+    QEMU_ADD_BLOCK_PARAM(record, maxparams, num, "rd.reqs", entry->rd_req);
+    QEMU_ADD_BLOCK_PARAM(record, maxparams, num, "rd.bytes", entry->rd_bytes);
+    QEMU_ADD_BLOCK_PARAM(record, maxparams, num, "rd.times",
+                         entry->rd_total_times);
+    QEMU_ADD_BLOCK_PARAM(record, maxparams, num, "wr.reqs", entry->wr_req);
+    QEMU_ADD_BLOCK_PARAM(record, maxparams, num, "wr.bytes", entry->wr_bytes);
+    QEMU_ADD_BLOCK_PARAM(record, maxparams, num, "wr.times",
+                         entry->wr_total_times);
+    QEMU_ADD_BLOCK_PARAM(record, maxparams, num, "fl.reqs", entry->flush_req);
+    QEMU_ADD_BLOCK_PARAM(record, maxparams, num, "fl.times",
+                         entry->flush_total_times);
+
+    return 0;
+}
+
+static int
+qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
+                        virDomainObjPtr dom,
+                        virDomainStatsRecordPtr record,
+                        int *maxparams,
+                        unsigned int privflags)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    virHashTablePtr stats = NULL;
+    int ret = -1;
+    int i;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    /* A single query-blockstats covers all the disks */
+    if (privflags & QEMU_DOMAIN_STATS_HAVE_JOB) {
+        qemuDomainObjEnterMonitor(driver, dom);
+        stats = qemuMonitorGetAllBlockStatsInfo(priv->mon);
+        qemuDomainObjExitMonitor(driver, dom);
+
+        if (!stats)
+            virResetLastError();
+    }
+
+    if (virTypedParamsAddUInt(&record->params, &record->nparams, maxparams,
+                              "block.count",
+                              (unsigned int) dom->def->ndisks) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < dom->def->ndisks ; i++) {
+        virDomainDiskDefPtr disk = dom->def->disks[i];
+        qemuBlockStatsPtr entry;
+        char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
+                 "block.%d.name", i);
+        if (virTypedParamsAddString(&record->params, &record->nparams,
+                                    maxparams, param_name, disk->dst) < 0)
+            goto cleanup;
+
+        if (!stats || !disk->info.alias ||
+            !(entry = virHashLookup(stats, disk->info.alias)))
+            continue;
+
+        if (qemuDomainGetStatsOneBlock(record, maxparams, i, entry) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virHashFree(stats);
+    return ret;
+}
+
+#undef QEMU_ADD_BLOCK_PARAM
+#undef QEMU_ADD_INDEXED_PARAM
+#undef QEMU_ADD_PARAM
+
+typedef int
+(*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          virDomainStatsRecordPtr record,
+                          int *maxparams,
+                          unsigned int flags);
+
+struct qemuDomainGetStatsWorker {
+    qemuDomainGetStatsFunc func;
+    unsigned int stats;
+    bool monitor;
+};
+
+static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
+    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false },
+    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false },
+    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true },
+    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, false },
+#ifdef __linux__
+    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
+#endif
+    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
+    { NULL, 0, false }
+};
+
+
+static int
+qemuDomainGetStatsCheckSupport(unsigned int *stats,
+                               bool enforce)
+{
+    unsigned int supportedstats = 0;
+    int i;
+
+    for (i = 0 ; qemuDomainGetStatsWorkers[i].func ; i++)
+        supportedstats |= qemuDomainGetStatsWorkers[i].stats;
+
+    if (*stats == 0) {
+        *stats = supportedstats;
+        return 0;
+    }
+
+    if (enforce &&
+        *stats & ~supportedstats) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Stats types bits 0x%x are not supported by this daemon"),
+                       *stats & ~supportedstats);
+        return -1;
+    }
+
+    *stats &= supportedstats;
+    return 0;
+}
+
+
+static bool
+qemuDomainGetStatsNeedMonitor(unsigned int stats)
+{
+    int i;
+
+    for (i = 0 ; qemuDomainGetStatsWorkers[i].func ; i++) {
+        if (stats & qemuDomainGetStatsWorkers[i].stats &&
+            qemuDomainGetStatsWorkers[i].monitor)
+            return true;
+    }
+
+    return false;
+}
+
+
+static int
+qemuDomainGetStats(virConnectPtr conn,
+                   virDomainObjPtr dom,
+                   unsigned int stats,
+                   virDomainStatsRecordPtr *record,
+                   unsigned int flags)
+{
+    int maxparams = 0;
+    virDomainStatsRecordPtr tmp;
+    int i;
+    int ret = -1;
+
+    if (VIR_ALLOC(tmp) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; qemuDomainGetStatsWorkers[i].func ; i++) {
+        if (stats & qemuDomainGetStatsWorkers[i].stats) {
+            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
+                                                  &maxparams, flags) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid)))
+        goto cleanup;
+    tmp->dom->id = dom->def->id;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+cleanup:
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        VIR_FREE(tmp);
+    }
+
+    return ret;
+}
+
+
+static int
+qemuConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virDomainPtr *domlist = NULL;
+    virDomainObjPtr dom = NULL;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
+    int ntempdoms = 0;
+    int nstats = 0;
+    int i;
+    int ret = -1;
+    unsigned int privflags = 0;
+
+    if (ndoms)
+        virCheckFlags(VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+    else
+        virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                      VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                      VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+
+    if (qemuDomainGetStatsCheckSupport(&stats, enforce) < 0)
+        return -1;
+
+    if (!ndoms) {
+        unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                                       VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                                       VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+
+        if ((ntempdoms = virDomainObjListExport(driver->domains, conn,
+                                                &domlist, lflags)) < 0)
+            goto cleanup;
+
+        ndoms = ntempdoms;
+        doms = domlist;
+    }
+
+    if (VIR_ALLOC_N(tmpstats, ndoms + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (qemuDomainGetStatsNeedMonitor(stats))
+        privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+
+    for (i = 0 ; i < ndoms ; i++) {
+        virDomainStatsRecordPtr tmp = NULL;
+        unsigned int domflags = privflags;
+
+        /* Domains which went away in the meantime are skipped */
+        if (!(dom = virDomainObjListFindByUUID(driver->domains,
+                                               doms[i]->uuid)))
+            continue;
+
+        /* One job per domain covers all the monitor queries. If the
+         * job can't be had, only the stats which don't need it are
+         * returned rather than failing the whole call */
+        if (domflags & QEMU_DOMAIN_STATS_HAVE_JOB &&
+            (!virDomainObjIsActive(dom) ||
+             qemuDomainObjBeginJob(driver, dom, QEMU_JOB_QUERY) < 0)) {
+            virResetLastError();
+            domflags &= ~QEMU_DOMAIN_STATS_HAVE_JOB;
+        }
+
+        if (qemuDomainGetStats(conn, dom, stats, &tmp, domflags) < 0) {
+            if (domflags & QEMU_DOMAIN_STATS_HAVE_JOB &&
+                !qemuDomainObjEndJob(driver, dom))
+                dom = NULL;
+            goto cleanup;
+        }
+
+        tmpstats[nstats++] = tmp;
+
+        if (domflags & QEMU_DOMAIN_STATS_HAVE_JOB &&
+            !qemuDomainObjEndJob(driver, dom)) {
+            dom = NULL;
+            continue;
+        }
+
+        virObjectUnlock(dom);
+        dom = NULL;
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+
+    ret = nstats;
+
+cleanup:
+    if (dom)
+        virObjectUnlock(dom);
+
+    virDomainStatsRecordListFree(tmpstats);
+
+    for (i = 0 ; i < ntempdoms ; i++)
+        virDomainFree(domlist[i]);
+    VIR_FREE(domlist);
+
+    return ret;
+}
+
+
 static virDriver qemuDriver = {
     .no = VIR_DRV_QEMU,
     .name = QEMU_DRIVER_NAME,
@@ -15121,6 +15676,7 @@ static virDriver qemuDriver = {
     .nodeGetCPUMap = nodeGetCPUMap, /* 1.0.0 */
     .domainFSTrim = qemuDomainFSTrim, /* 1.0.1 */
     .domainOpenChannel = qemuDomainOpenChannel, /* 1.0.2 */
+    .connectGetAllDomainStats = qemuConnectGetAllDomainStats, /* 1.0.3 */
 };
 
 
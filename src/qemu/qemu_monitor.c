@@ -47,6 +47,9 @@
 #define DEBUG_IO 0
 #define DEBUG_RAW_IO 0
 
+/* Largest receive buffer kept around while the monitor is idle */
+#define QEMU_MONITOR_MAX_IDLE_BUFFER (64 * 1024)
+
 struct _qemuMonitor {
     virObjectLockable parent;
 
@@ -70,6 +73,10 @@ struct _qemuMonitor {
     size_t bufferLength;
     char *buffer;
 
+    /* Incremental parser for QMP, holding the state of
+     * a partially received reply across reads */
+    virJSONStreamParserPtr parser;
+
     /* If anything went wrong, this will be fed back
      * the next monitor msg */
     virError lastError;
@@ -242,6 +249,7 @@ static void qemuMonitorDispose(void *obj)
         (mon->cb->destroy)(mon, mon->vm);
     virCondDestroy(&mon->notify);
     VIR_FREE(mon->buffer);
+    virJSONStreamParserFree(mon->parser);
 }
 
 
@@ -345,7 +353,7 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
           "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
 
     if (mon->json)
-        len = qemuMonitorJSONIOProcess(mon,
+        len = qemuMonitorJSONIOProcess(mon, mon->parser,
                                        mon->buffer, mon->bufferOffset,
                                        msg);
     else
@@ -362,9 +370,14 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     if (len < mon->bufferOffset) {
         memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
         mon->bufferOffset -= len;
-    } else {
+        mon->buffer[mon->bufferOffset] = '\0';
+    } else if (mon->bufferLength > QEMU_MONITOR_MAX_IDLE_BUFFER) {
+        /* Don't hang onto the memory used by an unusually large reply */
         VIR_FREE(mon->buffer);
         mon->bufferOffset = mon->bufferLength = 0;
+    } else {
+        mon->bufferOffset = 0;
+        mon->buffer[0] = '\0';
     }
 #if DEBUG_IO
     VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
@@ -481,14 +494,15 @@ qemuMonitorIORead(qemuMonitorPtr mon)
     size_t avail = mon->bufferLength - mon->bufferOffset;
     int ret = 0;
 
+    /* Grow geometrically, so that a large reply arriving
+     * in many reads doesn't cost a reallocation per KB */
     if (avail < 1024) {
-        if (VIR_REALLOC_N(mon->buffer,
-                          mon->bufferLength + 1024) < 0) {
+        if (VIR_RESIZE_N(mon->buffer, mon->bufferLength,
+                         mon->bufferOffset, 1024) < 0) {
             virReportOOMError();
             return -1;
         }
-        mon->bufferLength += 1024;
-        avail += 1024;
+        avail = mon->bufferLength - mon->bufferOffset;
     }
 
     /* Read as much as we can get into our buffer,
@@ -719,6 +733,9 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
     mon->cb = cb;
     virObjectLock(mon);
 
+    if (json && !(mon->parser = virJSONStreamParserNew()))
+        goto cleanup;
+
     if (virSetCloseExec(mon->fd) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("Unable to set monitor close-on-exec flag"));
@@ -1438,6 +1455,41 @@ qemuMonitorBlockInfoLookup(virHashTablePtr blockInfo,
     return info;
 }
 
+/*
+ * Returns a hash table of qemuBlockStats for all the block devices
+ * of the domain, keyed by the guest side device name, gathered with
+ * a single monitor command.
+ */
+virHashTablePtr
+qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon)
+{
+    int ret;
+    virHashTablePtr table;
+
+    VIR_DEBUG("mon=%p", mon);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return NULL;
+    }
+
+    if (!(table = virHashCreate(32, (virHashDataFree) free)))
+        return NULL;
+
+    if (mon->json)
+        ret = qemuMonitorJSONGetAllBlockStatsInfo(mon, table);
+    else
+        ret = qemuMonitorTextGetAllBlockStatsInfo(mon, table);
+
+    if (ret < 0) {
+        virHashFree(table);
+        return NULL;
+    }
+
+    return table;
+}
+
 int qemuMonitorGetBlockStatsInfo(qemuMonitorPtr mon,
                                  const char *dev_name,
                                  long long *rd_req,
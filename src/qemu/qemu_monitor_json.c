@@ -142,16 +142,13 @@ qemuMonitorJSONIOProcessEvent(qemuMonitorPtr mon,
 static int
 qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                              const char *line,
+                             virJSONValuePtr obj,
                              qemuMonitorMessagePtr msg)
 {
-    virJSONValuePtr obj = NULL;
     int ret = -1;
 
     VIR_DEBUG("Line [%s]", line);
 
-    if (!(obj = virJSONValueFromString(line)))
-        goto cleanup;
-
     if (obj->type != VIR_JSON_TYPE_OBJECT) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Parsed JSON reply '%s' isn't an object"), line);
@@ -187,38 +184,56 @@ cleanup:
     return ret;
 }
 
+/*
+ * The parser keeps its state across calls, so a reply which
+ * arrives over many reads is parsed as it comes in rather than
+ * being rescanned for its end every time. The reply is left in
+ * the buffer until it is complete, so the raw text is still at
+ * hand for probes and error messages.
+ */
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
+                             virJSONStreamParserPtr parser,
                              const char *data,
                              size_t len,
                              qemuMonitorMessagePtr msg)
 {
-    int used = 0;
+    size_t used = 0;
     /*VIR_DEBUG("Data %d bytes [%s]", len, data);*/
 
     while (used < len) {
-        char *nl = strstr(data + used, LINE_ENDING);
-
-        if (nl) {
-            int got = nl - (data + used);
-            char *line = strndup(data + used, got);
-            if (!line) {
-                virReportOOMError();
-                return -1;
-            }
-            used += got + strlen(LINE_ENDING);
-            line[got] = '\0'; /* kill \n */
-            if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0) {
-                VIR_FREE(line);
-                return -1;
-            }
-
-            VIR_FREE(line);
-        } else {
+        virJSONValuePtr obj;
+        const char *line;
+        char *tmp;
+        size_t got;
+        int rc;
+
+        if ((rc = virJSONStreamParserFeed(parser, data + used, len - used,
+                                          &got, &obj)) < 0)
+            return -1;
+        if (rc == 0)
             break;
+
+        if (!(tmp = strndup(data + used, got))) {
+            virJSONValueFree(obj);
+            virReportOOMError();
+            return -1;
         }
+        used += got;
+        if (len - used >= strlen(LINE_ENDING) &&
+            STRPREFIX(data + used, LINE_ENDING))
+            used += strlen(LINE_ENDING);
+
+        line = tmp;
+        virSkipSpaces(&line);
+        if (qemuMonitorJSONIOProcessLine(mon, line, obj, msg) < 0) {
+            VIR_FREE(tmp);
+            return -1;
+        }
+
+        VIR_FREE(tmp);
     }
 
-    VIR_DEBUG("Total used %d bytes out of %zd available in buffer", used, len);
+    VIR_DEBUG("Total used %zu bytes out of %zd available in buffer", used, len);
     return used;
 }
 
@@ -1608,37 +1623,96 @@ cleanup:
 }
 
 
-int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
-                                     const char *dev_name,
-                                     long long *rd_req,
-                                     long long *rd_bytes,
-                                     long long *rd_total_times,
-                                     long long *wr_req,
-                                     long long *wr_bytes,
-                                     long long *wr_total_times,
-                                     long long *flush_req,
-                                     long long *flush_total_times,
-                                     long long *errs)
+static int
+qemuMonitorJSONGetOneBlockStatsInfo(virJSONValuePtr stats,
+                                    qemuBlockStatsPtr bstats)
+{
+    bstats->rd_req = bstats->rd_bytes = -1;
+    bstats->wr_req = bstats->wr_bytes = bstats->errs = -1;
+    bstats->rd_total_times = bstats->wr_total_times = -1;
+    bstats->flush_req = bstats->flush_total_times = -1;
+
+    if (virJSONValueObjectGetNumberLong(stats, "rd_bytes",
+                                        &bstats->rd_bytes) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"),
+                       "rd_bytes");
+        return -1;
+    }
+    if (virJSONValueObjectGetNumberLong(stats, "rd_operations",
+                                        &bstats->rd_req) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"),
+                        "rd_operations");
+        return -1;
+    }
+    if (virJSONValueObjectHasKey(stats, "rd_total_time_ns") &&
+        (virJSONValueObjectGetNumberLong(stats, "rd_total_time_ns",
+                                         &bstats->rd_total_times) < 0)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"),
+                       "rd_total_time_ns");
+        return -1;
+    }
+    if (virJSONValueObjectGetNumberLong(stats, "wr_bytes",
+                                        &bstats->wr_bytes) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"),
+                       "wr_bytes");
+        return -1;
+    }
+    if (virJSONValueObjectGetNumberLong(stats, "wr_operations",
+                                        &bstats->wr_req) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"),
+                       "wr_operations");
+        return -1;
+    }
+    if (virJSONValueObjectHasKey(stats, "wr_total_time_ns") &&
+        (virJSONValueObjectGetNumberLong(stats, "wr_total_time_ns",
+                                         &bstats->wr_total_times) < 0)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"),
+                       "wr_total_time_ns");
+        return -1;
+    }
+    if (virJSONValueObjectHasKey(stats, "flush_operations") &&
+        (virJSONValueObjectGetNumberLong(stats, "flush_operations",
+                                         &bstats->flush_req) < 0)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"),
+                       "flush_operations");
+        return -1;
+    }
+    if (virJSONValueObjectHasKey(stats, "flush_total_time_ns") &&
+        (virJSONValueObjectGetNumberLong(stats, "flush_total_time_ns",
+                                         &bstats->flush_total_times) < 0)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"),
+                       "flush_total_time_ns");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Fills @table with a qemuBlockStats for every device reported by
+ * query-blockstats, keyed by the guest side device name. With a
+ * @dev_name, the stats of other devices are not even parsed, so
+ * that they can't get in the way. */
+static int
+qemuMonitorJSONGetBlockStatsTable(qemuMonitorPtr mon,
+                                  virHashTablePtr table,
+                                  const char *dev_name)
 {
     int ret;
     int i;
-    int found = 0;
     virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-blockstats",
                                                      NULL);
     virJSONValuePtr reply = NULL;
     virJSONValuePtr devices;
-
-    *rd_req = *rd_bytes = -1;
-    *wr_req = *wr_bytes = *errs = -1;
-
-    if (rd_total_times)
-        *rd_total_times = -1;
-    if (wr_total_times)
-        *wr_total_times = -1;
-    if (flush_req)
-        *flush_req = -1;
-    if (flush_total_times)
-        *flush_total_times = -1;
+    qemuBlockStatsPtr bstats = NULL;
 
     if (!cmd)
         return -1;
@@ -1681,10 +1755,9 @@ int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
         if (STRPREFIX(thisdev, QEMU_DRIVE_HOST_PREFIX))
             thisdev += strlen(QEMU_DRIVE_HOST_PREFIX);
 
-        if (STRNEQ(thisdev, dev_name))
+        if (dev_name && STRNEQ(thisdev, dev_name))
             continue;
 
-        found = 1;
         if ((stats = virJSONValueObjectGet(dev, "stats")) == NULL ||
             stats->type != VIR_JSON_TYPE_OBJECT) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -1692,78 +1765,93 @@ int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
             goto cleanup;
         }
 
-        if (virJSONValueObjectGetNumberLong(stats, "rd_bytes", rd_bytes) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "rd_bytes");
-            goto cleanup;
-        }
-        if (virJSONValueObjectGetNumberLong(stats, "rd_operations", rd_req) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                            "rd_operations");
-            goto cleanup;
-        }
-        if (rd_total_times &&
-            virJSONValueObjectHasKey(stats, "rd_total_time_ns") &&
-            (virJSONValueObjectGetNumberLong(stats, "rd_total_time_ns",
-                                             rd_total_times) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "rd_total_time_ns");
-            goto cleanup;
-        }
-        if (virJSONValueObjectGetNumberLong(stats, "wr_bytes", wr_bytes) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "wr_bytes");
-            goto cleanup;
-        }
-        if (virJSONValueObjectGetNumberLong(stats, "wr_operations", wr_req) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "wr_operations");
-            goto cleanup;
-        }
-        if (wr_total_times &&
-            virJSONValueObjectHasKey(stats, "wr_total_time_ns") &&
-            (virJSONValueObjectGetNumberLong(stats, "wr_total_time_ns",
-                                             wr_total_times) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "wr_total_time_ns");
+        if (VIR_ALLOC(bstats) < 0) {
+            virReportOOMError();
             goto cleanup;
         }
-        if (flush_req &&
-            virJSONValueObjectHasKey(stats, "flush_operations") &&
-            (virJSONValueObjectGetNumberLong(stats, "flush_operations",
-                                            flush_req) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "flush_operations");
+
+        if (qemuMonitorJSONGetOneBlockStatsInfo(stats, bstats) < 0)
             goto cleanup;
-        }
-        if (flush_total_times &&
-            virJSONValueObjectHasKey(stats, "flush_total_time_ns") &&
-            (virJSONValueObjectGetNumberLong(stats, "flush_total_time_ns",
-                                            flush_total_times) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "flush_total_time_ns");
+
+        if (virHashUpdateEntry(table, thisdev, bstats) < 0)
             goto cleanup;
-        }
+        bstats = NULL;
     }
 
-    if (!found) {
+    ret = 0;
+
+cleanup:
+    VIR_FREE(bstats);
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                        virHashTablePtr table)
+{
+    return qemuMonitorJSONGetBlockStatsTable(mon, table, NULL);
+}
+
+
+int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
+                                     const char *dev_name,
+                                     long long *rd_req,
+                                     long long *rd_bytes,
+                                     long long *rd_total_times,
+                                     long long *wr_req,
+                                     long long *wr_bytes,
+                                     long long *wr_total_times,
+                                     long long *flush_req,
+                                     long long *flush_total_times,
+                                     long long *errs)
+{
+    int ret = -1;
+    virHashTablePtr table;
+    qemuBlockStatsPtr bstats;
+
+    *rd_req = *rd_bytes = -1;
+    *wr_req = *wr_bytes = *errs = -1;
+
+    if (rd_total_times)
+        *rd_total_times = -1;
+    if (wr_total_times)
+        *wr_total_times = -1;
+    if (flush_req)
+        *flush_req = -1;
+    if (flush_total_times)
+        *flush_total_times = -1;
+
+    if (!(table = virHashCreate(32, (virHashDataFree) free)))
+        return -1;
+
+    if (qemuMonitorJSONGetBlockStatsTable(mon, table, dev_name) < 0)
+        goto cleanup;
+
+    if (!(bstats = virHashLookup(table, dev_name))) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("cannot find statistics for device '%s'"), dev_name);
         goto cleanup;
     }
+
+    *rd_req = bstats->rd_req;
+    *rd_bytes = bstats->rd_bytes;
+    *wr_req = bstats->wr_req;
+    *wr_bytes = bstats->wr_bytes;
+    if (rd_total_times)
+        *rd_total_times = bstats->rd_total_times;
+    if (wr_total_times)
+        *wr_total_times = bstats->wr_total_times;
+    if (flush_req)
+        *flush_req = bstats->flush_req;
+    if (flush_total_times)
+        *flush_total_times = bstats->flush_total_times;
+
     ret = 0;
 
 cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
+    virHashFree(table);
     return ret;
 }
 
@@ -859,23 +859,17 @@ cleanup:
     return ret;
 }
 
-int qemuMonitorTextGetBlockStatsInfo(qemuMonitorPtr mon,
-                                     const char *dev_name,
-                                     long long *rd_req,
-                                     long long *rd_bytes,
-                                     long long *rd_total_times,
-                                     long long *wr_req,
-                                     long long *wr_bytes,
-                                     long long *wr_total_times,
-                                     long long *flush_req,
-                                     long long *flush_total_times,
-                                     long long *errs)
+/* Fills @table with a qemuBlockStats for every device listed
+ * by 'info blockstats', keyed by the guest side device name */
+int qemuMonitorTextGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                        virHashTablePtr table)
 {
     char *info = NULL;
     int ret = -1;
     char *dummy;
-    const char *p, *eol;
-    int devnamelen = strlen(dev_name);
+    char *name = NULL;
+    const char *p, *eol, *colon;
+    qemuBlockStatsPtr bstats = NULL;
 
     if (qemuMonitorHMPCommand(mon, "info blockstats", &info) < 0)
         goto cleanup;
@@ -892,18 +886,6 @@ int qemuMonitorTextGetBlockStatsInfo(qemuMonitorPtr mon,
         goto cleanup;
     }
 
-    *rd_req = *rd_bytes = -1;
-    *wr_req = *wr_bytes = *errs = -1;
-
-    if (rd_total_times)
-        *rd_total_times = -1;
-    if (wr_total_times)
-        *wr_total_times = -1;
-    if (flush_req)
-        *flush_req = -1;
-    if (flush_total_times)
-        *flush_total_times = -1;
-
     /* The output format for both qemu & KVM is:
      *   blockdevice: rd_bytes=% wr_bytes=% rd_operations=% wr_operations=%
      *   (repeated for each block device)
@@ -919,51 +901,60 @@ int qemuMonitorTextGetBlockStatsInfo(qemuMonitorPtr mon,
         if (STRPREFIX(p, QEMU_DRIVE_HOST_PREFIX))
             p += strlen(QEMU_DRIVE_HOST_PREFIX);
 
-        if (STREQLEN(p, dev_name, devnamelen)
-            && p[devnamelen] == ':' && p[devnamelen+1] == ' ') {
+        eol = strchr(p, '\n');
+        if (!eol)
+            eol = p + strlen(p);
 
-            eol = strchr(p, '\n');
-            if (!eol)
-                eol = p + strlen(p);
+        colon = strchr(p, ':');
+        if (colon && colon < eol && colon[1] == ' ') {
+            if (!(name = strndup(p, colon - p)) ||
+                VIR_ALLOC(bstats) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            bstats->rd_req = bstats->rd_bytes = -1;
+            bstats->wr_req = bstats->wr_bytes = bstats->errs = -1;
+            bstats->rd_total_times = bstats->wr_total_times = -1;
+            bstats->flush_req = bstats->flush_total_times = -1;
 
-            p += devnamelen+2;         /* Skip to first label. */
+            p = colon + 2;         /* Skip to first label. */
 
             while (*p) {
                 if (STRPREFIX(p, "rd_bytes=")) {
                     p += strlen("rd_bytes=");
-                    if (virStrToLong_ll(p, &dummy, 10, rd_bytes) == -1)
+                    if (virStrToLong_ll(p, &dummy, 10, &bstats->rd_bytes) == -1)
                         VIR_DEBUG("error reading rd_bytes: %s", p);
                 } else if (STRPREFIX(p, "wr_bytes=")) {
                     p += strlen("wr_bytes=");
-                    if (virStrToLong_ll(p, &dummy, 10, wr_bytes) == -1)
+                    if (virStrToLong_ll(p, &dummy, 10, &bstats->wr_bytes) == -1)
                         VIR_DEBUG("error reading wr_bytes: %s", p);
                 } else if (STRPREFIX(p, "rd_operations=")) {
                     p += strlen("rd_operations=");
-                    if (virStrToLong_ll(p, &dummy, 10, rd_req) == -1)
+                    if (virStrToLong_ll(p, &dummy, 10, &bstats->rd_req) == -1)
                         VIR_DEBUG("error reading rd_req: %s", p);
                 } else if (STRPREFIX(p, "wr_operations=")) {
                     p += strlen("wr_operations=");
-                    if (virStrToLong_ll(p, &dummy, 10, wr_req) == -1)
+                    if (virStrToLong_ll(p, &dummy, 10, &bstats->wr_req) == -1)
                         VIR_DEBUG("error reading wr_req: %s", p);
-                } else if (rd_total_times &&
-                           STRPREFIX(p, "rd_total_time_ns=")) {
+                } else if (STRPREFIX(p, "rd_total_time_ns=")) {
                     p += strlen("rd_total_time_ns=");
-                    if (virStrToLong_ll(p, &dummy, 10, rd_total_times) == -1)
+                    if (virStrToLong_ll(p, &dummy, 10,
+                                        &bstats->rd_total_times) == -1)
                         VIR_DEBUG("error reading rd_total_times: %s", p);
-                } else if (wr_total_times &&
-                           STRPREFIX(p, "wr_total_time_ns=")) {
+                } else if (STRPREFIX(p, "wr_total_time_ns=")) {
                     p += strlen("wr_total_time_ns=");
-                    if (virStrToLong_ll(p, &dummy, 10, wr_total_times) == -1)
+                    if (virStrToLong_ll(p, &dummy, 10,
+                                        &bstats->wr_total_times) == -1)
                         VIR_DEBUG("error reading wr_total_times: %s", p);
-                } else if (flush_req &&
-                           STRPREFIX(p, "flush_operations=")) {
+                } else if (STRPREFIX(p, "flush_operations=")) {
                     p += strlen("flush_operations=");
-                    if (virStrToLong_ll(p, &dummy, 10, flush_req) == -1)
+                    if (virStrToLong_ll(p, &dummy, 10, &bstats->flush_req) == -1)
                         VIR_DEBUG("error reading flush_req: %s", p);
-                } else if (flush_total_times &&
-                           STRPREFIX(p, "flush_total_time_ns=")) {
+                } else if (STRPREFIX(p, "flush_total_time_ns=")) {
                     p += strlen("flush_total_time_ns=");
-                    if (virStrToLong_ll(p, &dummy, 10, flush_total_times) == -1)
+                    if (virStrToLong_ll(p, &dummy, 10,
+                                        &bstats->flush_total_times) == -1)
                         VIR_DEBUG("error reading flush_total_times: %s", p);
                 } else {
                     VIR_DEBUG("unknown block stat near %s", p);
@@ -974,25 +965,77 @@ int qemuMonitorTextGetBlockStatsInfo(qemuMonitorPtr mon,
                 if (!p || p >= eol) break;
                 p++;
             }
-            ret = 0;
-            goto cleanup;
+
+            if (virHashUpdateEntry(table, name, bstats) < 0)
+                goto cleanup;
+            bstats = NULL;
+            VIR_FREE(name);
         }
 
         /* Skip to next line. */
-        p = strchr(p, '\n');
+        p = strchr(eol, '\n');
         if (!p) break;
         p++;
     }
 
-    /* If we reach here then the device was not found. */
-    virReportError(VIR_ERR_INVALID_ARG,
-                   _("no stats found for device %s"), dev_name);
+    ret = 0;
 
  cleanup:
+    VIR_FREE(bstats);
+    VIR_FREE(name);
     VIR_FREE(info);
     return ret;
 }
 
+int qemuMonitorTextGetBlockStatsInfo(qemuMonitorPtr mon,
+                                     const char *dev_name,
+                                     long long *rd_req,
+                                     long long *rd_bytes,
+                                     long long *rd_total_times,
+                                     long long *wr_req,
+                                     long long *wr_bytes,
+                                     long long *wr_total_times,
+                                     long long *flush_req,
+                                     long long *flush_total_times,
+                                     long long *errs)
+{
+    int ret = -1;
+    virHashTablePtr table;
+    qemuBlockStatsPtr bstats;
+
+    if (!(table = virHashCreate(32, (virHashDataFree) free)))
+        return -1;
+
+    if (qemuMonitorTextGetAllBlockStatsInfo(mon, table) < 0)
+        goto cleanup;
+
+    if (!(bstats = virHashLookup(table, dev_name))) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("no stats found for device %s"), dev_name);
+        goto cleanup;
+    }
+
+    *rd_req = bstats->rd_req;
+    *rd_bytes = bstats->rd_bytes;
+    *wr_req = bstats->wr_req;
+    *wr_bytes = bstats->wr_bytes;
+    *errs = bstats->errs;
+    if (rd_total_times)
+        *rd_total_times = bstats->rd_total_times;
+    if (wr_total_times)
+        *wr_total_times = bstats->wr_total_times;
+    if (flush_req)
+        *flush_req = bstats->flush_req;
+    if (flush_total_times)
+        *flush_total_times = bstats->flush_total_times;
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(table);
+    return ret;
+}
+
 int qemuMonitorTextGetBlockStatsParamsNumber(qemuMonitorPtr mon,
                                              int *nparams)
 {
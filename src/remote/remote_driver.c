@@ -48,6 +48,7 @@
 #include "viruri.h"
 #include "virauth.h"
 #include "virauthconfig.h"
+#include "virshmstate.h"
 
 #define VIR_FROM_THIS VIR_FROM_REMOTE
 
@@ -91,6 +92,11 @@ struct private_data {
     int localUses;              /* Ref count for private data */
     char *hostname;             /* Original hostname */
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
+    unsigned int streamWindow;  /* Credit granted to the server per stream */
+    bool streamNegotiated;      /* Were stream features asked for yet? */
+    bool serverStreamSparse;    /* Does server understand stream holes? */
+    bool stateShmWanted;        /* Map the state snapshot on first use? */
+    virShmStatePtr stateShm;    /* Daemon's domain state snapshot, if mapped */
 
     virDomainEventStatePtr domainEventState;
 };
@@ -364,6 +370,67 @@ static void remoteClientCloseFunc(virNetClientPtr client ATTRIBUTE_UNUSED,
     virMutexUnlock(&conn->lock);
 }
 
+/* Must be called with the driver locked */
+static void
+remoteOpenStateShm(virConnectPtr conn, struct private_data *priv)
+{
+    remote_supports_feature_args args = { VIR_DRV_FEATURE_STATE_SHM };
+    remote_supports_feature_ret ret = { 0 };
+    remote_connect_open_state_shm_args shmargs = { 0 };
+    int *fdout = NULL;
+    size_t fdoutlen = 0;
+    size_t i;
+
+    if (call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+             (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+             (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret) == -1 ||
+        !ret.supported)
+        goto cleanup;
+
+    if (callFull(conn, priv, 0,
+                 NULL, 0,
+                 &fdout, &fdoutlen,
+                 REMOTE_PROC_CONNECT_OPEN_STATE_SHM,
+                 (xdrproc_t) xdr_remote_connect_open_state_shm_args, (char *) &shmargs,
+                 (xdrproc_t) xdr_void, (char *) NULL) == -1)
+        goto cleanup;
+
+    if (fdoutlen != 1) {
+        VIR_WARN("Expected a single state file descriptor, got %zu",
+                 fdoutlen);
+        goto cleanup;
+    }
+
+    priv->stateShm = virShmStateOpen(fdout[0]);
+
+cleanup:
+    if (!priv->stateShm) {
+        VIR_DEBUG("Answering all state queries over RPC");
+        virResetLastError();
+    }
+    for (i = 0 ; i < fdoutlen ; i++)
+        VIR_FORCE_CLOSE(fdout[i]);
+    VIR_FREE(fdout);
+}
+
+/*
+ * Most connections never ask for domain state, so the snapshot is
+ * only mapped when the first query comes. Must be called with the
+ * driver locked.
+ *
+ * Returns the snapshot, or NULL if queries go over RPC
+ */
+static virShmStatePtr
+remoteGetStateShm(virConnectPtr conn, struct private_data *priv)
+{
+    if (priv->stateShmWanted) {
+        priv->stateShmWanted = false;
+        remoteOpenStateShm(conn, priv);
+    }
+
+    return priv->stateShm;
+}
+
 /* helper macro to ease extraction of arguments from the URI */
 #define EXTRACT_URI_ARG_STR(ARG_NAME, ARG_VAR)          \
     if (STRCASEEQ(var->name, ARG_NAME)) {               \
@@ -488,6 +555,7 @@ doRemoteOpen(virConnectPtr conn,
     char *pkipath = NULL, *keyfile = NULL, *sshauth = NULL;
 
     char *knownHostsVerify = NULL,  *knownHosts = NULL;
+    unsigned int streamWindow = VIR_NET_STREAM_CREDIT_INITIAL;
 
     /* Return code from this function, and the private data. */
     int retcode = VIR_DRV_OPEN_ERROR;
@@ -541,6 +609,17 @@ doRemoteOpen(virConnectPtr conn,
             EXTRACT_URI_ARG_BOOL("no_verify", verify);
             EXTRACT_URI_ARG_BOOL("no_tty", tty);
 
+            if (STRCASEEQ(var->name, "stream_window")) {
+                if (virStrToLong_ui(var->value, NULL, 10, &streamWindow) < 0) {
+                    virReportError(VIR_ERR_INVALID_ARG,
+                                   _("Failed to parse value of URI component %s"),
+                                   var->name);
+                    goto failed;
+                }
+                var->ignore = 1;
+                continue;
+            }
+
             if (STRCASEEQ(var->name, "authfile")) {
                 /* Strip this param, used by virauth.c */
                 var->ignore = 1;
@@ -826,6 +905,15 @@ doRemoteOpen(virConnectPtr conn,
             goto failed;
     }
 
+    /* Flow control and holes are negotiated when the first stream
+     * is opened */
+    priv->streamWindow = streamWindow;
+
+    /* Local read-only clients, typically monitoring tools, can answer
+     * simple state queries from the daemon's snapshot instead of RPC */
+    if (transport == trans_unix && (flags & VIR_DRV_OPEN_REMOTE_RO))
+        priv->stateShmWanted = true;
+
     /* Now try and find out what URI the daemon used */
     if (conn->uri == NULL) {
         remote_get_uri_ret uriret;
@@ -1051,6 +1139,9 @@ doRemoteClose(virConnectPtr conn, struct private_data *priv)
     virDomainEventStateFree(priv->domainEventState);
     priv->domainEventState = NULL;
 
+    virShmStateClose(priv->stateShm);
+    priv->stateShm = NULL;
+
     return ret;
 }
 
@@ -1344,6 +1435,34 @@ done:
     return rv;
 }
 
+static int
+remoteNumOfDomains(virConnectPtr conn)
+{
+    int rv = -1;
+    struct private_data *priv = conn->privateData;
+    remote_num_of_domains_ret ret;
+    virShmStatePtr shm;
+
+    remoteDriverLock(priv);
+
+    if ((shm = remoteGetStateShm(conn, priv)) &&
+        (rv = virShmStateNumOfDomains(shm)) >= 0)
+        goto done;
+
+    memset(&ret, 0, sizeof(ret));
+
+    if (call(conn, priv, 0, REMOTE_PROC_NUM_OF_DOMAINS,
+             (xdrproc_t) xdr_void, (char *) NULL,
+             (xdrproc_t) xdr_remote_num_of_domains_ret, (char *) &ret) == -1)
+        goto done;
+
+    rv = ret.num;
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 static int
 remoteListDomains(virConnectPtr conn, int *ids, int maxids)
 {
@@ -2203,6 +2322,49 @@ done:
     return rv;
 }
 
+static int
+remoteDomainGetInfo(virDomainPtr domain, virDomainInfoPtr info)
+{
+    int rv = -1;
+    remote_domain_get_info_args args;
+    remote_domain_get_info_ret ret;
+    virShmStateDomain cur;
+    virShmStatePtr shm;
+    struct private_data *priv = domain->conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if ((shm = remoteGetStateShm(domain->conn, priv)) &&
+        virShmStateGetDomain(shm, domain->uuid, &cur) == 1) {
+        info->state = cur.state;
+        HYPER_TO_ULONG(info->maxMem, cur.maxMem);
+        HYPER_TO_ULONG(info->memory, cur.memory);
+        info->nrVirtCpu = cur.nrVirtCpu;
+        info->cpuTime = cur.cpuTime;
+        rv = 0;
+        goto done;
+    }
+
+    make_nonnull_domain(&args.dom, domain);
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(domain->conn, priv, 0, REMOTE_PROC_DOMAIN_GET_INFO,
+             (xdrproc_t) xdr_remote_domain_get_info_args, (char *) &args,
+             (xdrproc_t) xdr_remote_domain_get_info_ret, (char *) &ret) == -1)
+        goto done;
+
+    info->state = ret.state;
+    HYPER_TO_ULONG(info->maxMem, ret.maxMem);
+    HYPER_TO_ULONG(info->memory, ret.memory);
+    info->nrVirtCpu = ret.nrVirtCpu;
+    info->cpuTime = ret.cpuTime;
+    rv = 0;
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 static int
 remoteDomainGetState(virDomainPtr domain,
                      int *state,
@@ -2212,10 +2374,23 @@ remoteDomainGetState(virDomainPtr domain,
     int rv = -1;
     remote_domain_get_state_args args;
     remote_domain_get_state_ret ret;
+    virShmStateDomain cur;
+    virShmStatePtr shm;
     struct private_data *priv = domain->conn->privateData;
 
     remoteDriverLock(priv);
 
+    /* Leave flag validation to the daemon */
+    if (!flags &&
+        (shm = remoteGetStateShm(domain->conn, priv)) &&
+        virShmStateGetDomain(shm, domain->uuid, &cur) == 1) {
+        *state = cur.state;
+        if (reason)
+            *reason = cur.reason;
+        rv = 0;
+        goto done;
+    }
+
     make_nonnull_domain(&args.dom, domain);
     args.flags = flags;
 
@@ -4739,15 +4914,53 @@ remoteStreamSend(virStreamPtr st,
 
 
 static int
-remoteStreamRecv(virStreamPtr st,
-                 char *data,
-                 size_t nbytes)
+remoteStreamSendHole(virStreamPtr st,
+                     long long length,
+                     unsigned int flags)
 {
-    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv = -1;
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    if (!priv->serverStreamSparse) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("server does not support sparse streams"));
+        remoteDriverUnlock(priv);
+        return -1;
+    }
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamSendHole(privst,
+                                    priv->client,
+                                    length,
+                                    flags);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecvFlags(virStreamPtr st,
+                      char *data,
+                      size_t nbytes,
+                      unsigned int flags)
+{
+    VIR_DEBUG("st=%p data=%p nbytes=%zu flags=%x", st, data, nbytes, flags);
     struct private_data *priv = st->conn->privateData;
     virNetClientStreamPtr privst = st->privateData;
     int rv;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (virNetClientStreamRaiseError(privst))
         return -1;
 
@@ -4759,7 +4972,8 @@ remoteStreamRecv(virStreamPtr st,
                                       priv->client,
                                       data,
                                       nbytes,
-                                      (st->flags & VIR_STREAM_NONBLOCK));
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      flags);
 
     VIR_DEBUG("Done %d", rv);
 
@@ -4769,6 +4983,32 @@ remoteStreamRecv(virStreamPtr st,
     return rv;
 }
 
+
+static int
+remoteStreamRecv(virStreamPtr st,
+                 char *data,
+                 size_t nbytes)
+{
+    return remoteStreamRecvFlags(st, data, nbytes, 0);
+}
+
+
+static int
+remoteStreamRecvHole(virStreamPtr st,
+                     long long *length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%p flags=%x", st, length, flags);
+    virNetClientStreamPtr privst = st->privateData;
+
+    virCheckFlags(0, -1);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    return virNetClientStreamRecvHole(privst, length);
+}
+
 struct remoteStreamCallbackData {
     virStreamPtr st;
     virStreamEventCallback cb;
@@ -4944,6 +5184,9 @@ cleanup:
 static virStreamDriver remoteStreamDrv = {
     .streamRecv = remoteStreamRecv,
     .streamSend = remoteStreamSend,
+    .streamRecvFlags = remoteStreamRecvFlags,
+    .streamSendHole = remoteStreamSendHole,
+    .streamRecvHole = remoteStreamRecvHole,
     .streamFinish = remoteStreamFinish,
     .streamAbort = remoteStreamAbort,
     .streamAddCallback = remoteStreamEventAddCallback,
@@ -4952,6 +5195,58 @@ static virStreamDriver remoteStreamDrv = {
 };
 
 
+/*
+ * Ask for the stream features of the server before the first stream
+ * is opened, rather than on every connection.  The server applies
+ * them to the streams opened afterwards.  Call with the driver lock
+ * held; features the server lacks are simply not used.
+ */
+static void
+remoteStreamNegotiate(virConnectPtr conn, struct private_data *priv)
+{
+    if (priv->streamNegotiated)
+        return;
+    priv->streamNegotiated = true;
+
+    /* Keep the server from sending stream data faster than the
+     * application reads it */
+    if (priv->streamWindow) {
+        remote_supports_feature_args args =
+            { VIR_DRV_FEATURE_STREAM_CREDIT };
+        remote_supports_feature_ret ret = { 0 };
+        int rc;
+
+        rc = call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+                  (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+                  (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret);
+
+        if (rc != -1 && ret.supported) {
+            virNetClientSetStreamWindow(priv->client, priv->streamWindow);
+        } else {
+            VIR_INFO("Disabling stream flow control since it is not"
+                     " supported by the server");
+            virResetLastError();
+        }
+    }
+
+    /* Without this the server expands holes into zeros itself */
+    {
+        remote_supports_feature_args args =
+            { VIR_DRV_FEATURE_STREAM_SPARSE };
+        remote_supports_feature_ret ret = { 0 };
+        int rc;
+
+        rc = call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+                  (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+                  (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret);
+
+        priv->serverStreamSparse = rc != -1 && ret.supported;
+        if (rc == -1)
+            virResetLastError();
+    }
+}
+
+
 static int remoteDomainEventRegisterAny(virConnectPtr conn,
                                         virDomainPtr dom,
                                         int eventID,
@@ -5227,6 +5522,8 @@ remoteDomainMigratePrepareTunnel3(virConnectPtr dconn,
     memset(&args, 0, sizeof(args));
     memset(&ret, 0, sizeof(ret));
 
+    remoteStreamNegotiate(dconn, priv);
+
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3,
                                         priv->counter)))
@@ -5628,6 +5925,36 @@ call(virConnectPtr conn,
                     ret_filter, ret);
 }
 
+/*
+ * Serial a set of arguments into a method call message and queue
+ * it without waiting for the reply; @cb is run with the outcome
+ * once @ret is filled in. The connection's I/O thread is started
+ * on first use, since no caller may be left waiting to read the
+ * reply.
+ */
+static int
+callAsync(virConnectPtr conn ATTRIBUTE_UNUSED,
+          struct private_data *priv,
+          int proc_nr,
+          xdrproc_t args_filter, char *args,
+          xdrproc_t ret_filter, char *ret,
+          virNetClientProgramCallFunc cb,
+          void *opaque)
+{
+    int counter = priv->counter++;
+
+    if (virNetClientStartIOThread(priv->client) < 0)
+        return -1;
+
+    return virNetClientProgramCallAsync(priv->remoteProgram,
+                                        priv->client,
+                                        counter,
+                                        proc_nr,
+                                        args_filter, args,
+                                        ret_filter, ret,
+                                        cb, opaque);
+}
+
 
 static int
 remoteDomainGetInterfaceParameters(virDomainPtr domain,
@@ -5974,6 +6301,251 @@ done:
     return rv;
 }
 
+/* Explicit domain lists longer than this are split into several
+ * calls, all put in flight at once so that the daemon's workers
+ * gather their stats in parallel */
+#define REMOTE_DOMAIN_STATS_BATCH 128
+
+struct remoteDomainStatsCalls {
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+};
+
+struct remoteDomainStatsBatch {
+    remote_connect_get_all_domain_stats_args args;
+    remote_connect_get_all_domain_stats_ret ret;
+    struct remoteDomainStatsCalls *calls;
+    int rv;
+    virErrorPtr err;
+};
+
+static void
+remoteConnectGetAllDomainStatsDone(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                                   virNetClientPtr client ATTRIBUTE_UNUSED,
+                                   int rv,
+                                   void *opaque)
+{
+    struct remoteDomainStatsBatch *batch = opaque;
+    struct remoteDomainStatsCalls *calls = batch->calls;
+
+    /* Run by the I/O thread, so the error has to be carried over */
+    batch->rv = rv;
+    if (rv < 0)
+        batch->err = virSaveLastError();
+
+    virMutexLock(&calls->lock);
+    if (--calls->pending == 0)
+        virCondSignal(&calls->cond);
+    virMutexUnlock(&calls->lock);
+}
+
+/* Queue a call for each batch, then wait for all of them to
+ * complete. Returns -1 if any of them failed. */
+static int
+remoteConnectGetAllDomainStatsBatches(virConnectPtr conn,
+                                      struct private_data *priv,
+                                      struct remoteDomainStatsBatch *batches,
+                                      size_t nbatches)
+{
+    struct remoteDomainStatsCalls calls;
+    size_t i;
+    int rv = 0;
+
+    if (virMutexInit(&calls.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+    if (virCondInit(&calls.cond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize condition variable"));
+        virMutexDestroy(&calls.lock);
+        return -1;
+    }
+    calls.pending = nbatches;
+
+    for (i = 0 ; i < nbatches ; i++) {
+        batches[i].calls = &calls;
+        if (callAsync(conn, priv, REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS,
+                      (xdrproc_t)xdr_remote_connect_get_all_domain_stats_args,
+                      (char *)&batches[i].args,
+                      (xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+                      (char *)&batches[i].ret,
+                      remoteConnectGetAllDomainStatsDone,
+                      &batches[i]) < 0) {
+            /* The batches already queued must still be waited for */
+            virMutexLock(&calls.lock);
+            calls.pending -= nbatches - i;
+            virMutexUnlock(&calls.lock);
+            rv = -1;
+            break;
+        }
+    }
+
+    /* Unlock, as callFull does, while the I/O thread gets the
+     * replies */
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    virMutexLock(&calls.lock);
+    while (calls.pending)
+        ignore_value(virCondWait(&calls.cond, &calls.lock));
+    virMutexUnlock(&calls.lock);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+
+    if (rv < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < nbatches ; i++) {
+        if (batches[i].rv < 0) {
+            if (batches[i].err)
+                virSetError(batches[i].err);
+            rv = -1;
+            break;
+        }
+    }
+
+cleanup:
+    virCondDestroy(&calls.cond);
+    virMutexDestroy(&calls.lock);
+    return rv;
+}
+
+static int
+remoteConnectGetAllDomainStats(virConnectPtr conn,
+                               virDomainPtr *doms,
+                               unsigned int ndoms,
+                               unsigned int stats,
+                               virDomainStatsRecordPtr **retStats,
+                               unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    int rv = -1;
+    int i;
+    size_t j;
+    struct remoteDomainStatsBatch *batches = NULL;
+    size_t nbatches = 1;
+    size_t nrecords = 0;
+    size_t n = 0;
+    virDomainStatsRecordPtr elem = NULL;
+    virDomainStatsRecordPtr *tmpret = NULL;
+
+    if (ndoms > REMOTE_DOMAIN_STATS_BATCH)
+        nbatches = VIR_DIV_UP(ndoms, REMOTE_DOMAIN_STATS_BATCH);
+
+    if (VIR_ALLOC_N(batches, nbatches) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (j = 0 ; j < nbatches ; j++) {
+        remote_connect_get_all_domain_stats_args *args = &batches[j].args;
+        size_t first = j * REMOTE_DOMAIN_STATS_BATCH;
+        size_t count = MIN(ndoms - first, REMOTE_DOMAIN_STATS_BATCH);
+
+        if (ndoms) {
+            if (VIR_ALLOC_N(args->doms.doms_val, count) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            for (i = 0; i < count; i++)
+                make_nonnull_domain(args->doms.doms_val + i, doms[first + i]);
+        }
+        args->doms.doms_len = ndoms ? count : 0;
+
+        args->stats = stats;
+        args->flags = flags;
+    }
+
+    remoteDriverLock(priv);
+    if (nbatches == 1) {
+        if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS,
+                 (xdrproc_t)xdr_remote_connect_get_all_domain_stats_args,
+                 (char *)&batches[0].args,
+                 (xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+                 (char *)&batches[0].ret) == -1) {
+            remoteDriverUnlock(priv);
+            goto cleanup;
+        }
+    } else if (remoteConnectGetAllDomainStatsBatches(conn, priv, batches,
+                                                     nbatches) < 0) {
+        remoteDriverUnlock(priv);
+        goto cleanup;
+    }
+    remoteDriverUnlock(priv);
+
+    for (j = 0 ; j < nbatches ; j++) {
+        remote_connect_get_all_domain_stats_ret *ret = &batches[j].ret;
+
+        if (ret->retStats.retStats_len > REMOTE_DOMAIN_LIST_MAX) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Number of stats entries is %d, which exceeds max limit: %d"),
+                           ret->retStats.retStats_len, REMOTE_DOMAIN_LIST_MAX);
+            goto cleanup;
+        }
+        nrecords += ret->retStats.retStats_len;
+    }
+
+    *retStats = NULL;
+
+    if (VIR_ALLOC_N(tmpret, nrecords + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (j = 0 ; j < nbatches ; j++) {
+        remote_connect_get_all_domain_stats_ret *ret = &batches[j].ret;
+
+        for (i = 0; i < ret->retStats.retStats_len; i++) {
+            remote_domain_stats_record *rec = ret->retStats.retStats_val + i;
+
+            if (VIR_ALLOC(elem) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            if (!(elem->dom = get_nonnull_domain(conn, rec->dom)))
+                goto cleanup;
+
+            if (remoteDeserializeTypedParameters(rec->params.params_val,
+                                                 rec->params.params_len,
+                                                 REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX,
+                                                 &elem->params,
+                                                 &elem->nparams))
+                goto cleanup;
+
+            tmpret[n++] = elem;
+            elem = NULL;
+        }
+    }
+
+    *retStats = tmpret;
+    tmpret = NULL;
+    rv = nrecords;
+
+cleanup:
+    if (elem) {
+        if (elem->dom)
+            virDomainFree(elem->dom);
+        VIR_FREE(elem);
+    }
+
+    virDomainStatsRecordListFree(tmpret);
+    for (j = 0 ; j < nbatches ; j++) {
+        VIR_FREE(batches[j].args.doms.doms_val);
+        xdr_free((xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+                 (char *) &batches[j].ret);
+        virFreeError(batches[j].err);
+    }
+    VIR_FREE(batches);
+
+    return rv;
+}
+
 
 static void
 remoteDomainEventQueue(struct private_data *priv, virDomainEventPtr event)
@@ -6299,6 +6871,7 @@ static virDriver remote_driver = {
     .nodeGetCPUMap = remoteNodeGetCPUMap, /* 1.0.0 */
     .domainFSTrim = remoteDomainFSTrim, /* 1.0.1 */
     .domainLxcOpenNamespace = remoteDomainLxcOpenNamespace, /* 1.0.2 */
+    .connectGetAllDomainStats = remoteConnectGetAllDomainStats, /* 1.0.3 */
 };
 
 static virNetworkDriver network_driver = {
@@ -6393,6 +6966,7 @@ static virStorageDriver storage_driver = {
     .volResize = remoteStorageVolResize, /* 0.9.10 */
     .poolIsActive = remoteStoragePoolIsActive, /* 0.7.3 */
     .poolIsPersistent = remoteStoragePoolIsPersistent, /* 0.7.3 */
+    .volGetJobInfo = remoteStorageVolGetJobInfo, /* 1.0.3 */
 };
 
 static virSecretDriver secret_driver = {
@@ -234,6 +234,16 @@ const REMOTE_DOMAIN_DISK_ERRORS_MAX = 256;
  */
 const REMOTE_NODE_MEMORY_PARAMETERS_MAX = 64;
 
+/*
+ * Upper limit on the number of domains in a single stats query
+ */
+const REMOTE_DOMAIN_LIST_MAX = 16384;
+
+/*
+ * Upper limit on the number of stats fields returned per domain
+ */
+const REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX = 4096;
+
 /* UUID.  VIR_UUID_BUFLEN definition comes from libvirt.h */
 typedef opaque remote_uuid[VIR_UUID_BUFLEN];
 
@@ -2738,6 +2748,42 @@ struct remote_domain_fstrim_args {
     unsigned int flags;
 };
 
+struct remote_domain_stats_record {
+    remote_nonnull_domain dom;
+    remote_typed_param params<REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX>;
+};
+
+struct remote_connect_get_all_domain_stats_args {
+    remote_nonnull_domain doms<REMOTE_DOMAIN_LIST_MAX>;
+    unsigned int stats;
+    unsigned int flags;
+};
+
+struct remote_connect_get_all_domain_stats_ret {
+    remote_domain_stats_record retStats<REMOTE_DOMAIN_LIST_MAX>;
+};
+
+struct remote_storage_vol_get_job_info_args {
+    remote_nonnull_storage_vol vol;
+    unsigned int flags;
+};
+
+struct remote_storage_vol_get_job_info_ret { /* insert@1 */
+    int type;
+    int state;
+    unsigned hyper timeElapsed;
+    unsigned hyper dataTotal;
+    unsigned hyper dataProcessed;
+    unsigned hyper rate;
+};
+
+/* Not backed by a public API: the reply carries a read-only file
+ * descriptor of the daemon's domain state snapshot, which local
+ * clients map to answer simple queries without a round trip */
+struct remote_connect_open_state_shm_args {
+    unsigned int flags;
+};
+
 /*----- Protocol. -----*/
 
 /* Define the program number, protocol version and procedure numbers here. */
@@ -2777,7 +2823,7 @@ enum remote_procedure {
     REMOTE_PROC_DOMAIN_DETACH_DEVICE = 13, /* autogen autogen */
     REMOTE_PROC_DOMAIN_GET_XML_DESC = 14, /* autogen autogen */
     REMOTE_PROC_DOMAIN_GET_AUTOSTART = 15, /* autogen autogen priority:high */
-    REMOTE_PROC_DOMAIN_GET_INFO = 16, /* autogen autogen */
+    REMOTE_PROC_DOMAIN_GET_INFO = 16, /* autogen skipgen */
     REMOTE_PROC_DOMAIN_GET_MAX_MEMORY = 17, /* autogen autogen priority:high */
     REMOTE_PROC_DOMAIN_GET_MAX_VCPUS = 18, /* autogen autogen priority:high */
     REMOTE_PROC_DOMAIN_GET_OS_TYPE = 19, /* autogen autogen priority:high */
@@ -2816,7 +2862,7 @@ enum remote_procedure {
     REMOTE_PROC_NETWORK_UNDEFINE = 49, /* autogen autogen priority:high */
     REMOTE_PROC_NUM_OF_DEFINED_NETWORKS = 50, /* autogen autogen priority:high */
 
-    REMOTE_PROC_NUM_OF_DOMAINS = 51, /* autogen autogen priority:high */
+    REMOTE_PROC_NUM_OF_DOMAINS = 51, /* autogen skipgen priority:high */
     REMOTE_PROC_NUM_OF_NETWORKS = 52, /* autogen autogen priority:high */
     REMOTE_PROC_DOMAIN_CORE_DUMP = 53, /* autogen autogen */
     REMOTE_PROC_DOMAIN_RESTORE = 54, /* autogen autogen */
@@ -3089,7 +3135,11 @@ enum remote_procedure {
     REMOTE_PROC_NODE_DEVICE_LOOKUP_SCSI_HOST_BY_WWN = 297, /* autogen autogen priority:high */
     REMOTE_PROC_DOMAIN_GET_JOB_STATS = 298, /* skipgen skipgen */
     REMOTE_PROC_DOMAIN_MIGRATE_GET_COMPRESSION_CACHE = 299, /* autogen autogen */
-    REMOTE_PROC_DOMAIN_MIGRATE_SET_COMPRESSION_CACHE = 300 /* autogen autogen */
+    REMOTE_PROC_DOMAIN_MIGRATE_SET_COMPRESSION_CACHE = 300, /* autogen autogen */
+
+    REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS = 301, /* skipgen skipgen */
+    REMOTE_PROC_STORAGE_VOL_GET_JOB_INFO = 302, /* autogen autogen */
+    REMOTE_PROC_CONNECT_OPEN_STATE_SHM = 303 /* skipgen skipgen */
 
     /*
      * Notice how the entries are grouped in sets of 10 ?
@@ -1452,6 +1452,8 @@ elsif ($opt_k) {
         print "    remoteDriverLock(priv);\n";
 
         if ($call->{streamflag} ne "none") {
+            print "\n";
+            print "    remoteStreamNegotiate($priv_src, priv);\n";
             print "\n";
             print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, $call->{constname}, priv->counter)))\n";
             print "        goto done;\n";
@@ -58,6 +58,11 @@ struct _virNetClientCall {
 
     virCond cond;
 
+    /* Set for asynchronous calls, which get their reply through
+     * this callback rather than a waiting thread */
+    virNetClientCallDoneFunc doneCb;
+    void *doneOpaque;
+
     virNetClientCallPtr next;
 };
 
@@ -96,9 +101,16 @@ struct _virNetClient {
     virNetClientCallPtr waitDispatch;
     /* True if a thread holds the buck */
     bool haveTheBuck;
+    /* True if a dedicated thread holds the buck for good */
+    bool haveIOThread;
+    /* Asynchronous calls waiting for their callback to be run */
+    virNetClientCallPtr completed;
 
     size_t nstreams;
     virNetClientStreamPtr *streams;
+    /* Credit window of new streams, 0 if the server doesn't
+     * support stream credit */
+    size_t streamWindow;
 
     virKeepAlivePtr keepalive;
     bool wantClose;
@@ -166,19 +178,16 @@ static void virNetClientCallQueue(virNetClientCallPtr *head,
     call->next = NULL;
 }
 
-#if 0
 /* Obtain a call from the head of the list */
 static virNetClientCallPtr virNetClientCallServe(virNetClientCallPtr *head)
 {
     virNetClientCallPtr tmp = *head;
-    if (tmp)
-        *head = tmp->next;
-    else
-        *head = NULL;
+    if (!tmp)
+        return NULL;
+    *head = tmp->next;
     tmp->next = NULL;
     return tmp;
 }
-#endif
 
 /* Remove a call from anywhere in the list */
 static void virNetClientCallRemove(virNetClientCallPtr *head,
@@ -888,6 +897,19 @@ no_memory:
 }
 
 
+/*
+ * Have the streams added from now on grant the server credit for
+ * @window bytes of data at a time, which the server must support.
+ */
+void virNetClientSetStreamWindow(virNetClientPtr client,
+                                 size_t window)
+{
+    virObjectLock(client);
+    client->streamWindow = window;
+    virObjectUnlock(client);
+}
+
+
 int virNetClientAddStream(virNetClientPtr client,
                           virNetClientStreamPtr st)
 {
@@ -896,6 +918,8 @@ int virNetClientAddStream(virNetClientPtr client,
     if (VIR_EXPAND_N(client->streams, client->nstreams, 1) < 0)
         goto no_memory;
 
+    if (client->streamWindow)
+        virNetClientStreamSetWindow(st, client->streamWindow);
     client->streams[client->nstreams-1] = virObjectRef(st);
 
     virObjectUnlock(client);
@@ -980,15 +1004,15 @@ virNetClientCallDispatchReply(virNetClientPtr client)
         return -1;
     }
 
-    if (VIR_REALLOC_N(thecall->msg->buffer, client->msg.bufferLength) < 0) {
-        virReportOOMError();
-        return -1;
-    }
-
-    memcpy(thecall->msg->buffer, client->msg.buffer, client->msg.bufferLength);
+    /* Hand the reply buffer over rather than copying it */
+    virNetMessageReleaseBuffer(thecall->msg);
     memcpy(&thecall->msg->header, &client->msg.header, sizeof(client->msg.header));
+    thecall->msg->buffer = client->msg.buffer;
+    thecall->msg->bufferSize = client->msg.bufferSize;
     thecall->msg->bufferLength = client->msg.bufferLength;
     thecall->msg->bufferOffset = client->msg.bufferOffset;
+    client->msg.buffer = NULL;
+    client->msg.bufferSize = 0;
 
     thecall->msg->nfds = client->msg.nfds;
     thecall->msg->fds = client->msg.fds;
@@ -1142,6 +1166,7 @@ virNetClientCallDispatch(virNetClientPtr client)
         return virNetClientCallDispatchMessage(client);
 
     case VIR_NET_STREAM: /* Stream protocol */
+    case VIR_NET_STREAM_HOLE: /* Holes in sparse streams */
         return virNetClientCallDispatchStream(client);
 
     default:
@@ -1160,17 +1185,18 @@ virNetClientIOWriteMessage(virNetClientPtr client,
 {
     ssize_t ret = 0;
 
-    if (thecall->msg->bufferOffset < thecall->msg->bufferLength) {
-        ret = virNetSocketWrite(client->sock,
-                                thecall->msg->buffer + thecall->msg->bufferOffset,
-                                thecall->msg->bufferLength - thecall->msg->bufferOffset);
+    if (!virNetMessageTxDone(thecall->msg)) {
+        struct iovec iov[2];
+        int niov = virNetMessageGetTxIOV(thecall->msg, iov);
+
+        ret = virNetSocketWritev(client->sock, iov, niov);
         if (ret <= 0)
             return ret;
 
-        thecall->msg->bufferOffset += ret;
+        virNetMessageTxAdvance(thecall->msg, ret);
     }
 
-    if (thecall->msg->bufferOffset == thecall->msg->bufferLength) {
+    if (virNetMessageTxDone(thecall->msg)) {
         size_t i;
         for (i = thecall->msg->donefds ; i < thecall->msg->nfds ; i++) {
             int rv;
@@ -1181,9 +1207,8 @@ virNetClientIOWriteMessage(virNetClientPtr client,
             thecall->msg->donefds++;
         }
         thecall->msg->donefds = 0;
-        thecall->msg->bufferOffset = thecall->msg->bufferLength = 0;
         VIR_FREE(thecall->msg->fds);
-        VIR_FREE(thecall->msg->buffer);
+        virNetMessageReleaseBuffer(thecall->msg);
         if (thecall->expectReply)
             thecall->mode = VIR_NET_CLIENT_MODE_WAIT_RX;
         else
@@ -1210,7 +1235,15 @@ virNetClientIOHandleOutput(virNetClientPtr client)
                    */
 
     while (thecall) {
-        ssize_t ret = virNetClientIOWriteMessage(client, thecall);
+        ssize_t ret;
+
+        /* Skip the calls sent already, such as the I/O thread's own */
+        if (thecall->mode != VIR_NET_CLIENT_MODE_WAIT_TX) {
+            thecall = thecall->next;
+            continue;
+        }
+
+        ret = virNetClientIOWriteMessage(client, thecall);
         if (ret < 0)
             return ret;
 
@@ -1231,11 +1264,10 @@ virNetClientIOReadMessage(virNetClientPtr client)
 
     /* Start by reading length word */
     if (client->msg.bufferLength == 0) {
-        client->msg.bufferLength = 4;
-        if (VIR_ALLOC_N(client->msg.buffer, client->msg.bufferLength) < 0) {
-            virReportOOMError();
+        if (virNetMessageReserveBuffer(&client->msg,
+                                       VIR_NET_MESSAGE_LEN_MAX) < 0)
             return -ENOMEM;
-        }
+        client->msg.bufferLength = VIR_NET_MESSAGE_LEN_MAX;
     }
 
     wantData = client->msg.bufferLength - client->msg.bufferOffset;
@@ -1355,12 +1387,61 @@ static bool virNetClientIOEventLoopPollEvents(virNetClientCallPtr call,
 }
 
 
+struct virNetClientIOEventLoopData {
+    virNetClientPtr client;
+    virNetClientCallPtr thiscall;
+};
+
+
+/*
+ * Invoke the callbacks of finished asynchronous calls. The lock is
+ * released around each of them, so they may queue more asynchronous
+ * calls, but they must not wait for a reply on this client, since
+ * they may be run by the thread holding the buck.
+ */
+static void
+virNetClientCallRunCompleted(virNetClientPtr client)
+{
+    virNetClientCallPtr call;
+
+    while ((call = virNetClientCallServe(&client->completed))) {
+        int status = call->mode == VIR_NET_CLIENT_MODE_COMPLETE ? 0 : -1;
+        virErrorPtr saved = virSaveLastError();
+
+        VIR_DEBUG("Running callback of call %p status=%d", call, status);
+        virObjectUnlock(client);
+
+        if (status < 0)
+            virReportError(VIR_ERR_RPC, "%s",
+                           _("connection closed before the call completed"));
+        else
+            virResetLastError();
+        (call->doneCb)(client, call->msg, status, call->doneOpaque);
+
+        /* Don't leak the callback's errors into the thread's own call */
+        if (saved) {
+            virSetError(saved);
+            virFreeError(saved);
+        } else {
+            virResetLastError();
+        }
+
+        virCondDestroy(&call->cond);
+        VIR_FREE(call);
+
+        virObjectLock(client);
+        /* Drop the reference held on behalf of the call */
+        virObjectUnref(client);
+    }
+}
+
+
 static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
                                               void *opaque)
 {
-    virNetClientCallPtr thiscall = opaque;
+    struct virNetClientIOEventLoopData *data = opaque;
 
-    if (call == thiscall)
+    if (call == data->thiscall)
         return false;
 
     if (call->mode != VIR_NET_CLIENT_MODE_COMPLETE)
@@ -1379,6 +1460,9 @@ static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
     if (call->haveThread) {
         VIR_DEBUG("Waking up sleep %p", call);
         virCondSignal(&call->cond);
+    } else if (call->doneCb) {
+        VIR_DEBUG("Completing asynchronous call %p", call);
+        virNetClientCallQueue(&data->client->completed, call);
     } else {
         VIR_DEBUG("Removing completed call %p", call);
         if (call->expectReply)
@@ -1404,11 +1488,18 @@ static bool
 virNetClientIOEventLoopRemoveAll(virNetClientCallPtr call,
                                  void *opaque)
 {
-    virNetClientCallPtr thiscall = opaque;
+    struct virNetClientIOEventLoopData *data = opaque;
 
-    if (call == thiscall)
+    if (call == data->thiscall)
         return false;
 
+    /* Asynchronous calls get to know they failed */
+    if (call->doneCb) {
+        VIR_DEBUG("Failing asynchronous call %p", call);
+        virNetClientCallQueue(&data->client->completed, call);
+        return true;
+    }
+
     VIR_DEBUG("Removing call %p", call);
     virCondDestroy(&call->cond);
     VIR_FREE(call->msg);
@@ -1437,10 +1528,13 @@ virNetClientIOEventLoopPassTheBuck(virNetClientPtr client,
 
     VIR_DEBUG("No thread to pass the buck to");
     if (client->wantClose) {
+        struct virNetClientIOEventLoopData data = { client, thiscall };
+
         virNetClientCloseLocked(client);
         virNetClientCallRemovePredicate(&client->waitDispatch,
                                         virNetClientIOEventLoopRemoveAll,
-                                        thiscall);
+                                        &data);
+        virNetClientCallRunCompleted(client);
     }
 }
 
@@ -1457,6 +1551,7 @@ static int virNetClientIOEventLoop(virNetClientPtr client,
                                    virNetClientCallPtr thiscall)
 {
     struct pollfd fds[2];
+    struct virNetClientIOEventLoopData data = { client, thiscall };
     int ret;
 
     fds[0].fd = virNetSocketGetFD(client->sock);
@@ -1583,7 +1678,8 @@ static int virNetClientIOEventLoop(virNetClientPtr client,
          */
         virNetClientCallRemovePredicate(&client->waitDispatch,
                                         virNetClientIOEventLoopRemoveDone,
-                                        thiscall);
+                                        &data);
+        virNetClientCallRunCompleted(client);
 
         /* Now see if *we* are done */
         if (thiscall->mode == VIR_NET_CLIENT_MODE_COMPLETE) {
@@ -1814,6 +1910,7 @@ void virNetClientIncomingEvent(virNetSocketPtr sock,
                                void *opaque)
 {
     virNetClientPtr client = opaque;
+    struct virNetClientIOEventLoopData data = { client, NULL };
 
     virObjectLock(client);
 
@@ -1851,12 +1948,21 @@ void virNetClientIncomingEvent(virNetSocketPtr sock,
     /* Remove completed calls or signal their threads. */
     virNetClientCallRemovePredicate(&client->waitDispatch,
                                     virNetClientIOEventLoopRemoveDone,
-                                    NULL);
+                                    &data);
+    virNetClientCallRunCompleted(client);
     virNetClientIOUpdateCallback(client, true);
 
 done:
-    if (client->wantClose)
+    if (client->wantClose) {
         virNetClientCloseLocked(client);
+        /* Nobody else is going to see the calls still queued */
+        if (!client->haveTheBuck) {
+            virNetClientCallRemovePredicate(&client->waitDispatch,
+                                            virNetClientIOEventLoopRemoveAll,
+                                            &data);
+            virNetClientCallRunCompleted(client);
+        }
+    }
     virObjectUnlock(client);
 }
 
@@ -2045,6 +2151,164 @@ int virNetClientSendNonBlock(virNetClientPtr client,
     return ret;
 }
 
+/*
+ * @msg: a message allocated on the heap
+ * @cb: called with the reply
+ * @opaque: data for @cb
+ *
+ * Queue a message and return without waiting for the reply.
+ * Replies are matched to calls by serial, so any number of calls
+ * can be outstanding at once. The messages are sent and the
+ * replies read by whichever thread holds the buck: the I/O thread
+ * if virNetClientStartIOThread was called, the event loop if
+ * virNetClientRegisterAsyncIO was, or a thread making a
+ * synchronous call.
+ *
+ * @cb gets @msg back with the reply in it and a status of 0, or a
+ * status of -1 with an error set if the connection was closed
+ * first. It is run with the client unlocked and must free @msg.
+ * See virNetClientCallRunCompleted for what it must not do.
+ *
+ * Returns 0 if the message was queued, in which case @msg belongs
+ * to the client until @cb is run, or -1 on failure.
+ */
+int virNetClientSendAsync(virNetClientPtr client,
+                          virNetMessagePtr msg,
+                          virNetClientCallDoneFunc cb,
+                          void *opaque)
+{
+    virNetClientCallPtr call;
+    int ret = -1;
+
+    virObjectLock(client);
+
+    PROBE(RPC_CLIENT_MSG_TX_QUEUE,
+          "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
+          client, msg->bufferLength,
+          msg->header.prog, msg->header.vers, msg->header.proc,
+          msg->header.type, msg->header.status, msg->header.serial);
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    /* Sent like a non-blocking call, but the reply is expected */
+    if (!(call = virNetClientCallNew(msg, false, true)))
+        goto cleanup;
+    call->expectReply = true;
+    call->doneCb = cb;
+    call->doneOpaque = opaque;
+    call->haveThread = true;
+
+    switch (virNetClientIO(client, call)) {
+    case 1:
+        /* Queued, someone else will complete it. Unless the
+         * connection was closed meanwhile, in which case nobody
+         * will look at the queue again */
+        if (!client->sock) {
+            virNetClientCallRemove(&client->waitDispatch, call);
+            virNetClientCallQueue(&client->completed, call);
+        }
+        ret = 0;
+        break;
+
+    case 0:
+        /* The reply came straight away */
+        virNetClientCallQueue(&client->completed, call);
+        ret = 0;
+        break;
+
+    default:
+        virCondDestroy(&call->cond);
+        VIR_FREE(call);
+        goto cleanup;
+    }
+
+    /* Held until the callback has run */
+    virObjectRef(client);
+    virNetClientCallRunCompleted(client);
+
+cleanup:
+    virObjectUnlock(client);
+    return ret;
+}
+
+
+static void
+virNetClientIOThread(void *opaque)
+{
+    virNetClientPtr client = opaque;
+    virNetClientCallPtr call = NULL;
+    virNetMessagePtr msg = NULL;
+
+    virObjectLock(client);
+
+    /* A call that never completes, so that this thread keeps the
+     * buck until the connection is closed */
+    if (!(msg = virNetMessageNew(false)) ||
+        !(call = virNetClientCallNew(msg, false, false)))
+        goto cleanup;
+    call->haveThread = true;
+
+    VIR_DEBUG("I/O thread of client %p started", client);
+    ignore_value(virNetClientIO(client, call));
+    VIR_DEBUG("I/O thread of client %p exiting", client);
+
+    virCondDestroy(&call->cond);
+    VIR_FREE(call);
+
+cleanup:
+    client->haveIOThread = false;
+    virNetMessageFree(msg);
+    virObjectUnlock(client);
+    virObjectUnref(client);
+}
+
+
+/*
+ * Start a thread dedicated to sending calls and reading replies
+ * until the client is closed, so that neither a caller nor the
+ * event loop has to. Must be called once any TLS or SASL
+ * handshake is over.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int virNetClientStartIOThread(virNetClientPtr client)
+{
+    virThread thread;
+    int ret = -1;
+
+    virObjectLock(client);
+
+    if (client->haveIOThread) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    virObjectRef(client);
+    if (virThreadCreate(&thread, false, virNetClientIOThread, client) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create client I/O thread"));
+        virObjectUnref(client);
+        goto cleanup;
+    }
+    client->haveIOThread = true;
+    ret = 0;
+
+cleanup:
+    virObjectUnlock(client);
+    return ret;
+}
+
+
 /*
  * @msg: a message allocated on heap or stack
  *
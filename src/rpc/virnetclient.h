@@ -85,6 +85,8 @@ bool virNetClientHasPassFD(virNetClientPtr client);
 int virNetClientAddProgram(virNetClientPtr client,
                            virNetClientProgramPtr prog);
 
+void virNetClientSetStreamWindow(virNetClientPtr client,
+                                 size_t window);
 int virNetClientAddStream(virNetClientPtr client,
                           virNetClientStreamPtr st);
 
@@ -104,6 +106,18 @@ int virNetClientSendWithReplyStream(virNetClientPtr client,
                                     virNetMessagePtr msg,
                                     virNetClientStreamPtr st);
 
+typedef void (*virNetClientCallDoneFunc)(virNetClientPtr client,
+                                         virNetMessagePtr msg,
+                                         int status,
+                                         void *opaque);
+
+int virNetClientSendAsync(virNetClientPtr client,
+                          virNetMessagePtr msg,
+                          virNetClientCallDoneFunc cb,
+                          void *opaque);
+
+int virNetClientStartIOThread(virNetClientPtr client);
+
 # ifdef WITH_SASL
 void virNetClientSetSASLSession(virNetClientPtr client,
                                 virNetSASLSessionPtr sasl);
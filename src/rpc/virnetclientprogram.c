@@ -268,27 +268,19 @@ cleanup:
 }
 
 
-int virNetClientProgramCall(virNetClientProgramPtr prog,
-                            virNetClientPtr client,
-                            unsigned serial,
-                            int proc,
-                            size_t noutfds,
-                            int *outfds,
-                            size_t *ninfds,
-                            int **infds,
-                            xdrproc_t args_filter, void *args,
-                            xdrproc_t ret_filter, void *ret)
+static virNetMessagePtr
+virNetClientProgramNewCall(virNetClientProgramPtr prog,
+                           unsigned serial,
+                           int proc,
+                           size_t noutfds,
+                           int *outfds,
+                           xdrproc_t args_filter, void *args)
 {
     virNetMessagePtr msg;
     size_t i;
 
-    if (infds)
-        *infds = NULL;
-    if (ninfds)
-        *ninfds = 0;
-
     if (!(msg = virNetMessageNew(false)))
-        return -1;
+        return NULL;
 
     msg->header.prog = prog->program;
     msg->header.vers = prog->version;
@@ -328,8 +320,24 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
     if (virNetMessageEncodePayload(msg, args_filter, args) < 0)
         goto error;
 
-    if (virNetClientSendWithReply(client, msg) < 0)
-        goto error;
+    return msg;
+
+error:
+    virNetMessageFree(msg);
+    return NULL;
+}
+
+
+static int
+virNetClientProgramDecodeReply(virNetClientProgramPtr prog,
+                               virNetMessagePtr msg,
+                               unsigned serial,
+                               int proc,
+                               size_t *ninfds,
+                               int **infds,
+                               xdrproc_t ret_filter, void *ret)
+{
+    size_t i;
 
     /* None of these 3 should ever happen here, because
      * virNetClientSend should have validated the reply,
@@ -394,15 +402,134 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
         goto error;
     }
 
-    virNetMessageFree(msg);
-
     return 0;
 
 error:
-    virNetMessageFree(msg);
     if (infds && ninfds) {
         for (i = 0 ; i < *ninfds ; i++)
             VIR_FORCE_CLOSE((*infds)[i]);
     }
     return -1;
 }
+
+
+int virNetClientProgramCall(virNetClientProgramPtr prog,
+                            virNetClientPtr client,
+                            unsigned serial,
+                            int proc,
+                            size_t noutfds,
+                            int *outfds,
+                            size_t *ninfds,
+                            int **infds,
+                            xdrproc_t args_filter, void *args,
+                            xdrproc_t ret_filter, void *ret)
+{
+    virNetMessagePtr msg;
+    int rv = -1;
+
+    if (infds)
+        *infds = NULL;
+    if (ninfds)
+        *ninfds = 0;
+
+    if (!(msg = virNetClientProgramNewCall(prog, serial, proc,
+                                           noutfds, outfds,
+                                           args_filter, args)))
+        return -1;
+
+    if (virNetClientSendWithReply(client, msg) < 0)
+        goto cleanup;
+
+    rv = virNetClientProgramDecodeReply(prog, msg, serial, proc,
+                                        ninfds, infds, ret_filter, ret);
+
+cleanup:
+    virNetMessageFree(msg);
+    return rv;
+}
+
+
+struct virNetClientProgramAsyncCall {
+    virNetClientProgramPtr prog;
+    unsigned serial;
+    int proc;
+    xdrproc_t ret_filter;
+    void *ret;
+    virNetClientProgramCallFunc cb;
+    void *opaque;
+};
+
+
+static void
+virNetClientProgramCallDone(virNetClientPtr client,
+                            virNetMessagePtr msg,
+                            int status,
+                            void *opaque)
+{
+    struct virNetClientProgramAsyncCall *call = opaque;
+    int rv = status;
+
+    if (rv == 0)
+        rv = virNetClientProgramDecodeReply(call->prog, msg,
+                                            call->serial, call->proc,
+                                            NULL, NULL,
+                                            call->ret_filter, call->ret);
+    virNetMessageFree(msg);
+
+    (call->cb)(call->prog, client, rv, call->opaque);
+
+    virObjectUnref(call->prog);
+    VIR_FREE(call);
+}
+
+
+/*
+ * Like virNetClientProgramCall, without passing FDs, but returns as
+ * soon as the call is queued. @ret must stay valid until @cb has
+ * been run with the outcome: 0 if @ret was filled in, -1 with an
+ * error set otherwise. See virNetClientSendAsync for the context
+ * @cb is run in.
+ *
+ * Returns 0 if the call was queued, -1 on failure, in which case
+ * @cb is not run.
+ */
+int virNetClientProgramCallAsync(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 int proc,
+                                 xdrproc_t args_filter, void *args,
+                                 xdrproc_t ret_filter, void *ret,
+                                 virNetClientProgramCallFunc cb,
+                                 void *opaque)
+{
+    struct virNetClientProgramAsyncCall *call;
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetClientProgramNewCall(prog, serial, proc, 0, NULL,
+                                           args_filter, args)))
+        return -1;
+
+    if (VIR_ALLOC(call) < 0) {
+        virReportOOMError();
+        virNetMessageFree(msg);
+        return -1;
+    }
+
+    call->prog = virObjectRef(prog);
+    call->serial = serial;
+    call->proc = proc;
+    call->ret_filter = ret_filter;
+    call->ret = ret;
+    call->cb = cb;
+    call->opaque = opaque;
+
+    if (virNetClientSendAsync(client, msg,
+                              virNetClientProgramCallDone, call) < 0) {
+        virNetMessageFree(msg);
+        virObjectUnref(call->prog);
+        VIR_FREE(call);
+        return -1;
+    }
+
+    return 0;
+}
@@ -40,17 +40,24 @@ struct _virNetClientStream {
 
     virError err;
 
-    /* XXX this buffer is unbounded if the client
-     * app has domain events registered, since packets
-     * may be read off wire, while app isn't ready to
-     * recv them. Figure out how to address this some
-     * time by stopping consuming any incoming data
-     * off the socket....
+    /* Data packets read off the wire before the app is ready
+     * to recv them, in order, and the number of bytes they hold.
+     * Unless the server honours the credit granted below, this
+     * queue is unbounded.  Holes are queued along with the data,
+     * and the one being read is moved to 'holeLength'.
      */
-    char *incoming;
-    size_t incomingOffset;
+    virNetMessagePtr incoming;
     size_t incomingLength;
     bool incomingEOF;
+    unsigned long long holeLength;
+
+    /* Credit based flow control: the server sends no more than
+     * 'granted' bytes in total, and more is granted as the data is
+     * consumed, keeping up to 'window' bytes queued.  A zero window
+     * means the server doesn't support it */
+    size_t window;
+    unsigned long long consumed;
+    unsigned long long granted;
 
     virNetClientStreamEventCallback cb;
     void *cbOpaque;
@@ -84,9 +91,9 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
     if (!st->cb)
         return;
 
-    VIR_DEBUG("Check timer offset=%zu %d", st->incomingOffset, st->cbEvents);
+    VIR_DEBUG("Check timer length=%zu %d", st->incomingLength, st->cbEvents);
 
-    if (((st->incomingOffset || st->incomingEOF) &&
+    if (((st->incoming || st->holeLength || st->incomingEOF) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -108,13 +115,13 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->incomingOffset || st->incomingEOF))
+        (st->incoming || st->holeLength || st->incomingEOF))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
         events |= VIR_STREAM_EVENT_WRITABLE;
 
-    VIR_DEBUG("Got Timer dispatch %d %d offset=%zu", events, st->cbEvents, st->incomingOffset);
+    VIR_DEBUG("Got Timer dispatch %d %d length=%zu", events, st->cbEvents, st->incomingLength);
     if (events) {
         virNetClientStreamEventCallback cb = st->cb;
         void *cbOpaque = st->cbOpaque;
@@ -154,12 +161,32 @@ virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
     return st;
 }
 
+/*
+ * Have the server send no more than @window bytes of data ahead of
+ * what the app consumed.  Must only be used if the server supports
+ * VIR_DRV_FEATURE_STREAM_CREDIT, and before any data arrives.
+ */
+void virNetClientStreamSetWindow(virNetClientStreamPtr st,
+                                 size_t window)
+{
+    virObjectLock(st);
+    /* The server starts out with the initial credit anyway */
+    if (window < VIR_NET_STREAM_CREDIT_INITIAL)
+        window = VIR_NET_STREAM_CREDIT_INITIAL;
+    st->window = window;
+    st->granted = VIR_NET_STREAM_CREDIT_INITIAL;
+    virObjectUnlock(st);
+}
+
 void virNetClientStreamDispose(void *obj)
 {
     virNetClientStreamPtr st = obj;
 
     virResetError(&st->err);
-    VIR_FREE(st->incoming);
+    while (st->incoming) {
+        virNetMessagePtr msg = virNetMessageQueueServe(&st->incoming);
+        virNetMessageFree(msg);
+    }
     virObjectUnref(st->prog);
 }
 
@@ -259,6 +286,10 @@ cleanup:
 }
 
 
+/*
+ * Queue the data of @msg until the app reads it.  The buffer of @msg
+ * is taken over rather than copied.
+ */
 int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
                                   virNetMessagePtr msg)
 {
@@ -268,28 +299,30 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
     virObjectLock(st);
     need = msg->bufferLength - msg->bufferOffset;
     if (need) {
-        size_t avail = st->incomingLength - st->incomingOffset;
-        if (need > avail) {
-            size_t extra = need - avail;
-            if (VIR_REALLOC_N(st->incoming,
-                              st->incomingLength + extra) < 0) {
-                VIR_DEBUG("Out of memory handling stream data");
-                goto cleanup;
-            }
-            st->incomingLength += extra;
+        virNetMessagePtr tmp;
+
+        if (!(tmp = virNetMessageNew(false))) {
+            VIR_DEBUG("Out of memory handling stream data");
+            goto cleanup;
         }
 
-        memcpy(st->incoming + st->incomingOffset,
-               msg->buffer + msg->bufferOffset,
-               msg->bufferLength - msg->bufferOffset);
-        st->incomingOffset += (msg->bufferLength - msg->bufferOffset);
+        tmp->header = msg->header;
+        tmp->buffer = msg->buffer;
+        tmp->bufferSize = msg->bufferSize;
+        tmp->bufferLength = msg->bufferLength;
+        tmp->bufferOffset = msg->bufferOffset;
+        msg->buffer = NULL;
+        msg->bufferSize = msg->bufferLength = msg->bufferOffset = 0;
+
+        virNetMessageQueuePush(&st->incoming, tmp);
+        if (tmp->header.type != VIR_NET_STREAM_HOLE)
+            st->incomingLength += need;
     } else {
         st->incomingEOF = true;
     }
 
-    VIR_DEBUG("Stream incoming data offset %zu length %zu EOF %d",
-              st->incomingOffset, st->incomingLength,
-              st->incomingEOF);
+    VIR_DEBUG("Stream incoming data length %zu EOF %d",
+              st->incomingLength, st->incomingEOF);
     virNetClientStreamEventTimerUpdate(st);
 
     ret = 0;
@@ -330,7 +363,9 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
      * need a synchronous confirmation
      */
     if (status == VIR_NET_CONTINUE) {
-        if (virNetMessageEncodePayloadRaw(msg, data, nbytes) < 0)
+        /* NoReply waits for the message to be sent, so the data
+         * can be written straight from the caller's buffer */
+        if (virNetMessageEncodePayloadRawRef(msg, data, nbytes) < 0)
             goto error;
 
         if (virNetClientSendNoReply(client, msg) < 0)
@@ -353,17 +388,148 @@ error:
     return -1;
 }
 
+/*
+ * Tell the server it may send up to @limit bytes of stream data
+ * in total.
+ */
+static int
+virNetClientStreamSendCredit(virNetClientStreamPtr st,
+                             virNetClientPtr client,
+                             unsigned long long limit)
+{
+    virNetMessagePtr msg;
+    virNetStreamCredit credit;
+    int ret;
+
+    VIR_DEBUG("st=%p limit=%llu", st, limit);
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    virObjectLock(st);
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_OK;
+    msg->header.type = VIR_NET_STREAM_CREDIT;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virObjectUnlock(st);
+
+    credit.limit = limit;
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamCredit,
+                                   &credit) < 0)
+        goto error;
+
+    /* Like keepalive pings, this must not block the caller, and
+     * is sent along with the next I/O if it can't go right away */
+    if ((ret = virNetClientSendNonBlock(client, msg)) < 0)
+        goto error;
+    if (ret == 0)
+        virNetMessageFree(msg);
+
+    return 0;
+
+error:
+    virNetMessageFree(msg);
+    return -1;
+}
+
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags)
+{
+    virNetMessagePtr msg;
+    virNetStreamHole data;
+
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    virObjectLock(st);
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_CONTINUE;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virObjectUnlock(st);
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    /* Fire & forget, like data packets */
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0 ||
+        virNetClientSendNoReply(client, msg) < 0)
+        goto error;
+
+    virNetMessageFree(msg);
+    return 0;
+
+error:
+    virNetMessageFree(msg);
+    return -1;
+}
+
+
+/*
+ * Move the hole at the head of the incoming queue, if any, to
+ * 'holeLength', unless the previous one is still being read.
+ */
+static int
+virNetClientStreamTakeHole(virNetClientStreamPtr st)
+{
+    virNetMessagePtr msg = st->incoming;
+    virNetStreamHole data;
+
+    if (st->holeLength || !msg ||
+        msg->header.type != VIR_NET_STREAM_HOLE)
+        return 0;
+
+    memset(&data, 0, sizeof(data));
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    virNetMessageQueueServe(&st->incoming);
+    virNetMessageFree(msg);
+
+    if (data.length < 0) {
+        virReportError(VIR_ERR_RPC,
+                       _("invalid stream hole length %lld"),
+                       (long long) data.length);
+        return -1;
+    }
+    st->holeLength = data.length;
+
+    return 0;
+}
+
+
 int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock)
+                                 bool nonblock,
+                                 unsigned int flags)
 {
     int rv = -1;
-    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
-              st, client, data, nbytes, nonblock);
+    size_t got = 0;
+    size_t gotData = 0;
+    unsigned long long credit = 0;
+    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d flags=%x",
+              st, client, data, nbytes, nonblock, flags);
     virObjectLock(st);
-    if (!st->incomingOffset && !st->incomingEOF) {
+    if (!st->incoming && !st->holeLength && !st->incomingEOF) {
         virNetMessagePtr msg;
         int ret;
 
@@ -395,32 +561,92 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             goto cleanup;
     }
 
-    VIR_DEBUG("After IO %zu", st->incomingOffset);
-    if (st->incomingOffset) {
-        int want = st->incomingOffset;
-        if (want > nbytes)
-            want = nbytes;
-        memcpy(data, st->incoming, want);
-        if (want < st->incomingOffset) {
-            memmove(st->incoming, st->incoming + want, st->incomingOffset - want);
-            st->incomingOffset -= want;
-        } else {
-            VIR_FREE(st->incoming);
-            st->incomingOffset = st->incomingLength = 0;
+    VIR_DEBUG("After IO %zu", st->incomingLength);
+    while (got < nbytes) {
+        virNetMessagePtr msg;
+        size_t want;
+
+        if (virNetClientStreamTakeHole(st) < 0)
+            goto cleanup;
+
+        /* Holes read as zeros, unless the caller handles them */
+        if (st->holeLength) {
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                if (!got) {
+                    rv = -3;
+                    goto cleanup;
+                }
+                break;
+            }
+            want = MIN(nbytes - got, st->holeLength);
+            memset(data + got, 0, want);
+            st->holeLength -= want;
+            got += want;
+            continue;
+        }
+
+        if (!(msg = st->incoming))
+            break;
+
+        want = msg->bufferLength - msg->bufferOffset;
+        if (want > nbytes - got)
+            want = nbytes - got;
+        memcpy(data + got, msg->buffer + msg->bufferOffset, want);
+        msg->bufferOffset += want;
+        st->incomingLength -= want;
+        got += want;
+        gotData += want;
+
+        if (msg->bufferOffset == msg->bufferLength) {
+            virNetMessageQueueServe(&st->incoming);
+            virNetMessageFree(msg);
         }
-        rv = want;
-    } else {
-        rv = 0;
+    }
+    rv = got;
+
+    /* Grant more credit once half the window has been consumed,
+     * rather than after every read.  Holes don't count. */
+    st->consumed += gotData;
+    if (st->window &&
+        st->consumed + st->window - st->granted >= st->window / 2) {
+        st->granted = st->consumed + st->window;
+        credit = st->granted;
     }
 
     virNetClientStreamEventTimerUpdate(st);
 
 cleanup:
     virObjectUnlock(st);
+    if (credit &&
+        virNetClientStreamSendCredit(st, client, credit) < 0)
+        rv = -1;
     return rv;
 }
 
 
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length)
+{
+    int ret = -1;
+
+    virObjectLock(st);
+
+    if (virNetClientStreamTakeHole(st) < 0)
+        goto cleanup;
+
+    *length = st->holeLength;
+    st->holeLength = 0;
+    VIR_DEBUG("st=%p length=%lld", st, *length);
+
+    virNetClientStreamEventTimerUpdate(st);
+    ret = 0;
+
+cleanup:
+    virObjectUnlock(st);
+    return ret;
+}
+
+
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
                                        virNetClientStreamEventCallback cb,
@@ -29,14 +29,133 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "virutil.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Initial size of the buffer for outgoing messages */
+#define VIR_NET_MESSAGE_INITIAL 16384
+
+/* Every RPC call needs a message and one or two buffers, the
+ * largest of which is several MB. Rather than going back to
+ * malloc each time, recently freed ones are kept for reuse */
+#define VIR_NET_MESSAGE_POOL_MAX 64
+
+struct virNetMessagePoolClass {
+    size_t size;
+    size_t keep;
+    size_t nfree;
+    char *free[VIR_NET_MESSAGE_POOL_MAX];
+};
+
+/* Most messages fit in the smallest class, the largest can hold
+ * any message the protocol allows */
+static struct virNetMessagePoolClass virNetMessagePoolClasses[] = {
+    { 16 * 1024, 64, 0, { NULL } },
+    { 256 * 1024, 16, 0, { NULL } },
+    { VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX, 2, 0, { NULL } },
+};
+
+static virMutex virNetMessagePoolLock;
+static virNetMessagePtr virNetMessagePoolMsgs;
+static size_t virNetMessagePoolNMsgs;
+
+static int virNetMessagePoolOnceInit(void)
+{
+    if (virMutexInit(&virNetMessagePoolLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize message pool mutex"));
+        return -1;
+    }
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetMessagePool)
+
+
+static struct virNetMessagePoolClass *
+virNetMessagePoolClassForSize(size_t len)
+{
+    size_t i;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(virNetMessagePoolClasses) ; i++) {
+        if (len <= virNetMessagePoolClasses[i].size)
+            return &virNetMessagePoolClasses[i];
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Returns a buffer of at least @len bytes, storing its real
+ * size in @size. The contents of the buffer are undefined.
+ */
+static char *
+virNetMessagePoolGetBuffer(size_t len, size_t *size)
+{
+    struct virNetMessagePoolClass *klass;
+    char *buf = NULL;
+
+    if ((klass = virNetMessagePoolClassForSize(len))) {
+        len = klass->size;
+
+        virMutexLock(&virNetMessagePoolLock);
+        if (klass->nfree)
+            buf = klass->free[--klass->nfree];
+        virMutexUnlock(&virNetMessagePoolLock);
+    }
+
+    if (!buf &&
+        VIR_ALLOC_N(buf, len) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    *size = len;
+    return buf;
+}
+
+
+static void
+virNetMessagePoolPutBuffer(char *buf, size_t size)
+{
+    struct virNetMessagePoolClass *klass;
+
+    if (!buf)
+        return;
+
+    if ((klass = virNetMessagePoolClassForSize(size)) &&
+        klass->size == size) {
+        virMutexLock(&virNetMessagePoolLock);
+        if (klass->nfree < klass->keep) {
+            klass->free[klass->nfree++] = buf;
+            buf = NULL;
+        }
+        virMutexUnlock(&virNetMessagePoolLock);
+    }
+
+    VIR_FREE(buf);
+}
+
+
 virNetMessagePtr virNetMessageNew(bool tracked)
 {
-    virNetMessagePtr msg;
+    virNetMessagePtr msg = NULL;
 
-    if (VIR_ALLOC(msg) < 0) {
+    if (virNetMessagePoolInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&virNetMessagePoolLock);
+    if ((msg = virNetMessagePoolMsgs)) {
+        virNetMessagePoolMsgs = msg->next;
+        virNetMessagePoolNMsgs--;
+    }
+    virMutexUnlock(&virNetMessagePoolLock);
+
+    if (msg) {
+        memset(msg, 0, sizeof(*msg));
+    } else if (VIR_ALLOC(msg) < 0) {
         virReportOOMError();
         return NULL;
     }
@@ -48,6 +167,58 @@ virNetMessagePtr virNetMessageNew(bool tracked)
 }
 
 
+/*
+ * @msg: the message whose buffer to grow
+ * @len: the number of bytes needed
+ *
+ * Makes sure the buffer of @msg can hold at least @len bytes,
+ * preserving the first bufferLength bytes of its contents. The
+ * bufferLength and bufferOffset fields are left alone.
+ *
+ * returns 0 on success, -1 upon OOM
+ */
+int virNetMessageReserveBuffer(virNetMessagePtr msg,
+                               size_t len)
+{
+    char *buf;
+    size_t size;
+
+    if (msg->buffer && msg->bufferSize >= len)
+        return 0;
+
+    if (virNetMessagePoolInitialize() < 0)
+        return -1;
+
+    if (!(buf = virNetMessagePoolGetBuffer(len, &size)))
+        return -1;
+
+    if (msg->buffer) {
+        memcpy(buf, msg->buffer, msg->bufferLength);
+        virNetMessagePoolPutBuffer(msg->buffer, msg->bufferSize);
+    }
+
+    msg->buffer = buf;
+    msg->bufferSize = size;
+    return 0;
+}
+
+
+/*
+ * @msg: the message whose buffer to release
+ *
+ * Hands the buffer of @msg back for reuse and forgets about
+ * any attached raw payload
+ */
+void virNetMessageReleaseBuffer(virNetMessagePtr msg)
+{
+    virNetMessagePoolPutBuffer(msg->buffer, msg->bufferSize);
+    msg->buffer = NULL;
+    msg->bufferSize = msg->bufferLength = msg->bufferOffset = 0;
+    msg->payload = NULL;
+    msg->payloadLength = msg->payloadOffset = 0;
+}
+
+
 void virNetMessageClear(virNetMessagePtr msg)
 {
     bool tracked = msg->tracked;
@@ -58,7 +229,7 @@ void virNetMessageClear(virNetMessagePtr msg)
     for (i = 0 ; i < msg->nfds ; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
     VIR_FREE(msg->fds);
-    VIR_FREE(msg->buffer);
+    virNetMessageReleaseBuffer(msg);
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
 }
@@ -77,8 +248,19 @@ void virNetMessageFree(virNetMessagePtr msg)
 
     for (i = 0 ; i < msg->nfds ; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
-    VIR_FREE(msg->buffer);
+    virNetMessageReleaseBuffer(msg);
     VIR_FREE(msg->fds);
+
+    /* Messages can only be created once the pool is initialized */
+    virMutexLock(&virNetMessagePoolLock);
+    if (virNetMessagePoolNMsgs < VIR_NET_MESSAGE_POOL_MAX) {
+        msg->next = virNetMessagePoolMsgs;
+        virNetMessagePoolMsgs = msg;
+        virNetMessagePoolNMsgs++;
+        msg = NULL;
+    }
+    virMutexUnlock(&virNetMessagePoolLock);
+
     VIR_FREE(msg);
 }
 
@@ -142,11 +324,9 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
 
     /* Extend our declared buffer length and carry
        on reading the header + payload */
-    msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageReserveBuffer(msg, msg->bufferLength + len) < 0)
         goto cleanup;
-    }
+    msg->bufferLength += len;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
               msg->bufferLength, len);
@@ -221,12 +401,14 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-        virReportOOMError();
+    /* Start small, the buffer is grown if the payload doesn't fit */
+    msg->bufferLength = 0;
+    if (virNetMessageReserveBuffer(msg, VIR_NET_MESSAGE_INITIAL) < 0)
         return ret;
-    }
+    msg->bufferLength = msg->bufferSize;
     msg->bufferOffset = 0;
+    msg->payload = NULL;
+    msg->payloadLength = msg->payloadOffset = 0;
 
     /* Format the header. */
     xdrmem_create(&xdr,
@@ -351,9 +533,28 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
     xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
                   msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
 
-    if (!(*filter)(&xdr, data)) {
-        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
-        goto error;
+    /* The buffer starts out small, so on failure retry with a bigger
+     * one until we hit the protocol limit */
+    while (!(*filter)(&xdr, data)) {
+        size_t newlen = msg->bufferLength * 4;
+
+        if (msg->bufferLength >= VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX) {
+            virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
+            goto error;
+        }
+
+        xdr_destroy(&xdr);
+
+        if (newlen > VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX)
+            newlen = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX;
+
+        VIR_DEBUG("Growing message buffer to %zu", newlen);
+        if (virNetMessageReserveBuffer(msg, newlen) < 0)
+            return -1;
+        msg->bufferLength = msg->bufferSize;
+
+        xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
+                      msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
     }
 
     /* Get the length stored in buffer. */
@@ -415,14 +616,25 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
     XDR xdr;
     unsigned int msglen;
 
-    if ((msg->bufferLength - msg->bufferOffset) < len) {
+    if (len > VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX - msg->bufferOffset) {
         virReportError(VIR_ERR_RPC,
                     _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
-                    len, (msg->bufferLength - msg->bufferOffset));
+                    len, (VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX -
+                          msg->bufferOffset));
         return -1;
     }
 
-    memcpy(msg->buffer + msg->bufferOffset, data, len);
+    /* The data is already in place if it was read into the space
+     * handed out by virNetMessageReservePayloadRaw */
+    if (data != msg->buffer + msg->bufferOffset) {
+        if (msg->bufferLength - msg->bufferOffset < len) {
+            if (virNetMessageReserveBuffer(msg, msg->bufferOffset + len) < 0)
+                return -1;
+            msg->bufferLength = msg->bufferSize;
+        }
+
+        memcpy(msg->buffer + msg->bufferOffset, data, len);
+    }
     msg->bufferOffset += len;
 
     /* Re-encode the length word. */
@@ -445,6 +657,145 @@ error:
 }
 
 
+/*
+ * @msg: the outgoing message, whose payload to reference
+ * @data: the raw stream data
+ * @len: the length of @data
+ *
+ * Like virNetMessageEncodePayloadRaw, but rather than copying
+ * @data into the message buffer, it is written to the socket
+ * straight from the caller's memory after the header. The
+ * caller must keep @data valid until the message is sent.
+ *
+ * returns 0 if successfully encoded, -1 upon fatal error
+ */
+int virNetMessageEncodePayloadRawRef(virNetMessagePtr msg,
+                                     const char *data,
+                                     size_t len)
+{
+    XDR xdr;
+    unsigned int msglen;
+
+    if (len > VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX - msg->bufferOffset) {
+        virReportError(VIR_ERR_RPC,
+                    _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
+                    len, (VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX -
+                          msg->bufferOffset));
+        return -1;
+    }
+
+    /* Re-encode the length word, covering the referenced data */
+    VIR_DEBUG("Encode length as %zu", msg->bufferOffset + len);
+    xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
+    msglen = msg->bufferOffset + len;
+    if (!xdr_u_int(&xdr, &msglen)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
+        goto error;
+    }
+    xdr_destroy(&xdr);
+
+    msg->bufferLength = msg->bufferOffset;
+    msg->bufferOffset = 0;
+    msg->payload = data;
+    msg->payloadLength = len;
+    msg->payloadOffset = 0;
+    return 0;
+
+error:
+    xdr_destroy(&xdr);
+    return -1;
+}
+
+
+/*
+ * @msg: a new outgoing stream message
+ * @len: the amount of raw stream data to make room for
+ *
+ * Returns a pointer into the buffer of @msg where up to @len
+ * bytes of stream data can be placed, so that a subsequent
+ * virNetMessageEncodeHeader and virNetMessageEncodePayloadRaw
+ * on the same memory does not need to copy it. Stream messages
+ * have a fixed size header, so the data position is known
+ * before the header is encoded.
+ *
+ * returns NULL upon OOM
+ */
+char *virNetMessageReservePayloadRaw(virNetMessagePtr msg,
+                                     size_t len)
+{
+    size_t offset = VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX;
+
+    if (len > VIR_NET_MESSAGE_PAYLOAD_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("Stream data too long to send (%zu bytes needed, %d bytes available)"),
+                       len, VIR_NET_MESSAGE_PAYLOAD_MAX);
+        return NULL;
+    }
+
+    msg->bufferLength = 0;
+    if (virNetMessageReserveBuffer(msg, offset + len) < 0)
+        return NULL;
+
+    return msg->buffer + offset;
+}
+
+
+/*
+ * @msg: the outgoing message
+ * @iov: array of at least two elements to fill
+ *
+ * Fills @iov with the parts of @msg which remain to be sent
+ *
+ * returns the number of elements of @iov used
+ */
+int virNetMessageGetTxIOV(virNetMessagePtr msg,
+                          struct iovec *iov)
+{
+    int niov = 0;
+
+    if (msg->bufferOffset < msg->bufferLength) {
+        iov[niov].iov_base = msg->buffer + msg->bufferOffset;
+        iov[niov].iov_len = msg->bufferLength - msg->bufferOffset;
+        niov++;
+    }
+
+    if (msg->payloadOffset < msg->payloadLength) {
+        iov[niov].iov_base = (char *)msg->payload + msg->payloadOffset;
+        iov[niov].iov_len = msg->payloadLength - msg->payloadOffset;
+        niov++;
+    }
+
+    return niov;
+}
+
+
+/*
+ * @msg: the outgoing message
+ * @len: number of bytes written
+ *
+ * Records that @len more bytes of @msg have been sent
+ *
+ * returns true once the whole message has been sent
+ */
+bool virNetMessageTxAdvance(virNetMessagePtr msg,
+                            size_t len)
+{
+    size_t done = MIN(len, msg->bufferLength - msg->bufferOffset);
+
+    msg->bufferOffset += done;
+    msg->payloadOffset += len - done;
+
+    return virNetMessageTxDone(msg);
+}
+
+
+bool virNetMessageTxDone(virNetMessagePtr msg)
+{
+    return msg->bufferOffset == msg->bufferLength &&
+        msg->payloadOffset == msg->payloadLength;
+}
+
+
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
 {
     XDR xdr;
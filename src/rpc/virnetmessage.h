@@ -21,6 +21,8 @@
 #ifndef __VIR_NET_MESSAGE_H__
 # define __VIR_NET_MESSAGE_H__
 
+# include <sys/uio.h>
+
 # include "virnetprotocol.h"
 
 typedef struct virNetMessageHeader *virNetMessageHeaderPtr;
@@ -34,10 +36,16 @@ typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 struct _virNetMessage {
     bool tracked;
 
-    char *buffer; /* Typically VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX */
+    char *buffer; /* At most VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX */
+    size_t bufferSize; /* Allocated size of buffer */
     size_t bufferLength;
     size_t bufferOffset;
 
+    /* Raw stream data sent after buffer, owned by the caller */
+    const char *payload;
+    size_t payloadLength;
+    size_t payloadOffset;
+
     virNetMessageHeader header;
 
     virNetMessageFreeCallback cb;
@@ -55,6 +63,12 @@ virNetMessagePtr virNetMessageNew(bool tracked);
 
 void virNetMessageClear(virNetMessagePtr);
 
+int virNetMessageReserveBuffer(virNetMessagePtr msg,
+                               size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+void virNetMessageReleaseBuffer(virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1);
+
 void virNetMessageFree(virNetMessagePtr msg);
 
 virNetMessagePtr virNetMessageQueueServe(virNetMessagePtr *queue)
@@ -86,9 +100,25 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
                                   const char *buf,
                                   size_t len)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageEncodePayloadRawRef(virNetMessagePtr msg,
+                                     const char *buf,
+                                     size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+char *virNetMessageReservePayloadRaw(virNetMessagePtr msg,
+                                     size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+int virNetMessageGetTxIOV(virNetMessagePtr msg,
+                          struct iovec *iov)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+bool virNetMessageTxAdvance(virNetMessagePtr msg,
+                            size_t len)
+    ATTRIBUTE_NONNULL(1);
+bool virNetMessageTxDone(virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1);
+
 void virNetMessageSaveError(virNetMessageErrorPtr rerr)
     ATTRIBUTE_NONNULL(1);
 
@@ -92,6 +92,12 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *  - type == VIR_NET_STREAM
  *      * serial matches that from the corresponding VIR_NET_CALL
  *
+ *  - type == VIR_NET_STREAM_CREDIT
+ *      * serial matches that from the corresponding VIR_NET_CALL
+ *
+ *  - type == VIR_NET_STREAM_HOLE
+ *      * serial matches that from the corresponding VIR_NET_CALL
+ *
  * and the 'status' field varies according to:
  *
  *  - type == VIR_NET_CALL
@@ -109,6 +115,12 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * VIR_NET_OK if stream is complete
  *     * VIR_NET_ERROR if stream had an error
  *
+ *  - type == VIR_NET_STREAM_CREDIT
+ *     * VIR_NET_OK always
+ *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * VIR_NET_CONTINUE always
+ *
  * Payload varies according to type and status:
  *
  *  - type == VIR_NET_CALL
@@ -132,6 +144,12 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * status == VIR_NET_OK
  *          <empty>
  *
+ *  - type == VIR_NET_STREAM_CREDIT
+ *          virNetStreamCredit  new limit on the stream data
+ *
+ *  - type == VIR_NET_STREAM_HOLE
+ *          virNetStreamHole  length of the hole in the stream data
+ *
  *  - type == VIR_NET_CALL_WITH_FDS
  *          int8 - number of FDs
  *          XXX_args  for procedure
@@ -156,7 +174,11 @@ enum virNetMessageType {
     /* client -> server. args from a method call, with passed FDs */
     VIR_NET_CALL_WITH_FDS = 4,
     /* server -> client. reply/error from a method call, with passed FDs */
-    VIR_NET_REPLY_WITH_FDS = 5
+    VIR_NET_REPLY_WITH_FDS = 5,
+    /* client -> server. more room for data of a stream from the server */
+    VIR_NET_STREAM_CREDIT = 6,
+    /* client <-> server. a hole in the data of a sparse stream */
+    VIR_NET_STREAM_HOLE = 7
 };
 
 enum virNetMessageStatus {
@@ -236,3 +258,28 @@ struct virNetMessageError {
     int int2;
     virNetMessageNetwork net; /* unused */
 };
+
+/* Credit based flow control of streams from server to client.
+ * Once the client has told the server it supports this, using
+ * VIR_DRV_FEATURE_STREAM_CREDIT, the server sends at most 'limit'
+ * bytes of data on each stream it opens.  The limit starts out at
+ * VIR_NET_STREAM_CREDIT_INITIAL and only ever grows, as the client
+ * grants more with VIR_NET_STREAM_CREDIT packets while the
+ * application consumes the data.
+ */
+const VIR_NET_STREAM_CREDIT_INITIAL = 8388608;
+
+struct virNetStreamCredit {
+    unsigned hyper limit; /* total bytes of data since the stream opened */
+};
+
+/* Holes in the data of sparse streams.  Once the client has told
+ * the server it supports this, using VIR_DRV_FEATURE_STREAM_SPARSE,
+ * either side may send a VIR_NET_STREAM_HOLE packet in place of
+ * 'length' bytes of zeros, in the same order as the data packets.
+ * Holes never count against the stream credit.
+ */
+struct virNetStreamHole {
+    hyper length;
+    unsigned int flags; /* not used yet, always 0 */
+};
@@ -35,6 +35,8 @@
 #include "virthreadpool.h"
 #include "virutil.h"
 #include "virfile.h"
+#include "virtime.h"
+#include "virnetserverdispatch.h"
 #include "virnetservermdns.h"
 #include "virdbus.h"
 
@@ -61,12 +63,15 @@ struct _virNetServerJob {
     virNetServerClientPtr client;
     virNetMessagePtr msg;
     virNetServerProgramPtr prog;
+    unsigned long long queued; /* When it was queued, in ms */
 };
 
 struct _virNetServer {
     virObjectLockable parent;
 
     virThreadPoolPtr workers;
+    /* Shares the workers between clients, in weighted round-robin */
+    virNetServerDispatchPtr dispatch;
 
     bool privileged;
 
@@ -172,17 +177,71 @@ cleanup:
     return ret;
 }
 
+static void virNetServerJobFree(void *opaque)
+{
+    virNetServerJobPtr job = opaque;
+
+    virObjectUnref(job->prog);
+    virNetMessageFree(job->msg);
+    virObjectUnref(job->client);
+    VIR_FREE(job);
+}
+
+
+static int virNetServerSendJob(void *job,
+                               unsigned int priority,
+                               void *opaque)
+{
+    virNetServerPtr srv = opaque;
+
+    return virThreadPoolSendJob(srv->workers, priority, job);
+}
+
+
+/*
+ * The identity of a client is only known once it has authenticated,
+ * which happens in one of its calls, so its weight is refreshed
+ * after each call it makes
+ */
+static void virNetServerUpdateDispatchWeight(virNetServerPtr srv,
+                                             virNetServerClientPtr client)
+{
+    if (!virNetServerDispatchHasIdentities(srv->dispatch))
+        return;
+
+    virNetServerDispatchUpdateWeight(srv->dispatch,
+                                     virNetServerClientGetDispatchQueue(client),
+                                     virNetServerClientGetIdentity(client),
+                                     virNetServerClientGetReadonly(client));
+}
+
+
 static void virNetServerHandleJob(void *jobOpaque, void *opaque)
 {
     virNetServerPtr srv = opaque;
     virNetServerJobPtr job = jobOpaque;
+    unsigned long long now;
+
+    /* Jobs without priority wait in the client queues, the pool
+     * only tells us to run the next one */
+    if (!job && !(job = virNetServerDispatchNextJob(srv->dispatch)))
+        return;
 
     VIR_DEBUG("server=%p client=%p message=%p prog=%p",
               srv, job->client, job->msg, job->prog);
 
+    if (virTimeMillisNowRaw(&now) == 0) {
+        PROBE(RPC_SERVER_DISPATCH_JOB,
+              "client=%p prog=%u vers=%u proc=%u serial=%u waited=%llu",
+              job->client, job->msg->header.prog, job->msg->header.vers,
+              job->msg->header.proc, job->msg->header.serial,
+              now - job->queued);
+    }
+
     if (virNetServerProcessMsg(srv, job->client, job->prog, job->msg) < 0)
         goto error;
 
+    virNetServerUpdateDispatchWeight(srv, job->client);
     virObjectUnref(job->prog);
     virObjectUnref(job->client);
     VIR_FREE(job);
@@ -227,6 +286,8 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
 
         job->client = client;
         job->msg = msg;
+        if (virTimeMillisNowRaw(&job->queued) < 0)
+            job->queued = 0;
 
         if (prog) {
             virObjectRef(prog);
@@ -234,8 +295,10 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
             priority = virNetServerProgramGetPriority(prog, msg->header.proc);
         }
 
-        ret = virThreadPoolSendJob(srv->workers, priority, job);
-
+        /* The client is locked, its queue can still be used */
+        ret = virNetServerDispatchQueueJob(srv->dispatch,
+                                           virNetServerClientGetDispatchQueue(client),
+                                           job, priority);
         if (ret < 0) {
             VIR_FREE(job);
             virObjectUnref(prog);
@@ -270,6 +333,14 @@ static int virNetServerAddClient(virNetServerPtr srv,
         virReportOOMError();
         goto error;
     }
+
+    /* Not done on its first call, since the client is locked then
+     * and its read-only status can't be looked up */
+    virNetServerDispatchUpdateWeight(srv->dispatch,
+                                     virNetServerClientGetDispatchQueue(client),
+                                     NULL,
+                                     virNetServerClientGetReadonly(client));
+
     srv->clients[srv->nclients-1] = client;
     virObjectRef(client);
 
@@ -368,6 +439,11 @@ virNetServerPtr virNetServerNew(size_t min_workers,
     if (!(srv = virObjectLockableNew(virNetServerClass)))
         return NULL;
 
+    if (!(srv->dispatch = virNetServerDispatchNew(virNetServerSendJob,
+                                                  virNetServerJobFree,
+                                                  srv)))
+        goto error;
+
     if (max_workers &&
         !(srv->workers = virThreadPoolNew(min_workers, max_workers,
                                           priority_workers,
@@ -1121,6 +1197,7 @@ void virNetServerRun(virNetServerPtr srv)
                 virNetServerClientClose(srv->clients[i]);
             if (virNetServerClientIsClosed(srv->clients[i])) {
                 virNetServerClientPtr client = srv->clients[i];
+
                 if (srv->nclients > 1) {
                     memmove(srv->clients + i,
                             srv->clients + i + 1,
@@ -1145,6 +1222,29 @@ cleanup:
 }
 
 
+/*
+ * @weight: calls a read-write client may start per turn
+ * @readonlyWeight: calls a read-only client may start per turn
+ * @identities: NULL terminated list of "PATTERN=WEIGHT" strings, or
+ *              NULL
+ *
+ * Set the share of the workers each client gets when there are more
+ * calls than workers. Clients whose identity matches one of the
+ * wildcard patterns in @identities get the weight of the first
+ * match instead. Meant to be called before clients connect.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetServerSetDispatchWeights(virNetServerPtr srv,
+                                   unsigned int weight,
+                                   unsigned int readonlyWeight,
+                                   const char *const *identities)
+{
+    return virNetServerDispatchSetWeights(srv->dispatch, weight,
+                                          readonlyWeight, identities);
+}
+
+
 void virNetServerQuit(virNetServerPtr srv)
 {
     virObjectLock(srv);
@@ -1191,6 +1291,9 @@ void virNetServerDispose(void *obj)
     }
     VIR_FREE(srv->clients);
 
+    /* The workers are gone, so nobody will run these calls */
+    virNetServerDispatchFree(srv->dispatch);
+
     VIR_FREE(srv->mdnsGroupName);
     virNetServerMDNSFree(srv->mdns);
 }
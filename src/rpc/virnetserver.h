@@ -91,6 +91,11 @@ void virNetServerUpdateServices(virNetServerPtr srv,
 
 void virNetServerRun(virNetServerPtr srv);
 
+int virNetServerSetDispatchWeights(virNetServerPtr srv,
+                                   unsigned int weight,
+                                   unsigned int readonlyWeight,
+                                   const char *const *identities);
+
 void virNetServerQuit(virNetServerPtr srv);
 
 void virNetServerClose(virNetServerPtr srv);
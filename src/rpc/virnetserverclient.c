@@ -96,6 +96,8 @@ struct _virNetServerClient
 
     virNetServerClientDispatchFunc dispatchFunc;
     void *dispatchOpaque;
+    /* Its calls waiting for a worker, immutable */
+    virNetServerDispatchQueuePtr dispatchQueue;
 
     void *privateData;
     virFreeCallback privateDataFreeFunc;
@@ -309,12 +311,11 @@ virNetServerClientCheckAccess(virNetServerClientPtr client)
      * indicate this (otherwise the socket is abruptly closed).
      * (NB. The '\1' byte is sent in an encrypted record).
      */
-    confirm->bufferLength = 1;
-    if (VIR_ALLOC_N(confirm->buffer, confirm->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageReserveBuffer(confirm, 1) < 0) {
         virNetMessageFree(confirm);
         return -1;
     }
+    confirm->bufferLength = 1;
     confirm->bufferOffset = 0;
     confirm->buffer[0] = '\1';
 
@@ -364,6 +365,9 @@ virNetServerClientNewInternal(virNetSocketPtr sock,
 #endif
     client->nrequests_max = nrequests_max;
 
+    if (!(client->dispatchQueue = virNetServerDispatchQueueNew()))
+        goto error;
+
     client->sockTimer = virEventAddTimeout(-1, virNetServerClientSockTimerFunc,
                                            client, NULL);
     if (client->sockTimer < 0)
@@ -372,11 +376,9 @@ virNetServerClientNewInternal(virNetSocketPtr sock,
     /* Prepare one for packet receive */
     if (!(client->rx = virNetMessageNew(true)))
         goto error;
-    client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_ALLOC_N(client->rx->buffer, client->rx->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageReserveBuffer(client->rx, VIR_NET_MESSAGE_LEN_MAX) < 0)
         goto error;
-    }
+    client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
     client->nrequests = 1;
 
     PROBE(RPC_SERVER_CLIENT_NEW,
@@ -585,6 +587,16 @@ bool virNetServerClientGetReadonly(virNetServerClientPtr client)
     return readonly;
 }
 
+/*
+ * The queue is set for the whole life of the client, so this
+ * doesn't take the client lock and may be called with it held
+ */
+virNetServerDispatchQueuePtr
+virNetServerClientGetDispatchQueue(virNetServerClientPtr client)
+{
+    return client->dispatchQueue;
+}
+
 
 #ifdef WITH_GNUTLS
 bool virNetServerClientHasTLSSession(virNetServerClientPtr client)
@@ -647,6 +659,17 @@ bool virNetServerClientIsSecure(virNetServerClientPtr client)
 }
 
 
+bool virNetServerClientIsLocal(virNetServerClientPtr client)
+{
+    bool local = false;
+    virObjectLock(client);
+    if (client->sock)
+        local = virNetSocketIsLocal(client->sock);
+    virObjectUnlock(client);
+    return local;
+}
+
+
 #if WITH_SASL
 void virNetServerClientSetSASLSession(virNetServerClientPtr client,
                                       virNetSASLSessionPtr sasl)
@@ -754,6 +777,7 @@ void virNetServerClientDispose(void *obj)
     virObjectUnref(client->tlsCtxt);
 #endif
     virObjectUnref(client->sock);
+    virNetServerDispatchQueueFree(client->dispatchQueue);
     virObjectUnlock(client);
 }
 
@@ -1045,6 +1069,13 @@ readmore:
                 virNetMessageFree(response);
         }
 
+        /* Stream credit is never replied to, so it mustn't hold
+         * up one of the client's request slots */
+        if (msg && msg->header.type == VIR_NET_STREAM_CREDIT) {
+            msg->tracked = false;
+            client->nrequests--;
+        }
+
         /* Maybe send off for queue against a filter */
         if (msg) {
             filter = client->filters;
@@ -1082,15 +1113,12 @@ readmore:
         if (client->nrequests < client->nrequests_max) {
             if (!(client->rx = virNetMessageNew(true))) {
                 client->wantClose = true;
+            } else if (virNetMessageReserveBuffer(client->rx,
+                                                  VIR_NET_MESSAGE_LEN_MAX) < 0) {
+                client->wantClose = true;
             } else {
                 client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
-                    virReportOOMError();
-                    client->wantClose = true;
-                } else {
-                    client->nrequests++;
-                }
+                client->nrequests++;
             }
         }
         virNetServerClientUpdateEvent(client);
@@ -1109,6 +1137,8 @@ readmore:
 static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
 {
     ssize_t ret;
+    struct iovec iov[2];
+    int niov;
 
     if (client->tx->bufferLength < client->tx->bufferOffset) {
         virReportError(VIR_ERR_RPC,
@@ -1118,16 +1148,16 @@ static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
         return -1;
     }
 
-    if (client->tx->bufferLength == client->tx->bufferOffset)
+    if (virNetMessageTxDone(client->tx))
         return 1;
 
-    ret = virNetSocketWrite(client->sock,
-                            client->tx->buffer + client->tx->bufferOffset,
-                            client->tx->bufferLength - client->tx->bufferOffset);
+    /* Stream data may follow the header in a separate buffer */
+    niov = virNetMessageGetTxIOV(client->tx, iov);
+    ret = virNetSocketWritev(client->sock, iov, niov);
     if (ret <= 0)
         return ret; /* -1 error, 0 = egain */
 
-    client->tx->bufferOffset += ret;
+    virNetMessageTxAdvance(client->tx, ret);
     return ret;
 }
 
@@ -1140,7 +1170,7 @@ static void
 virNetServerClientDispatchWrite(virNetServerClientPtr client)
 {
     while (client->tx) {
-        if (client->tx->bufferOffset < client->tx->bufferLength) {
+        if (!virNetMessageTxDone(client->tx)) {
             ssize_t ret;
             ret = virNetServerClientWrite(client);
             if (ret < 0) {
@@ -1151,7 +1181,7 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                 return; /* Would block on write EAGAIN */
         }
 
-        if (client->tx->bufferOffset == client->tx->bufferLength) {
+        if (virNetMessageTxDone(client->tx)) {
             virNetMessagePtr msg;
             size_t i;
 
@@ -1187,12 +1217,12 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                     client->nrequests < client->nrequests_max) {
                     /* Ready to recv more messages */
                     virNetMessageClear(msg);
-                    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-                        virReportOOMError();
+                    if (virNetMessageReserveBuffer(msg,
+                                                   VIR_NET_MESSAGE_LEN_MAX) < 0) {
                         virNetMessageFree(msg);
                         return;
                     }
+                    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
                     client->rx = msg;
                     msg = NULL;
                     client->nrequests++;
@@ -26,6 +26,7 @@
 
 # include "virnetsocket.h"
 # include "virnetmessage.h"
+# include "virnetserverdispatch.h"
 # include "virobject.h"
 # include "virjson.h"
 
@@ -77,6 +78,8 @@ void virNetServerClientRemoveFilter(virNetServerClientPtr client,
 
 int virNetServerClientGetAuth(virNetServerClientPtr client);
 bool virNetServerClientGetReadonly(virNetServerClientPtr client);
+virNetServerDispatchQueuePtr
+virNetServerClientGetDispatchQueue(virNetServerClientPtr client);
 
 # ifdef WITH_GNUTLS
 bool virNetServerClientHasTLSSession(virNetServerClientPtr client);
@@ -91,6 +94,7 @@ void virNetServerClientSetSASLSession(virNetServerClientPtr client,
 int virNetServerClientGetFD(virNetServerClientPtr client);
 
 bool virNetServerClientIsSecure(virNetServerClientPtr client);
+bool virNetServerClientIsLocal(virNetServerClientPtr client);
 
 int virNetServerClientSetIdentity(virNetServerClientPtr client,
                                   const char *identity);
@@ -0,0 +1,418 @@
+/*
+ * virnetserverdispatch.c: fair sharing of workers between clients
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <fnmatch.h>
+
+#include "virnetserverdispatch.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virthread.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+typedef struct _virNetServerDispatchJob virNetServerDispatchJob;
+typedef virNetServerDispatchJob *virNetServerDispatchJobPtr;
+
+struct _virNetServerDispatchJob {
+    void *data;
+
+    virNetServerDispatchJobPtr next;
+};
+
+struct _virNetServerDispatchQueue {
+    unsigned int weight;
+    unsigned int credit; /* Calls it may still start this turn */
+
+    virNetServerDispatchJobPtr head;
+    virNetServerDispatchJobPtr tail;
+
+    virNetServerDispatchQueuePtr nextActive; /* Among non-empty queues */
+};
+
+typedef struct _virNetServerDispatchIdentity virNetServerDispatchIdentity;
+typedef virNetServerDispatchIdentity *virNetServerDispatchIdentityPtr;
+
+struct _virNetServerDispatchIdentity {
+    char *pattern;
+    unsigned int weight;
+};
+
+/*
+ * Calls are not handed to the workers in the order they come in, so
+ * that a busy client can't keep all of them to itself. Each client
+ * has a queue, and the non-empty ones take turns in weighted
+ * round-robin order, each starting as many calls as its weight before
+ * the next one gets to. The workers are only told that there is one
+ * more call to run. High priority calls bypass all this and go
+ * straight to the workers, so the priority workers see them.
+ *
+ * The queues belong to the clients, the dispatcher only knows about
+ * those which have calls waiting.
+ */
+struct _virNetServerDispatch {
+    virMutex lock;
+
+    virNetServerDispatchSendFunc sendFunc;
+    virFreeCallback jobFree;
+    void *opaque;
+
+    virNetServerDispatchQueuePtr active;
+    virNetServerDispatchQueuePtr activeTail;
+
+    unsigned int weight;
+    unsigned int readonlyWeight;
+    size_t nidentities;
+    virNetServerDispatchIdentityPtr identities;
+};
+
+
+static void
+virNetServerDispatchIdentitiesFree(virNetServerDispatchIdentityPtr identities,
+                                   size_t nidentities)
+{
+    size_t i;
+
+    for (i = 0 ; i < nidentities ; i++)
+        VIR_FREE(identities[i].pattern);
+    VIR_FREE(identities);
+}
+
+
+virNetServerDispatchPtr
+virNetServerDispatchNew(virNetServerDispatchSendFunc sendFunc,
+                        virFreeCallback jobFree,
+                        void *opaque)
+{
+    virNetServerDispatchPtr dispatch;
+
+    if (VIR_ALLOC(dispatch) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virMutexInit(&dispatch->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(dispatch);
+        return NULL;
+    }
+
+    dispatch->sendFunc = sendFunc;
+    dispatch->jobFree = jobFree;
+    dispatch->opaque = opaque;
+    dispatch->weight = 1;
+    dispatch->readonlyWeight = 1;
+
+    return dispatch;
+}
+
+
+/*
+ * Jobs still waiting are freed, since nobody is left to run them.
+ * Freeing them may well free their client, and its queue along with
+ * it, so all the queues are emptied first.
+ */
+void
+virNetServerDispatchFree(virNetServerDispatchPtr dispatch)
+{
+    virNetServerDispatchQueuePtr queue;
+    virNetServerDispatchJobPtr jobs = NULL;
+    virNetServerDispatchJobPtr *last = &jobs;
+    virNetServerDispatchJobPtr job;
+
+    if (!dispatch)
+        return;
+
+    while ((queue = dispatch->active)) {
+        dispatch->active = queue->nextActive;
+        *last = queue->head;
+        last = &queue->tail->next;
+        queue->head = queue->tail = NULL;
+        queue->nextActive = NULL;
+    }
+
+    while ((job = jobs)) {
+        jobs = job->next;
+        dispatch->jobFree(job->data);
+        VIR_FREE(job);
+    }
+
+    virNetServerDispatchIdentitiesFree(dispatch->identities,
+                                       dispatch->nidentities);
+    virMutexDestroy(&dispatch->lock);
+    VIR_FREE(dispatch);
+}
+
+
+/*
+ * @weight: calls a read-write client may start per turn
+ * @readonlyWeight: calls a read-only client may start per turn
+ * @identities: NULL terminated list of "PATTERN=WEIGHT" strings, or
+ *              NULL
+ *
+ * Clients whose identity matches one of the wildcard patterns in
+ * @identities get the weight of the first match instead. Clients
+ * only pick up new weights once virNetServerDispatchUpdateWeight is
+ * called for them.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNetServerDispatchSetWeights(virNetServerDispatchPtr dispatch,
+                               unsigned int weight,
+                               unsigned int readonlyWeight,
+                               const char *const *identities)
+{
+    virNetServerDispatchIdentityPtr list = NULL;
+    size_t nlist = 0;
+    size_t i;
+
+    if (weight == 0 || readonlyWeight == 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("client weights must be at least 1"));
+        return -1;
+    }
+
+    for (i = 0 ; identities && identities[i] ; i++) {
+        const char *sep = strrchr(identities[i], '=');
+        unsigned int val;
+
+        if (!sep || sep == identities[i] ||
+            virStrToLong_ui(sep + 1, NULL, 10, &val) < 0 || val == 0) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("malformed client weight '%s', expecting"
+                             " PATTERN=WEIGHT"),
+                           identities[i]);
+            goto error;
+        }
+
+        if (VIR_EXPAND_N(list, nlist, 1) < 0 ||
+            !(list[nlist - 1].pattern = strndup(identities[i],
+                                                 sep - identities[i]))) {
+            virReportOOMError();
+            goto error;
+        }
+        list[nlist - 1].weight = val;
+    }
+
+    virMutexLock(&dispatch->lock);
+    dispatch->weight = weight;
+    dispatch->readonlyWeight = readonlyWeight;
+    virNetServerDispatchIdentitiesFree(dispatch->identities,
+                                       dispatch->nidentities);
+    dispatch->identities = list;
+    dispatch->nidentities = nlist;
+    virMutexUnlock(&dispatch->lock);
+
+    return 0;
+
+error:
+    virNetServerDispatchIdentitiesFree(list, nlist);
+    return -1;
+}
+
+
+/*
+ * Without identity patterns the weight of a client never changes
+ * once it has been set, which spares looking up its identity
+ */
+bool
+virNetServerDispatchHasIdentities(virNetServerDispatchPtr dispatch)
+{
+    bool ret;
+
+    virMutexLock(&dispatch->lock);
+    ret = dispatch->nidentities > 0;
+    virMutexUnlock(&dispatch->lock);
+
+    return ret;
+}
+
+
+/*
+ * Set the weight of @queue for a client with @identity, which is
+ * NULL until the client has authenticated. A queue which is having
+ * its turn keeps its credit, the new weight applies from its next
+ * turn on.
+ */
+void
+virNetServerDispatchUpdateWeight(virNetServerDispatchPtr dispatch,
+                                 virNetServerDispatchQueuePtr queue,
+                                 const char *identity,
+                                 bool readonly)
+{
+    unsigned int weight;
+    size_t i;
+
+    virMutexLock(&dispatch->lock);
+
+    weight = readonly ? dispatch->readonlyWeight : dispatch->weight;
+    if (identity) {
+        for (i = 0 ; i < dispatch->nidentities ; i++) {
+            if (fnmatch(dispatch->identities[i].pattern, identity, 0) == 0) {
+                weight = dispatch->identities[i].weight;
+                break;
+            }
+        }
+    }
+    queue->weight = weight;
+
+    virMutexUnlock(&dispatch->lock);
+}
+
+
+/*
+ * A new queue has the read-write weight of a dispatcher with the
+ * defaults, until virNetServerDispatchUpdateWeight says otherwise
+ */
+virNetServerDispatchQueuePtr
+virNetServerDispatchQueueNew(void)
+{
+    virNetServerDispatchQueuePtr queue;
+
+    if (VIR_ALLOC(queue) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    queue->weight = 1;
+
+    return queue;
+}
+
+
+/*
+ * The queue must be empty. Since each waiting job holds a reference
+ * on its client, that is the case once the client is disposed of.
+ */
+void
+virNetServerDispatchQueueFree(virNetServerDispatchQueuePtr queue)
+{
+    VIR_FREE(queue);
+}
+
+
+/*
+ * Queue @job behind the other calls of the client owning @queue, and
+ * wake up a worker to run whichever call is next in line. A job with
+ * a @priority is handed to the workers right away instead.
+ *
+ * Returns 0 on success, -1 on error, in which case @job is left to
+ * the caller
+ */
+int
+virNetServerDispatchQueueJob(virNetServerDispatchPtr dispatch,
+                             virNetServerDispatchQueuePtr queue,
+                             void *job,
+                             unsigned int priority)
+{
+    virNetServerDispatchJobPtr entry;
+    int ret = -1;
+
+    if (priority)
+        return dispatch->sendFunc(job, priority, dispatch->opaque);
+
+    if (VIR_ALLOC(entry) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    entry->data = job;
+
+    /* Holding the lock keeps workers from looking for the job
+     * before it is queued */
+    virMutexLock(&dispatch->lock);
+
+    if (dispatch->sendFunc(NULL, 0, dispatch->opaque) < 0) {
+        VIR_FREE(entry);
+        goto cleanup;
+    }
+
+    if (queue->tail) {
+        queue->tail->next = entry;
+        queue->tail = entry;
+    } else {
+        /* The queue was empty, so it joins the end of the line */
+        queue->head = queue->tail = entry;
+        queue->credit = queue->weight;
+        queue->nextActive = NULL;
+        if (dispatch->activeTail)
+            dispatch->activeTail->nextActive = queue;
+        else
+            dispatch->active = queue;
+        dispatch->activeTail = queue;
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&dispatch->lock);
+    return ret;
+}
+
+
+/*
+ * Take the next call in line from the client whose turn it is
+ *
+ * Returns the job, or NULL if there is none
+ */
+void *
+virNetServerDispatchNextJob(virNetServerDispatchPtr dispatch)
+{
+    virNetServerDispatchQueuePtr queue;
+    virNetServerDispatchJobPtr entry;
+    void *job = NULL;
+
+    virMutexLock(&dispatch->lock);
+
+    if (!(queue = dispatch->active))
+        goto cleanup;
+
+    entry = queue->head;
+    if (!(queue->head = entry->next))
+        queue->tail = NULL;
+    job = entry->data;
+    VIR_FREE(entry);
+
+    if (queue->head && --queue->credit > 0)
+        goto cleanup;
+
+    /* Turn over: leave the line, or go to the back of it */
+    if (!(dispatch->active = queue->nextActive))
+        dispatch->activeTail = NULL;
+    queue->nextActive = NULL;
+
+    if (queue->head) {
+        queue->credit = queue->weight;
+        if (dispatch->activeTail)
+            dispatch->activeTail->nextActive = queue;
+        else
+            dispatch->active = queue;
+        dispatch->activeTail = queue;
+    }
+
+cleanup:
+    virMutexUnlock(&dispatch->lock);
+    return job;
+}
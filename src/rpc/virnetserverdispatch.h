@@ -0,0 +1,68 @@
+/*
+ * virnetserverdispatch.h: fair sharing of workers between clients
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_NET_SERVER_DISPATCH_H__
+# define __VIR_NET_SERVER_DISPATCH_H__
+
+# include "internal.h"
+
+typedef struct _virNetServerDispatch virNetServerDispatch;
+typedef virNetServerDispatch *virNetServerDispatchPtr;
+
+/* The calls of one client waiting for a worker */
+typedef struct _virNetServerDispatchQueue virNetServerDispatchQueue;
+typedef virNetServerDispatchQueue *virNetServerDispatchQueuePtr;
+
+/*
+ * Hand @job to a worker, or only wake one up to take the next job in
+ * line when @job is NULL. Returns 0 on success, -1 on error.
+ */
+typedef int (*virNetServerDispatchSendFunc)(void *job,
+                                            unsigned int priority,
+                                            void *opaque);
+
+virNetServerDispatchPtr virNetServerDispatchNew(virNetServerDispatchSendFunc sendFunc,
+                                                virFreeCallback jobFree,
+                                                void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virNetServerDispatchFree(virNetServerDispatchPtr dispatch);
+
+int virNetServerDispatchSetWeights(virNetServerDispatchPtr dispatch,
+                                   unsigned int weight,
+                                   unsigned int readonlyWeight,
+                                   const char *const *identities);
+bool virNetServerDispatchHasIdentities(virNetServerDispatchPtr dispatch);
+void virNetServerDispatchUpdateWeight(virNetServerDispatchPtr dispatch,
+                                      virNetServerDispatchQueuePtr queue,
+                                      const char *identity,
+                                      bool readonly);
+
+virNetServerDispatchQueuePtr virNetServerDispatchQueueNew(void);
+void virNetServerDispatchQueueFree(virNetServerDispatchQueuePtr queue);
+
+int virNetServerDispatchQueueJob(virNetServerDispatchPtr dispatch,
+                                 virNetServerDispatchQueuePtr queue,
+                                 void *job,
+                                 unsigned int priority)
+    ATTRIBUTE_RETURN_CHECK;
+void *virNetServerDispatchNextJob(virNetServerDispatchPtr dispatch);
+
+#endif /* __VIR_NET_SERVER_DISPATCH_H__ */
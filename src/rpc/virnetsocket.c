@@ -27,6 +27,7 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <netdb.h>
@@ -1499,6 +1500,70 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
     return ret;
 }
 
+/*
+ * Writes the @niov segments of @iov in one go. This is only
+ * possible on a plain socket, any transport which has to
+ * encode the data itself only gets sent the first segment.
+ *
+ * Returns the number of bytes written, 0 if it would block,
+ * -1 on error
+ */
+ssize_t virNetSocketWritev(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           int niov)
+{
+    ssize_t ret;
+    bool plain = true;
+
+    if (niov == 0)
+        return 0;
+
+    virObjectLock(sock);
+#if WITH_SASL
+    if (sock->saslSession)
+        plain = false;
+#endif
+#if WITH_GNUTLS
+    if (sock->tlsSession &&
+        virNetTLSSessionGetHandshakeStatus(sock->tlsSession) ==
+        VIR_NET_TLS_HANDSHAKE_COMPLETE)
+        plain = false;
+#endif
+#if WITH_SSH2
+    if (sock->sshSession)
+        plain = false;
+#endif
+
+    if (!plain || niov == 1) {
+        virObjectUnlock(sock);
+        return virNetSocketWrite(sock, iov[0].iov_base, iov[0].iov_len);
+    }
+
+rewrite:
+    ret = writev(sock->fd, iov, niov);
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto rewrite;
+        if (errno == EAGAIN) {
+            ret = 0;
+            goto cleanup;
+        }
+
+        virReportSystemError(errno, "%s",
+                             _("Cannot write data"));
+        goto cleanup;
+    }
+    if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while writing data"));
+        ret = -1;
+    }
+
+cleanup:
+    virObjectUnlock(sock);
+    return ret;
+}
+
 
 /*
  * Returns 1 if an FD was sent, 0 if it would block, -1 on error
@@ -55,6 +55,8 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "stat-time.h"
+#include "virthread.h"
+#include "virtime.h"
 
 #if WITH_STORAGE_LVM
 # include "storage_backend_logical.h"
@@ -123,9 +125,263 @@ enum {
     TOOL_QCOW_CREATE,
 };
 
-#define READ_BLOCK_SIZE_DEFAULT  (1024 * 1024)
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
+/* Volumes are copied in chunks of this size, handed out to
+ * a few threads, so reads of one chunk overlap with writes
+ * of another */
+#define COPY_CHUNK_SIZE         (8 * 1024 * 1024)
+#define COPY_THREADS_MAX        4
+#define COPY_PROGRESS_INTERVAL  (10 * 1000)
+
+typedef struct _virStorageBackendCopyJob virStorageBackendCopyJob;
+typedef virStorageBackendCopyJob *virStorageBackendCopyJobPtr;
+struct _virStorageBackendCopyJob {
+    virMutex lock;
+    virCond cond;
+
+    int inputfd;
+    int fd;
+    bool sparse;            /* holes may be left unwritten in fd */
+    bool offload;           /* copy_file_range worth trying */
+    size_t wbytes;
+
+    unsigned long long length;
+    unsigned long long next;
+    unsigned long long done;
+    size_t running;
+
+    int err;
+    bool errWrite;
+    bool errAlloc;          /* a worker had no memory for its buffer */
+};
+
+
+/*
+ * Transfers exactly @len bytes at @offset, returning the amount
+ * actually transferred, which is only less than @len when reading
+ * hits end of file, or -1 on error
+ */
+static ssize_t
+virStorageBackendCopyIO(int fd, char *buf, size_t len,
+                        off_t offset, bool write)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t r;
+
+        if (write)
+            r = pwrite(fd, buf + done, len - done, offset + done);
+        else
+            r = pread(fd, buf + done, len - done, offset + done);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (r == 0) {
+            if (write) {
+                errno = EIO;
+                return -1;
+            }
+            break;
+        }
+        done += r;
+    }
+
+    return done;
+}
+
+
+/*
+ * Copies one extent of data, in which there are no holes in
+ * the input, skipping over blocks of zeros if allowed to.
+ */
+static int
+virStorageBackendCopyExtent(virStorageBackendCopyJobPtr job,
+                            char *buf,
+                            off_t offset,
+                            size_t len,
+                            bool *errWrite)
+{
+    ssize_t got;
+    size_t pos;
+    size_t run = 0;
+    size_t runStart = 0;
+
+#if HAVE_COPY_FILE_RANGE
+    bool offload;
+
+    virMutexLock(&job->lock);
+    offload = job->offload;
+    virMutexUnlock(&job->lock);
+
+    if (offload) {
+        off_t inoff = offset;
+        off_t outoff = offset;
+
+        while (len) {
+            ssize_t r = copy_file_range(job->inputfd, &inoff,
+                                        job->fd, &outoff, len, 0);
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EXDEV && errno != EINVAL &&
+                    errno != ENOSYS && errno != EOPNOTSUPP) {
+                    *errWrite = true;
+                    return -1;
+                }
+                /* Not supported between these two, do it by hand */
+                virMutexLock(&job->lock);
+                job->offload = false;
+                virMutexUnlock(&job->lock);
+                break;
+            }
+            if (r == 0)
+                return 0;
+            len -= r;
+        }
+        if (len == 0)
+            return 0;
+        offset = inoff;
+    }
+#endif
+
+    if ((got = virStorageBackendCopyIO(job->inputfd, buf, len,
+                                       offset, false)) < 0) {
+        *errWrite = false;
+        return -1;
+    }
+
+    /* Only write out runs of blocks that aren't entirely zero */
+    for (pos = 0 ; pos < got ; pos += job->wbytes) {
+        size_t interval = MIN(job->wbytes, got - pos);
+
+        if (job->sparse &&
+            virMemIsZero(buf + pos, interval)) {
+            if (run &&
+                virStorageBackendCopyIO(job->fd, buf + runStart, run,
+                                        offset + runStart, true) < 0) {
+                *errWrite = true;
+                return -1;
+            }
+            run = 0;
+            continue;
+        }
+
+        if (!run)
+            runStart = pos;
+        run += interval;
+    }
+
+    if (run &&
+        virStorageBackendCopyIO(job->fd, buf + runStart, run,
+                                offset + runStart, true) < 0) {
+        *errWrite = true;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+virStorageBackendCopyChunk(virStorageBackendCopyJobPtr job,
+                           char *buf,
+                           off_t offset,
+                           size_t len,
+                           bool *errWrite)
+{
+    off_t end = offset + len;
+
+    while (offset < end) {
+        off_t data = offset;
+        off_t hole = end;
+
+#ifdef SEEK_DATA
+        /* Find the data extents of a sparse input, so that
+         * holes needn't even be read */
+        if (job->sparse) {
+            if ((data = lseek(job->inputfd, offset, SEEK_DATA)) < 0) {
+                if (errno == ENXIO)
+                    return 0; /* only a hole left */
+                data = offset;
+            } else if ((hole = lseek(job->inputfd, data, SEEK_HOLE)) < 0) {
+                hole = end;
+            }
+            if (data >= end)
+                return 0;
+            if (hole > end)
+                hole = end;
+        }
+#endif
+
+        if (virStorageBackendCopyExtent(job, buf, data, hole - data,
+                                        errWrite) < 0)
+            return -1;
+
+        offset = hole;
+    }
+
+    return 0;
+}
+
+
+static void
+virStorageBackendCopyWorker(void *opaque)
+{
+    virStorageBackendCopyJobPtr job = opaque;
+    void *base = NULL;
+    char *buf = NULL;
+    bool errWrite = false;
+
+#if HAVE_POSIX_MEMALIGN
+    if (posix_memalign(&base, WRITE_BLOCK_SIZE_DEFAULT, COPY_CHUNK_SIZE) == 0)
+        buf = base;
+#else
+    if (VIR_ALLOC_N(buf, COPY_CHUNK_SIZE) == 0)
+        base = buf;
+#endif
+
+    virMutexLock(&job->lock);
+    if (!buf && !job->err) {
+        job->err = ENOMEM;
+        job->errAlloc = true;
+    }
+
+    while (!job->err && job->next < job->length) {
+        off_t offset = job->next;
+        size_t len = MIN(COPY_CHUNK_SIZE, job->length - job->next);
+
+        job->next += len;
+        virMutexUnlock(&job->lock);
+
+        if (virStorageBackendCopyChunk(job, buf, offset, len,
+                                       &errWrite) < 0) {
+            /* Never let a failure pass for success */
+            int err = errno ? errno : EIO;
+
+            virMutexLock(&job->lock);
+            if (!job->err) {
+                job->err = err;
+                job->errWrite = errWrite;
+            }
+            break;
+        }
+
+        virMutexLock(&job->lock);
+        job->done += len;
+    }
+
+    job->running--;
+    virCondSignal(&job->cond);
+    virMutexUnlock(&job->lock);
+
+    VIR_FREE(base);
+}
+
+
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           virStorageVolDefPtr inputvol,
@@ -134,14 +390,20 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           int is_dest_file)
 {
     int inputfd = -1;
-    int amtread = -1;
     int ret = 0;
-    size_t rbytes = READ_BLOCK_SIZE_DEFAULT;
     size_t wbytes = 0;
-    int interval;
-    char *zerobuf = NULL;
-    char *buf = NULL;
     struct stat st;
+    struct stat inputst;
+    virStorageBackendCopyJob job;
+    virThread threads[COPY_THREADS_MAX];
+    size_t nthreads = 0;
+    unsigned long long start;
+    unsigned long long now;
+    unsigned long long length;
+    bool locked = false;
+    size_t i;
+
+    memset(&job, 0, sizeof(job));
 
     if ((inputfd = open(inputvol->target.path, O_RDONLY)) < 0) {
         ret = -errno;
@@ -161,59 +423,131 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
     if (wbytes < WRITE_BLOCK_SIZE_DEFAULT)
         wbytes = WRITE_BLOCK_SIZE_DEFAULT;
 
-    if (VIR_ALLOC_N(zerobuf, wbytes) < 0) {
+    /* Work out how much there is to copy, so it can be split up */
+    if (fstat(inputfd, &inputst) < 0) {
         ret = -errno;
-        virReportOOMError();
+        virReportSystemError(errno, _("cannot stat file '%s'"),
+                             inputvol->target.path);
         goto cleanup;
     }
+    if (S_ISREG(inputst.st_mode)) {
+        length = inputst.st_size;
+    } else {
+        off_t end = lseek(inputfd, 0, SEEK_END);
+        length = end < 0 ? *total : end;
+    }
+    if (length > *total)
+        length = *total;
 
-    if (VIR_ALLOC_N(buf, rbytes) < 0) {
+    if (virTimeMillisNow(&start) < 0) {
         ret = -errno;
-        virReportOOMError();
         goto cleanup;
     }
 
-    while (amtread != 0) {
-        int amtleft;
-
-        if (*total < rbytes)
-            rbytes = *total;
-
-        if ((amtread = saferead(inputfd, buf, rbytes)) < 0) {
+#if defined(FICLONE)
+    /* If the whole file is wanted and both are on a filesystem
+     * which can share extents, there is no need to copy at all */
+    if (is_dest_file && S_ISREG(inputst.st_mode) &&
+        length == inputst.st_size &&
+        fstat(fd, &st) == 0 &&
+        ioctl(fd, FICLONE, inputfd) == 0) {
+        if (st.st_size > inputst.st_size &&
+            ftruncate(fd, st.st_size) < 0) {
             ret = -errno;
-            virReportSystemError(errno,
-                                 _("failed reading from file '%s'"),
-                                 inputvol->target.path);
+            virReportSystemError(errno, _("cannot extend file '%s'"),
+                                 vol->target.path);
             goto cleanup;
         }
-        *total -= amtread;
+        job.done = length;
+        goto done;
+    }
+#endif
+
+    if (virMutexInit(&job.lock) < 0) {
+        ret = -errno;
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&job.cond) < 0) {
+        ret = -errno;
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        virMutexDestroy(&job.lock);
+        goto cleanup;
+    }
+    locked = true;
 
-        /* Loop over amt read in 512 byte increments, looking for sparse
-         * blocks */
-        amtleft = amtread;
-        do {
-            interval = ((wbytes > amtleft) ? amtleft : wbytes);
-            int offset = amtread - amtleft;
+    job.inputfd = inputfd;
+    job.fd = fd;
+    job.sparse = is_dest_file != 0;
+    job.offload = true;
+    job.wbytes = wbytes;
+    job.length = length;
 
-            if (is_dest_file && memcmp(buf+offset, zerobuf, interval) == 0) {
-                if (lseek(fd, interval, SEEK_CUR) < 0) {
-                    ret = -errno;
-                    virReportSystemError(errno,
-                                         _("cannot extend file '%s'"),
-                                         vol->target.path);
-                    goto cleanup;
-                }
-            } else if (safewrite(fd, buf+offset, interval) < 0) {
+    virMutexLock(&job.lock);
+    for (i = 0 ; i < COPY_THREADS_MAX ; i++) {
+        if (i * COPY_CHUNK_SIZE >= length && i > 0)
+            break;
+        if (virThreadCreate(&threads[i], true,
+                            virStorageBackendCopyWorker, &job) < 0) {
+            if (i == 0) {
                 ret = -errno;
-                virReportSystemError(errno,
-                                     _("failed writing to file '%s'"),
-                                     vol->target.path);
+                virReportSystemError(errno, "%s",
+                                     _("cannot create copy thread"));
+                virMutexUnlock(&job.lock);
                 goto cleanup;
-
             }
-        } while ((amtleft -= interval) > 0);
+            break;
+        }
+        job.running++;
+    }
+    nthreads = i;
+
+    while (job.running) {
+        if (virTimeMillisNow(&now) < 0 ||
+            (virCondWaitUntil(&job.cond, &job.lock,
+                              now + COPY_PROGRESS_INTERVAL) < 0 &&
+             errno != ETIMEDOUT)) {
+            ignore_value(virCondWait(&job.cond, &job.lock));
+            continue;
+        }
+        if (job.running && virTimeMillisNow(&now) == 0)
+            VIR_INFO("Copied %llu of %llu bytes from '%s' to '%s', %llu KiB/s",
+                     job.done, length, inputvol->target.path,
+                     vol->target.path,
+                     job.done / 1024 * 1000 / MAX(now - start, 1));
+    }
+    virMutexUnlock(&job.lock);
+
+    for (i = 0 ; i < nthreads ; i++)
+        virThreadJoin(&threads[i]);
+
+    if (job.err) {
+        ret = -job.err;
+        if (job.errAlloc)
+            virReportOOMError();
+        else if (job.errWrite)
+            virReportSystemError(job.err,
+                                 _("failed writing to file '%s'"),
+                                 vol->target.path);
+        else
+            virReportSystemError(job.err,
+                                 _("failed reading from file '%s'"),
+                                 inputvol->target.path);
+        goto cleanup;
     }
 
+#if defined(FICLONE)
+done:
+#endif
+    *total -= length;
+
+    if (virTimeMillisNow(&now) == 0)
+        VIR_INFO("Copied %llu bytes from '%s' to '%s' in %llu ms, %llu KiB/s",
+                 length, inputvol->target.path, vol->target.path,
+                 now - start, length / 1024 * 1000 / MAX(now - start, 1));
+
     if (fdatasync(fd) < 0) {
         ret = -errno;
         virReportSystemError(errno, _("cannot sync data to file '%s'"),
@@ -234,8 +568,10 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
 cleanup:
     VIR_FORCE_CLOSE(inputfd);
 
-    VIR_FREE(zerobuf);
-    VIR_FREE(buf);
+    if (locked) {
+        virCondDestroy(&job.cond);
+        virMutexDestroy(&job.lock);
+    }
 
     return ret;
 }
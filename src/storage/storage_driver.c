@@ -29,12 +29,18 @@
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <fcntl.h>
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+# include <linux/falloc.h>
+#endif
 
 #if HAVE_PWD_H
 # include <pwd.h>
 #endif
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
 
 #include "virerror.h"
 #include "datatypes.h"
@@ -46,6 +52,8 @@
 #include "storage_backend.h"
 #include "virlog.h"
 #include "virfile.h"
+#include "viratomic.h"
+#include "virprocess.h"
 #include "fdstream.h"
 #include "configmake.h"
 
@@ -54,6 +62,7 @@
 static virStorageDriverStatePtr driverState;
 
 static int storageDriverShutdown(void);
+static void storageVolumeWipeCancelAll(virStorageDriverStatePtr driver);
 
 static void storageDriverLock(virStorageDriverStatePtr driver)
 {
@@ -215,6 +224,9 @@ storageDriverShutdown(void) {
     if (!driverState)
         return -1;
 
+    /* Background wipes still use the pools */
+    storageVolumeWipeCancelAll(driverState);
+
     storageDriverLock(driverState);
 
     /* free inactive pools */
@@ -1249,6 +1261,13 @@ cleanup:
 }
 
 
+/*
+ * Each pool indexes its own volumes by key and path, there is no index
+ * spanning all pools. Volumes come and go under the lock of their pool
+ * alone, and a path only means something once turned into the stable
+ * path of a given pool, so the lookups below still visit each pool but
+ * no longer scan its volumes.
+ */
 static virStorageVolPtr
 storageVolumeLookupByKey(virConnectPtr conn,
                          const char *key) {
@@ -1336,6 +1355,61 @@ storageVolumeLookupByPath(virConnectPtr conn,
     return ret;
 }
 
+/*
+ * Refreshing a volume may change its key or path, in which case the
+ * indexes of @pool have to follow
+ */
+static int
+storageVolumeRefresh(virConnectPtr conn,
+                     virStorageBackendPtr backend,
+                     virStoragePoolObjPtr pool,
+                     virStorageVolDefPtr vol)
+{
+    char *oldkey = NULL;
+    char *oldpath = NULL;
+    int ret = -1;
+
+    if (!backend->refreshVol)
+        return 0;
+
+    if ((vol->key && !(oldkey = strdup(vol->key))) ||
+        (vol->target.path && !(oldpath = strdup(vol->target.path)))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    /* Even a failed refresh may have replaced the key or path */
+    ret = backend->refreshVol(conn, pool, vol);
+
+    if (virStoragePoolObjRekeyVol(pool, vol, oldkey, oldpath) < 0)
+        ret = -1;
+
+cleanup:
+    VIR_FREE(oldkey);
+    VIR_FREE(oldpath);
+    return ret;
+}
+
+/*
+ * Reports why @vol, which has its building flag set, can't be used
+ */
+static void
+storageVolumeReportBusy(virStorageVolDefPtr vol)
+{
+    virStorageVolJobInfo info;
+
+    virStorageVolJobGetInfo(vol->job, &info);
+    if (info.type == VIR_STORAGE_VOL_JOB_WIPE &&
+        info.state == VIR_STORAGE_VOL_JOB_STATE_RUNNING)
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is still being wiped."),
+                       vol->name);
+    else
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is still being allocated."),
+                       vol->name);
+}
+
 static int storageVolumeDelete(virStorageVolPtr obj, unsigned int flags);
 
 static virStorageVolPtr
@@ -1380,12 +1454,6 @@ storageVolumeCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (!backend->createVol) {
         virReportError(VIR_ERR_NO_SUPPORT,
                        "%s", _("storage pool does not support volume "
@@ -1397,11 +1465,16 @@ storageVolumeCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    pool->volumes.objs[pool->volumes.count++] = voldef;
+    if (virStoragePoolObjAddVol(pool, voldef) < 0) {
+        if (backend->deleteVol)
+            backend->deleteVol(obj->conn, pool, voldef, 0);
+        goto cleanup;
+    }
+
     volobj = virGetStorageVol(obj->conn, pool->def->name, voldef->name,
                               voldef->key, NULL, NULL);
     if (!volobj) {
-        pool->volumes.count--;
+        virStoragePoolObjRemoveVol(pool, voldef);
         goto cleanup;
     }
 
@@ -1548,28 +1621,24 @@ storageVolumeCreateXMLFrom(virStoragePoolPtr obj,
     }
 
     if (origvol->building) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       _("volume '%s' is still being allocated."),
-                       origvol->name);
+        storageVolumeReportBusy(origvol);
         goto cleanup;
     }
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, origvol) < 0)
-        goto cleanup;
-
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0) {
-        virReportOOMError();
+    if (storageVolumeRefresh(obj->conn, backend,
+                             origpool ? origpool : pool, origvol) < 0)
         goto cleanup;
-    }
 
     /* 'Define' the new volume so we get async progress reporting */
     if (backend->createVol(obj->conn, pool, newvol) < 0) {
         goto cleanup;
     }
 
-    pool->volumes.objs[pool->volumes.count++] = newvol;
+    if (virStoragePoolObjAddVol(pool, newvol) < 0) {
+        if (backend->deleteVol)
+            backend->deleteVol(obj->conn, pool, newvol, 0);
+        goto cleanup;
+    }
     volobj = virGetStorageVol(obj->conn, pool->def->name, newvol->name,
                               newvol->key, NULL, NULL);
 
@@ -1638,7 +1707,7 @@ storageVolumeDownload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1667,17 +1736,22 @@ storageVolumeDownload(virStorageVolPtr obj,
     }
 
     if (vol->building) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       _("volume '%s' is still being allocated."),
-                       vol->name);
+        storageVolumeReportBusy(vol);
         goto out;
     }
 
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_RDONLY) < 0)
+    if (flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenSparseFile(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_RDONLY) < 0)
+            goto out;
+    } else if (virFDStreamOpenFile(stream,
+                                   vol->target.path,
+                                   offset, length,
+                                   O_RDONLY) < 0) {
         goto out;
+    }
 
     ret = 0;
 
@@ -1701,7 +1775,7 @@ storageVolumeUpload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1730,19 +1804,24 @@ storageVolumeUpload(virStorageVolPtr obj,
     }
 
     if (vol->building) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       _("volume '%s' is still being allocated."),
-                       vol->name);
+        storageVolumeReportBusy(vol);
         goto out;
     }
 
     /* Not using O_CREAT because the file is required to
      * already exist at this point */
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_WRONLY) < 0)
+    if (flags & VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenSparseFile(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_WRONLY) < 0)
+            goto out;
+    } else if (virFDStreamOpenFile(stream,
+                                   vol->target.path,
+                                   offset, length,
+                                   O_WRONLY) < 0) {
         goto out;
+    }
 
     ret = 0;
 
@@ -1797,9 +1876,7 @@ storageVolumeResize(virStorageVolPtr obj,
     }
 
     if (vol->building) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       _("volume '%s' is still being allocated."),
-                       vol->name);
+        storageVolumeReportBusy(vol);
         goto out;
     }
 
@@ -1856,104 +1933,362 @@ out:
  * was smaller than this size, ftruncate() shall increase the size of
  * the file. If the file size is increased, the extended area shall
  * appear as if it were zero-filled.
+ *
+ * The file is cut down from its end a step at a time, so that the
+ * job shows progress and can be cancelled in between.  A cancelled
+ * wipe still gives the volume its size back.
  */
+#define WIPE_TRUNCATE_SIZE (1024 * 1024 * 1024)
+
 static int
 storageVolumeZeroSparseFile(virStorageVolDefPtr vol,
+                            virStorageVolJobPtr job,
+                            const int *cancelled,
                             off_t size,
                             int fd)
 {
-    int ret = -1;
+    off_t length = size;
+    unsigned long long reported = 0;
+
+    while (length > 0) {
+        unsigned long long done;
+
+        if (virAtomicIntGet(cancelled)) {
+            virReportSystemError(ECANCELED,
+                                 _("Failed to write to storage volume "
+                                   "with path '%s'"),
+                                 vol->target.path);
+            goto restore;
+        }
 
-    ret = ftruncate(fd, 0);
-    if (ret == -1) {
-        virReportSystemError(errno,
-                             _("Failed to truncate volume with "
-                               "path '%s' to 0 bytes"),
-                             vol->target.path);
-        goto out;
+        length -= MIN(length, WIPE_TRUNCATE_SIZE);
+        if (ftruncate(fd, length) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to truncate volume with "
+                                   "path '%s' to %ju bytes"),
+                                 vol->target.path, (uintmax_t)length);
+            goto restore;
+        }
+
+        /* The job counts the allocation, not the size */
+        done = (double)(size - length) / size * vol->allocation;
+        virStorageVolJobUpdate(job, done - MIN(done, reported));
+        reported = MAX(done, reported);
     }
 
-    ret = ftruncate(fd, size);
-    if (ret == -1) {
+    if (ftruncate(fd, size) < 0) {
         virReportSystemError(errno,
                              _("Failed to truncate volume with "
                                "path '%s' to %ju bytes"),
                              vol->target.path, (uintmax_t)size);
+        return -1;
     }
 
-out:
-    return ret;
+    return 0;
+
+restore:
+    ignore_value(ftruncate(fd, size));
+    return -1;
+}
+
+
+/* Wipes are split into chunks of this size, handed out to a few
+ * threads so that several writes are in flight at once */
+#define WIPE_CHUNK_SIZE   (64 * 1024 * 1024)
+#define WIPE_WRITE_SIZE   (1024 * 1024)
+#define WIPE_THREADS_MAX  4
+
+typedef struct _virStorageWipeExtent virStorageWipeExtent;
+typedef virStorageWipeExtent *virStorageWipeExtentPtr;
+struct _virStorageWipeExtent {
+    virMutex lock;
+
+    virStorageVolJobPtr job;
+    const int *cancelled;
+    int fd;
+    bool isBlock;
+    bool fast;              /* zeroing without writing still worth trying */
+    bool discardZeroes;     /* device reads back discarded blocks as zero */
+    const char *writebuf;
+    size_t writebuf_length;
+
+    off_t next;
+    off_t end;
+    int err;
+};
+
+
+/*
+ * Tries to have the kernel zero a range without us writing it, returning
+ * true if it did.
+ */
+static bool
+storageWipeChunkFast(virStorageWipeExtentPtr ext,
+                     off_t offset ATTRIBUTE_UNUSED,
+                     off_t len ATTRIBUTE_UNUSED)
+{
+#ifdef __linux__
+    if (ext->isBlock) {
+        uint64_t range[2] = { offset, len };
+
+# ifdef BLKDISCARD
+        if (ext->discardZeroes && ioctl(ext->fd, BLKDISCARD, range) == 0)
+            return true;
+# endif
+# ifdef BLKZEROOUT
+        if (ioctl(ext->fd, BLKZEROOUT, range) == 0)
+            return true;
+# endif
+        return false;
+    }
+#endif
+
+#if HAVE_FALLOCATE && defined(FALLOC_FL_PUNCH_HOLE)
+# ifdef FALLOC_FL_ZERO_RANGE
+    if (fallocate(ext->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                  offset, len) == 0)
+        return true;
+# endif
+    /* Allocating the hole again keeps the volume fully allocated */
+    if (fallocate(ext->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  offset, len) == 0 &&
+        fallocate(ext->fd, FALLOC_FL_KEEP_SIZE, offset, len) == 0)
+        return true;
+#endif
+
+    return false;
+}
+
+
+static int
+storageWipeChunk(virStorageWipeExtentPtr ext,
+                 off_t offset,
+                 off_t len)
+{
+    bool fast;
+
+    virMutexLock(&ext->lock);
+    fast = ext->fast;
+    virMutexUnlock(&ext->lock);
+
+    if (fast) {
+        if (storageWipeChunkFast(ext, offset, len)) {
+            virStorageVolJobUpdate(ext->job, len);
+            return 0;
+        }
+
+        VIR_DEBUG("Falling back to writing zeroes, errno=%d", errno);
+        virMutexLock(&ext->lock);
+        ext->fast = false;
+        virMutexUnlock(&ext->lock);
+    }
+
+    while (len > 0) {
+        size_t write_size = ((off_t)ext->writebuf_length < len ?
+                             ext->writebuf_length : len);
+        ssize_t written;
+
+        written = pwrite(ext->fd, ext->writebuf, write_size, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (written == 0) {
+            errno = EIO;
+            return -1;
+        }
+
+        offset += written;
+        len -= written;
+        virStorageVolJobUpdate(ext->job, written);
+    }
+
+    return 0;
+}
+
+
+static void
+storageWipeWorker(void *opaque)
+{
+    virStorageWipeExtentPtr ext = opaque;
+
+    virMutexLock(&ext->lock);
+    while (!ext->err && ext->next < ext->end) {
+        off_t offset = ext->next;
+        off_t len = MIN(WIPE_CHUNK_SIZE, ext->end - ext->next);
+
+        if (virAtomicIntGet(ext->cancelled)) {
+            ext->err = ECANCELED;
+            break;
+        }
+
+        ext->next += len;
+        virMutexUnlock(&ext->lock);
+
+        if (storageWipeChunk(ext, offset, len) < 0) {
+            int err = errno;
+
+            virMutexLock(&ext->lock);
+            if (!ext->err)
+                ext->err = err;
+            break;
+        }
+
+        virMutexLock(&ext->lock);
+    }
+    virMutexUnlock(&ext->lock);
 }
 
 
 static int
 storageWipeExtent(virStorageVolDefPtr vol,
+                  virStorageVolJobPtr job,
+                  const int *cancelled,
                   int fd,
+                  bool isBlock,
                   off_t extent_start,
-                  off_t extent_length,
-                  char *writebuf,
-                  size_t writebuf_length,
-                  size_t *bytes_wiped)
+                  off_t extent_length)
 {
-    int ret = -1, written = 0;
-    off_t remaining = 0;
-    size_t write_size = 0;
+    int ret = -1;
+    virStorageWipeExtent ext;
+    virThread threads[WIPE_THREADS_MAX];
+    size_t nthreads;
+    size_t i;
+    char *writebuf = NULL;
 
     VIR_DEBUG("extent logical start: %ju len: %ju",
               (uintmax_t)extent_start, (uintmax_t)extent_length);
 
-    if ((ret = lseek(fd, extent_start, SEEK_SET)) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to seek to position %ju in volume "
-                               "with path '%s'"),
-                             (uintmax_t)extent_start, vol->target.path);
-        goto out;
+    memset(&ext, 0, sizeof(ext));
+
+    if (VIR_ALLOC_N(writebuf, WIPE_WRITE_SIZE) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (virMutexInit(&ext.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize mutex"));
+        VIR_FREE(writebuf);
+        return -1;
     }
 
-    remaining = extent_length;
-    while (remaining > 0) {
+    ext.job = job;
+    ext.cancelled = cancelled;
+    ext.fd = fd;
+    ext.isBlock = isBlock;
+    ext.fast = true;
+    ext.writebuf = writebuf;
+    ext.writebuf_length = WIPE_WRITE_SIZE;
+    ext.next = extent_start;
+    ext.end = extent_start + extent_length;
 
-        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
-        written = safewrite(fd, writebuf, write_size);
-        if (written < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to write %zu bytes to "
-                                   "storage volume with path '%s'"),
-                                 write_size, vol->target.path);
+#if defined(__linux__) && defined(BLKDISCARDZEROES)
+    if (isBlock) {
+        unsigned int zeroes = 0;
 
-            goto out;
+        if (ioctl(fd, BLKDISCARDZEROES, &zeroes) == 0 && zeroes)
+            ext.discardZeroes = true;
+    }
+#endif
+
+    for (nthreads = 0 ; nthreads < WIPE_THREADS_MAX ; nthreads++) {
+        if (nthreads > 0 &&
+            (off_t)nthreads * WIPE_CHUNK_SIZE >= extent_length)
+            break;
+        if (virThreadCreate(&threads[nthreads], true,
+                            storageWipeWorker, &ext) < 0) {
+            if (nthreads == 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to create wipe thread"));
+                goto out;
+            }
+            break;
         }
+    }
+
+    for (i = 0 ; i < nthreads ; i++)
+        virThreadJoin(&threads[i]);
 
-        *bytes_wiped += written;
-        remaining -= written;
+    if (ext.err) {
+        virReportSystemError(ext.err,
+                             _("Failed to write to storage volume "
+                               "with path '%s'"),
+                             vol->target.path);
+        goto out;
     }
 
     if (fdatasync(fd) < 0) {
-        ret = -errno;
         virReportSystemError(errno,
                              _("cannot sync data to volume with path '%s'"),
                              vol->target.path);
         goto out;
     }
 
-    VIR_DEBUG("Wrote %zu bytes to volume with path '%s'",
-              *bytes_wiped, vol->target.path);
+    VIR_DEBUG("Wiped %ju bytes of volume with path '%s' using %zu threads",
+              (uintmax_t)extent_length, vol->target.path, nthreads);
 
     ret = 0;
 
 out:
+    virMutexDestroy(&ext.lock);
+    VIR_FREE(writebuf);
+    return ret;
+}
+
+
+struct _virStorageWipeJob {
+    virStorageDriverStatePtr driver;
+    /* The pool's asyncjobs count and the volume's building flag
+     * keep both alive until storageVolumeWipeEnd */
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    virStorageVolJobPtr job;
+    unsigned int algorithm;
+
+    virThread thread;
+    int cancelled;          /* accessed atomically */
+
+    /* Protected by the driver lock */
+    pid_t scrub;            /* scrub process while it runs, or 0 */
+    bool done;              /* the thread no longer uses the job */
+};
+
+
+static int
+storageVolumeWipeScrub(virStorageWipeJobPtr wipe,
+                       virCommandPtr cmd)
+{
+    pid_t pid;
+    int ret;
+
+    if (virCommandRunAsync(cmd, &pid) < 0)
+        return -1;
+
+    storageDriverLock(wipe->driver);
+    wipe->scrub = pid;
+    if (virAtomicIntGet(&wipe->cancelled))
+        virProcessKill(pid, SIGTERM);
+    storageDriverUnlock(wipe->driver);
+
+    ret = virCommandWait(cmd, NULL);
+
+    storageDriverLock(wipe->driver);
+    wipe->scrub = 0;
+    storageDriverUnlock(wipe->driver);
+
     return ret;
 }
 
 
 static int
-storageVolumeWipeInternal(virStorageVolDefPtr def,
-                          unsigned int algorithm)
+storageVolumeWipeInternal(virStorageWipeJobPtr wipe)
 {
+    virStorageVolDefPtr def = wipe->vol;
+    unsigned int algorithm = wipe->algorithm;
     int ret = -1, fd = -1;
     struct stat st;
-    char *writebuf = NULL;
-    size_t bytes_wiped = 0;
     virCommandPtr cmd = NULL;
 
     VIR_DEBUG("Wiping volume with path '%s' and algorithm %u",
@@ -2010,39 +2345,139 @@ storageVolumeWipeInternal(virStorageVolDefPtr def,
         virCommandAddArgList(cmd, "-f", "-p", alg_char,
                              def->target.path, NULL);
 
-        if (virCommandRun(cmd, NULL) < 0)
+        if (storageVolumeWipeScrub(wipe, cmd) < 0)
             goto out;
 
         ret = 0;
         goto out;
     } else {
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
-            ret = storageVolumeZeroSparseFile(def, st.st_size, fd);
+            ret = storageVolumeZeroSparseFile(def, wipe->job,
+                                              &wipe->cancelled,
+                                              st.st_size, fd);
         } else {
-
-            if (VIR_ALLOC_N(writebuf, st.st_blksize) != 0) {
-                virReportOOMError();
-                goto out;
-            }
-
             ret = storageWipeExtent(def,
+                                    wipe->job,
+                                    &wipe->cancelled,
                                     fd,
+                                    S_ISBLK(st.st_mode),
                                     0,
-                                    def->allocation,
-                                    writebuf,
-                                    st.st_blksize,
-                                    &bytes_wiped);
+                                    def->allocation);
         }
     }
 
 out:
     virCommandFree(cmd);
-    VIR_FREE(writebuf);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
 
 
+/*
+ * Records the outcome of a wipe and gives the volume back to the pool.
+ * Called without the pool lock. Background wipes may be joined and
+ * freed as soon as this marks them done.
+ */
+static void
+storageVolumeWipeEnd(virStorageWipeJobPtr wipe, bool success)
+{
+    virStorageDriverStatePtr driver = wipe->driver;
+    virStoragePoolObjPtr pool = wipe->pool;
+
+    virStorageVolJobEnd(wipe->job, success);
+
+    storageDriverLock(driver);
+    virStoragePoolObjLock(pool);
+
+    wipe->vol->building = 0;
+    pool->asyncjobs--;
+    wipe->done = true;
+
+    storageDriverUnlock(driver);
+    virStoragePoolObjUnlock(pool);
+}
+
+
+static int
+storageVolumeWipeRun(virStorageWipeJobPtr wipe)
+{
+    int ret;
+
+    ret = storageVolumeWipeInternal(wipe);
+    storageVolumeWipeEnd(wipe, ret == 0);
+
+    return ret;
+}
+
+
+static void
+storageVolumeWipeThread(void *opaque)
+{
+    virStorageWipeJobPtr wipe = opaque;
+
+    /* Errors are logged as they are reported, and the job state
+     * tells the caller how the wipe went */
+    ignore_value(storageVolumeWipeRun(wipe));
+}
+
+
+/*
+ * Joins the threads of background wipes which have finished.
+ * Called with the driver lock held.
+ */
+static void
+storageVolumeWipeReap(virStorageDriverStatePtr driver)
+{
+    size_t i = 0;
+
+    while (i < driver->nwipeJobs) {
+        virStorageWipeJobPtr wipe = driver->wipeJobs[i];
+
+        if (!wipe->done) {
+            i++;
+            continue;
+        }
+
+        virThreadJoin(&wipe->thread);
+        VIR_FREE(wipe);
+        VIR_DELETE_ELEMENT(driver->wipeJobs, i, driver->nwipeJobs);
+    }
+}
+
+
+/*
+ * Stops all background wipes and waits for their threads, which
+ * report the volumes' jobs as failed. Called without the driver lock.
+ */
+static void
+storageVolumeWipeCancelAll(virStorageDriverStatePtr driver)
+{
+    virStorageWipeJobPtr *jobs;
+    size_t njobs;
+    size_t i;
+
+    storageDriverLock(driver);
+    jobs = driver->wipeJobs;
+    njobs = driver->nwipeJobs;
+    driver->wipeJobs = NULL;
+    driver->nwipeJobs = 0;
+
+    for (i = 0 ; i < njobs ; i++) {
+        virAtomicIntSet(&jobs[i]->cancelled, 1);
+        if (jobs[i]->scrub)
+            virProcessKill(jobs[i]->scrub, SIGTERM);
+    }
+    storageDriverUnlock(driver);
+
+    /* The threads need the driver lock to finish */
+    for (i = 0 ; i < njobs ; i++) {
+        virThreadJoin(&jobs[i]->thread);
+        VIR_FREE(jobs[i]);
+    }
+    VIR_FREE(jobs);
+}
+
+
 static int
 storageVolumeWipePattern(virStorageVolPtr obj,
                          unsigned int algorithm,
@@ -2051,9 +2486,11 @@ storageVolumeWipePattern(virStorageVolPtr obj,
     virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
     virStoragePoolObjPtr pool = NULL;
     virStorageVolDefPtr vol = NULL;
+    virStorageWipeJobPtr wipe = NULL;
+    virStorageVolJobPtr job;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_WIPE_ASYNC, -1);
 
     if (algorithm >= VIR_STORAGE_VOL_WIPE_ALG_LAST) {
         virReportError(VIR_ERR_INVALID_ARG,
@@ -2089,19 +2526,68 @@ storageVolumeWipePattern(virStorageVolPtr obj,
     }
 
     if (vol->building) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       _("volume '%s' is still being allocated."),
-                       vol->name);
+        storageVolumeReportBusy(vol);
+        goto out;
+    }
+
+    if (VIR_ALLOC(wipe) < 0) {
+        virReportOOMError();
         goto out;
     }
 
-    if (storageVolumeWipeInternal(vol, algorithm) == -1) {
+    if (!(job = virStorageVolJobNew(VIR_STORAGE_VOL_JOB_WIPE,
+                                    vol->allocation)))
         goto out;
+    virStorageVolJobFree(vol->job);
+    vol->job = job;
+
+    wipe->driver = driver;
+    wipe->pool = pool;
+    wipe->vol = vol;
+    wipe->job = job;
+    wipe->algorithm = algorithm;
+
+    /* Drop the pool lock while wiping, so the pool and its other
+     * volumes stay usable */
+    pool->asyncjobs++;
+    vol->building = 1;
+    virStoragePoolObjUnlock(pool);
+    pool = NULL;
+
+    if (flags & VIR_STORAGE_VOL_WIPE_ASYNC) {
+        storageDriverLock(driver);
+        storageVolumeWipeReap(driver);
+
+        if (VIR_EXPAND_N(driver->wipeJobs, driver->nwipeJobs, 1) < 0) {
+            storageDriverUnlock(driver);
+            virReportOOMError();
+            storageVolumeWipeEnd(wipe, false);
+            goto out;
+        }
+
+        if (virThreadCreate(&wipe->thread, true,
+                            storageVolumeWipeThread, wipe) < 0) {
+            VIR_SHRINK_N(driver->wipeJobs, driver->nwipeJobs, 1);
+            storageDriverUnlock(driver);
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create wipe thread"));
+            storageVolumeWipeEnd(wipe, false);
+            goto out;
+        }
+
+        driver->wipeJobs[driver->nwipeJobs - 1] = wipe;
+        storageDriverUnlock(driver);
+        wipe = NULL;
+    } else {
+        ret = storageVolumeWipeRun(wipe);
+        if (ret < 0)
+            goto out;
     }
 
     ret = 0;
 
 out:
+    VIR_FREE(wipe);
     if (pool) {
         virStoragePoolObjUnlock(pool);
     }
@@ -2117,6 +2603,53 @@ storageVolumeWipe(virStorageVolPtr obj,
     return storageVolumeWipePattern(obj, VIR_STORAGE_VOL_WIPE_ALG_ZERO, flags);
 }
 
+static int
+storageVolumeGetJobInfo(virStorageVolPtr obj,
+                        virStorageVolJobInfoPtr info,
+                        unsigned int flags)
+{
+    virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    storageDriverLock(driver);
+    pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
+    storageDriverUnlock(driver);
+
+    if (!pool) {
+        virReportError(VIR_ERR_NO_STORAGE_POOL,
+                       _("no storage pool with matching name '%s'"),
+                       obj->pool);
+        goto cleanup;
+    }
+
+    if (!virStoragePoolObjIsActive(pool)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("storage pool '%s' is not active"), pool->def->name);
+        goto cleanup;
+    }
+
+    vol = virStorageVolDefFindByName(pool, obj->name);
+
+    if (!vol) {
+        virReportError(VIR_ERR_NO_STORAGE_VOL,
+                       _("no storage vol with matching name '%s'"),
+                       obj->name);
+        goto cleanup;
+    }
+
+    virStorageVolJobGetInfo(vol->job, info);
+    ret = 0;
+
+cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    return ret;
+}
+
 static int
 storageVolumeDelete(virStorageVolPtr obj,
                     unsigned int flags) {
@@ -2124,7 +2657,6 @@ storageVolumeDelete(virStorageVolPtr obj,
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
     virStorageVolDefPtr vol = NULL;
-    unsigned int i;
     int ret = -1;
 
     storageDriverLock(driver);
@@ -2157,9 +2689,7 @@ storageVolumeDelete(virStorageVolPtr obj,
     }
 
     if (vol->building) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       _("volume '%s' is still being allocated."),
-                       vol->name);
+        storageVolumeReportBusy(vol);
         goto cleanup;
     }
 
@@ -2173,25 +2703,11 @@ storageVolumeDelete(virStorageVolPtr obj,
     if (backend->deleteVol(obj->conn, pool, vol, flags) < 0)
         goto cleanup;
 
-    for (i = 0 ; i < pool->volumes.count ; i++) {
-        if (pool->volumes.objs[i] == vol) {
-            VIR_INFO("Deleting volume '%s' from storage pool '%s'",
-                     vol->name, pool->def->name);
-            virStorageVolDefFree(vol);
-            vol = NULL;
-
-            if (i < (pool->volumes.count - 1))
-                memmove(pool->volumes.objs + i, pool->volumes.objs + i + 1,
-                        sizeof(*(pool->volumes.objs)) * (pool->volumes.count - (i + 1)));
-
-            if (VIR_REALLOC_N(pool->volumes.objs, pool->volumes.count - 1) < 0) {
-                ; /* Failure to reduce memory allocation isn't fatal */
-            }
-            pool->volumes.count--;
-
-            break;
-        }
-    }
+    VIR_INFO("Deleting volume '%s' from storage pool '%s'",
+             vol->name, pool->def->name);
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
+    vol = NULL;
     ret = 0;
 
 cleanup:
@@ -2238,8 +2754,7 @@ storageVolumeGetInfo(virStorageVolPtr obj,
     if ((backend = virStorageBackendForType(pool->def->type)) == NULL)
         goto cleanup;
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, vol) < 0)
+    if (storageVolumeRefresh(obj->conn, backend, pool, vol) < 0)
         goto cleanup;
 
     memset(info, 0, sizeof(*info));
@@ -2295,8 +2810,7 @@ storageVolumeGetXMLDesc(virStorageVolPtr obj,
     if ((backend = virStorageBackendForType(pool->def->type)) == NULL)
         goto cleanup;
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, vol) < 0)
+    if (storageVolumeRefresh(obj->conn, backend, pool, vol) < 0)
         goto cleanup;
 
     ret = virStorageVolDefFormat(pool->def, vol);
@@ -2413,6 +2927,7 @@ static virStorageDriver storageDriver = {
 
     .poolIsActive = storagePoolIsActive, /* 0.7.3 */
     .poolIsPersistent = storagePoolIsPersistent, /* 0.7.3 */
+    .volGetJobInfo = storageVolumeGetJobInfo, /* 1.0.3 */
 };
 
 
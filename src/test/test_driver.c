@@ -730,12 +730,6 @@ static int testOpenVolumesForPool(xmlDocPtr xml,
             }
         }
 
-        if (VIR_REALLOC_N(pool->volumes.objs,
-                          pool->volumes.count+1) < 0) {
-            virReportOOMError();
-            goto error;
-        }
-
         if (def->target.path == NULL) {
             if (virAsprintf(&def->target.path, "%s/%s",
                             pool->def->target.path,
@@ -753,11 +747,13 @@ static int testOpenVolumesForPool(xmlDocPtr xml,
             }
         }
 
+        if (virStoragePoolObjAddVol(pool, def) < 0)
+            goto error;
+
         pool->def->allocation += def->allocation;
         pool->def->available = (pool->def->capacity -
                                 pool->def->allocation);
 
-        pool->volumes.objs[pool->volumes.count++] = def;
         def = NULL;
     }
 
@@ -4879,12 +4875,6 @@ testStorageVolumeCreateXML(virStoragePoolPtr pool,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(privpool->volumes.objs,
-                      privpool->volumes.count+1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     privpool->def->target.path,
                     privvol->name) == -1) {
@@ -4898,12 +4888,13 @@ testStorageVolumeCreateXML(virStoragePoolPtr pool,
         goto cleanup;
     }
 
+    if (virStoragePoolObjAddVol(privpool, privvol) < 0)
+        goto cleanup;
+
     privpool->def->allocation += privvol->allocation;
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    privpool->volumes.objs[privpool->volumes.count++] = privvol;
-
     ret = virGetStorageVol(pool->conn, privpool->def->name,
                            privvol->name, privvol->key,
                            NULL, NULL);
@@ -4974,12 +4965,6 @@ testStorageVolumeCreateXMLFrom(virStoragePoolPtr pool,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    if (VIR_REALLOC_N(privpool->volumes.objs,
-                      privpool->volumes.count+1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     privpool->def->target.path,
                     privvol->name) == -1) {
@@ -4993,12 +4978,13 @@ testStorageVolumeCreateXMLFrom(virStoragePoolPtr pool,
         goto cleanup;
     }
 
+    if (virStoragePoolObjAddVol(privpool, privvol) < 0)
+        goto cleanup;
+
     privpool->def->allocation += privvol->allocation;
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    privpool->volumes.objs[privpool->volumes.count++] = privvol;
-
     ret = virGetStorageVol(pool->conn, privpool->def->name,
                            privvol->name, privvol->key,
                            NULL, NULL);
@@ -5018,7 +5004,6 @@ testStorageVolumeDelete(virStorageVolPtr vol,
     testConnPtr privconn = vol->conn->privateData;
     virStoragePoolObjPtr privpool;
     virStorageVolDefPtr privvol;
-    int i;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -5054,25 +5039,8 @@ testStorageVolumeDelete(virStorageVolPtr vol,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    for (i = 0 ; i < privpool->volumes.count ; i++) {
-        if (privpool->volumes.objs[i] == privvol) {
-            virStorageVolDefFree(privvol);
-
-            if (i < (privpool->volumes.count - 1))
-                memmove(privpool->volumes.objs + i,
-                        privpool->volumes.objs + i + 1,
-                        sizeof(*(privpool->volumes.objs)) *
-                                (privpool->volumes.count - (i + 1)));
-
-            if (VIR_REALLOC_N(privpool->volumes.objs,
-                              privpool->volumes.count - 1) < 0) {
-                ; /* Failure to reduce memory allocation isn't fatal */
-            }
-            privpool->volumes.count--;
-
-            break;
-        }
-    }
+    virStoragePoolObjRemoveVol(privpool, privvol);
+    virStorageVolDefFree(privvol);
     ret = 0;
 
 cleanup:
@@ -5750,6 +5718,150 @@ cleanup:
     return ret;
 }
 
+static int
+testDomainGetStatsOne(virConnectPtr conn,
+                      virDomainObjPtr dom,
+                      unsigned int stats,
+                      virDomainStatsRecordPtr *record)
+{
+    virDomainStatsRecordPtr tmp;
+    int maxparams = 0;
+    int state;
+    int reason;
+    int ret = -1;
+
+    if (VIR_ALLOC(tmp) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_STATE) {
+        state = virDomainObjGetState(dom, &reason);
+        if (virTypedParamsAddInt(&tmp->params, &tmp->nparams, &maxparams,
+                                 "state.state", state) < 0 ||
+            virTypedParamsAddInt(&tmp->params, &tmp->nparams, &maxparams,
+                                 "state.reason", reason) < 0)
+            goto cleanup;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_BALLOON) {
+        if (virTypedParamsAddULLong(&tmp->params, &tmp->nparams, &maxparams,
+                                    "balloon.current",
+                                    dom->def->mem.cur_balloon) < 0 ||
+            virTypedParamsAddULLong(&tmp->params, &tmp->nparams, &maxparams,
+                                    "balloon.maximum",
+                                    dom->def->mem.max_balloon) < 0)
+            goto cleanup;
+    }
+
+    if (stats & VIR_DOMAIN_STATS_VCPU) {
+        if (virTypedParamsAddUInt(&tmp->params, &tmp->nparams, &maxparams,
+                                  "vcpu.current", dom->def->vcpus) < 0 ||
+            virTypedParamsAddUInt(&tmp->params, &tmp->nparams, &maxparams,
+                                  "vcpu.maximum", dom->def->maxvcpus) < 0)
+            goto cleanup;
+    }
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid)))
+        goto cleanup;
+    tmp->dom->id = dom->def->id;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+cleanup:
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        VIR_FREE(tmp);
+    }
+    return ret;
+}
+
+static int
+testConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    testConnPtr privconn = conn->privateData;
+    unsigned int supported = VIR_DOMAIN_STATS_STATE |
+                             VIR_DOMAIN_STATS_BALLOON |
+                             VIR_DOMAIN_STATS_VCPU;
+    virDomainPtr *domlist = NULL;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    int ntempdoms = 0;
+    int nstats = 0;
+    int ret = -1;
+    int i;
+
+    if (ndoms)
+        virCheckFlags(VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+    else
+        virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                      VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                      VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+
+    if (!stats) {
+        stats = supported;
+    } else if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS &&
+               stats & ~supported) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Stats types bits 0x%x are not supported by this daemon"),
+                       stats & ~supported);
+        return -1;
+    }
+    stats &= supported;
+
+    testDriverLock(privconn);
+
+    if (!ndoms) {
+        if ((ntempdoms = virDomainObjListExport(privconn->domains, conn,
+                                                &domlist,
+                                                flags & ~VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS)) < 0)
+            goto cleanup;
+
+        ndoms = ntempdoms;
+        doms = domlist;
+    }
+
+    if (VIR_ALLOC_N(tmpstats, ndoms + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < ndoms ; i++) {
+        virDomainObjPtr dom;
+        int rc;
+
+        /* Domains which went away in the meantime are skipped */
+        if (!(dom = virDomainObjListFindByUUID(privconn->domains,
+                                               doms[i]->uuid)))
+            continue;
+
+        rc = testDomainGetStatsOne(conn, dom, stats, &tmpstats[nstats]);
+        virObjectUnlock(dom);
+        if (rc < 0)
+            goto cleanup;
+        nstats++;
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+    ret = nstats;
+
+cleanup:
+    testDriverUnlock(privconn);
+    virDomainStatsRecordListFree(tmpstats);
+    for (i = 0 ; i < ntempdoms ; i++)
+        virDomainFree(domlist[i]);
+    VIR_FREE(domlist);
+    return ret;
+}
+
 
 static virDriver testDriver = {
     .no = VIR_DRV_TEST,
@@ -5820,6 +5932,7 @@ static virDriver testDriver = {
     .domainEventDeregisterAny = testDomainEventDeregisterAny, /* 0.8.0 */
     .isAlive = testIsAlive, /* 0.9.8 */
     .nodeGetCPUMap = testNodeGetCPUMap, /* 1.0.0 */
+    .connectGetAllDomainStats = testConnectGetAllDomainStats, /* 1.0.3 */
 };
 
 static virNetworkDriver testNetworkDriver = {
@@ -453,7 +453,10 @@ umlStartup(bool privileged,
     if (!(uml_driver->domains = virDomainObjListNew()))
         goto error;
 
-    uml_driver->domainEventState = virDomainEventStateNew();
+    /* events are relayed to remote clients, which is safe from any thread */
+    uml_driver->domainEventState =
+        virDomainEventStateNewFull(VIR_DOMAIN_EVENT_STATE_ASYNC |
+                                   VIR_DOMAIN_EVENT_STATE_COALESCE);
     if (!uml_driver->domainEventState)
         goto error;
 
@@ -23,6 +23,8 @@
  *   - Read existing file
  *   - Write existing file
  *   - Create & write new file
+ *   - Compress & decompress save images between stdin and stdout
+ *   - Read & write sparse files, passing holes rather than zeros
  */
 
 #include <config.h>
@@ -30,8 +32,15 @@
 #include <locale.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef __linux__
+# include <linux/falloc.h>
+#endif
+#if WITH_ZLIB
+# include <zlib.h>
+#endif
 
 #include "virutil.h"
 #include "virthread.h"
@@ -72,6 +81,193 @@ cleanup:
     return fd;
 }
 
+/*
+ * Write @len bytes of @buf to @fd, which is at offset @pos.  Blocks
+ * of zeros beyond @sparseFrom, the initial end of the file, are
+ * seeked over rather than written, as they read back as zeros anyway
+ * once the file is extended past them.
+ */
+static int
+writeSparse(int fd, const char *buf, size_t len, size_t blksize,
+            off_t sparseFrom, off_t *pos)
+{
+    size_t done = 0;
+    size_t run = 0;
+
+    while (done < len) {
+        size_t n = MIN(blksize, len - done);
+
+        if (*pos + (off_t) done >= sparseFrom &&
+            virMemIsZero(buf + done, n)) {
+            if (run && safewrite(fd, buf + done - run, run) < 0)
+                return -1;
+            run = 0;
+            if (lseek(fd, n, SEEK_CUR) < 0)
+                return -1;
+        } else {
+            run += n;
+        }
+        done += n;
+    }
+
+    if (run && safewrite(fd, buf + done - run, run) < 0)
+        return -1;
+
+    *pos += len;
+    return 0;
+}
+
+/* Number of buffers in flight when reads and writes overlap */
+#define RUNIO_BUFFERS 2
+
+struct runIOOutput {
+    int fd;
+    bool sparse; /* true if zeros may be left as holes */
+    off_t sparseFrom;
+    off_t pos;
+    size_t blksize;
+};
+
+struct runIOChunk {
+    char *buf;
+    size_t len;
+    off_t end; /* if non-zero, truncate the output there */
+};
+
+/* State shared with the thread writing out one chunk while the
+ * next one is read */
+struct runIOWriter {
+    virMutex lock;
+    virCond cond;
+    struct runIOOutput *out;
+    struct runIOChunk chunks[RUNIO_BUFFERS];
+    size_t head; /* next chunk to write */
+    size_t count; /* chunks waiting to be written */
+    bool done; /* no more chunks are coming */
+    int err; /* errno of a failed write */
+    bool errTruncate;
+};
+
+/*
+ * Write one chunk of data to @out.  Returns 0, or -1 with errno set,
+ * in which case @truncate tells whether writing or truncating failed.
+ */
+static int
+runIOWrite(struct runIOOutput *out, const char *buf, size_t len,
+           off_t end, bool *truncate)
+{
+    *truncate = false;
+
+    if ((out->sparse ?
+         writeSparse(out->fd, buf, len, out->blksize,
+                     out->sparseFrom, &out->pos) :
+         safewrite(out->fd, buf, len)) < 0)
+        return -1;
+
+    if (end && ftruncate(out->fd, end) < 0) {
+        *truncate = true;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+runIOWriterWorker(void *opaque)
+{
+    struct runIOWriter *w = opaque;
+
+    virMutexLock(&w->lock);
+    while (!w->err) {
+        struct runIOChunk *chunk;
+        bool truncate;
+        int err = 0;
+
+        if (!w->count) {
+            if (w->done)
+                break;
+            ignore_value(virCondWait(&w->cond, &w->lock));
+            continue;
+        }
+
+        chunk = &w->chunks[w->head];
+        virMutexUnlock(&w->lock);
+        if (runIOWrite(w->out, chunk->buf, chunk->len,
+                       chunk->end, &truncate) < 0)
+            err = errno;
+        virMutexLock(&w->lock);
+
+        if (err) {
+            w->err = err;
+            w->errTruncate = truncate;
+        }
+        w->head = (w->head + 1) % RUNIO_BUFFERS;
+        w->count--;
+        virCondBroadcast(&w->cond);
+    }
+    virMutexUnlock(&w->lock);
+}
+
+/* Wait for the queued chunks to be written.  Returns 0, or -1 if
+ * a write failed */
+static int
+runIOWriterStop(struct runIOWriter *w, virThreadPtr thread)
+{
+    virMutexLock(&w->lock);
+    w->done = true;
+    virCondBroadcast(&w->cond);
+    virMutexUnlock(&w->lock);
+
+    virThreadJoin(thread);
+    virCondDestroy(&w->cond);
+    virMutexDestroy(&w->lock);
+
+    return w->err ? -1 : 0;
+}
+
+#if HAVE_SPLICE
+/*
+ * Move data between @fdin and @fdout, one of which must be a pipe,
+ * without copying it through user space.  Returns 0 on success, -1 on
+ * error, or 1 if splicing isn't possible and nothing was transferred.
+ */
+static int
+runSplice(int fdin, const char *fdinname, int fdout, const char *fdoutname,
+          unsigned long long length)
+{
+    unsigned long long total = 0;
+
+    while (1) {
+        size_t want = 1024*1024;
+        ssize_t got;
+
+        if (length &&
+            (length - total) < want)
+            want = length - total;
+
+        if (want == 0)
+            break; /* End of requested data from client */
+
+        if ((got = splice(fdin, NULL, fdout, NULL, want,
+                          SPLICE_F_MOVE | SPLICE_F_MORE)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS))
+                return 1;
+            virReportSystemError(errno, _("Unable to splice %s to %s"),
+                                 fdinname, fdoutname);
+            return -1;
+        }
+        if (got == 0)
+            break; /* End of file before end of requested data */
+
+        total += got;
+    }
+
+    return 0;
+}
+#endif
+
 static int
 runIO(const char *path, int fd, int oflags, unsigned long long length)
 {
@@ -86,15 +282,32 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
     bool shortRead = false; /* true if we hit a short read */
     off_t end = 0;
+    struct runIOOutput out;
+    struct runIOWriter writer;
+    virThread thread;
+    bool threaded = false; /* true if writes are done by a thread */
+    bool spliced = false; /* true if the kernel moved the data */
+    bool truncate;
+    size_t nbufs = 1;
+    struct stat sb;
+    size_t i;
+
+    memset(&out, 0, sizeof(out));
+    memset(&writer, 0, sizeof(writer));
+
+    /* Nothing is cached with O_DIRECT, so have the next buffer read
+     * while the previous one is being written */
+    if (direct)
+        nbufs = RUNIO_BUFFERS;
 
 #if HAVE_POSIX_MEMALIGN
-    if (posix_memalign(&base, alignMask + 1, buflen)) {
+    if (posix_memalign(&base, alignMask + 1, nbufs * buflen)) {
         virReportOOMError();
         goto cleanup;
     }
     buf = base;
 #else
-    if (VIR_ALLOC_N(buf, buflen + alignMask) < 0) {
+    if (VIR_ALLOC_N(buf, nbufs * buflen + alignMask) < 0) {
         virReportOOMError();
         goto cleanup;
     }
@@ -128,6 +341,14 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
                                  _("O_DIRECT write needs empty seekable file"));
             goto cleanup;
         }
+        /* Zeros past the current end of a regular file need not be
+         * written, but data already in the file must be overwritten */
+        if (!(oflags & O_APPEND) &&
+            fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) &&
+            (out.pos = lseek(fd, 0, SEEK_CUR)) >= 0) {
+            out.sparse = true;
+            out.sparseFrom = sb.st_size;
+        }
         break;
 
     case O_RDWR:
@@ -138,9 +359,61 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
-    while (1) {
+    out.fd = fdout;
+    out.blksize = alignMask + 1;
+
+#if HAVE_SPLICE
+    /* Unless the data has to be looked at or aligned, let the kernel
+     * move it between the pipe and the file */
+    if (!direct && !out.sparse &&
+        ((fstat(fdin, &sb) == 0 && S_ISFIFO(sb.st_mode)) ||
+         (fstat(fdout, &sb) == 0 && S_ISFIFO(sb.st_mode)))) {
+        int rc;
+
+        if ((rc = runSplice(fdin, fdinname, fdout, fdoutname, length)) < 0)
+            goto cleanup;
+        spliced = rc == 0;
+    }
+#endif
+
+    if (!spliced && nbufs > 1 &&
+        virMutexInit(&writer.lock) == 0) {
+        if (virCondInit(&writer.cond) < 0) {
+            virMutexDestroy(&writer.lock);
+        } else {
+            writer.out = &out;
+            for (i = 0 ; i < nbufs ; i++)
+                writer.chunks[i].buf = buf + i * buflen;
+            if (virThreadCreate(&thread, true,
+                                runIOWriterWorker, &writer) < 0) {
+                virCondDestroy(&writer.cond);
+                virMutexDestroy(&writer.lock);
+            } else {
+                threaded = true;
+            }
+        }
+    }
+
+    while (!spliced) {
+        char *chunk = buf;
+        size_t slot = 0;
         ssize_t got;
 
+        if (threaded) {
+            bool failed;
+
+            virMutexLock(&writer.lock);
+            while (writer.count == nbufs && !writer.err)
+                ignore_value(virCondWait(&writer.cond, &writer.lock));
+            slot = (writer.head + writer.count) % nbufs;
+            failed = writer.err != 0;
+            virMutexUnlock(&writer.lock);
+
+            if (failed)
+                break; /* Reported once the writer is stopped */
+            chunk = writer.chunks[slot].buf;
+        }
+
         if (length &&
             (length - total) < buflen)
             buflen = length - total;
@@ -148,7 +421,7 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         if (buflen == 0)
             break; /* End of requested data from client */
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
+        if ((got = saferead(fdin, chunk, buflen)) < 0) {
             virReportSystemError(errno, _("Unable to read %s"), fdinname);
             goto cleanup;
         }
@@ -166,19 +439,49 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         total += got;
         if (fdout == fd && direct && shortRead) {
             end = total;
-            memset(buf + got, 0, buflen - got);
+            memset(chunk + got, 0, buflen - got);
             got = (got + alignMask) & ~alignMask;
         }
-        if (safewrite(fdout, buf, got) < 0) {
-            virReportSystemError(errno, _("Unable to write %s"), fdoutname);
+
+        if (threaded) {
+            virMutexLock(&writer.lock);
+            writer.chunks[slot].len = got;
+            writer.chunks[slot].end = end;
+            writer.count++;
+            virCondBroadcast(&writer.cond);
+            virMutexUnlock(&writer.lock);
+        } else if (runIOWrite(&out, chunk, got, end, &truncate) < 0) {
+            if (truncate)
+                virReportSystemError(errno, _("Unable to truncate %s"),
+                                     fdoutname);
+            else
+                virReportSystemError(errno, _("Unable to write %s"),
+                                     fdoutname);
             goto cleanup;
         }
-        if (end && ftruncate(fd, end) < 0) {
-            virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
+    }
+
+    if (threaded) {
+        threaded = false;
+        if (runIOWriterStop(&writer, &thread) < 0) {
+            if (writer.errTruncate)
+                virReportSystemError(writer.err, _("Unable to truncate %s"),
+                                     fdoutname);
+            else
+                virReportSystemError(writer.err, _("Unable to write %s"),
+                                     fdoutname);
             goto cleanup;
         }
     }
 
+    /* A trailing hole only exists once the file is extended over it */
+    if (out.sparse && !end &&
+        (fstat(fd, &sb) < 0 ||
+         (sb.st_size < out.pos && ftruncate(fd, out.pos) < 0))) {
+        virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
+        goto cleanup;
+    }
+
     /* Ensure all data is written */
     if (fdatasync(fdout) < 0) {
         if (errno != EINVAL && errno != EROFS) {
@@ -191,6 +494,9 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     ret = 0;
 
 cleanup:
+    if (threaded)
+        ignore_value(runIOWriterStop(&writer, &thread));
+
     if (VIR_CLOSE(fd) < 0 &&
         ret == 0) {
         virReportSystemError(errno, _("Unable to close %s"), path);
@@ -201,6 +507,641 @@ cleanup:
     return ret;
 }
 
+
+/*
+ * Send the file as data and hole records, finding the holes
+ * with SEEK_DATA/SEEK_HOLE.
+ */
+static int
+runSparseRead(const char *path, int fd, unsigned long long length,
+              char *buf, size_t buflen)
+{
+    char hdr[VIR_FILE_SPARSE_RECORD_HEADER_LEN];
+    unsigned long long total = 0;
+
+    while (!length || total < length) {
+        unsigned long long len;
+        bool inData;
+
+        if (virFileInData(fd, &inData, &len) < 0)
+            return -1;
+        if (len == 0)
+            break; /* End of file before end of requested data */
+        if (length && len > length - total)
+            len = length - total;
+
+        if (!inData) {
+            virFileSparseRecordEncode(hdr, VIR_FILE_SPARSE_RECORD_HOLE, len);
+            if (safewrite(STDOUT_FILENO, hdr, sizeof(hdr)) < 0) {
+                virReportSystemError(errno, "%s", _("Unable to write stdout"));
+                return -1;
+            }
+            if (lseek(fd, len, SEEK_CUR) < 0) {
+                virReportSystemError(errno, _("Unable to seek %s"), path);
+                return -1;
+            }
+            total += len;
+            continue;
+        }
+
+        while (len) {
+            ssize_t got;
+
+            if ((got = saferead(fd, buf, MIN(buflen, len))) < 0) {
+                virReportSystemError(errno, _("Unable to read %s"), path);
+                return -1;
+            }
+            if (got == 0)
+                return 0; /* The file shrank meanwhile */
+
+            virFileSparseRecordEncode(hdr, VIR_FILE_SPARSE_RECORD_DATA, got);
+            if (safewrite(STDOUT_FILENO, hdr, sizeof(hdr)) < 0 ||
+                safewrite(STDOUT_FILENO, buf, got) < 0) {
+                virReportSystemError(errno, "%s", _("Unable to write stdout"));
+                return -1;
+            }
+            len -= got;
+            total += got;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Make the @len bytes at @pos, the current offset of @fd, read back
+ * as zeros and move past them.  Past @sparseFrom, the initial end of
+ * a regular file, there is nothing to clear.  Anything else, which
+ * may not be able to seek, just gets zeros written to it.
+ */
+static int
+sparseSkip(int fd, off_t pos, unsigned long long len,
+           bool isReg, off_t sparseFrom, char *buf, size_t buflen)
+{
+    unsigned long long zero = len;
+
+    if (isReg)
+        zero = pos >= sparseFrom ? 0 : MIN(len, sparseFrom - pos);
+
+#if HAVE_FALLOCATE && defined(FALLOC_FL_PUNCH_HOLE)
+    if (zero &&
+        fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  pos, zero) == 0)
+        zero = 0;
+#endif
+
+    if (zero) {
+        memset(buf, 0, MIN(buflen, zero));
+        while (zero) {
+            size_t n = MIN(buflen, zero);
+
+            if (safewrite(fd, buf, n) < 0)
+                return -1;
+            zero -= n;
+        }
+    }
+
+    if (isReg && lseek(fd, pos + len, SEEK_SET) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * Write the data and hole records read from stdin to the file,
+ * punching the holes where there was data before.
+ */
+static int
+runSparseWrite(const char *path, int fd, unsigned long long length,
+               char *buf, size_t buflen)
+{
+    char hdr[VIR_FILE_SPARSE_RECORD_HEADER_LEN];
+    unsigned long long total = 0;
+    struct runIOOutput out;
+    struct stat sb;
+    bool truncate;
+    off_t pos = 0;
+
+    memset(&out, 0, sizeof(out));
+    out.fd = fd;
+    out.blksize = 64 * 1024;
+
+    /* Only regular files need to know where they are */
+    if (fstat(fd, &sb) < 0 ||
+        (S_ISREG(sb.st_mode) && (pos = lseek(fd, 0, SEEK_CUR)) < 0)) {
+        virReportSystemError(errno, _("Unable to access %s"), path);
+        return -1;
+    }
+    if (S_ISREG(sb.st_mode)) {
+        out.sparse = true;
+        out.sparseFrom = sb.st_size;
+        out.pos = pos;
+    }
+
+    for (;;) {
+        unsigned long long len;
+        ssize_t got;
+        int type;
+
+        if ((got = saferead(STDIN_FILENO, hdr, sizeof(hdr))) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to read stdin"));
+            return -1;
+        }
+        if (got == 0)
+            break;
+        if (got < (ssize_t) sizeof(hdr) ||
+            virFileSparseRecordDecode(hdr, &type, &len) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed record in sparse stream"));
+            return -1;
+        }
+
+        if (length && len > length - total) {
+            virReportSystemError(ENOSPC, _("Unable to write %s"), path);
+            return -1;
+        }
+        total += len;
+
+        if (type == VIR_FILE_SPARSE_RECORD_HOLE) {
+            if (sparseSkip(fd, pos, len, out.sparse, out.sparseFrom,
+                           buf, buflen) < 0) {
+                virReportSystemError(errno, _("Unable to write %s"), path);
+                return -1;
+            }
+            pos += len;
+            out.pos = pos;
+            continue;
+        }
+
+        while (len) {
+            if ((got = saferead(STDIN_FILENO, buf, MIN(buflen, len))) < 0) {
+                virReportSystemError(errno, "%s", _("Unable to read stdin"));
+                return -1;
+            }
+            if (got == 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("truncated record in sparse stream"));
+                return -1;
+            }
+            if (runIOWrite(&out, buf, got, 0, &truncate) < 0) {
+                virReportSystemError(errno, _("Unable to write %s"), path);
+                return -1;
+            }
+            len -= got;
+            pos += got;
+        }
+    }
+
+    /* A trailing hole only exists once the file is extended over it */
+    if (out.sparse &&
+        (fstat(fd, &sb) < 0 ||
+         (sb.st_size < pos && ftruncate(fd, pos) < 0))) {
+        virReportSystemError(errno, _("Unable to truncate %s"), path);
+        return -1;
+    }
+
+    if (fdatasync(fd) < 0 && errno != EINVAL && errno != EROFS) {
+        virReportSystemError(errno, _("unable to fsync %s"), path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+runSparse(const char *path, int fd, int oflags, unsigned long long length)
+{
+    char *buf = NULL;
+    size_t buflen = 1024*1024;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, buflen) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    switch (oflags & O_ACCMODE) {
+    case O_RDONLY:
+        ret = runSparseRead(path, fd, length, buf, buflen);
+        break;
+    case O_WRONLY:
+        ret = runSparseWrite(path, fd, length, buf, buflen);
+        break;
+    case O_RDWR:
+    default:
+        virReportSystemError(EINVAL,
+                             _("Unable to process file with flags %d"),
+                             (oflags & O_ACCMODE));
+        break;
+    }
+
+cleanup:
+    if (VIR_CLOSE(fd) < 0 &&
+        ret == 0) {
+        virReportSystemError(errno, _("Unable to close %s"), path);
+        ret = -1;
+    }
+
+    VIR_FREE(buf);
+    return ret;
+}
+
+#if WITH_ZLIB
+/*
+ * Chunked compression, used for save images.  The stream starts with
+ * a header:
+ *
+ *   8 bytes   magic "LVCHUNKZ"
+ *   4 bytes   maximum uncompressed length of a chunk
+ *
+ * followed by one frame per chunk of input:
+ *
+ *   4 bytes   uncompressed length of the chunk, 0 ends the stream
+ *   4 bytes   length of the data that follows
+ *   data      zlib stream, or the chunk itself if the data is as
+ *             long as the chunk
+ *
+ * All integers are big endian.  Chunks are independent of each other,
+ * so they are compressed and decompressed by several threads at once,
+ * while the main thread reads the input and writes the results in
+ * order.
+ */
+#define CHUNK_MAGIC "LVCHUNKZ"
+#define CHUNK_SIZE (1024 * 1024)
+#define CHUNK_SIZE_MAX (16 * 1024 * 1024)
+#define CHUNK_WORKERS_MAX 16
+#define CHUNK_HEADER_LEN (sizeof(CHUNK_MAGIC) - 1 + 4)
+#define CHUNK_FRAME_LEN 8
+
+enum {
+    CHUNK_FREE = 0, /* waiting to be filled by the main thread */
+    CHUNK_READ,     /* waiting for a worker */
+    CHUNK_BUSY,     /* being transformed by a worker */
+    CHUNK_DONE,     /* waiting to be written by the main thread */
+};
+
+struct chunkSlot {
+    int state;
+    unsigned char *in;
+    size_t inlen;
+    size_t rawlen; /* uncompressed length of the chunk */
+    unsigned char *out;
+    size_t outlen;
+};
+
+struct chunkPipeline {
+    virMutex lock;
+    virCond cond;
+    bool compress;
+    size_t chunkSize;
+    size_t buflen; /* size of the in and out buffers of each slot */
+    struct chunkSlot *slots;
+    size_t nslots;
+    unsigned long long nread; /* chunks handed to the workers */
+    unsigned long long nwork; /* chunks taken by the workers */
+    unsigned long long nwritten;
+    bool quit;
+    int zerr; /* zlib error of a failed chunk */
+};
+
+static void
+chunkPutUint32(unsigned char *buf, uint32_t val)
+{
+    buf[0] = val >> 24;
+    buf[1] = val >> 16;
+    buf[2] = val >> 8;
+    buf[3] = val;
+}
+
+static uint32_t
+chunkGetUint32(const unsigned char *buf)
+{
+    return ((uint32_t) buf[0] << 24) | ((uint32_t) buf[1] << 16) |
+        ((uint32_t) buf[2] << 8) | buf[3];
+}
+
+/* Compress or decompress one chunk, returning a zlib status */
+static int
+chunkTransform(struct chunkPipeline *p, struct chunkSlot *slot)
+{
+    uLongf len = p->buflen - CHUNK_FRAME_LEN;
+    int rc;
+
+    if (p->compress) {
+        rc = compress2(slot->out + CHUNK_FRAME_LEN, &len,
+                       slot->in, slot->inlen, Z_BEST_SPEED);
+        if (rc == Z_BUF_ERROR || (rc == Z_OK && len >= slot->inlen)) {
+            /* Incompressible data is stored as it is */
+            memcpy(slot->out + CHUNK_FRAME_LEN, slot->in, slot->inlen);
+            len = slot->inlen;
+        } else if (rc != Z_OK) {
+            return rc;
+        }
+        chunkPutUint32(slot->out, slot->inlen);
+        chunkPutUint32(slot->out + 4, len);
+        slot->outlen = CHUNK_FRAME_LEN + len;
+    } else {
+        if (slot->inlen == slot->rawlen) {
+            memcpy(slot->out, slot->in, slot->inlen);
+        } else {
+            len = slot->rawlen;
+            if ((rc = uncompress(slot->out, &len,
+                                 slot->in, slot->inlen)) != Z_OK)
+                return rc == Z_BUF_ERROR ? Z_DATA_ERROR : rc;
+            if (len != slot->rawlen)
+                return Z_DATA_ERROR;
+        }
+        slot->outlen = slot->rawlen;
+    }
+
+    return Z_OK;
+}
+
+static void
+chunkWorker(void *opaque)
+{
+    struct chunkPipeline *p = opaque;
+
+    virMutexLock(&p->lock);
+    while (!p->quit) {
+        struct chunkSlot *slot;
+        int rc;
+
+        if (p->nwork == p->nread) {
+            ignore_value(virCondWait(&p->cond, &p->lock));
+            continue;
+        }
+
+        slot = &p->slots[p->nwork++ % p->nslots];
+        slot->state = CHUNK_BUSY;
+        virMutexUnlock(&p->lock);
+        rc = chunkTransform(p, slot);
+        virMutexLock(&p->lock);
+
+        if (rc != Z_OK && p->zerr == Z_OK)
+            p->zerr = rc;
+        slot->state = CHUNK_DONE;
+        virCondBroadcast(&p->cond);
+    }
+    virMutexUnlock(&p->lock);
+}
+
+/*
+ * Fill @slot with the next chunk of input.  Returns 1 if the slot
+ * was filled, 0 at the end of the input, or -1 on error.
+ */
+static int
+chunkFill(struct chunkPipeline *p, struct chunkSlot *slot, bool *last)
+{
+    unsigned char frame[CHUNK_FRAME_LEN];
+    ssize_t got;
+
+    if (p->compress) {
+        if ((got = saferead(STDIN_FILENO, slot->in, p->chunkSize)) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to read stdin"));
+            return -1;
+        }
+        /* saferead only comes up short at end of file */
+        *last = (size_t) got < p->chunkSize;
+        slot->inlen = slot->rawlen = got;
+        return got > 0;
+    }
+
+    if ((got = saferead(STDIN_FILENO, frame, sizeof(frame))) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to read stdin"));
+        return -1;
+    }
+    if (got != sizeof(frame))
+        goto truncated;
+
+    slot->rawlen = chunkGetUint32(frame);
+    slot->inlen = chunkGetUint32(frame + 4);
+    if (slot->rawlen == 0) {
+        *last = true;
+        if (slot->inlen) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed end of compressed stream"));
+            return -1;
+        }
+        return 0;
+    }
+    if (slot->rawlen > p->chunkSize ||
+        slot->inlen == 0 ||
+        slot->inlen > compressBound(slot->rawlen)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("malformed compressed chunk of %zu bytes"),
+                       slot->inlen);
+        return -1;
+    }
+
+    if ((got = saferead(STDIN_FILENO, slot->in, slot->inlen)) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to read stdin"));
+        return -1;
+    }
+    if ((size_t) got != slot->inlen)
+        goto truncated;
+
+    return 1;
+
+truncated:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("compressed stream is truncated"));
+    return -1;
+}
+
+/* Exchange the stream header, sizing the chunks */
+static int
+chunkHeader(struct chunkPipeline *p)
+{
+    unsigned char header[CHUNK_HEADER_LEN];
+    size_t magiclen = sizeof(CHUNK_MAGIC) - 1;
+    ssize_t got;
+
+    if (p->compress) {
+        p->chunkSize = CHUNK_SIZE;
+        memcpy(header, CHUNK_MAGIC, magiclen);
+        chunkPutUint32(header + magiclen, p->chunkSize);
+        if (safewrite(STDOUT_FILENO, header, sizeof(header)) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to write stdout"));
+            return -1;
+        }
+        return 0;
+    }
+
+    if ((got = saferead(STDIN_FILENO, header, sizeof(header))) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to read stdin"));
+        return -1;
+    }
+    if (got != sizeof(header) ||
+        memcmp(header, CHUNK_MAGIC, magiclen) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("input is not a chunked compressed stream"));
+        return -1;
+    }
+    p->chunkSize = chunkGetUint32(header + magiclen);
+    if (p->chunkSize == 0 || p->chunkSize > CHUNK_SIZE_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unsupported compressed chunk size %zu"),
+                       p->chunkSize);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+runChunked(bool compress)
+{
+    struct chunkPipeline p;
+    virThreadPtr workers = NULL;
+    size_t nworkers = 0;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads;
+    bool locked = false;
+    bool last = false;
+    int ret = -1;
+    size_t i;
+
+    memset(&p, 0, sizeof(p));
+    p.compress = compress;
+
+    if (chunkHeader(&p) < 0)
+        return -1;
+
+    if (ncpus < 1)
+        ncpus = 1;
+    if (ncpus > CHUNK_WORKERS_MAX)
+        ncpus = CHUNK_WORKERS_MAX;
+    nthreads = ncpus;
+
+    /* Twice as many chunks as workers keeps them all busy while
+     * the main thread reads and writes */
+    p.nslots = nthreads * 2;
+    p.buflen = CHUNK_FRAME_LEN + compressBound(p.chunkSize);
+    if (VIR_ALLOC_N(p.slots, p.nslots) < 0 ||
+        VIR_ALLOC_N(workers, nthreads) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    for (i = 0 ; i < p.nslots ; i++) {
+        if (VIR_ALLOC_N(p.slots[i].in, p.buflen) < 0 ||
+            VIR_ALLOC_N(p.slots[i].out, p.buflen) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+    }
+
+    if (virMutexInit(&p.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&p.cond) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init condition"));
+        virMutexDestroy(&p.lock);
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < nthreads ; i++) {
+        if (virThreadCreate(&workers[nworkers], true, chunkWorker, &p) < 0) {
+            if (nworkers)
+                break;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create compression thread"));
+            goto stop;
+        }
+        nworkers++;
+    }
+
+    virMutexLock(&p.lock);
+    locked = true;
+    while (1) {
+        struct chunkSlot *wslot = &p.slots[p.nwritten % p.nslots];
+        struct chunkSlot *rslot = &p.slots[p.nread % p.nslots];
+        int rc;
+
+        if (p.zerr != Z_OK) {
+            if (compress)
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to compress chunk: %s"),
+                               zError(p.zerr));
+            else
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to decompress chunk: %s"),
+                               zError(p.zerr));
+            goto stop;
+        }
+
+        if (p.nwritten < p.nread && wslot->state == CHUNK_DONE) {
+            virMutexUnlock(&p.lock);
+            rc = safewrite(STDOUT_FILENO, wslot->out, wslot->outlen);
+            virMutexLock(&p.lock);
+            if (rc < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to write stdout"));
+                goto stop;
+            }
+            wslot->state = CHUNK_FREE;
+            p.nwritten++;
+        } else if (!last && rslot->state == CHUNK_FREE) {
+            virMutexUnlock(&p.lock);
+            rc = chunkFill(&p, rslot, &last);
+            virMutexLock(&p.lock);
+            if (rc < 0)
+                goto stop;
+            if (rc > 0) {
+                rslot->state = CHUNK_READ;
+                p.nread++;
+                virCondBroadcast(&p.cond);
+            }
+        } else if (last && p.nwritten == p.nread) {
+            break;
+        } else {
+            ignore_value(virCondWait(&p.cond, &p.lock));
+        }
+    }
+
+    if (compress) {
+        unsigned char frame[CHUNK_FRAME_LEN];
+
+        memset(frame, 0, sizeof(frame));
+        if (safewrite(STDOUT_FILENO, frame, sizeof(frame)) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to write stdout"));
+            goto stop;
+        }
+    }
+
+    ret = 0;
+
+stop:
+    if (!locked)
+        virMutexLock(&p.lock);
+    p.quit = true;
+    virCondBroadcast(&p.cond);
+    virMutexUnlock(&p.lock);
+    for (i = 0 ; i < nworkers ; i++)
+        virThreadJoin(&workers[i]);
+    virCondDestroy(&p.cond);
+    virMutexDestroy(&p.lock);
+
+cleanup:
+    if (p.slots) {
+        for (i = 0 ; i < p.nslots ; i++) {
+            VIR_FREE(p.slots[i].in);
+            VIR_FREE(p.slots[i].out);
+        }
+        VIR_FREE(p.slots);
+    }
+    VIR_FREE(workers);
+    return ret;
+}
+#else /* !WITH_ZLIB */
+static int
+runChunked(bool compress ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("chunked compression is not supported on this platform"));
+    return -1;
+}
+#endif /* !WITH_ZLIB */
+
 static const char *program_name;
 
 ATTRIBUTE_NORETURN static void
@@ -210,8 +1151,9 @@ usage(int status)
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
         printf(_("Usage: %s FILENAME OFLAGS MODE OFFSET LENGTH DELETE\n"
-                 "   or: %s FILENAME LENGTH FD\n"),
-               program_name, program_name);
+                 "   or: %s [-s] FILENAME LENGTH FD\n"
+                 "   or: %s -c|-dc\n"),
+               program_name, program_name, program_name);
     }
     exit(status);
 }
@@ -228,6 +1170,7 @@ main(int argc, char **argv)
     unsigned int delete = 0;
     int fd = -1;
     int lengthIndex = 0;
+    bool sparse = false;
 
     program_name = argv[0];
 
@@ -248,6 +1191,21 @@ main(int argc, char **argv)
 
     if (argc > 1 && STREQ(argv[1], "--help"))
         usage(EXIT_SUCCESS);
+    if (argc == 2 &&
+        (STREQ(argv[1], "-c") || STREQ(argv[1], "-dc"))) {
+        /* Filter like gzip -c and gzip -dc */
+        path = "stdin";
+        if (runChunked(STREQ(argv[1], "-c")) < 0)
+            goto error;
+        return 0;
+    }
+    if (argc == 5 && STREQ(argv[1], "-s")) {
+        /* Pass holes as such, in the records described in virfile.h */
+        sparse = true;
+        argc--;
+        argv++;
+        path = argv[1];
+    }
     if (argc == 7) { /* FILENAME OFLAGS MODE OFFSET LENGTH DELETE */
         lengthIndex = 5;
         if (virStrToLong_i(argv[2], NULL, 10, &oflags) < 0) {
@@ -302,7 +1260,9 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (fd < 0 || runIO(path, fd, oflags, length) < 0)
+    if (fd < 0 ||
+        (sparse ? runSparse(path, fd, oflags, length) :
+         runIO(path, fd, oflags, length)) < 0)
         goto error;
 
     if (delete)
@@ -32,6 +32,7 @@
 
 #include "virbuffer.h"
 #include "viralloc.h"
+#include "virthread.h"
 
 
 /* If adding more fields, ensure to edit buf.h to match
@@ -41,9 +42,104 @@ struct _virBuffer {
     unsigned int use;
     unsigned int error; /* errno value, or -1 for usage error */
     int indent;
+    unsigned int scratch; /* content belongs to the thread's scratch space */
     char *content;
 };
 
+/* Scratch allocations larger than this are not kept around */
+#define VIR_BUFFER_SCRATCH_MAX (1024 * 1024)
+
+typedef struct _virBufferScratch virBufferScratch;
+typedef virBufferScratch *virBufferScratchPtr;
+struct _virBufferScratch {
+    unsigned int size;
+    char *content;
+};
+
+static virThreadLocal virBufferScratchLocal;
+
+static void
+virBufferScratchFree(void *opaque)
+{
+    virBufferScratchPtr scratch = opaque;
+
+    if (scratch) {
+        VIR_FREE(scratch->content);
+        VIR_FREE(scratch);
+    }
+}
+
+static int
+virBufferOnceInit(void)
+{
+    return virThreadLocalInit(&virBufferScratchLocal, virBufferScratchFree);
+}
+
+VIR_ONCE_GLOBAL_INIT(virBuffer)
+
+/**
+ * virBufferScratchRelease:
+ * @buf: the buffer
+ *
+ * Hand the content of @buf back to the scratch space of the calling
+ * thread, or free it if there is no room for it.
+ */
+static void
+virBufferScratchRelease(virBufferPtr buf)
+{
+    virBufferScratchPtr scratch = virThreadLocalGet(&virBufferScratchLocal);
+
+    if (!scratch &&
+        VIR_ALLOC(scratch) == 0 &&
+        virThreadLocalSet(&virBufferScratchLocal, scratch) < 0)
+        VIR_FREE(scratch);
+
+    if (!scratch || scratch->content ||
+        buf->size > VIR_BUFFER_SCRATCH_MAX) {
+        VIR_FREE(buf->content);
+    } else {
+        scratch->content = buf->content;
+        scratch->size = buf->size;
+        buf->content = NULL;
+    }
+    buf->size = 0;
+    buf->use = 0;
+    buf->scratch = 0;
+}
+
+/**
+ * virBufferUseScratch:
+ * @buf: the buffer
+ *
+ * Let the empty buffer @buf work on the scratch space of the calling
+ * thread, which is kept allocated between uses.  This saves repeated
+ * growing of buffers which are filled and emptied often, at the cost
+ * of a copy when the content is retrieved.  The buffer must be
+ * emptied with virBufferContentAndReset or virBufferFreeAndReset on
+ * the same thread.
+ */
+void
+virBufferUseScratch(virBufferPtr buf)
+{
+    virBufferScratchPtr scratch;
+
+    if (!buf || buf->error || buf->content || buf->scratch)
+        return;
+
+    if (virBufferInitialize() < 0)
+        return;
+
+    buf->scratch = 1;
+    if ((scratch = virThreadLocalGet(&virBufferScratchLocal)) &&
+        scratch->content) {
+        buf->content = scratch->content;
+        buf->size = scratch->size;
+        buf->content[0] = '\0';
+        scratch->content = NULL;
+        scratch->size = 0;
+    }
+}
+
 /**
  * virBufferFail
  * @buf: the buffer
@@ -54,6 +150,8 @@ struct _virBuffer {
 static void
 virBufferSetError(virBufferPtr buf, int error)
 {
+    if (buf->scratch)
+        virBufferScratchRelease(buf);
     VIR_FREE(buf->content);
     buf->size = 0;
     buf->use = 0;
@@ -109,22 +207,33 @@ virBufferGetIndent(const virBufferPtr buf, bool dynamic)
  * @buf: the buffer
  * @len: the minimum free size to allocate on top of existing used space
  *
- * Grow the available space of a buffer to at least @len bytes.
+ * Grow the available space of a buffer to at least @len bytes.  The
+ * allocation is at least doubled, so that a buffer built from many
+ * small pieces is only reallocated a logarithmic number of times.
  *
  * Returns zero on success or -1 on error
  */
 static int
 virBufferGrow(virBufferPtr buf, unsigned int len)
 {
-    int size;
+    unsigned int size;
 
     if (buf->error)
         return -1;
 
-    if ((len + buf->use) < buf->size)
+    if (len < buf->size - buf->use)
         return 0;
 
+    /* Check before adding anything up, so nothing can wrap around */
+    if (buf->use > INT_MAX - 1000 ||
+        len > INT_MAX - 1000 - buf->use) {
+        virBufferSetError(buf, ENOMEM);
+        return -1;
+    }
+
     size = buf->use + len + 1000;
+    if (buf->size <= INT_MAX / 2 && size < buf->size * 2)
+        size = buf->size * 2;
 
     if (VIR_REALLOC_N(buf->content, size) < 0) {
         virBufferSetError(buf, errno);
@@ -171,6 +280,33 @@ virBufferAdd(virBufferPtr buf, const char *str, int len)
     buf->content[buf->use] = '\0';
 }
 
+/**
+ * virBufferAddRaw:
+ * @buf: the buffer to append to
+ * @str: the bytes
+ * @len: the number of bytes to add
+ *
+ * Add a string range to a buffer, without any auto indentation.
+ */
+static void
+virBufferAddRaw(virBufferPtr buf, const char *str, size_t len)
+{
+    if (len == 0)
+        return;
+
+    if (len > INT_MAX) {
+        virBufferSetError(buf, ENOMEM);
+        return;
+    }
+
+    if (virBufferGrow(buf, len) < 0)
+        return;
+
+    memcpy(&buf->content[buf->use], str, len);
+    buf->use += len;
+    buf->content[buf->use] = '\0';
+}
+
 /**
  * virBufferAddChar:
  * @buf: the buffer to append to
@@ -227,6 +363,17 @@ virBufferContentAndReset(virBufferPtr buf)
         return NULL;
     }
 
+    if (buf->scratch) {
+        /* The scratch space stays with the thread, hand out a copy */
+        if (!buf->use || VIR_ALLOC_N(str, buf->use + 1) < 0)
+            str = NULL;
+        else
+            memcpy(str, buf->content, buf->use + 1);
+        virBufferScratchRelease(buf);
+        memset(buf, 0, sizeof(*buf));
+        return str;
+    }
+
     str = buf->content;
     memset(buf, 0, sizeof(*buf));
     return str;
@@ -240,8 +387,15 @@ virBufferContentAndReset(virBufferPtr buf)
  */
 void virBufferFreeAndReset(virBufferPtr buf)
 {
-    char *str = virBufferContentAndReset(buf);
+    char *str;
 
+    if (buf && buf->scratch) {
+        virBufferScratchRelease(buf);
+        memset(buf, 0, sizeof(*buf));
+        return;
+    }
+
+    str = virBufferContentAndReset(buf);
     VIR_FREE(str);
 }
 
@@ -351,6 +505,93 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
     buf->use += count;
 }
 
+/**
+ * virBufferSplitFormat:
+ * @format: a printf like format string
+ * @prefixlen: set to the length of the text before the conversion
+ * @suffix: set to the text after the conversion
+ *
+ * Check whether @format consists of a single %s conversion surrounded
+ * by plain text, so that the string argument can be appended in place
+ * rather than through vsnprintf.
+ *
+ * Returns true if it does, false otherwise.
+ */
+static bool
+virBufferSplitFormat(const char *format, size_t *prefixlen,
+                     const char **suffix)
+{
+    const char *conv = strchr(format, '%');
+
+    if (!conv || conv[1] != 's' || strchr(conv + 2, '%'))
+        return false;
+
+    *prefixlen = conv - format;
+    *suffix = conv + 2;
+    return true;
+}
+
+/**
+ * virBufferEscapeXML:
+ * @buf: the buffer to append to
+ * @str: the string to escape
+ *
+ * Append @str escaped for use in XML, without auto indentation.  The
+ * string is scanned only once, runs of characters that need no
+ * escaping are copied as a whole.
+ */
+static void
+virBufferEscapeXML(virBufferPtr buf, const char *str)
+{
+    const char *cur = str;
+    const char *entity;
+    unsigned char c;
+
+    for (;;) {
+        const char *start = cur;
+
+        /*
+         * Note that character over 0x80 are likely to give problem
+         * with UTF-8 XML, but since our string don't have an encoding
+         * it's hard to handle properly we have to assume it's UTF-8 too
+         */
+        while ((c = *cur) >= 0x20 ?
+               (c != '<' && c != '>' && c != '&' && c != '"' && c != '\'') :
+               (c == '\n' || c == '\t' || c == '\r'))
+            cur++;
+
+        virBufferAddRaw(buf, start, cur - start);
+
+        switch (c) {
+        case '\0':
+            return;
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '&':
+            entity = "&amp;";
+            break;
+        case '"':
+            entity = "&quot;";
+            break;
+        case '\'':
+            entity = "&apos;";
+            break;
+        default:
+            /* other control characters are not allowed in XML */
+            entity = NULL;
+            break;
+        }
+
+        if (entity)
+            virBufferAddRaw(buf, entity, strlen(entity));
+        cur++;
+    }
+}
+
 /**
  * virBufferEscapeString:
  * @buf: the buffer to append to
@@ -365,9 +606,9 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 void
 virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
 {
-    int len;
-    char *escaped, *out;
-    const char *cur;
+    virBuffer escaped = VIR_BUFFER_INITIALIZER;
+    const char *suffix;
+    size_t prefixlen;
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -375,67 +616,22 @@ virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
     if (buf->error)
         return;
 
-    len = strlen(str);
-    if (strcspn(str, "<>&'\"") == len) {
-        virBufferAsprintf(buf, format, str);
+    if (virBufferSplitFormat(format, &prefixlen, &suffix)) {
+        virBufferAdd(buf, format, prefixlen); /* auto-indent */
+        virBufferEscapeXML(buf, str);
+        virBufferAddRaw(buf, suffix, strlen(suffix));
         return;
     }
 
-    if (xalloc_oversized(6, len) ||
-        VIR_ALLOC_N(escaped, 6 * len + 1) < 0) {
-        virBufferSetError(buf, errno);
+    virBufferEscapeXML(&escaped, str);
+    if (virBufferError(&escaped)) {
+        virBufferSetError(buf, virBufferError(&escaped));
+        virBufferFreeAndReset(&escaped);
         return;
     }
 
-    cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        if (*cur == '<') {
-            *out++ = '&';
-            *out++ = 'l';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '>') {
-            *out++ = '&';
-            *out++ = 'g';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '&') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'm';
-            *out++ = 'p';
-            *out++ = ';';
-        } else if (*cur == '"') {
-            *out++ = '&';
-            *out++ = 'q';
-            *out++ = 'u';
-            *out++ = 'o';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '\'') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'p';
-            *out++ = 'o';
-            *out++ = 's';
-            *out++ = ';';
-        } else if (((unsigned char)*cur >= 0x20) || (*cur == '\n') || (*cur == '\t') ||
-                   (*cur == '\r')) {
-            /*
-             * default case, just copy !
-             * Note that character over 0x80 are likely to give problem
-             * with UTF-8 XML, but since our string don't have an encoding
-             * it's hard to handle properly we have to assume it's UTF-8 too
-             */
-            *out++ = *cur;
-        }
-        cur++;
-    }
-    *out = 0;
-
-    virBufferAsprintf(buf, format, escaped);
-    VIR_FREE(escaped);
+    virBufferAsprintf(buf, format, virBufferCurrentContent(&escaped));
+    virBufferFreeAndReset(&escaped);
 }
 
 /**
@@ -482,9 +678,12 @@ void
 virBufferEscape(virBufferPtr buf, char escape, const char *toescape,
                 const char *format, const char *str)
 {
-    int len;
-    char *escaped, *out;
+    virBuffer escaped = VIR_BUFFER_INITIALIZER;
+    virBufferPtr out = buf;
     const char *cur;
+    const char *suffix = NULL;
+    size_t prefixlen;
+    size_t len;
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -492,30 +691,36 @@ virBufferEscape(virBufferPtr buf, char escape, const char *toescape,
     if (buf->error)
         return;
 
-    len = strlen(str);
-    if (strcspn(str, toescape) == len) {
-        virBufferAsprintf(buf, format, str);
-        return;
+    if (virBufferSplitFormat(format, &prefixlen, &suffix))
+        virBufferAdd(buf, format, prefixlen); /* auto-indent */
+    else
+        out = &escaped;
+
+    cur = str;
+    while (*cur != 0) {
+        len = strcspn(cur, toescape);
+        virBufferAddRaw(out, cur, len);
+        cur += len;
+        if (*cur == 0)
+            break;
+        virBufferAddRaw(out, &escape, 1);
+        virBufferAddRaw(out, cur, 1);
+        cur++;
     }
 
-    if (xalloc_oversized(2, len) ||
-        VIR_ALLOC_N(escaped, 2 * len + 1) < 0) {
-        virBufferSetError(buf, errno);
+    if (suffix) {
+        virBufferAddRaw(buf, suffix, strlen(suffix));
         return;
     }
 
-    cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        if (strchr(toescape, *cur))
-            *out++ = escape;
-        *out++ = *cur;
-        cur++;
+    if (virBufferError(&escaped)) {
+        virBufferSetError(buf, virBufferError(&escaped));
+        virBufferFreeAndReset(&escaped);
+        return;
     }
-    *out = 0;
 
-    virBufferAsprintf(buf, format, escaped);
-    VIR_FREE(escaped);
+    virBufferAsprintf(buf, format, virBufferCurrentContent(&escaped));
+    virBufferFreeAndReset(&escaped);
 }
 
 /**
@@ -35,8 +35,9 @@
 typedef struct _virBuffer virBuffer;
 typedef virBuffer *virBufferPtr;
 
+# define VIR_BUFFER_INITIALIZER { 0, 0, 0, 0, 0, NULL }
+
 # ifndef __VIR_BUFFER_C__
-#  define VIR_BUFFER_INITIALIZER { 0, 0, 0, 0, NULL }
 
 /* This struct must be kept in sync with the real struct
    in the buf.c impl file */
@@ -45,13 +46,15 @@ struct _virBuffer {
     unsigned int b;
     unsigned int c;
     int d;
-    char *e;
+    unsigned int e;
+    char *f;
 };
 # endif
 
 const char *virBufferCurrentContent(virBufferPtr buf);
 char *virBufferContentAndReset(virBufferPtr buf);
 void virBufferFreeAndReset(virBufferPtr buf);
+void virBufferUseScratch(virBufferPtr buf);
 int virBufferError(const virBufferPtr buf);
 unsigned int virBufferUse(const virBufferPtr buf);
 void virBufferAdd(virBufferPtr buf, const char *str, int len);
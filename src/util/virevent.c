@@ -24,12 +24,31 @@
 #include <config.h>
 
 #include "virevent.h"
+#include "vireventepoll.h"
 #include "vireventpoll.h"
 #include "virlog.h"
 #include "virerror.h"
+#include "virutil.h"
 
 #include <stdlib.h>
 
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+enum {
+    VIR_EVENT_LOOP_POLL,
+    VIR_EVENT_LOOP_EPOLL,
+
+    VIR_EVENT_LOOP_LAST
+};
+
+VIR_ENUM_DECL(virEventLoop)
+VIR_ENUM_IMPL(virEventLoop, VIR_EVENT_LOOP_LAST,
+              "poll",
+              "epoll")
+
+/* Implementation picked by virEventRegisterDefaultImpl */
+static int defaultLoop = VIR_EVENT_LOOP_POLL;
+
 static virEventAddHandleFunc addHandleImpl = NULL;
 static virEventUpdateHandleFunc updateHandleImpl = NULL;
 static virEventRemoveHandleFunc removeHandleImpl = NULL;
@@ -219,6 +238,13 @@ void virEventRegisterImpl(virEventAddHandleFunc addHandle,
  * not have a need to integrate with an external event
  * loop impl.
  *
+ * On Linux an implementation based on epoll() may be used
+ * instead, which scales better with large numbers of file
+ * handles. It is picked when libvirt was configured with
+ * --with-event-loop=epoll, or when the LIBVIRT_EVENT_LOOP
+ * environment variable is set to "epoll"; setting it to "poll"
+ * forces the poll() implementation.
+ *
  * Once registered, the application has to invoke virEventRunDefaultImpl in
  * a loop to process events.  Failure to do so may result in connections being
  * closed unexpectedly as a result of keepalive timeout.
@@ -227,15 +253,49 @@ void virEventRegisterImpl(virEventAddHandleFunc addHandle,
  */
 int virEventRegisterDefaultImpl(void)
 {
+    const char *name = getenv("LIBVIRT_EVENT_LOOP");
+    virErrorPtr err;
+    int loop;
+
     VIR_DEBUG("registering default event implementation");
 
     virResetLastError();
 
+    if (!name || !*name)
+        name = DEFAULT_EVENT_LOOP;
+
+    if ((loop = virEventLoopTypeFromString(name)) < 0) {
+        VIR_WARN("Unknown event loop implementation '%s', using poll", name);
+        loop = VIR_EVENT_LOOP_POLL;
+    }
+
+    if (loop == VIR_EVENT_LOOP_EPOLL) {
+        if (virEventEpollInit() == 0) {
+            VIR_DEBUG("using epoll event loop");
+            defaultLoop = loop;
+            virEventRegisterImpl(
+                virEventEpollAddHandle,
+                virEventEpollUpdateHandle,
+                virEventEpollRemoveHandle,
+                virEventEpollAddTimeout,
+                virEventEpollUpdateTimeout,
+                virEventEpollRemoveTimeout
+                );
+            return 0;
+        }
+
+        err = virGetLastError();
+        VIR_WARN("Unable to initialize epoll event loop, using poll: %s",
+                 err ? err->message : "<unknown problem>");
+        virResetLastError();
+    }
+
     if (virEventPollInit() < 0) {
         virDispatchError(NULL);
         return -1;
     }
 
+    defaultLoop = VIR_EVENT_LOOP_POLL;
     virEventRegisterImpl(
         virEventPollAddHandle,
         virEventPollUpdateHandle,
@@ -270,7 +330,8 @@ int virEventRunDefaultImpl(void)
     VIR_DEBUG("running default event implementation");
     virResetLastError();
 
-    if (virEventPollRunOnce() < 0) {
+    if ((defaultLoop == VIR_EVENT_LOOP_EPOLL ?
+         virEventEpollRunOnce() : virEventPollRunOnce()) < 0) {
         virDispatchError(NULL);
         return -1;
     }
@@ -0,0 +1,1109 @@
+/*
+ * vireventepoll.c: epoll based event loop for monitoring file handles
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
+#include "virthread.h"
+#include "virlog.h"
+#include "vireventepoll.h"
+#include "vireventpoll.h"
+#include "viralloc.h"
+#include "virutil.h"
+#include "virfile.h"
+#include "virerror.h"
+#include "virhash.h"
+#include "virhashcode.h"
+#include "virtime.h"
+
+#define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
+
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+#ifdef HAVE_SYS_EPOLL_H
+
+/*
+ * Unlike the poll() implementation, which rebuilds its pollfd
+ * array and scans every handle and timer on each iteration, this
+ * implementation keeps file handles registered with the kernel
+ * across iterations, keeps armed timers in a binary heap ordered
+ * by expiry, and only looks at the handles the kernel reports as
+ * ready. The cost of a wakeup is thus proportional to the amount
+ * of work to be done rather than to the number of registrations.
+ */
+
+/* Maximum number of ready file descriptors collected per iteration.
+ * Any more are reported on the next iteration, since handles are
+ * registered level triggered */
+# define EVENT_EPOLL_MAX_EVENTS 256
+
+/* Allocate extra slots for the scratch and deleted arrays in this
+ * multiple */
+# define EVENT_ALLOC_EXTENT 10
+
+static int virEventEpollInterruptLocked(void);
+
+/* State for a single file handle being monitored */
+struct virEventEpollHandle {
+    int watch;
+    int fd;
+    int events;
+    virEventHandleCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+};
+
+/* The kernel only allows a file descriptor to be added to an epoll
+ * set once, so all watches on the same descriptor share a record
+ * and the union of their events is what is registered */
+struct virEventEpollFD {
+    size_t nhandles;
+    struct virEventEpollHandle **handles;
+    int events;
+    bool registered;
+    /* epoll refuses descriptors which are always ready, such as
+     * regular files; these are dispatched on every iteration, just
+     * as poll() would report them */
+    bool alwaysReady;
+};
+
+/* State for a single timer being generated */
+struct virEventEpollTimeout {
+    int timer;
+    int frequency;
+    unsigned long long expiresAt;
+    virEventTimeoutCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    /* Index in the heap, or -1 if the timer is disabled */
+    ssize_t heapIndex;
+};
+
+/* A handle or timer to dispatch once the ready set is known */
+struct virEventEpollPending {
+    int id;
+    int events;
+};
+
+/* State for the main event loop */
+struct virEventEpollLoop {
+    virMutex lock;
+    int running;
+    virThread leader;
+    int wakeupfd[2];
+    int epollfd;
+
+    /* watch -> struct virEventEpollHandle */
+    virHashTablePtr handles;
+    /* indexed by file descriptor number */
+    size_t nfds;
+    struct virEventEpollFD **fds;
+    size_t nalwaysReady;
+
+    /* timer -> struct virEventEpollTimeout */
+    virHashTablePtr timeouts;
+    /* armed timers, ordered by expiresAt */
+    size_t heapCount;
+    size_t heapAlloc;
+    struct virEventEpollTimeout **heap;
+
+    /* Records are unlinked as soon as they are removed, but the
+     * free callbacks are only run once dispatch has finished */
+    size_t deletedHandlesCount;
+    size_t deletedHandlesAlloc;
+    struct virEventEpollHandle **deletedHandles;
+    size_t deletedTimeoutsCount;
+    size_t deletedTimeoutsAlloc;
+    struct virEventEpollTimeout **deletedTimeouts;
+
+    /* Scratch space for dispatch, kept across iterations */
+    size_t pendingCount;
+    size_t pendingAlloc;
+    struct virEventEpollPending *pending;
+};
+
+/* Only have one event loop */
+static struct virEventEpollLoop eventLoop = { .epollfd = -1 };
+
+/* Unique ID for the next FD watch to be registered */
+static int nextWatch = 1;
+
+/* Unique ID for the next timer to be registered */
+static int nextTimer = 1;
+
+
+static uint32_t virEventEpollIDCode(const void *name, uint32_t seed)
+{
+    unsigned long id = (unsigned long)(intptr_t)name;
+    return virHashCodeGen(&id, sizeof(id), seed);
+}
+static bool virEventEpollIDEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+static void *virEventEpollIDCopy(const void *name)
+{
+    return (void*)name;
+}
+
+static virHashTablePtr virEventEpollIDHashCreate(void)
+{
+    return virHashCreateFull(64,
+                             NULL,
+                             virEventEpollIDCode,
+                             virEventEpollIDEqual,
+                             virEventEpollIDCopy,
+                             NULL);
+}
+
+# define ID_KEY(id) ((void *)(intptr_t)(id))
+
+
+static uint32_t
+virEventEpollToEpollEvents(int events)
+{
+    uint32_t ret = 0;
+    if (events & POLLIN)
+        ret |= EPOLLIN;
+    if (events & POLLOUT)
+        ret |= EPOLLOUT;
+    /* EPOLLERR and EPOLLHUP are always reported */
+    return ret;
+}
+
+static int
+virEventEpollFromEpollEvents(uint32_t events)
+{
+    int ret = 0;
+    if (events & EPOLLIN)
+        ret |= POLLIN;
+    if (events & EPOLLOUT)
+        ret |= POLLOUT;
+    if (events & EPOLLERR)
+        ret |= POLLERR;
+    if (events & EPOLLHUP)
+        ret |= POLLHUP;
+    return ret;
+}
+
+
+/*
+ * Bring the kernel's view of @fd in line with the watches
+ * registered against it, releasing the record if none are left.
+ * Unless @force is set, no system call is made if the set of
+ * events did not change.
+ *
+ * Returns 0 on success, -1 with errno set on failure
+ */
+static int
+virEventEpollSyncFD(int fd, bool force)
+{
+    struct virEventEpollFD *rec = eventLoop.fds[fd];
+    struct epoll_event ev;
+    int events = 0;
+    size_t i;
+
+    memset(&ev, 0, sizeof(ev));
+    for (i = 0 ; i < rec->nhandles ; i++)
+        events |= rec->handles[i]->events;
+
+    if (rec->nhandles == 0) {
+        EVENT_DEBUG("Release fd=%d", fd);
+        /* The fd may well have been closed already, in which
+         * case the kernel dropped it from the set by itself */
+        if (rec->registered)
+            ignore_value(epoll_ctl(eventLoop.epollfd, EPOLL_CTL_DEL, fd, &ev));
+        if (rec->alwaysReady)
+            eventLoop.nalwaysReady--;
+        VIR_FREE(rec->handles);
+        VIR_FREE(eventLoop.fds[fd]);
+        return 0;
+    }
+
+    if (!force && events == rec->events)
+        return 0;
+    rec->events = events;
+
+    if (rec->alwaysReady)
+        return 0;
+
+    /* poll() never reports anything for handles which asked for
+     * no events, so don't leave them registered to get hangups */
+    if (events == 0) {
+        if (rec->registered &&
+            epoll_ctl(eventLoop.epollfd, EPOLL_CTL_DEL, fd, &ev) < 0 &&
+            errno != ENOENT && errno != EBADF)
+            return -1;
+        rec->registered = false;
+        return 0;
+    }
+
+    ev.events = virEventEpollToEpollEvents(events);
+    ev.data.fd = fd;
+
+    if (rec->registered) {
+        if (epoll_ctl(eventLoop.epollfd, EPOLL_CTL_MOD, fd, &ev) == 0)
+            return 0;
+        /* The fd was closed and its number reused behind our back */
+        if (errno != ENOENT)
+            return -1;
+        rec->registered = false;
+    }
+
+    if (epoll_ctl(eventLoop.epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        if (errno == EEXIST) {
+            if (epoll_ctl(eventLoop.epollfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+                return -1;
+        } else if (errno == EPERM) {
+            EVENT_DEBUG("fd=%d does not support epoll, treating as always ready",
+                        fd);
+            rec->alwaysReady = true;
+            eventLoop.nalwaysReady++;
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+    rec->registered = true;
+
+    return 0;
+}
+
+
+/*
+ * Register a callback for monitoring file handle events.
+ * NB, it *must* be safe to call this from within a callback
+ */
+int virEventEpollAddHandle(int fd, int events,
+                           virEventHandleCallback cb,
+                           void *opaque,
+                           virFreeCallback ff)
+{
+    struct virEventEpollHandle *handle = NULL;
+    struct virEventEpollFD *rec;
+    int watch = -1;
+
+    if (fd < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid file handle %d"), fd);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+
+    if ((size_t)fd >= eventLoop.nfds &&
+        VIR_EXPAND_N(eventLoop.fds, eventLoop.nfds,
+                     fd + 1 - eventLoop.nfds) < 0)
+        goto no_memory;
+
+    if (VIR_ALLOC(handle) < 0)
+        goto no_memory;
+
+    if (!(rec = eventLoop.fds[fd])) {
+        if (VIR_ALLOC(rec) < 0)
+            goto no_memory;
+        eventLoop.fds[fd] = rec;
+    }
+
+    if (VIR_EXPAND_N(rec->handles, rec->nhandles, 1) < 0) {
+        if (rec->nhandles == 0)
+            VIR_FREE(eventLoop.fds[fd]);
+        goto no_memory;
+    }
+
+    handle->watch = nextWatch;
+    handle->fd = fd;
+    handle->events = virEventPollToNativeEvents(events);
+    handle->cb = cb;
+    handle->ff = ff;
+    handle->opaque = opaque;
+    rec->handles[rec->nhandles - 1] = handle;
+
+    if (virHashAddEntry(eventLoop.handles, ID_KEY(handle->watch), handle) < 0) {
+        VIR_SHRINK_N(rec->handles, rec->nhandles, 1);
+        ignore_value(virEventEpollSyncFD(fd, false));
+        goto cleanup;
+    }
+
+    if (virEventEpollSyncFD(fd, true) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to add file handle %d to epoll set"),
+                             fd);
+        ignore_value(virHashSteal(eventLoop.handles, ID_KEY(handle->watch)));
+        VIR_SHRINK_N(rec->handles, rec->nhandles, 1);
+        ignore_value(virEventEpollSyncFD(fd, false));
+        goto cleanup;
+    }
+
+    watch = nextWatch++;
+    handle = NULL;
+
+    virEventEpollInterruptLocked();
+
+    EVENT_DEBUG("watch=%d fd=%d events=%d cb=%p opaque=%p ff=%p",
+                watch, fd, events, cb, opaque, ff);
+
+cleanup:
+    virMutexUnlock(&eventLoop.lock);
+    VIR_FREE(handle);
+    return watch;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
+void virEventEpollUpdateHandle(int watch, int events)
+{
+    struct virEventEpollHandle *handle;
+
+    EVENT_DEBUG("watch=%d events=%d", watch, events);
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid update watch %d", watch);
+        return;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (!(handle = virHashLookup(eventLoop.handles, ID_KEY(watch)))) {
+        virMutexUnlock(&eventLoop.lock);
+        VIR_WARN("Got update for non-existent handle watch %d", watch);
+        return;
+    }
+
+    handle->events = virEventPollToNativeEvents(events);
+    if (virEventEpollSyncFD(handle->fd, false) < 0) {
+        char ebuf[1024];
+        VIR_WARN("Unable to update file handle %d in epoll set: %s",
+                 handle->fd, virStrerror(errno, ebuf, sizeof(ebuf)));
+    }
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+}
+
+/*
+ * Unregister a callback from a file handle
+ * NB, it *must* be safe to call this from within a callback
+ * The handle is unlinked immediately so it can never be dispatched
+ * again, but the free callback is invoked out-of-band
+ */
+int virEventEpollRemoveHandle(int watch)
+{
+    struct virEventEpollHandle *handle;
+    struct virEventEpollFD *rec;
+    size_t i;
+
+    EVENT_DEBUG("watch=%d", watch);
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid remove watch %d", watch);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (!(handle = virHashSteal(eventLoop.handles, ID_KEY(watch)))) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
+    }
+
+    /* Even if we can't remember it, the handle must not be
+     * freed since a dispatch may be using it */
+    if (VIR_RESIZE_N(eventLoop.deletedHandles, eventLoop.deletedHandlesAlloc,
+                     eventLoop.deletedHandlesCount, EVENT_ALLOC_EXTENT) == 0)
+        eventLoop.deletedHandles[eventLoop.deletedHandlesCount++] = handle;
+
+    EVENT_DEBUG("mark delete %d %d", watch, handle->fd);
+    rec = eventLoop.fds[handle->fd];
+    for (i = 0 ; i < rec->nhandles ; i++) {
+        if (rec->handles[i] == handle) {
+            VIR_DELETE_ELEMENT(rec->handles, i, rec->nhandles);
+            break;
+        }
+    }
+    if (virEventEpollSyncFD(handle->fd, false) < 0) {
+        char ebuf[1024];
+        VIR_WARN("Unable to update file handle %d in epoll set: %s",
+                 handle->fd, virStrerror(errno, ebuf, sizeof(ebuf)));
+    }
+
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+}
+
+
+/*
+ * Helpers to maintain the binary min-heap of armed timers
+ */
+static void
+virEventEpollHeapSet(size_t idx, struct virEventEpollTimeout *t)
+{
+    eventLoop.heap[idx] = t;
+    t->heapIndex = idx;
+}
+
+static void
+virEventEpollHeapUp(size_t idx)
+{
+    struct virEventEpollTimeout *t = eventLoop.heap[idx];
+
+    while (idx > 0) {
+        size_t parent = (idx - 1) / 2;
+        if (eventLoop.heap[parent]->expiresAt <= t->expiresAt)
+            break;
+        virEventEpollHeapSet(idx, eventLoop.heap[parent]);
+        idx = parent;
+    }
+    virEventEpollHeapSet(idx, t);
+}
+
+static void
+virEventEpollHeapDown(size_t idx)
+{
+    struct virEventEpollTimeout *t = eventLoop.heap[idx];
+
+    for (;;) {
+        size_t child = idx * 2 + 1;
+        if (child >= eventLoop.heapCount)
+            break;
+        if (child + 1 < eventLoop.heapCount &&
+            eventLoop.heap[child + 1]->expiresAt < eventLoop.heap[child]->expiresAt)
+            child++;
+        if (t->expiresAt <= eventLoop.heap[child]->expiresAt)
+            break;
+        virEventEpollHeapSet(idx, eventLoop.heap[child]);
+        idx = child;
+    }
+    virEventEpollHeapSet(idx, t);
+}
+
+static void
+virEventEpollHeapRemove(struct virEventEpollTimeout *t)
+{
+    size_t idx = t->heapIndex;
+
+    if (t->heapIndex < 0)
+        return;
+
+    t->heapIndex = -1;
+    eventLoop.heapCount--;
+    if (idx == eventLoop.heapCount)
+        return;
+
+    virEventEpollHeapSet(idx, eventLoop.heap[eventLoop.heapCount]);
+    if (idx > 0 &&
+        eventLoop.heap[idx]->expiresAt < eventLoop.heap[(idx - 1) / 2]->expiresAt)
+        virEventEpollHeapUp(idx);
+    else
+        virEventEpollHeapDown(idx);
+}
+
+/* The heap always has room for every registered timer, see
+ * virEventEpollAddTimeout, so this can't fail */
+static void
+virEventEpollHeapInsert(struct virEventEpollTimeout *t)
+{
+    virEventEpollHeapSet(eventLoop.heapCount++, t);
+    virEventEpollHeapUp(t->heapIndex);
+}
+
+static void
+virEventEpollTimeoutArm(struct virEventEpollTimeout *t,
+                        int frequency,
+                        unsigned long long now)
+{
+    virEventEpollHeapRemove(t);
+    t->frequency = frequency;
+    if (frequency >= 0) {
+        t->expiresAt = frequency + now;
+        virEventEpollHeapInsert(t);
+    } else {
+        t->expiresAt = 0;
+    }
+}
+
+
+/*
+ * Register a callback for a timer event
+ * NB, it *must* be safe to call this from within a callback
+ */
+int virEventEpollAddTimeout(int frequency,
+                            virEventTimeoutCallback cb,
+                            void *opaque,
+                            virFreeCallback ff)
+{
+    struct virEventEpollTimeout *t = NULL;
+    unsigned long long now;
+    size_t ntimeouts;
+    int ret = -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    virMutexLock(&eventLoop.lock);
+
+    ntimeouts = virHashSize(eventLoop.timeouts);
+    if (VIR_ALLOC(t) < 0 ||
+        VIR_RESIZE_N(eventLoop.heap, eventLoop.heapAlloc,
+                     ntimeouts, 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    t->timer = nextTimer;
+    t->cb = cb;
+    t->ff = ff;
+    t->opaque = opaque;
+    t->heapIndex = -1;
+
+    if (virHashAddEntry(eventLoop.timeouts, ID_KEY(t->timer), t) < 0)
+        goto cleanup;
+
+    virEventEpollTimeoutArm(t, frequency, now);
+    ret = nextTimer++;
+    t = NULL;
+
+    virEventEpollInterruptLocked();
+
+    EVENT_DEBUG("timer=%d frequency=%d cb=%p opaque=%p ff=%p",
+                ret, frequency, cb, opaque, ff);
+
+cleanup:
+    virMutexUnlock(&eventLoop.lock);
+    VIR_FREE(t);
+    return ret;
+}
+
+void virEventEpollUpdateTimeout(int timer, int frequency)
+{
+    struct virEventEpollTimeout *t;
+    unsigned long long now;
+
+    EVENT_DEBUG("timer=%d frequency=%d", timer, frequency);
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid update timer %d", timer);
+        return;
+    }
+
+    if (virTimeMillisNow(&now) < 0)
+        return;
+
+    virMutexLock(&eventLoop.lock);
+    if (!(t = virHashLookup(eventLoop.timeouts, ID_KEY(timer)))) {
+        virMutexUnlock(&eventLoop.lock);
+        VIR_WARN("Got update for non-existent timer %d", timer);
+        return;
+    }
+
+    virEventEpollTimeoutArm(t, frequency, now);
+    VIR_DEBUG("Set timer freq=%d expires=%llu", frequency, t->expiresAt);
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+}
+
+/*
+ * Unregister a callback for a timer
+ * NB, it *must* be safe to call this from within a callback
+ * The timer is unlinked immediately so it can never fire
+ * again, but the free callback is invoked out-of-band
+ */
+int virEventEpollRemoveTimeout(int timer)
+{
+    struct virEventEpollTimeout *t;
+
+    EVENT_DEBUG("timer=%d", timer);
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid remove timer %d", timer);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (!(t = virHashSteal(eventLoop.timeouts, ID_KEY(timer)))) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
+    }
+
+    virEventEpollHeapRemove(t);
+    if (VIR_RESIZE_N(eventLoop.deletedTimeouts, eventLoop.deletedTimeoutsAlloc,
+                     eventLoop.deletedTimeoutsCount, EVENT_ALLOC_EXTENT) == 0)
+        eventLoop.deletedTimeouts[eventLoop.deletedTimeoutsCount++] = t;
+
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+}
+
+
+/* Look at the earliest armed timer only
+ * @timeout: filled with expiry time of soonest timer, or -1 if
+ *           no timeout is pending
+ * returns: 0 on success, -1 on error
+ */
+static int virEventEpollCalculateTimeout(int *timeout)
+{
+    unsigned long long then;
+    unsigned long long now;
+
+    if (eventLoop.heapCount == 0) {
+        *timeout = -1;
+        EVENT_DEBUG("No timeout pending, %d", *timeout);
+        return 0;
+    }
+
+    then = eventLoop.heap[0]->expiresAt;
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    EVENT_DEBUG("Schedule timeout then=%llu now=%llu", then, now);
+    if (then <= now)
+        *timeout = 0;
+    else if (then - now > INT_MAX)
+        *timeout = INT_MAX;
+    else
+        *timeout = then - now;
+
+    EVENT_DEBUG("Timeout at %llu due in %d ms", then, *timeout);
+
+    return 0;
+}
+
+
+static int
+virEventEpollAddPending(int id, int events)
+{
+    if (VIR_RESIZE_N(eventLoop.pending, eventLoop.pendingAlloc,
+                     eventLoop.pendingCount, EVENT_ALLOC_EXTENT) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    eventLoop.pending[eventLoop.pendingCount].id = id;
+    eventLoop.pending[eventLoop.pendingCount].events = events;
+    eventLoop.pendingCount++;
+    return 0;
+}
+
+
+/*
+ * Pop every timer due to expire off the heap, rescheduling
+ * each one before any callback runs, then invoke them. Each
+ * timer fires at most once per iteration, as with poll, so a
+ * zero frequency timer can't starve the file handles. Does
+ * not try to 'catch up' on time if the actual expiry time
+ * was later than the requested time.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventEpollDispatchTimeouts(void)
+{
+    unsigned long long now;
+    size_t i;
+    int ret = -1;
+
+    if (eventLoop.heapCount == 0)
+        return 0;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    eventLoop.pendingCount = 0;
+
+    /* Add 20ms fuzz so we don't pointlessly spin doing
+     * <10ms sleeps, particularly on kernels with low HZ
+     * it is fine that a timer expires 20ms earlier than
+     * requested
+     */
+    while (eventLoop.heapCount > 0 &&
+           eventLoop.heap[0]->expiresAt <= (now+20)) {
+        struct virEventEpollTimeout *t = eventLoop.heap[0];
+        if (virEventEpollAddPending(t->timer, 0) < 0)
+            goto cleanup;
+        virEventEpollHeapRemove(t);
+    }
+
+    ret = 0;
+
+cleanup:
+    /* Re-arm everything popped, even on failure, so no timer is lost */
+    for (i = 0 ; i < eventLoop.pendingCount ; i++) {
+        struct virEventEpollTimeout *t =
+            virHashLookup(eventLoop.timeouts, ID_KEY(eventLoop.pending[i].id));
+        virEventEpollTimeoutArm(t, t->frequency, now);
+    }
+
+    VIR_DEBUG("Dispatch %zu", eventLoop.pendingCount);
+
+    for (i = 0 ; ret == 0 && i < eventLoop.pendingCount ; i++) {
+        int timer = eventLoop.pending[i].id;
+        struct virEventEpollTimeout *t;
+        virEventTimeoutCallback cb;
+        void *opaque;
+
+        /* An earlier callback may have removed it */
+        if (!(t = virHashLookup(eventLoop.timeouts, ID_KEY(timer))))
+            continue;
+
+        cb = t->cb;
+        opaque = t->opaque;
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(timer, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+
+    return ret;
+}
+
+
+static int
+virEventEpollQueueFD(int fd, int revents)
+{
+    struct virEventEpollFD *rec;
+    size_t i;
+
+    if (fd < 0 || (size_t)fd >= eventLoop.nfds || !(rec = eventLoop.fds[fd]))
+        return 0;
+
+    for (i = 0 ; i < rec->nhandles ; i++) {
+        struct virEventEpollHandle *handle = rec->handles[i];
+        int events = revents & (handle->events | POLLERR | POLLHUP);
+
+        if (handle->events == 0 || events == 0)
+            continue;
+        if (virEventEpollAddPending(handle->watch, events) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Dispatch only the file handles which the kernel reported
+ * ready, plus any which epoll could not watch. The ready set
+ * is copied first since callbacks may add, update or remove
+ * handles, including ones reported ready in this iteration.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventEpollDispatchHandles(int nevents,
+                                        struct epoll_event *events)
+{
+    size_t i;
+
+    eventLoop.pendingCount = 0;
+
+    for (i = 0 ; i < (size_t)nevents ; i++) {
+        if (virEventEpollQueueFD(events[i].data.fd,
+                                 virEventEpollFromEpollEvents(events[i].events)) < 0)
+            return -1;
+    }
+
+    if (eventLoop.nalwaysReady) {
+        for (i = 0 ; i < eventLoop.nfds ; i++) {
+            if (eventLoop.fds[i] && eventLoop.fds[i]->alwaysReady &&
+                virEventEpollQueueFD(i, POLLIN | POLLOUT) < 0)
+                return -1;
+        }
+    }
+
+    VIR_DEBUG("Dispatch %zu", eventLoop.pendingCount);
+
+    for (i = 0 ; i < eventLoop.pendingCount ; i++) {
+        int watch = eventLoop.pending[i].id;
+        struct virEventEpollHandle *handle;
+        virEventHandleCallback cb;
+        void *opaque;
+        int fd;
+        int hEvents;
+
+        /* An earlier callback may have removed or updated it */
+        if (!(handle = virHashLookup(eventLoop.handles, ID_KEY(watch))))
+            continue;
+        hEvents = eventLoop.pending[i].events &
+            (handle->events | POLLERR | POLLHUP);
+        if (handle->events == 0 || hEvents == 0)
+            continue;
+
+        cb = handle->cb;
+        opaque = handle->opaque;
+        fd = handle->fd;
+        hEvents = virEventPollFromNativeEvents(hEvents);
+        EVENT_DEBUG("watch=%d events=%d", watch, hEvents);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(watch, fd, hEvents, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+
+    return 0;
+}
+
+
+/* Used post dispatch to run the free callbacks of any timers and
+ * handles that were removed. This asynchronous cleanup is needed
+ * to make dispatch re-entrant safe.
+ */
+static void virEventEpollCleanup(void)
+{
+    VIR_DEBUG("Cleanup %zu handles, %zu timeouts",
+              eventLoop.deletedHandlesCount, eventLoop.deletedTimeoutsCount);
+
+    /* Free callbacks may remove further records, so always
+     * take from the end of the lists */
+    while (eventLoop.deletedTimeoutsCount > 0) {
+        struct virEventEpollTimeout *t =
+            eventLoop.deletedTimeouts[--eventLoop.deletedTimeoutsCount];
+        if (t->ff) {
+            virMutexUnlock(&eventLoop.lock);
+            (t->ff)(t->opaque);
+            virMutexLock(&eventLoop.lock);
+        }
+        VIR_FREE(t);
+    }
+
+    while (eventLoop.deletedHandlesCount > 0) {
+        struct virEventEpollHandle *handle =
+            eventLoop.deletedHandles[--eventLoop.deletedHandlesCount];
+        if (handle->ff) {
+            virMutexUnlock(&eventLoop.lock);
+            (handle->ff)(handle->opaque);
+            virMutexLock(&eventLoop.lock);
+        }
+        VIR_FREE(handle);
+    }
+}
+
+/*
+ * Run a single iteration of the event loop, blocking until
+ * at least one file handle has an event, or a timer expires
+ */
+int virEventEpollRunOnce(void)
+{
+    struct epoll_event events[EVENT_EPOLL_MAX_EVENTS];
+    int ret, timeout;
+
+    virMutexLock(&eventLoop.lock);
+    eventLoop.running = 1;
+    virThreadSelf(&eventLoop.leader);
+
+    virEventEpollCleanup();
+
+    if (virEventEpollCalculateTimeout(&timeout) < 0)
+        goto error;
+
+    /* Descriptors epoll can't watch are always ready */
+    if (eventLoop.nalwaysReady)
+        timeout = 0;
+
+    virMutexUnlock(&eventLoop.lock);
+
+ retry:
+    EVENT_DEBUG("nhandles=%zu timeout=%d",
+                virHashSize(eventLoop.handles), timeout);
+    ret = epoll_wait(eventLoop.epollfd, events,
+                     EVENT_EPOLL_MAX_EVENTS, timeout);
+    if (ret < 0) {
+        EVENT_DEBUG("Poll got error event %d", errno);
+        if (errno == EINTR || errno == EAGAIN) {
+            goto retry;
+        }
+        virReportSystemError(errno, "%s",
+                             _("Unable to poll on file handles"));
+        goto error_unlocked;
+    }
+    EVENT_DEBUG("Poll got %d event(s)", ret);
+
+    virMutexLock(&eventLoop.lock);
+    if (virEventEpollDispatchTimeouts() < 0)
+        goto error;
+
+    if ((ret > 0 || eventLoop.nalwaysReady) &&
+        virEventEpollDispatchHandles(ret, events) < 0)
+        goto error;
+
+    virEventEpollCleanup();
+
+    eventLoop.running = 0;
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+
+error:
+    eventLoop.running = 0;
+    virMutexUnlock(&eventLoop.lock);
+error_unlocked:
+    return -1;
+}
+
+
+static void virEventEpollHandleWakeup(int watch ATTRIBUTE_UNUSED,
+                                      int fd,
+                                      int events ATTRIBUTE_UNUSED,
+                                      void *opaque ATTRIBUTE_UNUSED)
+{
+    char c;
+    virMutexLock(&eventLoop.lock);
+    ignore_value(saferead(fd, &c, sizeof(c)));
+    virMutexUnlock(&eventLoop.lock);
+}
+
+int virEventEpollInit(void)
+{
+    if (virMutexInit(&eventLoop.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(eventLoop.handles = virEventEpollIDHashCreate()) ||
+        !(eventLoop.timeouts = virEventEpollIDHashCreate()))
+        goto error;
+
+    if ((eventLoop.epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll file handle"));
+        goto error;
+    }
+
+    if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to setup wakeup pipe"));
+        goto error;
+    }
+
+    if (virEventEpollAddHandle(eventLoop.wakeupfd[0],
+                               VIR_EVENT_HANDLE_READABLE,
+                               virEventEpollHandleWakeup, NULL, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to add handle %d to event loop"),
+                       eventLoop.wakeupfd[0]);
+        VIR_FORCE_CLOSE(eventLoop.wakeupfd[0]);
+        VIR_FORCE_CLOSE(eventLoop.wakeupfd[1]);
+        goto error;
+    }
+
+    return 0;
+
+error:
+    VIR_FORCE_CLOSE(eventLoop.epollfd);
+    virHashFree(eventLoop.handles);
+    eventLoop.handles = NULL;
+    virHashFree(eventLoop.timeouts);
+    eventLoop.timeouts = NULL;
+    virMutexDestroy(&eventLoop.lock);
+    return -1;
+}
+
+static int virEventEpollInterruptLocked(void)
+{
+    char c = '\0';
+
+    if (!eventLoop.running ||
+        virThreadIsSelf(&eventLoop.leader)) {
+        VIR_DEBUG("Skip interrupt, %d %d", eventLoop.running,
+                  virThreadID(&eventLoop.leader));
+        return 0;
+    }
+
+    VIR_DEBUG("Interrupting");
+    if (safewrite(eventLoop.wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+        return -1;
+    return 0;
+}
+
+int virEventEpollInterrupt(void)
+{
+    int ret;
+    virMutexLock(&eventLoop.lock);
+    ret = virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return ret;
+}
+
+#else /* !HAVE_SYS_EPOLL_H */
+
+int virEventEpollAddHandle(int fd ATTRIBUTE_UNUSED,
+                           int events ATTRIBUTE_UNUSED,
+                           virEventHandleCallback cb ATTRIBUTE_UNUSED,
+                           void *opaque ATTRIBUTE_UNUSED,
+                           virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("epoll event loop is not supported on this platform"));
+    return -1;
+}
+
+void virEventEpollUpdateHandle(int watch ATTRIBUTE_UNUSED,
+                               int events ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollRemoveHandle(int watch ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollAddTimeout(int frequency ATTRIBUTE_UNUSED,
+                            virEventTimeoutCallback cb ATTRIBUTE_UNUSED,
+                            void *opaque ATTRIBUTE_UNUSED,
+                            virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("epoll event loop is not supported on this platform"));
+    return -1;
+}
+
+void virEventEpollUpdateTimeout(int timer ATTRIBUTE_UNUSED,
+                                int frequency ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollRemoveTimeout(int timer ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollInit(void)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("epoll event loop is not supported on this platform"));
+    return -1;
+}
+
+int virEventEpollRunOnce(void)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("epoll event loop is not supported on this platform"));
+    return -1;
+}
+
+int virEventEpollInterrupt(void)
+{
+    return -1;
+}
+
+#endif /* !HAVE_SYS_EPOLL_H */
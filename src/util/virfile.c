@@ -644,3 +644,135 @@ int virFileLoopDeviceAssociate(const char *file,
 }
 
 #endif /* __linux__ */
+
+
+/**
+ * virFileInData:
+ * @fd: a seekable file
+ * @inData: set to true if the current offset of @fd is in data
+ * @length: set to the number of bytes up to the next hole or
+ *          data, or to 0 at the end of the file
+ *
+ * Tells how far the data or hole at the current offset of @fd
+ * extends, leaving the offset unchanged.  Without SEEK_HOLE and
+ * SEEK_DATA, or if the file system doesn't support them, all of
+ * the file is reported as data.
+ *
+ * Returns 0 on success, -1 with an error reported on failure.
+ */
+int
+virFileInData(int fd,
+              bool *inData,
+              unsigned long long *length)
+{
+    off_t cur, end;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t data, hole;
+#endif
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) < 0) {
+        virReportSystemError(errno, "%s", _("unable to get file offset"));
+        return -1;
+    }
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    if ((data = lseek(fd, cur, SEEK_DATA)) >= 0) {
+        if (data > cur) {
+            *inData = false;
+            *length = data - cur;
+        } else if ((hole = lseek(fd, cur, SEEK_HOLE)) >= 0) {
+            *inData = true;
+            *length = hole - cur;
+        } else {
+            virReportSystemError(errno, "%s", _("unable to seek to hole"));
+            goto error;
+        }
+        goto done;
+    }
+
+    /* ENXIO means there's no more data after @cur, EINVAL that the
+     * file system doesn't know about holes */
+    if (errno != ENXIO && errno != EINVAL) {
+        virReportSystemError(errno, "%s", _("unable to seek to data"));
+        goto error;
+    }
+    *inData = errno == EINVAL;
+#else
+    *inData = true;
+#endif
+
+    if ((end = lseek(fd, 0, SEEK_END)) < 0) {
+        virReportSystemError(errno, "%s", _("unable to seek to end of file"));
+        goto error;
+    }
+    *length = end > cur ? end - cur : 0;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+done:
+#endif
+    if (lseek(fd, cur, SEEK_SET) < 0) {
+        virReportSystemError(errno, "%s", _("unable to restore file offset"));
+        return -1;
+    }
+    return 0;
+
+error:
+    ignore_value(lseek(fd, cur, SEEK_SET));
+    return -1;
+}
+
+
+/**
+ * virFileSparseRecordEncode:
+ * @buf: VIR_FILE_SPARSE_RECORD_HEADER_LEN bytes to fill
+ * @type: VIR_FILE_SPARSE_RECORD_DATA or VIR_FILE_SPARSE_RECORD_HOLE
+ * @length: number of bytes of data or hole in the record
+ *
+ * Fill @buf with the header of a record of a sparse file.
+ */
+void
+virFileSparseRecordEncode(char *buf,
+                          int type,
+                          unsigned long long length)
+{
+    unsigned char *hdr = (unsigned char *) buf;
+    size_t i;
+
+    for (i = 0 ; i < 4 ; i++)
+        hdr[i] = (type >> (24 - i * 8)) & 0xff;
+    for (i = 0 ; i < 8 ; i++)
+        hdr[4 + i] = (length >> (56 - i * 8)) & 0xff;
+}
+
+
+/**
+ * virFileSparseRecordDecode:
+ * @buf: VIR_FILE_SPARSE_RECORD_HEADER_LEN bytes of a record header
+ * @type: filled with the type of the record
+ * @length: filled with the length of the record
+ *
+ * Parse the header of a record of a sparse file.  No error is
+ * reported, as only the caller knows where the record came from.
+ *
+ * Returns 0 on success, -1 if the record has an unknown type.
+ */
+int
+virFileSparseRecordDecode(const char *buf,
+                          int *type,
+                          unsigned long long *length)
+{
+    const unsigned char *hdr = (const unsigned char *) buf;
+    size_t i;
+
+    *type = 0;
+    *length = 0;
+    for (i = 0 ; i < 4 ; i++)
+        *type = (*type << 8) | hdr[i];
+    for (i = 0 ; i < 8 ; i++)
+        *length = (*length << 8) | hdr[4 + i];
+
+    if (*type != VIR_FILE_SPARSE_RECORD_DATA &&
+        *type != VIR_FILE_SPARSE_RECORD_HOLE)
+        return -1;
+    return 0;
+}
@@ -108,4 +108,31 @@ int virFileUpdatePerm(const char *path,
 int virFileLoopDeviceAssociate(const char *file,
                                char **dev);
 
+int virFileInData(int fd,
+                  bool *inData,
+                  unsigned long long *length)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3) ATTRIBUTE_RETURN_CHECK;
+
+/* Sparse files pass through a pipe, such as the one between a stream
+ * and the I/O helper, as a series of records, each made of a big
+ * endian 32 bit type and 64 bit length, followed by that many bytes
+ * for data records */
+# define VIR_FILE_SPARSE_RECORD_HEADER_LEN 12
+
+enum {
+    VIR_FILE_SPARSE_RECORD_DATA = 0,
+    VIR_FILE_SPARSE_RECORD_HOLE = 1,
+};
+
+void virFileSparseRecordEncode(char *buf,
+                               int type,
+                               unsigned long long length)
+    ATTRIBUTE_NONNULL(1);
+
+int virFileSparseRecordDecode(const char *buf,
+                              int *type,
+                              unsigned long long *length)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_RETURN_CHECK;
+
 #endif /* __VIR_FILES_H */
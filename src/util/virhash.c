@@ -523,6 +523,40 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
     return count;
 }
 
+/**
+ * virHashForEachReadOnly
+ * @table: the hash table to process
+ * @iter: callback to process each element
+ * @data: opaque data to pass to the iterator
+ *
+ * Iterates over every element in the hash table like virHashForEach,
+ * but without marking the table as being iterated over. The callback
+ * must not modify the table, which is not checked. In exchange, any
+ * number of threads may iterate over the same table at once, or look
+ * up entries meanwhile, as long as nothing modifies it.
+ *
+ * Returns number of items iterated over upon completion, -1 on failure
+ */
+ssize_t
+virHashForEachReadOnly(virHashTablePtr table, virHashIterator iter, void *data)
+{
+    size_t i, count = 0;
+
+    if (table == NULL || iter == NULL)
+        return -1;
+
+    for (i = 0 ; i < table->size ; i++) {
+        virHashEntryPtr entry;
+
+        for (entry = table->table[i]; entry; entry = entry->next) {
+            iter(entry->payload, entry->name, data);
+            count++;
+        }
+    }
+
+    return count;
+}
+
 /**
  * virHashRemoveSet
  * @table: the hash table to process
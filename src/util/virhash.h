@@ -180,6 +180,8 @@ bool virHashEqual(const virHashTablePtr table1,
  * Iterators
  */
 ssize_t virHashForEach(virHashTablePtr table, virHashIterator iter, void *data);
+ssize_t virHashForEachReadOnly(virHashTablePtr table, virHashIterator iter,
+                               void *data);
 ssize_t virHashRemoveSet(virHashTablePtr table, virHashSearcher iter, const void *data);
 void *virHashSearch(virHashTablePtr table, virHashSearcher iter, const void *data);
 
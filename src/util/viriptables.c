@@ -42,10 +42,12 @@
 #include "internal.h"
 #include "viriptables.h"
 #include "vircommand.h"
+#include "virbuffer.h"
 #include "viralloc.h"
 #include "virerror.h"
 #include "virlog.h"
 #include "virthread.h"
+#include "virutil.h"
 
 #if HAVE_FIREWALLD
 static char *firewall_cmd_path = NULL;
@@ -91,12 +93,22 @@ typedef struct
     char  *chain;
 } iptRules;
 
+typedef struct _iptRule iptRule;
+
 struct _iptablesContext
 {
     iptRules *input_filter;
     iptRules *forward_filter;
     iptRules *nat_postrouting;
     iptRules *mangle_postrouting;
+
+    /* Rules queued by an open transaction. Like the rest of the
+     * context, these have no locking of their own: callers serialize
+     * all use of a context. The network driver holds its driver lock
+     * around every use, including reloads after firewalld restarts */
+    bool transaction;
+    iptRule **pending;
+    size_t npending;
 };
 
 static void
@@ -129,56 +141,390 @@ iptRulesNew(const char *table,
     return NULL;
 }
 
+/* A single rule to insert or delete, kept as arguments so that it can
+ * either be run on its own or written out for iptables-restore */
+struct _iptRule
+{
+    int family;
+    int action;
+    iptRules *rules;
+    char **args;
+    size_t nargs;
+};
+
+static void
+iptRuleFree(iptRule *rule)
+{
+    size_t i;
+
+    if (!rule)
+        return;
+
+    for (i = 0 ; i < rule->nargs ; i++)
+        VIR_FREE(rule->args[i]);
+    VIR_FREE(rule->args);
+    VIR_FREE(rule);
+}
+
+static iptRule *
+iptablesRuleNew(iptRules *rules, int family, int action)
+{
+    iptRule *rule;
+
+    if (VIR_ALLOC(rule) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    rule->family = family;
+    rule->action = action;
+    rule->rules = rules;
+
+    return rule;
+}
+
+static int ATTRIBUTE_SENTINEL
+iptablesRuleAddArgList(iptRule *rule, ...)
+{
+    va_list args;
+    const char *s;
+    int ret = 0;
+
+    va_start(args, rule);
+    while ((s = va_arg(args, const char *))) {
+        char *arg;
+
+        if (!(arg = strdup(s)) ||
+            VIR_APPEND_ELEMENT(rule->args, rule->nargs, arg) < 0) {
+            VIR_FREE(arg);
+            virReportOOMError();
+            ret = -1;
+            break;
+        }
+    }
+    va_end(args);
+
+    return ret;
+}
+
 static virCommandPtr
-iptablesCommandNew(iptRules *rules, int family, int action)
+iptablesCommandNew(iptRule *rule, int action)
 {
     virCommandPtr cmd = NULL;
+    size_t i;
 #if HAVE_FIREWALLD
     virIpTablesInitialize();
     if (firewall_cmd_path) {
         cmd = virCommandNew(firewall_cmd_path);
         virCommandAddArgList(cmd, "--direct", "--passthrough",
-                             (family == AF_INET6) ? "ipv6" : "ipv4", NULL);
+                             (rule->family == AF_INET6) ? "ipv6" : "ipv4",
+                             NULL);
     }
 #endif
 
     if (cmd == NULL) {
-        cmd = virCommandNew((family == AF_INET6)
+        cmd = virCommandNew((rule->family == AF_INET6)
                         ? IP6TABLES_PATH : IPTABLES_PATH);
     }
 
-    virCommandAddArgList(cmd, "--table", rules->table,
+    virCommandAddArgList(cmd, "--table", rule->rules->table,
                          action == ADD ? "--insert" : "--delete",
-                         rules->chain, NULL);
+                         rule->rules->chain, NULL);
+    for (i = 0 ; i < rule->nargs ; i++)
+        virCommandAddArg(cmd, rule->args[i]);
+
     return cmd;
 }
 
 static int
-iptablesCommandRunAndFree(virCommandPtr cmd)
+iptablesRuleRun(iptRule *rule, int action)
 {
+    virCommandPtr cmd;
     int ret;
+
+    cmd = iptablesCommandNew(rule, action);
     ret = virCommandRun(cmd, NULL);
     virCommandFree(cmd);
     return ret;
 }
 
+/*
+ * Runs @rule straight away, or queues it if a transaction is open.
+ * Either way @rule is consumed.
+ */
+static int
+iptablesRuleApply(iptablesContext *ctx, iptRule *rule)
+{
+    int ret;
+
+    if (!rule)
+        return -1;
+
+    if (ctx->transaction) {
+        if (VIR_APPEND_ELEMENT(ctx->pending, ctx->npending, rule) < 0) {
+            iptRuleFree(rule);
+            virReportOOMError();
+            return -1;
+        }
+        return 0;
+    }
+
+    ret = iptablesRuleRun(rule, rule->action);
+    iptRuleFree(rule);
+    return ret;
+}
+
 static int ATTRIBUTE_SENTINEL
-iptablesAddRemoveRule(iptRules *rules, int family, int action,
+iptablesAddRemoveRule(iptablesContext *ctx, iptRules *rules,
+                      int family, int action,
                       const char *arg, ...)
 {
     va_list args;
-    virCommandPtr cmd = NULL;
+    iptRule *rule;
     const char *s;
 
-    cmd = iptablesCommandNew(rules, family, action);
-    virCommandAddArg(cmd, arg);
+    if (!(rule = iptablesRuleNew(rules, family, action)))
+        return -1;
+
+    if (iptablesRuleAddArgList(rule, arg, NULL) < 0)
+        goto error;
 
     va_start(args, arg);
-    while ((s = va_arg(args, const char *)))
-        virCommandAddArg(cmd, s);
+    while ((s = va_arg(args, const char *))) {
+        if (iptablesRuleAddArgList(rule, s, NULL) < 0) {
+            va_end(args);
+            goto error;
+        }
+    }
     va_end(args);
 
-    return iptablesCommandRunAndFree(cmd);
+    return iptablesRuleApply(ctx, rule);
+
+ error:
+    iptRuleFree(rule);
+    return -1;
+}
+
+/*
+ * Formats the pending rules for @table of @family as input for
+ * iptables-restore, in the order they were queued. Returns NULL if
+ * one of them can't be written out safely.
+ */
+static char *
+iptablesTransactionFormat(iptablesContext *ctx, int family,
+                          const char *table)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i, j;
+
+    virBufferAsprintf(&buf, "*%s\n", table);
+
+    for (i = 0 ; i < ctx->npending ; i++) {
+        iptRule *rule = ctx->pending[i];
+
+        if (rule->family != family || STRNEQ(rule->rules->table, table))
+            continue;
+
+        virBufferAsprintf(&buf, "%s %s",
+                          rule->action == ADD ? "--insert" : "--delete",
+                          rule->rules->chain);
+        for (j = 0 ; j < rule->nargs ; j++) {
+            if (strpbrk(rule->args[j], " \t\n\"'")) {
+                VIR_DEBUG("Not batching rule with argument '%s'",
+                          rule->args[j]);
+                virBufferFreeAndReset(&buf);
+                return NULL;
+            }
+            virBufferAsprintf(&buf, " %s", rule->args[j]);
+        }
+        virBufferAddLit(&buf, "\n");
+    }
+
+    virBufferAddLit(&buf, "COMMIT\n");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+/*
+ * Applies the pending rules for @table of @family in one
+ * iptables-restore run, which either applies all of them or none.
+ * Returns 0 if they were applied, -1 if not.
+ */
+static int
+iptablesTransactionRestore(iptablesContext *ctx, int family,
+                           const char *table)
+{
+    const char *path = family == AF_INET6 ?
+        IP6TABLES_RESTORE_PATH : IPTABLES_RESTORE_PATH;
+    virCommandPtr cmd = NULL;
+    char *input = NULL;
+    char *errbuf = NULL;
+    int status;
+    int ret = -1;
+
+#if HAVE_FIREWALLD
+    /* Rules must go through firewalld, which can't take a batch */
+    virIpTablesInitialize();
+    if (firewall_cmd_path)
+        return -1;
+#endif
+
+    if (!virFileIsExecutable(path))
+        return -1;
+
+    if (!(input = iptablesTransactionFormat(ctx, family, table)))
+        return -1;
+
+    cmd = virCommandNewArgList(path, "--noflush", NULL);
+    virCommandSetInputBuffer(cmd, input);
+    virCommandSetErrorBuffer(cmd, &errbuf);
+
+    if (virCommandRun(cmd, &status) < 0 || status != 0) {
+        VIR_DEBUG("%s failed, applying rules one at a time: %s",
+                  path, NULLSTR(errbuf));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virCommandFree(cmd);
+    VIR_FREE(input);
+    VIR_FREE(errbuf);
+    return ret;
+}
+
+static void
+iptablesTransactionClear(iptablesContext *ctx)
+{
+    size_t i;
+
+    for (i = 0 ; i < ctx->npending ; i++)
+        iptRuleFree(ctx->pending[i]);
+    VIR_FREE(ctx->pending);
+    ctx->npending = 0;
+}
+
+/**
+ * iptablesTransactionBegin:
+ * @ctx: pointer to the IP table context
+ *
+ * Start queueing rules added to or removed from @ctx, instead of
+ * applying each one as it comes. Until iptablesTransactionCommit or
+ * iptablesTransactionAbort is called, the helpers only fail if the
+ * rule can't be queued. The caller must not let other threads use
+ * @ctx until then.
+ */
+void
+iptablesTransactionBegin(iptablesContext *ctx)
+{
+    iptablesTransactionClear(ctx);
+    ctx->transaction = true;
+}
+
+/**
+ * iptablesTransactionAbort:
+ * @ctx: pointer to the IP table context
+ *
+ * Throw away any rules queued since iptablesTransactionBegin, and go
+ * back to applying rules one at a time.
+ */
+void
+iptablesTransactionAbort(iptablesContext *ctx)
+{
+    iptablesTransactionClear(ctx);
+    ctx->transaction = false;
+}
+
+/**
+ * iptablesTransactionCommit:
+ * @ctx: pointer to the IP table context
+ *
+ * Apply the rules queued since iptablesTransactionBegin, with one
+ * iptables-restore or ip6tables-restore run per table. If that isn't
+ * possible the rules are run one at a time instead; then, if a rule
+ * fails to be added, the rules applied before it are taken out again.
+ * Failures to remove a rule are ignored, as they usually mean it
+ * wasn't there.
+ *
+ * Returns 0 in case of success or -1 if the rules couldn't be added
+ */
+int
+iptablesTransactionCommit(iptablesContext *ctx)
+{
+    bool *tried = NULL;
+    bool *applied = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    VIR_DEBUG("Applying %zu queued rules", ctx->npending);
+
+    if (VIR_ALLOC_N(tried, ctx->npending) < 0 ||
+        VIR_ALLOC_N(applied, ctx->npending) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    /* One restore per table, so that each is all or nothing */
+    for (i = 0 ; i < ctx->npending ; i++) {
+        iptRule *rule = ctx->pending[i];
+        bool ok;
+
+        if (tried[i])
+            continue;
+
+        ok = iptablesTransactionRestore(ctx, rule->family,
+                                        rule->rules->table) == 0;
+
+        for (j = i ; j < ctx->npending ; j++) {
+            if (ctx->pending[j]->family == rule->family &&
+                STREQ(ctx->pending[j]->rules->table, rule->rules->table)) {
+                tried[j] = true;
+                applied[j] = ok;
+            }
+        }
+    }
+
+    for (i = 0 ; i < ctx->npending ; i++) {
+        iptRule *rule = ctx->pending[i];
+
+        if (applied[i])
+            continue;
+
+        if (iptablesRuleRun(rule, rule->action) == 0) {
+            applied[i] = true;
+        } else if (rule->action == ADD) {
+            virErrorPtr orig_error = virSaveLastError();
+
+            j = ctx->npending;
+            while (j-- > 0) {
+                if (!applied[j])
+                    continue;
+                rule = ctx->pending[j];
+                ignore_value(iptablesRuleRun(rule,
+                                             rule->action == ADD ?
+                                             REMOVE : ADD));
+            }
+
+            virSetError(orig_error);
+            virFreeError(orig_error);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(tried);
+    VIR_FREE(applied);
+    iptablesTransactionAbort(ctx);
+    return ret;
 }
 
 /**
@@ -224,6 +570,7 @@ iptablesContextNew(void)
 void
 iptablesContextFree(iptablesContext *ctx)
 {
+    iptablesTransactionClear(ctx);
     if (ctx->input_filter)
         iptRulesFree(ctx->input_filter);
     if (ctx->forward_filter)
@@ -248,7 +595,7 @@ iptablesInput(iptablesContext *ctx,
     snprintf(portstr, sizeof(portstr), "%d", port);
     portstr[sizeof(portstr) - 1] = '\0';
 
-    return iptablesAddRemoveRule(ctx->input_filter,
+    return iptablesAddRemoveRule(ctx, ctx->input_filter,
                                  family,
                                  action,
                                  "--in-interface", iface,
@@ -385,26 +732,35 @@ iptablesForwardAllowOut(iptablesContext *ctx,
                         const char *physdev,
                         int action)
 {
-    int ret;
+    int ret = -1;
     char *networkstr;
-    virCommandPtr cmd = NULL;
+    iptRule *rule = NULL;
 
     if (!(networkstr = iptablesFormatNetwork(netaddr, prefix)))
         return -1;
 
-    cmd = iptablesCommandNew(ctx->forward_filter,
-                             VIR_SOCKET_ADDR_FAMILY(netaddr),
-                             action);
-    virCommandAddArgList(cmd,
-                         "--source", networkstr,
-                         "--in-interface", iface, NULL);
+    if (!(rule = iptablesRuleNew(ctx->forward_filter,
+                                 VIR_SOCKET_ADDR_FAMILY(netaddr),
+                                 action)))
+        goto cleanup;
 
-    if (physdev && physdev[0])
-        virCommandAddArgList(cmd, "--out-interface", physdev, NULL);
+    if (iptablesRuleAddArgList(rule,
+                               "--source", networkstr,
+                               "--in-interface", iface, NULL) < 0)
+        goto cleanup;
 
-    virCommandAddArgList(cmd, "--jump", "ACCEPT", NULL);
+    if (physdev && physdev[0] &&
+        iptablesRuleAddArgList(rule, "--out-interface", physdev, NULL) < 0)
+        goto cleanup;
+
+    if (iptablesRuleAddArgList(rule, "--jump", "ACCEPT", NULL) < 0)
+        goto cleanup;
 
-    ret = iptablesCommandRunAndFree(cmd);
+    ret = iptablesRuleApply(ctx, rule);
+    rule = NULL;
+
+cleanup:
+    iptRuleFree(rule);
     VIR_FREE(networkstr);
     return ret;
 }
@@ -474,7 +830,7 @@ iptablesForwardAllowRelatedIn(iptablesContext *ctx,
         return -1;
 
     if (physdev && physdev[0]) {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--destination", networkstr,
@@ -485,7 +841,7 @@ iptablesForwardAllowRelatedIn(iptablesContext *ctx,
                                     "--jump", "ACCEPT",
                                     NULL);
     } else {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--destination", networkstr,
@@ -562,7 +918,7 @@ iptablesForwardAllowIn(iptablesContext *ctx,
         return -1;
 
     if (physdev && physdev[0]) {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--destination", networkstr,
@@ -571,7 +927,7 @@ iptablesForwardAllowIn(iptablesContext *ctx,
                                     "--jump", "ACCEPT",
                                     NULL);
     } else {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--destination", networkstr,
@@ -639,7 +995,7 @@ iptablesForwardAllowCross(iptablesContext *ctx,
                           const char *iface,
                           int action)
 {
-    return iptablesAddRemoveRule(ctx->forward_filter,
+    return iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                  family,
                                  action,
                                  "--in-interface", iface,
@@ -696,7 +1052,7 @@ iptablesForwardRejectOut(iptablesContext *ctx,
                          const char *iface,
                          int action)
 {
-    return iptablesAddRemoveRule(ctx->forward_filter,
+    return iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                  family,
                                  action,
                                  "--in-interface", iface,
@@ -752,7 +1108,7 @@ iptablesForwardRejectIn(iptablesContext *ctx,
                         const char *iface,
                         int action)
 {
-    return iptablesAddRemoveRule(ctx->forward_filter,
+    return iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                  family,
                                  action,
                                  "--out-interface", iface,
@@ -816,7 +1172,7 @@ iptablesForwardMasquerade(iptablesContext *ctx,
     char *addrEndStr = NULL;
     char *portRangeStr = NULL;
     char *natRangeStr = NULL;
-    virCommandPtr cmd = NULL;
+    iptRule *rule = NULL;
 
     if (!(networkstr = iptablesFormatNetwork(netaddr, prefix)))
         return -1;
@@ -838,16 +1194,23 @@ iptablesForwardMasquerade(iptablesContext *ctx,
         }
     }
 
-    cmd = iptablesCommandNew(ctx->nat_postrouting, AF_INET, action);
-    virCommandAddArgList(cmd, "--source", networkstr, NULL);
+    if (!(rule = iptablesRuleNew(ctx->nat_postrouting, AF_INET, action)))
+        goto cleanup;
 
-    if (protocol && protocol[0])
-        virCommandAddArgList(cmd, "-p", protocol, NULL);
+    if (iptablesRuleAddArgList(rule, "--source", networkstr, NULL) < 0)
+        goto cleanup;
+
+    if (protocol && protocol[0] &&
+        iptablesRuleAddArgList(rule, "-p", protocol, NULL) < 0)
+        goto cleanup;
 
-    virCommandAddArgList(cmd, "!", "--destination", networkstr, NULL);
+    if (iptablesRuleAddArgList(rule,
+                               "!", "--destination", networkstr, NULL) < 0)
+        goto cleanup;
 
-    if (physdev && physdev[0])
-        virCommandAddArgList(cmd, "--out-interface", physdev, NULL);
+    if (physdev && physdev[0] &&
+        iptablesRuleAddArgList(rule, "--out-interface", physdev, NULL) < 0)
+        goto cleanup;
 
     if (protocol && protocol[0]) {
         if (port->start == 0 && port->end == 0) {
@@ -885,18 +1248,23 @@ iptablesForwardMasquerade(iptablesContext *ctx,
             goto cleanup;
         }
 
-        virCommandAddArgList(cmd, "--jump", "SNAT",
-                                  "--to-source", natRangeStr, NULL);
+        if (iptablesRuleAddArgList(rule, "--jump", "SNAT",
+                                   "--to-source", natRangeStr, NULL) < 0)
+            goto cleanup;
      } else {
-         virCommandAddArgList(cmd, "--jump", "MASQUERADE", NULL);
+         if (iptablesRuleAddArgList(rule, "--jump", "MASQUERADE", NULL) < 0)
+             goto cleanup;
 
-         if (portRangeStr && portRangeStr[0])
-             virCommandAddArgList(cmd, "--to-ports", &portRangeStr[1], NULL);
+         if (portRangeStr && portRangeStr[0] &&
+             iptablesRuleAddArgList(rule, "--to-ports",
+                                    &portRangeStr[1], NULL) < 0)
+             goto cleanup;
      }
 
-    ret = virCommandRun(cmd, NULL);
+    ret = iptablesRuleApply(ctx, rule);
+    rule = NULL;
 cleanup:
-    virCommandFree(cmd);
+    iptRuleFree(rule);
     VIR_FREE(networkstr);
     VIR_FREE(addrStartStr);
     VIR_FREE(addrEndStr);
@@ -969,7 +1337,7 @@ iptablesOutputFixUdpChecksum(iptablesContext *ctx,
     snprintf(portstr, sizeof(portstr), "%d", port);
     portstr[sizeof(portstr) - 1] = '\0';
 
-    return iptablesAddRemoveRule(ctx->mangle_postrouting,
+    return iptablesAddRemoveRule(ctx, ctx->mangle_postrouting,
                                  AF_INET,
                                  action,
                                  "--out-interface", iface,
@@ -31,6 +31,10 @@ typedef struct _iptablesContext iptablesContext;
 iptablesContext *iptablesContextNew              (void);
 void             iptablesContextFree             (iptablesContext *ctx);
 
+void             iptablesTransactionBegin        (iptablesContext *ctx);
+int              iptablesTransactionCommit       (iptablesContext *ctx);
+void             iptablesTransactionAbort        (iptablesContext *ctx);
+
 int              iptablesAddTcpInput             (iptablesContext *ctx,
                                                   int family,
                                                   const char *iface,
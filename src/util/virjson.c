@@ -58,6 +58,19 @@ struct _virJSONParser {
     virJSONValuePtr head;
     virJSONParserStatePtr state;
     unsigned int nstate;
+    /* Set when parsing a stream of values, to stop the
+     * parser as soon as the top level value is complete */
+    bool stream;
+    bool done;
+};
+
+struct _virJSONStreamParser {
+#if WITH_YAJL
+    yajl_handle handle;
+#endif
+    virJSONParser parser;
+    /* Bytes of the current, incomplete value already fed to yajl */
+    size_t fed;
 };
 
 
@@ -709,6 +722,19 @@ static int virJSONParserInsertValue(virJSONParserPtr parser,
     return 0;
 }
 
+/* When parsing a stream, yajl is stopped as soon as the top
+ * level value is complete so that any data following it is
+ * left for the next value */
+static int virJSONParserCheckDone(virJSONParserPtr parser)
+{
+    if (parser->stream && !parser->nstate && parser->head) {
+        parser->done = true;
+        return 0;
+    }
+
+    return 1;
+}
+
 static int virJSONParserHandleNull(void *ctx)
 {
     virJSONParserPtr parser = ctx;
@@ -724,7 +750,7 @@ static int virJSONParserHandleNull(void *ctx)
         return 0;
     }
 
-    return 1;
+    return virJSONParserCheckDone(parser);
 }
 
 static int virJSONParserHandleBoolean(void *ctx, int boolean_)
@@ -742,7 +768,7 @@ static int virJSONParserHandleBoolean(void *ctx, int boolean_)
         return 0;
     }
 
-    return 1;
+    return virJSONParserCheckDone(parser);
 }
 
 static int virJSONParserHandleNumber(void *ctx,
@@ -768,7 +794,7 @@ static int virJSONParserHandleNumber(void *ctx,
         return 0;
     }
 
-    return 1;
+    return virJSONParserCheckDone(parser);
 }
 
 static int virJSONParserHandleString(void *ctx,
@@ -789,7 +815,7 @@ static int virJSONParserHandleString(void *ctx,
         return 0;
     }
 
-    return 1;
+    return virJSONParserCheckDone(parser);
 }
 
 static int virJSONParserHandleMapKey(void *ctx,
@@ -863,7 +889,7 @@ static int virJSONParserHandleEndMap(void *ctx)
         return 0;
     parser->nstate--;
 
-    return 1;
+    return virJSONParserCheckDone(parser);
 }
 
 static int virJSONParserHandleStartArray(void *ctx)
@@ -913,7 +939,7 @@ static int virJSONParserHandleEndArray(void *ctx)
         return 0;
     parser->nstate--;
 
-    return 1;
+    return virJSONParserCheckDone(parser);
 }
 
 static const yajl_callbacks parserCallbacks = {
@@ -931,32 +957,49 @@ static const yajl_callbacks parserCallbacks = {
 };
 
 
-/* XXX add an incremental streaming parser - yajl trivially supports it */
-virJSONValuePtr virJSONValueFromString(const char *jsonstring)
+static yajl_handle virJSONParserNewHandle(virJSONParserPtr parser)
 {
     yajl_handle hand;
-    virJSONParser parser = { NULL, NULL, 0 };
-    virJSONValuePtr ret = NULL;
 # ifndef WITH_YAJL2
     yajl_parser_config cfg = { 1, 1 };
 # endif
 
-    VIR_DEBUG("string=%s", jsonstring);
-
 # ifdef WITH_YAJL2
-    hand = yajl_alloc(&parserCallbacks, NULL, &parser);
+    hand = yajl_alloc(&parserCallbacks, NULL, parser);
     if (hand) {
         yajl_config(hand, yajl_allow_comments, 1);
         yajl_config(hand, yajl_dont_validate_strings, 0);
     }
 # else
-    hand = yajl_alloc(&parserCallbacks, &cfg, NULL, &parser);
+    hand = yajl_alloc(&parserCallbacks, &cfg, NULL, parser);
 # endif
-    if (!hand) {
+    if (!hand)
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Unable to create JSON parser"));
+
+    return hand;
+}
+
+static void virJSONParserClearState(virJSONParserPtr parser)
+{
+    int i;
+
+    for (i = 0 ; i < parser->nstate ; i++)
+        VIR_FREE(parser->state[i].key);
+    VIR_FREE(parser->state);
+    parser->nstate = 0;
+}
+
+virJSONValuePtr virJSONValueFromString(const char *jsonstring)
+{
+    yajl_handle hand;
+    virJSONParser parser = { NULL, NULL, 0, false, false };
+    virJSONValuePtr ret = NULL;
+
+    VIR_DEBUG("string=%s", jsonstring);
+
+    if (!(hand = virJSONParserNewHandle(&parser)))
         goto cleanup;
-    }
 
     if (yajl_parse(hand,
                    (const unsigned char *)jsonstring,
@@ -976,14 +1019,10 @@ virJSONValuePtr virJSONValueFromString(const char *jsonstring)
     ret = parser.head;
 
 cleanup:
-    yajl_free(hand);
+    if (hand)
+        yajl_free(hand);
 
-    if (parser.nstate) {
-        int i;
-        for (i = 0 ; i < parser.nstate ; i++) {
-            VIR_FREE(parser.state[i].key);
-        }
-    }
+    virJSONParserClearState(&parser);
 
     VIR_DEBUG("result=%p", parser.head);
 
@@ -991,6 +1030,132 @@ cleanup:
 }
 
 
+virJSONStreamParserPtr virJSONStreamParserNew(void)
+{
+    virJSONStreamParserPtr stream;
+
+    if (VIR_ALLOC(stream) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    stream->parser.stream = true;
+
+    return stream;
+}
+
+
+static void virJSONStreamParserReset(virJSONStreamParserPtr stream)
+{
+    if (stream->handle) {
+        yajl_free(stream->handle);
+        stream->handle = NULL;
+    }
+
+    virJSONValueFree(stream->parser.head);
+    stream->parser.head = NULL;
+    virJSONParserClearState(&stream->parser);
+    stream->parser.done = false;
+    stream->fed = 0;
+}
+
+
+void virJSONStreamParserFree(virJSONStreamParserPtr stream)
+{
+    if (!stream)
+        return;
+
+    virJSONStreamParserReset(stream);
+    VIR_FREE(stream);
+}
+
+
+/**
+ * virJSONStreamParserFeed:
+ * @stream: the stream parser
+ * @data: unconsumed data, starting with the incomplete value
+ * @len: length of @data
+ * @used: filled with the length of the returned value
+ * @value: filled with the first complete value found in @data
+ *
+ * Bytes which were already given to the parser by a previous call
+ * are not parsed again, so @data is expected to start at the same
+ * place each time, with new data appended to it, until a complete
+ * value is returned. On return of a value, the first @used bytes
+ * of @data have been consumed and parsing the next value starts
+ * at @data + @used.
+ *
+ * Returns 1 if a complete value was parsed, 0 if more data is
+ * needed, or -1 on error
+ */
+int virJSONStreamParserFeed(virJSONStreamParserPtr stream,
+                            const char *data,
+                            size_t len,
+                            size_t *used,
+                            virJSONValuePtr *value)
+{
+    const unsigned char *chunk;
+    size_t chunklen;
+    yajl_status rc;
+
+    *used = 0;
+    *value = NULL;
+
+    if (len < stream->fed) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("JSON stream data is shorter than already parsed"));
+        goto error;
+    }
+
+    chunk = (const unsigned char *)data + stream->fed;
+    chunklen = len - stream->fed;
+    if (!chunklen)
+        return 0;
+
+    if (!stream->handle &&
+        !(stream->handle = virJSONParserNewHandle(&stream->parser)))
+        goto error;
+
+    rc = yajl_parse(stream->handle, chunk, chunklen);
+
+    if (rc == yajl_status_client_canceled && stream->parser.done) {
+        *used = stream->fed + yajl_get_bytes_consumed(stream->handle);
+        *value = stream->parser.head;
+        stream->parser.head = NULL;
+        virJSONStreamParserReset(stream);
+        VIR_DEBUG("stream=%p used=%zu value=%p", stream, *used, *value);
+        return 1;
+    }
+
+    if (rc == yajl_status_ok
+# ifndef WITH_YAJL2
+        || rc == yajl_status_insufficient_data
+# endif
+        ) {
+        stream->fed = len;
+        return 0;
+    }
+
+    if (rc == yajl_status_client_canceled) {
+        /* One of the callbacks failed */
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot parse json stream"));
+    } else {
+        unsigned char *errstr = yajl_get_error(stream->handle, 1,
+                                               chunk, chunklen);
+
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot parse json stream: %s"),
+                       (const char*) errstr);
+        VIR_FREE(errstr);
+    }
+
+error:
+    virJSONStreamParserReset(stream);
+    return -1;
+}
+
+
 static int virJSONValueToStringOne(virJSONValuePtr object,
                                    yajl_gen g)
 {
@@ -1112,6 +1277,26 @@ virJSONValuePtr virJSONValueFromString(const char *jsonstring ATTRIBUTE_UNUSED)
                    _("No JSON parser implementation is available"));
     return NULL;
 }
+virJSONStreamParserPtr virJSONStreamParserNew(void)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("No JSON parser implementation is available"));
+    return NULL;
+}
+void virJSONStreamParserFree(virJSONStreamParserPtr stream)
+{
+    VIR_FREE(stream);
+}
+int virJSONStreamParserFeed(virJSONStreamParserPtr stream ATTRIBUTE_UNUSED,
+                            const char *data ATTRIBUTE_UNUSED,
+                            size_t len ATTRIBUTE_UNUSED,
+                            size_t *used ATTRIBUTE_UNUSED,
+                            virJSONValuePtr *value ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("No JSON parser implementation is available"));
+    return -1;
+}
 char *virJSONValueToString(virJSONValuePtr object ATTRIBUTE_UNUSED,
                            bool pretty ATTRIBUTE_UNUSED)
 {
@@ -39,6 +39,9 @@ typedef enum {
 typedef struct _virJSONValue virJSONValue;
 typedef virJSONValue *virJSONValuePtr;
 
+typedef struct _virJSONStreamParser virJSONStreamParser;
+typedef virJSONStreamParser *virJSONStreamParserPtr;
+
 typedef struct _virJSONObject virJSONObject;
 typedef virJSONObject *virJSONObjectPtr;
 
@@ -135,4 +138,12 @@ virJSONValuePtr virJSONValueFromString(const char *jsonstring);
 char *virJSONValueToString(virJSONValuePtr object,
                            bool pretty);
 
+virJSONStreamParserPtr virJSONStreamParserNew(void);
+void virJSONStreamParserFree(virJSONStreamParserPtr stream);
+int virJSONStreamParserFeed(virJSONStreamParserPtr stream,
+                            const char *data,
+                            size_t len,
+                            size_t *used,
+                            virJSONValuePtr *value);
+
 #endif /* __VIR_JSON_H_ */
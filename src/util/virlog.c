@@ -46,6 +46,7 @@
 #include "virutil.h"
 #include "virbuffer.h"
 #include "virthread.h"
+#include "viratomic.h"
 #include "virfile.h"
 #include "virtime.h"
 #include "intprops.h"
@@ -67,14 +68,76 @@ VIR_ENUM_IMPL(virLogSource, VIR_LOG_FROM_LAST,
               "library");
 
 /*
- * A logging buffer to keep some history over logs
+ * A logging buffer to keep some history over logs. Each thread appends
+ * binary records to a ring of its own without taking any lock; they are
+ * only turned into text when the buffer gets dumped.
  */
+typedef struct _virLogRecord virLogRecord;
+typedef virLogRecord *virLogRecordPtr;
+struct _virLogRecord {
+    unsigned int len;           /* length including the message */
+    unsigned int seq;           /* orders records across threads */
+    unsigned long long stamp;   /* milliseconds since the epoch */
+    const char *funcname;
+    int tid;
+    int linenr;
+    virLogPriority priority;
+    /* followed by the message, not zero terminated */
+};
+
+typedef struct _virLogRing virLogRing;
+typedef virLogRing *virLogRingPtr;
+struct _virLogRing {
+    char *buf;
+    unsigned int size;          /* a power of two */
+    volatile int head;          /* end of the newest record */
+    volatile int tail;          /* start of the oldest record */
+    volatile int inuse;         /* owned by a thread */
+    int generation;
+    virLogRingPtr next;
+};
+
+#define VIR_LOG_RING_MIN_SIZE 4096
+#define VIR_LOG_DUMP_MAX_RINGS 128
 
 static int virLogSize = 64 * 1024;
-static char *virLogBuffer = NULL;
-static int virLogLen = 0;
-static int virLogStart = 0;
-static int virLogEnd = 0;
+static virLogRingPtr virLogRings = NULL;
+static volatile int virLogGeneration = 0;
+static volatile int virLogSeq = 0;
+static virThreadLocal virLogRingLocal;
+
+/*
+ * With a writer thread running, messages are passed to the outputs
+ * asynchronously instead of by the thread emitting them
+ */
+typedef struct _virLogWriterMsg virLogWriterMsg;
+typedef virLogWriterMsg *virLogWriterMsgPtr;
+struct _virLogWriterMsg {
+    virLogSource source;
+    virLogPriority priority;
+    const char *filename;
+    int linenr;
+    const char *funcname;
+    int tid;
+    unsigned long long stamp;
+    virLogMetadataPtr metadata;
+    unsigned int flags;
+    char *str;
+    virLogWriterMsgPtr next;
+};
+
+#define VIR_LOG_WRITER_MAX_QUEUE 4096
+
+static virMutex virLogWriterMutex;
+static virCond virLogWriterCond;      /* messages queued or quitting */
+static virCond virLogWriterSpaceCond; /* queue drained */
+static virThread virLogWriterThread;
+static bool virLogWriterActive = false;
+static bool virLogWriterQuit = false;
+static pid_t virLogWriterPid = 0;
+static virLogWriterMsgPtr virLogWriterHead = NULL;
+static virLogWriterMsgPtr virLogWriterTail = NULL;
+static size_t virLogWriterLen = 0;
 
 /*
  * Filters are used to refine the rules on what to keep or drop
@@ -134,6 +197,12 @@ static void virLogOutputToFd(virLogSource src,
  */
 virMutex virLogMutex;
 
+/*
+ * Filters are checked for every message; they are only modified while
+ * also holding virLogMutex
+ */
+static virRWLock virLogFilterLock;
+
 void
 virLogLock(void)
 {
@@ -182,60 +251,162 @@ virLogPriorityString(virLogPriority lvl)
 }
 
 
+static void virLogRingRelease(void *data);
+
 static int
 virLogOnceInit(void)
 {
-    const char *pbm = NULL;
-
     if (virMutexInit(&virLogMutex) < 0)
         return -1;
 
+    if (virRWLockInit(&virLogFilterLock) < 0 ||
+        virThreadLocalInit(&virLogRingLocal, virLogRingRelease) < 0 ||
+        virMutexInit(&virLogWriterMutex) < 0 ||
+        virCondInit(&virLogWriterCond) < 0 ||
+        virCondInit(&virLogWriterSpaceCond) < 0)
+        return -1;
+
     virLogLock();
-    if (VIR_ALLOC_N(virLogBuffer, virLogSize + 1) < 0) {
-        /*
-         * The debug buffer is not a critical component, allow startup
-         * even in case of failure to allocate it in case of a
-         * configuration mistake.
-         */
-        virLogSize = 64 * 1024;
-        if (VIR_ALLOC_N(virLogBuffer, virLogSize + 1) < 0) {
-            pbm = "Failed to allocate debug buffer: deactivating debug log\n";
-            virLogSize = 0;
-        } else {
-            pbm = "Failed to allocate debug buffer: reduced to 64 kB\n";
-        }
-    }
-    virLogLen = 0;
-    virLogStart = 0;
-    virLogEnd = 0;
     virLogDefaultPriority = VIR_LOG_DEFAULT;
     virLogUnlock();
-    if (pbm)
-        VIR_WARN("%s", pbm);
     return 0;
 }
 
 VIR_ONCE_GLOBAL_INIT(virLog)
 
 
+static void
+virLogRingFree(virLogRingPtr ring)
+{
+    if (!ring)
+        return;
+
+    VIR_FREE(ring->buf);
+    VIR_FREE(ring);
+}
+
+
+/*
+ * Free the rings left behind by a buffer resize or reset which are not
+ * owned by any thread anymore. Must be called with virLogMutex held.
+ */
+static void
+virLogRingPurge(void)
+{
+    virLogRingPtr *prev = &virLogRings;
+
+    while (*prev) {
+        virLogRingPtr ring = *prev;
+
+        if (ring->generation != virLogGeneration &&
+            !virAtomicIntGet(&ring->inuse)) {
+            *prev = ring->next;
+            virLogRingFree(ring);
+        } else {
+            prev = &ring->next;
+        }
+    }
+}
+
+
+/*
+ * Called on thread exit; the history of the thread is kept and the
+ * ring can be picked up by the next thread starting to log.
+ */
+static void
+virLogRingRelease(void *data)
+{
+    virLogRingPtr ring = data;
+
+    virAtomicIntSet(&ring->inuse, 0);
+}
+
+
+/*
+ * Get the ring buffer of the calling thread, allocating it on first
+ * use. Returns NULL if the buffer is deactivated.
+ */
+static virLogRingPtr
+virLogRingGet(void)
+{
+    virLogRingPtr ring = virThreadLocalGet(&virLogRingLocal);
+    virLogRingPtr tmp;
+    unsigned int size;
+
+    if (ring && ring->generation == virAtomicIntGet(&virLogGeneration))
+        return ring;
+
+    virLogLock();
+
+    /* the buffer was resized or reset since the ring was set up */
+    if (ring) {
+        virAtomicIntSet(&ring->inuse, 0);
+        ring = NULL;
+    }
+    virLogRingPurge();
+
+    if (virLogSize <= 0)
+        goto cleanup;
+
+    for (tmp = virLogRings; tmp; tmp = tmp->next) {
+        if (tmp->generation == virLogGeneration &&
+            !virAtomicIntGet(&tmp->inuse)) {
+            ring = tmp;
+            goto cleanup;
+        }
+    }
+
+    size = VIR_LOG_RING_MIN_SIZE;
+    while (size <= (unsigned int) virLogSize / 2)
+        size *= 2;
+
+    if (VIR_ALLOC(ring) < 0)
+        goto cleanup;
+    if (VIR_ALLOC_N(ring->buf, size) < 0) {
+        VIR_FREE(ring);
+        goto cleanup;
+    }
+    ring->size = size;
+    ring->generation = virLogGeneration;
+    ring->next = virLogRings;
+    virLogRings = ring;
+
+cleanup:
+    if (ring)
+        virAtomicIntSet(&ring->inuse, 1);
+    virLogUnlock();
+
+    ignore_value(virThreadLocalSet(&virLogRingLocal, ring));
+    return ring;
+}
+
+
+/*
+ * Drop all the rings; each thread sets up a new one on its next message.
+ * Must be called with virLogMutex held.
+ */
+static void
+virLogRingReset(void)
+{
+    virAtomicIntInc(&virLogGeneration);
+    virLogRingPurge();
+}
+
+
 /**
  * virLogSetBufferSize:
  * @size: size of the buffer in kilobytes or <= 0 to deactivate
  *
  * Dynamically set the size or deactivate the logging buffer used to keep
- * a trace of all recent debug output. Note that the content of the buffer
- * is lost if it gets reallocated.
+ * a trace of all recent debug output. Every thread logging messages gets
+ * a buffer of that size, rounded down to a power of two. Note that the
+ * content of the buffer is lost if it gets reallocated.
  *
  * Return -1 in case of failure or 0 in case of success
  */
 int
 virLogSetBufferSize(int size)
 {
-    int ret = 0;
-    int oldsize;
-    char *oldLogBuffer;
-    const char *pbm = NULL;
-
     if (size < 0)
         size = 0;
 
@@ -243,37 +414,19 @@ virLogSetBufferSize(int size)
         return -1;
 
     if (size * 1024 == virLogSize)
-        return ret;
-
-    virLogLock();
-
-    oldsize = virLogSize;
-    oldLogBuffer = virLogBuffer;
+        return 0;
 
     if (INT_MAX / 1024 <= size) {
-        pbm = "Requested log size of %d kB too large\n";
-        ret = -1;
-        goto error;
+        VIR_ERROR("Requested log size of %d kB too large", size);
+        return -1;
     }
 
+    virLogLock();
     virLogSize = size * 1024;
-    if (VIR_ALLOC_N(virLogBuffer, virLogSize + 1) < 0) {
-        pbm = "Failed to allocate debug buffer of %d kB\n";
-        virLogBuffer = oldLogBuffer;
-        virLogSize = oldsize;
-        ret = -1;
-        goto error;
-    }
-    VIR_FREE(oldLogBuffer);
-    virLogLen = 0;
-    virLogStart = 0;
-    virLogEnd = 0;
-
-error:
+    virLogRingReset();
     virLogUnlock();
-    if (pbm)
-        VIR_ERROR(pbm, size);
-    return ret;
+
+    return 0;
 }
 
 
@@ -293,54 +446,85 @@ virLogReset(void)
     virLogLock();
     virLogResetFilters();
     virLogResetOutputs();
-    virLogLen = 0;
-    virLogStart = 0;
-    virLogEnd = 0;
+    virLogRingReset();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
     virLogUnlock();
     return 0;
 }
 
 
+static void
+virLogRingCopyIn(virLogRingPtr ring, unsigned int pos,
+                 const void *data, size_t len)
+{
+    size_t off = pos & (ring->size - 1);
+    size_t tmp = MIN(len, ring->size - off);
+
+    memcpy(ring->buf + off, data, tmp);
+    memcpy(ring->buf, (const char *)data + tmp, len - tmp);
+}
+
+
+static void
+virLogRingCopyOut(virLogRingPtr ring, unsigned int pos,
+                  void *data, size_t len)
+{
+    size_t off = pos & (ring->size - 1);
+    size_t tmp = MIN(len, ring->size - off);
+
+    memcpy(data, ring->buf + off, tmp);
+    memcpy((char *)data + tmp, ring->buf, len - tmp);
+}
+
+
 /*
- * Store a string in the ring buffer
+ * Store a message in the ring buffer of the calling thread. Only this
+ * thread writes to the ring, readers cope with concurrent updates.
  */
 static void
-virLogStr(const char *str)
+virLogStr(virLogPriority priority,
+          const char *funcname,
+          int linenr,
+          unsigned long long stamp,
+          const char *str)
 {
-    int tmp;
-    int len;
+    virLogRingPtr ring;
+    virLogRecord rec;
+    unsigned int head, tail;
+    size_t len;
 
-    if ((str == NULL) || (virLogBuffer == NULL) || (virLogSize <= 0))
+    if ((str == NULL) || !(ring = virLogRingGet()))
         return;
+
     len = strlen(str);
-    if (len >= virLogSize)
-        return;
+    if (len > ring->size - sizeof(rec))
+        len = ring->size - sizeof(rec);
+
+    rec.len = sizeof(rec) + len;
+    rec.seq = virAtomicIntInc(&virLogSeq);
+    rec.stamp = stamp;
+    rec.funcname = funcname;
+    rec.tid = virThreadSelfID();
+    rec.linenr = linenr;
+    rec.priority = priority;
 
     /*
-     * copy the data and reset the end, we cycle over the end of the buffer
-     */
-    if (virLogEnd + len >= virLogSize) {
-        tmp = virLogSize - virLogEnd;
-        memcpy(&virLogBuffer[virLogEnd], str, tmp);
-        memcpy(&virLogBuffer[0], &str[tmp], len - tmp);
-        virLogEnd = len - tmp;
-    } else {
-        memcpy(&virLogBuffer[virLogEnd], str, len);
-        virLogEnd += len;
-    }
-    virLogBuffer[virLogEnd] = 0;
-    /*
-     * Update the log length, and if full move the start index
+     * drop the oldest records until the new one fits, and only then
+     * overwrite them
      */
-    virLogLen += len;
-    if (virLogLen > virLogSize) {
-        tmp = virLogLen - virLogSize;
-        virLogLen = virLogSize;
-        virLogStart += tmp;
-        if (virLogStart >= virLogSize)
-            virLogStart -= virLogSize;
+    head = ring->head;
+    tail = ring->tail;
+    while (head - tail + rec.len > ring->size) {
+        virLogRecord old;
+
+        virLogRingCopyOut(ring, tail, &old, sizeof(old));
+        tail += old.len;
     }
+    virAtomicIntSet(&ring->tail, tail);
+
+    virLogRingCopyIn(ring, head, &rec, sizeof(rec));
+    virLogRingCopyIn(ring, head + sizeof(rec), str, len);
+    virAtomicIntSet(&ring->head, head + rec.len);
 }
 
 
@@ -367,6 +551,70 @@ virLogDumpAllFD(const char *msg, int len)
 }
 
 
+typedef struct _virLogDumpCursor virLogDumpCursor;
+typedef virLogDumpCursor *virLogDumpCursorPtr;
+struct _virLogDumpCursor {
+    virLogRingPtr ring;
+    unsigned int pos;
+    unsigned int head;
+    virLogRecord rec;
+};
+
+
+/*
+ * Read the header of the record at the cursor position, returns false
+ * when the end of the ring or a bogus record is reached.
+ */
+static bool
+virLogDumpCursorLoad(virLogDumpCursorPtr cur)
+{
+    if (cur->head - cur->pos < sizeof(cur->rec))
+        return false;
+
+    virLogRingCopyOut(cur->ring, cur->pos, &cur->rec, sizeof(cur->rec));
+
+    return cur->rec.len >= sizeof(cur->rec) &&
+           cur->rec.len <= cur->head - cur->pos;
+}
+
+
+/*
+ * Format the record at the cursor position, this must be async signal
+ * safe.
+ */
+static void
+virLogDumpRecord(virLogDumpCursorPtr cur)
+{
+    virLogRingPtr ring = cur->ring;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    char prefix[256];
+    size_t off = (cur->pos + sizeof(cur->rec)) & (ring->size - 1);
+    size_t len = cur->rec.len - sizeof(cur->rec);
+    size_t tmp = MIN(len, ring->size - off);
+
+    if (virTimeStringThenRaw(cur->rec.stamp, timestamp) < 0)
+        timestamp[0] = '\0';
+
+    if (cur->rec.funcname != NULL) {
+        snprintf(prefix, sizeof(prefix), "%s: %d: %s : %s:%d : ",
+                 timestamp, cur->rec.tid,
+                 virLogPriorityString(cur->rec.priority),
+                 cur->rec.funcname, cur->rec.linenr);
+    } else {
+        snprintf(prefix, sizeof(prefix), "%s: %d: %s : ",
+                 timestamp, cur->rec.tid,
+                 virLogPriorityString(cur->rec.priority));
+    }
+
+    virLogDumpAllFD(prefix, -1);
+    if (tmp > 0)
+        virLogDumpAllFD(ring->buf + off, tmp);
+    if (len > tmp)
+        virLogDumpAllFD(ring->buf, len - tmp);
+    virLogDumpAllFD("\n", 1);
+}
+
+
 /**
  * virLogEmergencyDumpAll:
  * @signum: the signal number
@@ -379,8 +627,10 @@ virLogDumpAllFD(const char *msg, int len)
 void
 virLogEmergencyDumpAll(int signum)
 {
-    int len;
-    int oldLogStart, oldLogLen;
+    virLogDumpCursor rings[VIR_LOG_DUMP_MAX_RINGS];
+    virLogRingPtr ring;
+    int nrings = 0;
+    int i;
 
     switch (signum) {
 #ifdef SIGFPE
@@ -417,7 +667,7 @@ virLogEmergencyDumpAll(int signum)
             virLogDumpAllFD("Caught unexpected signal", -1);
             break;
     }
-    if ((virLogBuffer == NULL) || (virLogSize <= 0)) {
+    if (virLogRings == NULL) {
         virLogDumpAllFD(" internal log buffer deactivated\n", -1);
         return;
     }
@@ -426,33 +676,43 @@ virLogEmergencyDumpAll(int signum)
     virLogDumpAllFD("\n\n    ====== start of log =====\n\n", -1);
 
     /*
-     * Since we can't lock the buffer safely from a signal handler
-     * we mark it as empty in case of concurrent access, and proceed
-     * with the data, at worse we will output something a bit weird
-     * if another thread start logging messages at the same time.
-     * Note that virLogStr() uses virLogEnd for the computations and
-     * writes to the buffer and only then updates virLogLen and virLogStart
-     * so it's best to reset it first.
+     * Since we can't lock the buffers safely from a signal handler we
+     * merge the records of all threads in the order they were logged
+     * while they might still be written to. Records are validated before
+     * being used; at worse we will output something a bit weird if other
+     * threads keep logging messages at the same time.
      */
-    oldLogStart = virLogStart;
-    oldLogLen = virLogLen;
-    virLogEnd = 0;
-    virLogLen = 0;
-    virLogStart = 0;
-
-    while (oldLogLen > 0) {
-        if (oldLogStart + oldLogLen < virLogSize) {
-            virLogBuffer[oldLogStart + oldLogLen] = 0;
-            virLogDumpAllFD(&virLogBuffer[oldLogStart], oldLogLen);
-            oldLogStart += oldLogLen;
-            oldLogLen = 0;
-        } else {
-            len = virLogSize - oldLogStart;
-            virLogBuffer[virLogSize] = 0;
-            virLogDumpAllFD(&virLogBuffer[oldLogStart], len);
-            oldLogLen -= len;
-            oldLogStart = 0;
+    for (ring = virLogRings;
+         ring && nrings < VIR_LOG_DUMP_MAX_RINGS;
+         ring = ring->next) {
+        /* left over from before a resize or reset, and still owned
+         * by a thread which hasn't logged since */
+        if (ring->generation != virLogGeneration)
+            continue;
+        rings[nrings].ring = ring;
+        rings[nrings].head = virAtomicIntGet(&ring->head);
+        rings[nrings].pos = virAtomicIntGet(&ring->tail);
+        if (virLogDumpCursorLoad(&rings[nrings]))
+            nrings++;
+    }
+
+    for (;;) {
+        virLogDumpCursorPtr next = NULL;
+
+        for (i = 0; i < nrings; i++) {
+            if (!rings[i].ring)
+                continue;
+            if (!next || (int)(rings[i].rec.seq - next->rec.seq) < 0)
+                next = &rings[i];
         }
+        if (!next)
+            break;
+
+        virLogDumpRecord(next);
+
+        next->pos += next->rec.len;
+        if (!virLogDumpCursorLoad(next))
+            next->ring = NULL;
     }
     virLogDumpAllFD("\n\n     ====== end of log =====\n\n", -1);
 }
@@ -495,10 +755,12 @@ virLogResetFilters(void)
 {
     int i;
 
+    virRWLockWrite(&virLogFilterLock);
     for (i = 0; i < virLogNbFilters;i++)
         VIR_FREE(virLogFilters[i].match);
     VIR_FREE(virLogFilters);
     virLogNbFilters = 0;
+    virRWLockUnlock(&virLogFilterLock);
     return i;
 }
 
@@ -531,6 +793,7 @@ virLogDefineFilter(const char *match,
         return -1;
 
     virLogLock();
+    virRWLockWrite(&virLogFilterLock);
     for (i = 0;i < virLogNbFilters;i++) {
         if (STREQ(virLogFilters[i].match, match)) {
             virLogFilters[i].priority = priority;
@@ -554,6 +817,7 @@ virLogDefineFilter(const char *match,
     virLogFilters[i].flags = flags;
     virLogNbFilters++;
 cleanup:
+    virRWLockUnlock(&virLogFilterLock);
     virLogUnlock();
     return i;
 }
@@ -576,7 +840,7 @@ virLogFiltersCheck(const char *input,
     int ret = 0;
     int i;
 
-    virLogLock();
+    virRWLockRead(&virLogFilterLock);
     for (i = 0;i < virLogNbFilters;i++) {
         if (strstr(input, virLogFilters[i].match)) {
             ret = virLogFilters[i].priority;
@@ -584,7 +848,7 @@ virLogFiltersCheck(const char *input,
             break;
         }
     }
-    virLogUnlock();
+    virRWLockUnlock(&virLogFilterLock);
     return ret;
 }
 
@@ -674,6 +938,7 @@ cleanup:
 
 static int
 virLogFormatString(char **msg,
+                   int tid,
                    int linenr,
                    const char *funcname,
                    virLogPriority priority,
@@ -690,11 +955,11 @@ virLogFormatString(char **msg,
      */
     if ((funcname != NULL)) {
         ret = virAsprintf(msg, "%d: %s : %s:%d : %s\n",
-                          virThreadSelfID(), virLogPriorityString(priority),
+                          tid, virLogPriorityString(priority),
                           funcname, linenr, str);
     } else {
         ret = virAsprintf(msg, "%d: %s : %s\n",
-                          virThreadSelfID(), virLogPriorityString(priority),
+                          tid, virLogPriorityString(priority),
                           str);
     }
     return ret;
@@ -719,7 +984,8 @@ virLogVersionString(const char **rawmsg,
 #endif
 
     *rawmsg = LOG_VERSION_STRING;
-    return virLogFormatString(msg, 0, NULL, VIR_LOG_INFO, LOG_VERSION_STRING);
+    return virLogFormatString(msg, virThreadSelfID(), 0, NULL, VIR_LOG_INFO,
+                              LOG_VERSION_STRING);
 }
 
 
@@ -755,6 +1021,297 @@ virLogMessage(virLogSource source,
 }
 
 
+/*
+ * Pass a message to the outputs defined, if none use stderr.
+ */
+static void
+virLogOutputMessage(virLogSource source,
+                    virLogPriority priority,
+                    const char *filename,
+                    int linenr,
+                    const char *funcname,
+                    int tid,
+                    unsigned long long stamp,
+                    virLogMetadataPtr metadata,
+                    unsigned int filterflags,
+                    const char *str)
+{
+    static bool logVersionStderr = true;
+    char *msg = NULL;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    int i;
+
+    if (virLogFormatString(&msg, tid, linenr, funcname, priority, str) < 0)
+        return;
+
+    if (virTimeStringThenRaw(stamp, timestamp) < 0)
+        timestamp[0] = '\0';
+
+    /*
+     * NOTE: the locking is a single point of contention for multiple
+     *       threads, but avoid intermixing. Maybe set up locks per output
+     *       to improve paralellism.
+     */
+    virLogLock();
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (priority >= virLogOutputs[i].priority) {
+            if (virLogOutputs[i].logVersion) {
+                const char *rawver;
+                char *ver = NULL;
+                if (virLogVersionString(&rawver, &ver) >= 0)
+                    virLogOutputs[i].f(VIR_LOG_FROM_FILE, VIR_LOG_INFO,
+                                       __FILE__, __LINE__, __func__,
+                                       timestamp, NULL, 0, rawver, ver,
+                                       virLogOutputs[i].data);
+                VIR_FREE(ver);
+                virLogOutputs[i].logVersion = false;
+            }
+            virLogOutputs[i].f(source, priority,
+                               filename, linenr, funcname,
+                               timestamp, metadata, filterflags,
+                               str, msg, virLogOutputs[i].data);
+        }
+    }
+    if ((virLogNbOutputs == 0) && (source != VIR_LOG_FROM_ERROR)) {
+        if (logVersionStderr) {
+            const char *rawver;
+            char *ver = NULL;
+            if (virLogVersionString(&rawver, &ver) >= 0)
+                virLogOutputToFd(VIR_LOG_FROM_FILE, VIR_LOG_INFO,
+                                 __FILE__, __LINE__, __func__,
+                                 timestamp, NULL, 0, rawver, ver,
+                                 (void *) STDERR_FILENO);
+            VIR_FREE(ver);
+            logVersionStderr = false;
+        }
+        virLogOutputToFd(source, priority,
+                         filename, linenr, funcname,
+                         timestamp, metadata, filterflags,
+                         str, msg, (void *) STDERR_FILENO);
+    }
+    virLogUnlock();
+
+    VIR_FREE(msg);
+}
+
+
+static void
+virLogWriterMsgFree(virLogWriterMsgPtr msg)
+{
+    int i;
+
+    if (!msg)
+        return;
+
+    if (msg->metadata) {
+        for (i = 0; msg->metadata[i].key; i++)
+            VIR_FREE(msg->metadata[i].s);
+        VIR_FREE(msg->metadata);
+    }
+    VIR_FREE(msg->str);
+    VIR_FREE(msg);
+}
+
+
+static int
+virLogWriterMsgCopyMetadata(virLogWriterMsgPtr msg,
+                            virLogMetadataPtr metadata)
+{
+    int i, n = 0;
+
+    if (!metadata)
+        return 0;
+
+    while (metadata[n].key)
+        n++;
+
+    if (VIR_ALLOC_N(msg->metadata, n + 1) < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        msg->metadata[i].key = metadata[i].key;
+        msg->metadata[i].i = metadata[i].i;
+        if (metadata[i].s &&
+            !(msg->metadata[i].s = strdup(metadata[i].s)))
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Queue a message for the writer thread. On success the writer takes
+ * ownership of @str. Returns -1 if the message has to be passed to the
+ * outputs by the caller.
+ */
+static int
+virLogWriterQueue(virLogSource source,
+                  virLogPriority priority,
+                  const char *filename,
+                  int linenr,
+                  const char *funcname,
+                  unsigned long long stamp,
+                  virLogMetadataPtr metadata,
+                  unsigned int filterflags,
+                  char **str)
+{
+    virLogWriterMsgPtr msg;
+
+    /* don't touch the writer state in a child process after fork() */
+    if (virLogWriterPid != getpid() ||
+        virThreadIsSelf(&virLogWriterThread))
+        return -1;
+
+    /* the stack trace has to be taken by the thread emitting the message */
+    if (filterflags & VIR_LOG_STACK_TRACE)
+        return -1;
+
+    if (VIR_ALLOC(msg) < 0)
+        return -1;
+
+    msg->source = source;
+    msg->priority = priority;
+    msg->filename = filename;
+    msg->linenr = linenr;
+    msg->funcname = funcname;
+    msg->tid = virThreadSelfID();
+    msg->stamp = stamp;
+    msg->flags = filterflags;
+    if (virLogWriterMsgCopyMetadata(msg, metadata) < 0) {
+        virLogWriterMsgFree(msg);
+        return -1;
+    }
+
+    virMutexLock(&virLogWriterMutex);
+    while (virLogWriterActive &&
+           virLogWriterLen >= VIR_LOG_WRITER_MAX_QUEUE)
+        ignore_value(virCondWait(&virLogWriterSpaceCond, &virLogWriterMutex));
+
+    if (!virLogWriterActive) {
+        virMutexUnlock(&virLogWriterMutex);
+        virLogWriterMsgFree(msg);
+        return -1;
+    }
+
+    msg->str = *str;
+    *str = NULL;
+    if (virLogWriterTail)
+        virLogWriterTail->next = msg;
+    else
+        virLogWriterHead = msg;
+    virLogWriterTail = msg;
+    virLogWriterLen++;
+    virCondSignal(&virLogWriterCond);
+    virMutexUnlock(&virLogWriterMutex);
+
+    return 0;
+}
+
+
+static void
+virLogWriterWorker(void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&virLogWriterMutex);
+    for (;;) {
+        virLogWriterMsgPtr msg;
+
+        while (!virLogWriterHead && !virLogWriterQuit)
+            ignore_value(virCondWait(&virLogWriterCond, &virLogWriterMutex));
+
+        if (!virLogWriterHead)
+            break;
+
+        msg = virLogWriterHead;
+        virLogWriterHead = virLogWriterTail = NULL;
+        virLogWriterLen = 0;
+        virCondBroadcast(&virLogWriterSpaceCond);
+        virMutexUnlock(&virLogWriterMutex);
+
+        while (msg) {
+            virLogWriterMsgPtr next = msg->next;
+
+            virLogOutputMessage(msg->source, msg->priority,
+                                msg->filename, msg->linenr, msg->funcname,
+                                msg->tid, msg->stamp, msg->metadata,
+                                msg->flags, msg->str);
+            virLogWriterMsgFree(msg);
+            msg = next;
+        }
+
+        virMutexLock(&virLogWriterMutex);
+    }
+    virMutexUnlock(&virLogWriterMutex);
+}
+
+
+/**
+ * virLogStartWriter:
+ *
+ * Start a thread passing the logged messages to the outputs, so that
+ * the threads emitting them don't have to wait for the outputs. Must be
+ * called again after a fork() for the child to use a writer thread.
+ *
+ * Returns 0 if successful, and -1 in case or error
+ */
+int
+virLogStartWriter(void)
+{
+    int ret = -1;
+
+    if (virLogInitialize() < 0)
+        return -1;
+
+    virMutexLock(&virLogWriterMutex);
+    if (virLogWriterActive) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    virLogWriterQuit = false;
+    if (virThreadCreate(&virLogWriterThread, true,
+                        virLogWriterWorker, NULL) < 0)
+        goto cleanup;
+
+    virLogWriterActive = true;
+    virLogWriterPid = getpid();
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&virLogWriterMutex);
+    return ret;
+}
+
+
+/**
+ * virLogStopWriter:
+ *
+ * Pass all queued messages to the outputs and stop the writer thread;
+ * messages are then passed to the outputs by the thread emitting them.
+ */
+void
+virLogStopWriter(void)
+{
+    if (virLogInitialize() < 0)
+        return;
+
+    virMutexLock(&virLogWriterMutex);
+    if (!virLogWriterActive || virLogWriterPid != getpid()) {
+        virMutexUnlock(&virLogWriterMutex);
+        return;
+    }
+
+    virLogWriterActive = false;
+    virLogWriterPid = 0;
+    virLogWriterQuit = true;
+    virCondSignal(&virLogWriterCond);
+    virCondBroadcast(&virLogWriterSpaceCond);
+    virMutexUnlock(&virLogWriterMutex);
+
+    virThreadJoin(&virLogWriterThread);
+}
+
+
 /**
  * virLogVMessage:
  * @source: where is that message coming from
@@ -779,11 +1336,9 @@ virLogVMessage(virLogSource source,
                const char *fmt,
                va_list vargs)
 {
-    static bool logVersionStderr = true;
     char *str = NULL;
-    char *msg = NULL;
-    char timestamp[VIR_TIME_STRING_BUFLEN];
-    int fprio, i, ret;
+    unsigned long long stamp;
+    int fprio;
     int saved_errno = errno;
     int emit = 1;
     unsigned int filterflags = 0;
@@ -805,80 +1360,37 @@ virLogVMessage(virLogSource source,
         emit = 0;
     }
 
-    if ((emit == 0) && ((virLogBuffer == NULL) || (virLogSize <= 0)))
+    if ((emit == 0) && (virLogSize <= 0))
         goto cleanup;
 
     /*
-     * serialize the error message, add level and timestamp
+     * serialize the error message; level and timestamp are only
+     * formatted once the message is output or the history dumped
      */
     if (virVasprintf(&str, fmt, vargs) < 0) {
         goto cleanup;
     }
 
-    ret = virLogFormatString(&msg, linenr, funcname, priority, str);
-    if (ret < 0)
-        goto cleanup;
-
-    if (virTimeStringNowRaw(timestamp) < 0)
-        timestamp[0] = '\0';
+    if (virTimeMillisNowRaw(&stamp) < 0)
+        stamp = 0;
 
     /*
      * Log based on defaults, first store in the history buffer,
-     * then if emit push the message on the outputs defined, if none
-     * use stderr.
-     * NOTE: the locking is a single point of contention for multiple
-     *       threads, but avoid intermixing. Maybe set up locks per output
-     *       to improve paralellism.
+     * then if emit push the message on the outputs defined.
      */
-    virLogLock();
-    virLogStr(timestamp);
-    virLogStr(msg);
-    virLogUnlock();
+    if (virLogSize > 0)
+        virLogStr(priority, funcname, linenr, stamp, str);
     if (emit == 0)
         goto cleanup;
 
-    virLogLock();
-    for (i = 0; i < virLogNbOutputs; i++) {
-        if (priority >= virLogOutputs[i].priority) {
-            if (virLogOutputs[i].logVersion) {
-                const char *rawver;
-                char *ver = NULL;
-                if (virLogVersionString(&rawver, &ver) >= 0)
-                    virLogOutputs[i].f(VIR_LOG_FROM_FILE, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, rawver, ver,
-                                       virLogOutputs[i].data);
-                VIR_FREE(ver);
-                virLogOutputs[i].logVersion = false;
-            }
-            virLogOutputs[i].f(source, priority,
-                               filename, linenr, funcname,
-                               timestamp, metadata, filterflags,
-                               str, msg, virLogOutputs[i].data);
-        }
-    }
-    if ((virLogNbOutputs == 0) && (source != VIR_LOG_FROM_ERROR)) {
-        if (logVersionStderr) {
-            const char *rawver;
-            char *ver = NULL;
-            if (virLogVersionString(&rawver, &ver) >= 0)
-                virLogOutputToFd(VIR_LOG_FROM_FILE, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, rawver, ver,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(ver);
-            logVersionStderr = false;
-        }
-        virLogOutputToFd(source, priority,
-                         filename, linenr, funcname,
-                         timestamp, metadata, filterflags,
-                         str, msg, (void *) STDERR_FILENO);
-    }
-    virLogUnlock();
+    if (virLogWriterQueue(source, priority, filename, linenr, funcname,
+                          stamp, metadata, filterflags, &str) < 0)
+        virLogOutputMessage(source, priority, filename, linenr, funcname,
+                            virThreadSelfID(), stamp, metadata, filterflags,
+                            str);
 
 cleanup:
     VIR_FREE(str);
-    VIR_FREE(msg);
     errno = saved_errno;
 }
 
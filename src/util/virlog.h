@@ -187,5 +187,7 @@ extern void virLogVMessage(virLogSource src,
                            const char *fmt,
                            va_list vargs) ATTRIBUTE_FMT_PRINTF(7, 0);
 extern int virLogSetBufferSize(int size);
+extern int virLogStartWriter(void);
+extern void virLogStopWriter(void);
 extern void virLogEmergencyDumpAll(int signum);
 #endif
@@ -0,0 +1,369 @@
+/*
+ * virshmstate.c: shared memory snapshot of domain state
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#include "virshmstate.h"
+#include "viratomic.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virtime.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* How often a reader retries while the publisher is busy
+ * before it gives up and lets the caller use RPC instead */
+#define VIR_SHM_STATE_RETRIES 1000
+
+static int
+virShmStateCompareDomains(const void *a, const void *b)
+{
+    const virShmStateDomain *da = a;
+    const virShmStateDomain *db = b;
+
+    return memcmp(da->uuid, db->uuid, VIR_UUID_BUFLEN);
+}
+
+static int
+virShmStateCompareUUID(const void *key, const void *elem)
+{
+    const virShmStateDomain *dom = elem;
+
+    return memcmp(key, dom->uuid, VIR_UUID_BUFLEN);
+}
+
+static bool
+virShmStateIsFresh(unsigned long long updated)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return false;
+
+    return updated <= now && now - updated <= VIR_SHM_STATE_MAX_AGE;
+}
+
+#if HAVE_MMAP
+
+/**
+ * virShmStateNew:
+ * @dir: directory to create the backing file in
+ * @rofd: filled with a read-only descriptor of the backing file
+ *
+ * Create an empty snapshot for a publisher. The backing file is
+ * unlinked straight away, so @rofd, which can be handed out to
+ * clients without letting them modify the snapshot, is the only
+ * way to reach it. Release the mapping with virShmStateClose.
+ *
+ * Returns the writable mapping, or NULL on error
+ */
+virShmStatePtr
+virShmStateNew(const char *dir, int *rofd)
+{
+    virShmStatePtr state = NULL;
+    char *path = NULL;
+    int fd = -1;
+    int readfd = -1;
+
+    if (virAsprintf(&path, "%s/state-shm.XXXXXX", dir) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if ((fd = mkostemp(path, O_CLOEXEC)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot create state file in %s"), dir);
+        goto cleanup;
+    }
+
+    readfd = open(path, O_RDONLY | O_CLOEXEC);
+    unlink(path);
+    if (readfd < 0) {
+        virReportSystemError(errno,
+                             _("cannot open state file %s"), path);
+        goto cleanup;
+    }
+
+    if (ftruncate(fd, sizeof(*state)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot resize state file %s"), path);
+        goto cleanup;
+    }
+
+    state = mmap(NULL, sizeof(*state), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+    if (state == MAP_FAILED) {
+        virReportSystemError(errno,
+                             _("cannot map state file %s"), path);
+        state = NULL;
+        goto cleanup;
+    }
+
+    state->maxDomains = VIR_SHM_STATE_MAX_DOMAINS;
+    state->version = VIR_SHM_STATE_VERSION;
+    state->magic = VIR_SHM_STATE_MAGIC;
+
+    *rofd = readfd;
+    readfd = -1;
+
+cleanup:
+    VIR_FORCE_CLOSE(readfd);
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(path);
+    return state;
+}
+
+
+/**
+ * virShmStateOpen:
+ * @fd: read-only descriptor obtained from a publisher
+ *
+ * Map a snapshot created by virShmStateNew for reading. The
+ * descriptor may be closed afterwards.
+ *
+ * Returns the mapping, or NULL on error
+ */
+virShmStatePtr
+virShmStateOpen(int fd)
+{
+    virShmStatePtr state;
+    struct stat sb;
+
+    if (fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, "%s", _("cannot stat state file"));
+        return NULL;
+    }
+
+    if ((unsigned long long) sb.st_size < sizeof(*state)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("state file too small: %llu bytes"),
+                       (unsigned long long) sb.st_size);
+        return NULL;
+    }
+
+    state = mmap(NULL, sizeof(*state), PROT_READ, MAP_SHARED, fd, 0);
+    if (state == MAP_FAILED) {
+        virReportSystemError(errno, "%s", _("cannot map state file"));
+        return NULL;
+    }
+
+    if (state->magic != VIR_SHM_STATE_MAGIC ||
+        state->version != VIR_SHM_STATE_VERSION ||
+        state->maxDomains != VIR_SHM_STATE_MAX_DOMAINS) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unsupported state file version %u"),
+                       state->version);
+        munmap(state, sizeof(*state));
+        return NULL;
+    }
+
+    return state;
+}
+
+
+void
+virShmStateClose(virShmStatePtr state)
+{
+    if (!state)
+        return;
+
+    munmap(state, sizeof(*state));
+}
+
+#else /* !HAVE_MMAP */
+
+virShmStatePtr
+virShmStateNew(const char *dir ATTRIBUTE_UNUSED,
+               int *rofd ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("shared memory state is not supported on this platform"));
+    return NULL;
+}
+
+
+virShmStatePtr
+virShmStateOpen(int fd ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("shared memory state is not supported on this platform"));
+    return NULL;
+}
+
+
+void
+virShmStateClose(virShmStatePtr state ATTRIBUTE_UNUSED)
+{
+}
+
+#endif /* !HAVE_MMAP */
+
+
+/**
+ * virShmStatePublish:
+ * @state: the writable mapping from virShmStateNew
+ * @domains: the current state of all domains
+ * @ndomains: number of entries in @domains
+ *
+ * Replace the snapshot with @domains, which is sorted in place.
+ * There must be only a single publisher for each snapshot, readers
+ * never block it.
+ */
+void
+virShmStatePublish(virShmStatePtr state,
+                   virShmStateDomainPtr domains,
+                   size_t ndomains)
+{
+    unsigned long long now = 0;
+    unsigned int flags = 0;
+
+    if (ndomains > VIR_SHM_STATE_MAX_DOMAINS) {
+        VIR_WARN("Only publishing state of %d out of %zu domains",
+                 VIR_SHM_STATE_MAX_DOMAINS, ndomains);
+        flags |= VIR_SHM_STATE_TRUNCATED;
+        ndomains = VIR_SHM_STATE_MAX_DOMAINS;
+    }
+
+    if (ndomains)
+        qsort(domains, ndomains, sizeof(*domains), virShmStateCompareDomains);
+
+    ignore_value(virTimeMillisNow(&now));
+
+    virAtomicIntInc(&state->seq);
+
+    state->flags = flags;
+    state->ndomains = ndomains;
+    if (ndomains)
+        memcpy(state->domains, domains, ndomains * sizeof(*domains));
+    state->updated = now;
+
+    virAtomicIntInc(&state->seq);
+}
+
+
+/**
+ * virShmStateGetDomain:
+ * @state: the snapshot
+ * @uuid: UUID of the domain to look up
+ * @domain: filled with a consistent copy of the domain's state
+ *
+ * Never reports an error, a return value of 0 just means the
+ * caller needs to ask the daemon instead.
+ *
+ * Returns 1 if @domain was filled, 0 if the snapshot is stale,
+ * busy, or does not know the domain
+ */
+int
+virShmStateGetDomain(virShmStatePtr state,
+                     const unsigned char *uuid,
+                     virShmStateDomainPtr domain)
+{
+    size_t tries;
+
+    for (tries = 0 ; tries < VIR_SHM_STATE_RETRIES ; tries++) {
+        virShmStateDomainPtr found;
+        unsigned long long updated;
+        size_t ndomains;
+        int seq;
+
+        seq = virAtomicIntGet(&state->seq);
+        if (seq & 1)
+            continue;
+        /* Re-reading also orders the copy below after the first read */
+        if (virAtomicIntGet(&state->seq) != seq)
+            continue;
+
+        updated = state->updated;
+        ndomains = MIN(state->ndomains, VIR_SHM_STATE_MAX_DOMAINS);
+        found = bsearch(uuid, state->domains, ndomains, sizeof(*found),
+                        virShmStateCompareUUID);
+        if (found)
+            memcpy(domain, found, sizeof(*domain));
+
+        if (virAtomicIntGet(&state->seq) != seq)
+            continue;
+
+        return found && virShmStateIsFresh(updated) ? 1 : 0;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virShmStateNumOfDomains:
+ * @state: the snapshot
+ *
+ * Never reports an error, see virShmStateGetDomain.
+ *
+ * Returns the number of active domains, or -1 if the snapshot
+ * cannot answer
+ */
+int
+virShmStateNumOfDomains(virShmStatePtr state)
+{
+    size_t tries;
+
+    for (tries = 0 ; tries < VIR_SHM_STATE_RETRIES ; tries++) {
+        unsigned long long updated;
+        unsigned int flags;
+        size_t ndomains;
+        size_t i;
+        int seq;
+        int active = 0;
+
+        seq = virAtomicIntGet(&state->seq);
+        if (seq & 1)
+            continue;
+        if (virAtomicIntGet(&state->seq) != seq)
+            continue;
+
+        updated = state->updated;
+        flags = state->flags;
+        ndomains = MIN(state->ndomains, VIR_SHM_STATE_MAX_DOMAINS);
+        for (i = 0 ; i < ndomains ; i++) {
+            if (state->domains[i].id >= 0)
+                active++;
+        }
+
+        if (virAtomicIntGet(&state->seq) != seq)
+            continue;
+
+        if ((flags & VIR_SHM_STATE_TRUNCATED) ||
+            !virShmStateIsFresh(updated))
+            return -1;
+        return active;
+    }
+
+    return -1;
+}
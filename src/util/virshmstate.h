@@ -0,0 +1,100 @@
+/*
+ * virshmstate.h: shared memory snapshot of domain state
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_SHM_STATE_H__
+# define __VIR_SHM_STATE_H__
+
+# include "internal.h"
+
+/* The layout below is shared between libvirtd and local clients,
+ * bump the version whenever it changes */
+# define VIR_SHM_STATE_MAGIC 0x4c565353 /* "LVSS" */
+# define VIR_SHM_STATE_VERSION 1
+
+# define VIR_SHM_STATE_NAME_LEN 128
+# define VIR_SHM_STATE_MAX_DOMAINS 1024
+
+/* Readers ignore a snapshot which has not been refreshed for
+ * this many milliseconds, since the publisher has likely stopped */
+# define VIR_SHM_STATE_MAX_AGE 5000
+
+typedef enum {
+    /* More domains exist than fit in the snapshot */
+    VIR_SHM_STATE_TRUNCATED = (1 << 0),
+} virShmStateFlags;
+
+typedef enum {
+    /* The name did not fit in VIR_SHM_STATE_NAME_LEN */
+    VIR_SHM_STATE_DOMAIN_NAME_TRUNCATED = (1 << 0),
+} virShmStateDomainFlags;
+
+typedef struct _virShmStateDomain virShmStateDomain;
+typedef virShmStateDomain *virShmStateDomainPtr;
+struct _virShmStateDomain {
+    int id;                     /* -1 if the domain is inactive */
+    int state;                  /* virDomainState */
+    int reason;
+    unsigned int flags;         /* virShmStateDomainFlags */
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char name[VIR_SHM_STATE_NAME_LEN];
+    unsigned int nrVirtCpu;
+    unsigned int padding;
+    unsigned long long maxMem;  /* in KiB */
+    unsigned long long memory;  /* in KiB */
+    unsigned long long cpuTime; /* in nanoseconds */
+};
+
+typedef struct _virShmState virShmState;
+typedef virShmState *virShmStatePtr;
+struct _virShmState {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int maxDomains;
+    unsigned int flags;         /* virShmStateFlags */
+
+    /* Sequence lock, odd while the publisher is rewriting the data
+     * following it */
+    int seq;
+    unsigned int ndomains;
+    unsigned long long updated; /* ms since the epoch */
+
+    /* Sorted by UUID */
+    virShmStateDomain domains[VIR_SHM_STATE_MAX_DOMAINS];
+};
+
+virShmStatePtr virShmStateNew(const char *dir, int *rofd)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virShmStatePublish(virShmStatePtr state,
+                        virShmStateDomainPtr domains,
+                        size_t ndomains)
+    ATTRIBUTE_NONNULL(1);
+
+virShmStatePtr virShmStateOpen(int fd);
+void virShmStateClose(virShmStatePtr state);
+
+int virShmStateGetDomain(virShmStatePtr state,
+                         const unsigned char *uuid,
+                         virShmStateDomainPtr domain)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+int virShmStateNumOfDomains(virShmStatePtr state)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_SHM_STATE_H__ */
@@ -28,38 +28,69 @@
 #include "virthreadpool.h"
 #include "viralloc.h"
 #include "virthread.h"
+#include "viratomic.h"
 #include "virerror.h"
+#include "virutil.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+/* Maximum number of spare job records kept by each queue */
+#define VIR_THREAD_POOL_MAX_SPARE_JOBS 32
+
 typedef struct _virThreadPoolJob virThreadPoolJob;
 typedef virThreadPoolJob *virThreadPoolJobPtr;
 
 struct _virThreadPoolJob {
-    virThreadPoolJobPtr prev;
     virThreadPoolJobPtr next;
     unsigned int priority;
 
     void *data;
 };
 
-typedef struct _virThreadPoolJobList virThreadPoolJobList;
-typedef virThreadPoolJobList *virThreadPoolJobListPtr;
+/* A FIFO of jobs with its own lock, along with a cache of spare
+ * job records, so queueing a job rarely needs to allocate */
+typedef struct _virThreadPoolJobQueue virThreadPoolJobQueue;
+typedef virThreadPoolJobQueue *virThreadPoolJobQueuePtr;
 
-struct _virThreadPoolJobList {
+struct _virThreadPoolJobQueue {
+    virMutex lock;
     virThreadPoolJobPtr head;
     virThreadPoolJobPtr tail;
-    virThreadPoolJobPtr firstPrio;
+    /* Updated under the lock, but may be read without it to
+     * skip empty queues cheaply */
+    int njobs;
+
+    virThreadPoolJobPtr spare;
+    size_t nspare;
 };
 
 
+/*
+ * Every worker owns a job queue, and new jobs are spread over
+ * the queues round-robin. A worker takes jobs from its own queue
+ * first and only when that is empty steals from its peers, so
+ * submitters and workers rarely contend for the same lock.
+ * Priority jobs go to a queue of their own, which both kinds of
+ * workers look at first.
+ *
+ * The pool mutex is only needed for creating workers and for
+ * putting idle workers to sleep. The queue depths and the
+ * number of idle workers are maintained atomically, so a job
+ * submitter only takes the mutex when there is a worker to wake.
+ */
 struct _virThreadPool {
-    bool quit;
+    int quit;
 
     virThreadPoolJobFunc jobFunc;
     void *jobOpaque;
-    virThreadPoolJobList jobList;
-    size_t jobQueueDepth;
+
+    size_t nqueues;
+    virThreadPoolJobQueuePtr queues;
+    int nextQueue;
+    virThreadPoolJobQueue prioQueue;
+
+    int jobQueueDepth;
+    int prioQueueDepth;
 
     virMutex mutex;
     virCond cond;
@@ -67,10 +98,13 @@ struct _virThreadPool {
 
     size_t maxWorkers;
     size_t minWorkers;
-    size_t freeWorkers;
-    size_t nWorkers;
+    int freeWorkers;
+    int wakeups;
+    int nWorkers;
     virThreadPtr workers;
 
+    int freePrioWorkers;
+    int prioWakeups;
     size_t nPrioWorkers;
     virThreadPtr prioWorkers;
     virCond prioCond;
@@ -80,82 +114,290 @@ struct virThreadPoolWorkerData {
     virThreadPoolPtr pool;
     virCondPtr cond;
     bool priority;
+    size_t id;
 };
 
+
+static int virThreadPoolJobQueueInit(virThreadPoolJobQueuePtr queue)
+{
+    if (virMutexInit(&queue->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+    return 0;
+}
+
+static void virThreadPoolJobQueueClear(virThreadPoolJobQueuePtr queue)
+{
+    virThreadPoolJobPtr job;
+
+    while ((job = queue->head)) {
+        queue->head = job->next;
+        VIR_FREE(job);
+    }
+    queue->tail = NULL;
+
+    while ((job = queue->spare)) {
+        queue->spare = job->next;
+        VIR_FREE(job);
+    }
+    queue->nspare = 0;
+}
+
+/* Returns the oldest job in @queue, or NULL if it is empty. If a
+ * job is found, the record of the worker's previous job in @done
+ * is handed back in the same go, saving a second trip through
+ * the queue lock */
+static virThreadPoolJobPtr
+virThreadPoolJobQueueTake(virThreadPoolJobQueuePtr queue,
+                          virThreadPoolJobPtr *done)
+{
+    virThreadPoolJobPtr job;
+
+    if (virAtomicIntGet(&queue->njobs) <= 0)
+        return NULL;
+
+    virMutexLock(&queue->lock);
+    if ((job = queue->head)) {
+        queue->head = job->next;
+        if (!queue->head)
+            queue->tail = NULL;
+        virAtomicIntAdd(&queue->njobs, -1);
+
+        if (*done && queue->nspare < VIR_THREAD_POOL_MAX_SPARE_JOBS) {
+            (*done)->next = queue->spare;
+            queue->spare = *done;
+            queue->nspare++;
+            *done = NULL;
+        }
+    }
+    virMutexUnlock(&queue->lock);
+
+    return job;
+}
+
+static int
+virThreadPoolJobQueueAdd(virThreadPoolJobQueuePtr queue,
+                         unsigned int priority,
+                         void *jobData)
+{
+    virThreadPoolJobPtr job;
+
+    virMutexLock(&queue->lock);
+    if ((job = queue->spare)) {
+        queue->spare = job->next;
+        queue->nspare--;
+    } else if (VIR_ALLOC(job) < 0) {
+        virMutexUnlock(&queue->lock);
+        virReportOOMError();
+        return -1;
+    }
+
+    job->next = NULL;
+    job->data = jobData;
+    job->priority = priority;
+
+    if (queue->tail)
+        queue->tail->next = job;
+    else
+        queue->head = job;
+    queue->tail = job;
+    virAtomicIntInc(&queue->njobs);
+    virMutexUnlock(&queue->lock);
+
+    return 0;
+}
+
+/* Hand a finished job's record back to @queue for reuse */
+static void
+virThreadPoolJobQueueRelease(virThreadPoolJobQueuePtr queue,
+                             virThreadPoolJobPtr job)
+{
+    if (!job)
+        return;
+
+    virMutexLock(&queue->lock);
+    if (queue->nspare < VIR_THREAD_POOL_MAX_SPARE_JOBS) {
+        job->next = queue->spare;
+        queue->spare = job;
+        queue->nspare++;
+        job = NULL;
+    }
+    virMutexUnlock(&queue->lock);
+
+    VIR_FREE(job);
+}
+
+/*
+ * Find the next job for a worker: priority jobs first, then the
+ * worker's own queue, then any of its peers' queues. @self is
+ * the index of the worker's queue, or -1 for priority workers,
+ * which only run priority jobs.
+ */
+static virThreadPoolJobPtr
+virThreadPoolNextJob(virThreadPoolPtr pool,
+                     ssize_t self,
+                     virThreadPoolJobPtr *done)
+{
+    virThreadPoolJobPtr job = NULL;
+    size_t nqueues;
+    size_t i;
+
+    if ((job = virThreadPoolJobQueueTake(&pool->prioQueue, done))) {
+        virAtomicIntAdd(&pool->prioQueueDepth, -1);
+        goto cleanup;
+    }
+
+    if (self < 0)
+        return NULL;
+
+    /* Jobs are only ever queued for running workers, or the
+     * first queue if there are none yet */
+    nqueues = MAX(virAtomicIntGet(&pool->nWorkers), 1);
+    for (i = 0 ; i < nqueues ; i++) {
+        if ((job = virThreadPoolJobQueueTake(&pool->queues[(self + i) % nqueues],
+                                             done)))
+            goto cleanup;
+    }
+
+cleanup:
+    if (job)
+        virAtomicIntAdd(&pool->jobQueueDepth, -1);
+    return job;
+}
+
+/* Wake up an idle worker, unless all of them have already been
+ * woken up and will find the new job anyway. A woken worker keeps
+ * going until it runs out of jobs, so waking more of them than
+ * there are idle ones would only make them compete for the same
+ * jobs */
+static void virThreadPoolWakeWorker(virThreadPoolPtr pool, bool priority)
+{
+    bool wake = virAtomicIntGet(&pool->freeWorkers) >
+        virAtomicIntGet(&pool->wakeups);
+    bool wakePrio = priority &&
+        virAtomicIntGet(&pool->freePrioWorkers) >
+        virAtomicIntGet(&pool->prioWakeups);
+
+    if (!wake && !wakePrio)
+        return;
+
+    virMutexLock(&pool->mutex);
+    if (pool->freeWorkers > pool->wakeups) {
+        virAtomicIntInc(&pool->wakeups);
+        virCondSignal(&pool->cond);
+    }
+    if (priority && pool->freePrioWorkers > pool->prioWakeups) {
+        virAtomicIntInc(&pool->prioWakeups);
+        virCondSignal(&pool->prioCond);
+    }
+    virMutexUnlock(&pool->mutex);
+}
+
 static void virThreadPoolWorker(void *opaque)
 {
     struct virThreadPoolWorkerData *data = opaque;
     virThreadPoolPtr pool = data->pool;
     virCondPtr cond = data->cond;
     bool priority = data->priority;
+    ssize_t self = priority ? -1 : data->id;
+    virThreadPoolJobQueuePtr queue;
+    int *depth;
+    int *freeWorkers;
+    int *wakeups;
     virThreadPoolJobPtr job = NULL;
+    virThreadPoolJobPtr done = NULL;
 
     VIR_FREE(data);
 
-    virMutexLock(&pool->mutex);
+    if (priority) {
+        queue = &pool->prioQueue;
+        depth = &pool->prioQueueDepth;
+        freeWorkers = &pool->freePrioWorkers;
+        wakeups = &pool->prioWakeups;
+    } else {
+        queue = &pool->queues[self];
+        depth = &pool->jobQueueDepth;
+        freeWorkers = &pool->freeWorkers;
+        wakeups = &pool->wakeups;
+    }
 
-    while (1) {
-        while (!pool->quit &&
-               ((!priority && !pool->jobList.head) ||
-                (priority && !pool->jobList.firstPrio))) {
-            if (!priority)
-                pool->freeWorkers++;
-            if (virCondWait(cond, &pool->mutex) < 0) {
-                if (!priority)
-                    pool->freeWorkers--;
-                goto out;
-            }
-            if (!priority)
-                pool->freeWorkers--;
+    while (!virAtomicIntGet(&pool->quit)) {
+        if ((job = virThreadPoolNextJob(pool, self, &done))) {
+            (pool->jobFunc)(job->data, pool->jobOpaque);
+            /* Still set only if the queue had no room left for it
+             * among its spares */
+            VIR_FREE(done);
+            done = job;
+            continue;
         }
 
-        if (pool->quit)
-            break;
-
-        if (priority) {
-            job = pool->jobList.firstPrio;
-        } else {
-            job = pool->jobList.head;
-        }
+        virThreadPoolJobQueueRelease(queue, done);
+        done = NULL;
 
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority) {
-                    break;
-                }
-                tmp = tmp->next;
+        /* Announce ourselves idle before the final check of the
+         * queue depth: virThreadPoolSendJob bumps the depth before
+         * looking for idle workers, so one of the two is bound to
+         * see the other and no wakeup can be lost */
+        virMutexLock(&pool->mutex);
+        virAtomicIntInc(freeWorkers);
+        while (!pool->quit && virAtomicIntGet(depth) <= 0) {
+            int rc = virCondWait(cond, &pool->mutex);
+
+            /* Whether this worker was the one signalled or not,
+             * one less wakeup is now outstanding */
+            if (virAtomicIntGet(wakeups) > 0)
+                virAtomicIntAdd(wakeups, -1);
+
+            if (rc < 0) {
+                virAtomicIntAdd(freeWorkers, -1);
+                virMutexUnlock(&pool->mutex);
+                goto out;
             }
-            pool->jobList.firstPrio = tmp;
         }
-
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
-
-        pool->jobQueueDepth--;
-
+        virAtomicIntAdd(freeWorkers, -1);
         virMutexUnlock(&pool->mutex);
-        (pool->jobFunc)(job->data, pool->jobOpaque);
-        VIR_FREE(job);
-        virMutexLock(&pool->mutex);
     }
 
 out:
+    VIR_FREE(done);
+    virMutexLock(&pool->mutex);
     if (priority)
         pool->nPrioWorkers--;
     else
-        pool->nWorkers--;
+        virAtomicIntAdd(&pool->nWorkers, -1);
     if (pool->nWorkers == 0 && pool->nPrioWorkers==0)
         virCondSignal(&pool->quit_cond);
     virMutexUnlock(&pool->mutex);
 }
 
+/* Must be called with pool->mutex held */
+static int virThreadPoolAddWorker(virThreadPoolPtr pool)
+{
+    struct virThreadPoolWorkerData *data = NULL;
+
+    if (VIR_ALLOC(data) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    data->pool = pool;
+    data->cond = &pool->cond;
+    data->id = pool->nWorkers;
+
+    if (virThreadCreate(&pool->workers[pool->nWorkers],
+                        true,
+                        virThreadPoolWorker,
+                        data) < 0) {
+        VIR_FREE(data);
+        return -1;
+    }
+
+    virAtomicIntInc(&pool->nWorkers);
+    return 0;
+}
+
 virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
                                   size_t maxWorkers,
                                   size_t prioWorkers,
@@ -174,8 +416,6 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
         return NULL;
     }
 
-    pool->jobList.tail = pool->jobList.head = NULL;
-
     pool->jobFunc = func;
     pool->jobOpaque = opaque;
 
@@ -186,28 +426,33 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
     if (virCondInit(&pool->quit_cond) < 0)
         goto error;
 
-    if (VIR_ALLOC_N(pool->workers, minWorkers) < 0)
+    /* Workers are never reaped before the pool is freed, so
+     * all the space they could need is allocated upfront */
+    if (VIR_ALLOC_N(pool->workers, maxWorkers) < 0 ||
+        VIR_ALLOC_N(pool->queues, MAX(maxWorkers, 1)) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+
+    for (i = 0; i < MAX(maxWorkers, 1); i++) {
+        if (virThreadPoolJobQueueInit(&pool->queues[i]) < 0)
+            goto error;
+        pool->nqueues++;
+    }
+    if (virThreadPoolJobQueueInit(&pool->prioQueue) < 0)
         goto error;
 
     pool->minWorkers = minWorkers;
     pool->maxWorkers = maxWorkers;
 
+    virMutexLock(&pool->mutex);
     for (i = 0; i < minWorkers; i++) {
-        if (VIR_ALLOC(data) < 0) {
-            virReportOOMError();
+        if (virThreadPoolAddWorker(pool) < 0) {
+            virMutexUnlock(&pool->mutex);
             goto error;
         }
-        data->pool = pool;
-        data->cond = &pool->cond;
-
-        if (virThreadCreate(&pool->workers[i],
-                            true,
-                            virThreadPoolWorker,
-                            data) < 0) {
-            goto error;
-        }
-        pool->nWorkers++;
     }
+    virMutexUnlock(&pool->mutex);
 
     if (prioWorkers) {
         if (virCondInit(&pool->prioCond) < 0)
@@ -245,14 +490,14 @@ error:
 
 void virThreadPoolFree(virThreadPoolPtr pool)
 {
-    virThreadPoolJobPtr job;
     bool priority = false;
+    size_t i;
 
     if (!pool)
         return;
 
     virMutexLock(&pool->mutex);
-    pool->quit = true;
+    virAtomicIntSet(&pool->quit, 1);
     if (pool->nWorkers > 0)
         virCondBroadcast(&pool->cond);
     if (pool->nPrioWorkers > 0) {
@@ -263,10 +508,13 @@ void virThreadPoolFree(virThreadPoolPtr pool)
     while (pool->nWorkers > 0 || pool->nPrioWorkers > 0)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
 
-    while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
-        VIR_FREE(job);
+    for (i = 0 ; i < pool->nqueues ; i++) {
+        virThreadPoolJobQueueClear(&pool->queues[i]);
+        virMutexDestroy(&pool->queues[i].lock);
     }
+    VIR_FREE(pool->queues);
+    virThreadPoolJobQueueClear(&pool->prioQueue);
+    virMutexDestroy(&pool->prioQueue.lock);
 
     VIR_FREE(pool->workers);
     virMutexUnlock(&pool->mutex);
@@ -304,68 +552,44 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          unsigned int priority,
                          void *jobData)
 {
-    virThreadPoolJobPtr job;
-    struct virThreadPoolWorkerData *data = NULL;
-
-    virMutexLock(&pool->mutex);
-    if (pool->quit)
-        goto error;
-
-    if (pool->freeWorkers - pool->jobQueueDepth <= 0 &&
-        pool->nWorkers < pool->maxWorkers) {
-        if (VIR_EXPAND_N(pool->workers, pool->nWorkers, 1) < 0) {
-            virReportOOMError();
-            goto error;
-        }
-
-        if (VIR_ALLOC(data) < 0) {
-            pool->nWorkers--;
-            virReportOOMError();
-            goto error;
-        }
-
-        data->pool = pool;
-        data->cond = &pool->cond;
-
-        if (virThreadCreate(&pool->workers[pool->nWorkers - 1],
-                            true,
-                            virThreadPoolWorker,
-                            data) < 0) {
-            VIR_FREE(data);
-            pool->nWorkers--;
-            goto error;
+    virThreadPoolJobQueuePtr queue;
+    int nWorkers;
+
+    if (virAtomicIntGet(&pool->quit))
+        return -1;
+
+    /* Spawn another worker if all the idle ones already have
+     * a job waiting for them */
+    nWorkers = virAtomicIntGet(&pool->nWorkers);
+    if ((size_t)nWorkers < pool->maxWorkers &&
+        virAtomicIntGet(&pool->freeWorkers) <=
+        virAtomicIntGet(&pool->jobQueueDepth)) {
+        virMutexLock(&pool->mutex);
+        if (!pool->quit &&
+            (size_t)pool->nWorkers < pool->maxWorkers &&
+            virThreadPoolAddWorker(pool) < 0) {
+            virMutexUnlock(&pool->mutex);
+            return -1;
         }
+        nWorkers = pool->nWorkers;
+        virMutexUnlock(&pool->mutex);
     }
 
-    if (VIR_ALLOC(job) < 0) {
-        virReportOOMError();
-        goto error;
+    if (priority) {
+        queue = &pool->prioQueue;
+    } else {
+        queue = &pool->queues[(unsigned int)virAtomicIntAdd(&pool->nextQueue, 1) %
+                              MAX(nWorkers, 1)];
     }
 
-    job->data = jobData;
-    job->priority = priority;
-
-    job->prev = pool->jobList.tail;
-    if (pool->jobList.tail)
-        pool->jobList.tail->next = job;
-    pool->jobList.tail = job;
+    if (virThreadPoolJobQueueAdd(queue, priority, jobData) < 0)
+        return -1;
 
-    if (!pool->jobList.head)
-        pool->jobList.head = job;
-
-    if (priority && !pool->jobList.firstPrio)
-        pool->jobList.firstPrio = job;
-
-    pool->jobQueueDepth++;
-
-    virCondSignal(&pool->cond);
+    virAtomicIntInc(&pool->jobQueueDepth);
     if (priority)
-        virCondSignal(&pool->prioCond);
+        virAtomicIntInc(&pool->prioQueueDepth);
 
-    virMutexUnlock(&pool->mutex);
-    return 0;
+    virThreadPoolWakeWorker(pool, priority);
 
-error:
-    virMutexUnlock(&pool->mutex);
-    return -1;
+    return 0;
 }
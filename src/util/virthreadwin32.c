@@ -121,6 +121,32 @@ void virMutexUnlock(virMutexPtr m)
 }
 
 
+int virRWLockInit(virRWLockPtr m)
+{
+    return virMutexInit(&m->lock);
+}
+
+void virRWLockDestroy(virRWLockPtr m)
+{
+    virMutexDestroy(&m->lock);
+}
+
+void virRWLockRead(virRWLockPtr m)
+{
+    virMutexLock(&m->lock);
+}
+
+void virRWLockWrite(virRWLockPtr m)
+{
+    virMutexLock(&m->lock);
+}
+
+void virRWLockUnlock(virRWLockPtr m)
+{
+    virMutexUnlock(&m->lock);
+}
+
+
 
 int virCondInit(virCondPtr c)
 {
@@ -30,6 +30,12 @@ struct virMutex {
     HANDLE lock;
 };
 
+/* Readers are not allowed to run in parallel here, since the
+ * slim reader/writer locks need a newer Windows than we target */
+struct virRWLock {
+    virMutex lock;
+};
+
 struct virCond {
     virMutex lock;
     unsigned int nwaiters;
@@ -3249,6 +3249,34 @@ virStrIsPrint(const char *str)
     return true;
 }
 
+/**
+ * virMemIsZero:
+ * @buf: memory to check
+ * @len: its length in bytes
+ *
+ * Returns true if all @len bytes of @buf are zero.
+ */
+bool
+virMemIsZero(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    size_t i;
+
+    /* Data is usually told apart from zeros within the first few
+     * bytes, so check those by hand.  The rest is compared against
+     * itself shifted by that much, which can only succeed if it is
+     * all zero too; memcmp is vectorized by the C library for the
+     * CPU at hand, and no zero-filled buffer has to be read along */
+    for (i = 0; i < 16; i++) {
+        if (i == len)
+            return true;
+        if (p[i])
+            return false;
+    }
+
+    return memcmp(p, p + 16, len - 16) == 0;
+}
+
 #if defined(major) && defined(minor)
 int
 virGetDeviceID(const char *path, int *maj, int *min)
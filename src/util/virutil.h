@@ -285,6 +285,8 @@ bool virValidateWWN(const char *wwn);
 
 bool virStrIsPrint(const char *str);
 
+bool virMemIsZero(const void *buf, size_t len) ATTRIBUTE_NONNULL(1);
+
 int virGetDeviceID(const char *path,
                    int *maj,
                    int *min);
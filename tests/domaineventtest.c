@@ -0,0 +1,527 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "datatypes.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "domain_event.h"
+
+#define TEST_TIMEOUT_MS 10000
+
+/* Must match the bound of the queue of a connection */
+#define CONN_QUEUE_MAX 1024
+
+static virConnectPtr conn;
+static virDomainPtr dom;
+static virDomainPtr otherdom;
+
+/* Callbacks run in the worker threads, everything they touch is
+ * protected by this lock */
+static virMutex lock;
+static virCond cond;
+/* A blocking callback sets this once it is running, and waits for
+ * the test to set released */
+static bool blocked;
+static bool released;
+
+struct testCallback {
+    bool block;
+    int calls;
+    long long last;
+    bool freed;
+};
+
+static void
+testCallbackCalled(struct testCallback *cb, long long value)
+{
+    virMutexLock(&lock);
+    cb->calls++;
+    cb->last = value;
+    if (cb->block && !released) {
+        blocked = true;
+        virCondBroadcast(&cond);
+        while (!released)
+            ignore_value(virCondWait(&cond, &lock));
+    }
+    virMutexUnlock(&lock);
+}
+
+static int
+testLifecycleCallback(virConnectPtr c ATTRIBUTE_UNUSED,
+                      virDomainPtr d ATTRIBUTE_UNUSED,
+                      int event,
+                      int detail ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    testCallbackCalled(opaque, event);
+    return 0;
+}
+
+/* The same function can't be registered twice for a connection */
+static int
+testLifecycleCallback2(virConnectPtr c,
+                       virDomainPtr d,
+                       int event,
+                       int detail,
+                       void *opaque)
+{
+    return testLifecycleCallback(c, d, event, detail, opaque);
+}
+
+static void
+testRTCChangeCallback(virConnectPtr c ATTRIBUTE_UNUSED,
+                      virDomainPtr d ATTRIBUTE_UNUSED,
+                      long long utcoffset,
+                      void *opaque)
+{
+    testCallbackCalled(opaque, utcoffset);
+}
+
+static void
+testBalloonChangeCallback(virConnectPtr c ATTRIBUTE_UNUSED,
+                          virDomainPtr d ATTRIBUTE_UNUSED,
+                          unsigned long long actual,
+                          void *opaque)
+{
+    testCallbackCalled(opaque, actual);
+}
+
+static void
+testBlockJobCallback(virConnectPtr c ATTRIBUTE_UNUSED,
+                     virDomainPtr d ATTRIBUTE_UNUSED,
+                     const char *disk ATTRIBUTE_UNUSED,
+                     int type ATTRIBUTE_UNUSED,
+                     int status,
+                     void *opaque)
+{
+    testCallbackCalled(opaque, status);
+}
+
+static void
+testCallbackFree(void *opaque)
+{
+    struct testCallback *cb = opaque;
+
+    virMutexLock(&lock);
+    cb->freed = true;
+    virMutexUnlock(&lock);
+}
+
+
+static virDomainEventStatePtr
+testStateNew(void)
+{
+    virMutexLock(&lock);
+    blocked = released = false;
+    virMutexUnlock(&lock);
+
+    return virDomainEventStateNewFull(VIR_DOMAIN_EVENT_STATE_ASYNC |
+                                      VIR_DOMAIN_EVENT_STATE_COALESCE);
+}
+
+static int
+testRegister(virDomainEventStatePtr state,
+             int eventID,
+             virConnectDomainEventGenericCallback cb,
+             struct testCallback *data)
+{
+    int callbackID;
+
+    if (virDomainEventStateRegisterID(conn, state, NULL, eventID, cb,
+                                      data, testCallbackFree,
+                                      &callbackID) < 0)
+        return -1;
+    return callbackID;
+}
+
+static void
+testRelease(void)
+{
+    virMutexLock(&lock);
+    released = true;
+    virCondBroadcast(&cond);
+    virMutexUnlock(&lock);
+}
+
+
+/* Runs the event loop, which flushes the queued events to the
+ * workers, until @check returns true */
+static int
+testWaitFor(bool (*check)(void *), void *opaque, const char *what)
+{
+    unsigned long long start;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+
+    while (true) {
+        if (check(opaque))
+            return 0;
+
+        if (virTimeMillisNow(&now) < 0)
+            return -1;
+        if (now - start > TEST_TIMEOUT_MS) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "timed out waiting for %s\n", what);
+            return -1;
+        }
+
+        if (virEventRunDefaultImpl() < 0)
+            return -1;
+    }
+}
+
+static bool
+testCheckBlocked(void *opaque ATTRIBUTE_UNUSED)
+{
+    bool ret;
+
+    virMutexLock(&lock);
+    ret = blocked;
+    virMutexUnlock(&lock);
+    return ret;
+}
+
+struct testCallsData {
+    struct testCallback *cb;
+    int calls;
+};
+
+static bool
+testCheckCalls(void *opaque)
+{
+    struct testCallsData *data = opaque;
+    bool ret;
+
+    virMutexLock(&lock);
+    ret = data->cb->calls >= data->calls;
+    virMutexUnlock(&lock);
+    return ret;
+}
+
+static bool
+testCheckFreed(void *opaque)
+{
+    struct testCallback *cb = opaque;
+    bool ret;
+
+    virMutexLock(&lock);
+    ret = cb->freed;
+    virMutexUnlock(&lock);
+    return ret;
+}
+
+struct testStatsData {
+    virDomainEventStatePtr state;
+    unsigned long long dropped;
+    unsigned long long coalesced;
+};
+
+/* Not under the test lock, which callbacks may be freed with the lock
+ * of the event state held */
+static bool
+testCheckStats(void *opaque)
+{
+    struct testStatsData *data = opaque;
+    unsigned long long dropped;
+    unsigned long long coalesced;
+
+    virDomainEventStateGetStats(data->state, &dropped, &coalesced);
+
+    return dropped == data->dropped && coalesced == data->coalesced;
+}
+
+static int
+testWaitCalls(struct testCallback *cb, int calls)
+{
+    struct testCallsData data = { cb, calls };
+
+    return testWaitFor(testCheckCalls, &data, "callbacks");
+}
+
+static int
+testWaitStats(virDomainEventStatePtr state,
+              unsigned long long dropped,
+              unsigned long long coalesced)
+{
+    struct testStatsData data = { state, dropped, coalesced };
+
+    return testWaitFor(testCheckStats, &data, "the events to be queued");
+}
+
+static void
+testQueueLifecycle(virDomainEventStatePtr state, int n)
+{
+    int i;
+
+    for (i = 0 ; i < n ; i++)
+        virDomainEventStateQueue(state,
+                                 virDomainEventNewFromDom(dom,
+                                                          VIR_DOMAIN_EVENT_STARTED,
+                                                          0));
+}
+
+static int
+testCheckCallback(const char *name, struct testCallback *cb,
+                  int calls, long long last)
+{
+    if (cb->calls == calls && (calls == 0 || cb->last == last))
+        return 0;
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "%s called %d times with %lld last, "
+                "expected %d times with %lld\n",
+                name, cb->calls, cb->last, calls, last);
+    return -1;
+}
+
+
+/* While a callback of a connection is busy, at most CONN_QUEUE_MAX
+ * events wait for it, the rest are dropped */
+static int
+testQueueBound(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainEventStatePtr state;
+    struct testCallback lifecycle = { .block = true };
+    int extra = CONN_QUEUE_MAX / 2;
+    int ret = -1;
+
+    if (!(state = testStateNew()))
+        return -1;
+
+    if (testRegister(state, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                     VIR_DOMAIN_EVENT_CALLBACK(testLifecycleCallback),
+                     &lifecycle) < 0)
+        goto cleanup;
+
+    testQueueLifecycle(state, 1);
+    if (testWaitFor(testCheckBlocked, NULL, "the callback") < 0)
+        goto cleanup;
+
+    testQueueLifecycle(state, CONN_QUEUE_MAX + extra);
+    if (testWaitStats(state, extra, 0) < 0)
+        goto cleanup;
+
+    testRelease();
+    if (testWaitCalls(&lifecycle, 1 + CONN_QUEUE_MAX) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testRelease();
+    virDomainEventStateFree(state);
+    /* all workers are done by now */
+    if (ret == 0 &&
+        (testCheckCallback("lifecycle", &lifecycle, 1 + CONN_QUEUE_MAX,
+                           VIR_DOMAIN_EVENT_STARTED) < 0 ||
+         !lifecycle.freed))
+        ret = -1;
+    return ret;
+}
+
+
+/* Events reporting the current value of something replace the older
+ * ones still waiting, other events are all delivered */
+static int
+testCoalesce(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainEventStatePtr state;
+    struct testCallback lifecycle = { .block = true };
+    struct testCallback rtc = { .block = false };
+    struct testCallback balloon = { .block = false };
+    struct testCallback blockjob = { .block = false };
+    const int type = VIR_DOMAIN_BLOCK_JOB_TYPE_PULL;
+    int i;
+    int ret = -1;
+
+    if (!(state = testStateNew()))
+        return -1;
+
+    if (testRegister(state, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                     VIR_DOMAIN_EVENT_CALLBACK(testLifecycleCallback),
+                     &lifecycle) < 0 ||
+        testRegister(state, VIR_DOMAIN_EVENT_ID_RTC_CHANGE,
+                     VIR_DOMAIN_EVENT_CALLBACK(testRTCChangeCallback),
+                     &rtc) < 0 ||
+        testRegister(state, VIR_DOMAIN_EVENT_ID_BALLOON_CHANGE,
+                     VIR_DOMAIN_EVENT_CALLBACK(testBalloonChangeCallback),
+                     &balloon) < 0 ||
+        testRegister(state, VIR_DOMAIN_EVENT_ID_BLOCK_JOB,
+                     VIR_DOMAIN_EVENT_CALLBACK(testBlockJobCallback),
+                     &blockjob) < 0)
+        goto cleanup;
+
+    testQueueLifecycle(state, 1);
+    if (testWaitFor(testCheckBlocked, NULL, "the callback") < 0)
+        goto cleanup;
+
+    /* A different domain's value isn't older news */
+    virDomainEventStateQueue(state,
+                             virDomainEventRTCChangeNewFromDom(otherdom, 10));
+    for (i = 1 ; i <= 3 ; i++) {
+        virDomainEventStateQueue(state,
+                                 virDomainEventRTCChangeNewFromDom(dom, i));
+        virDomainEventStateQueue(state,
+                                 virDomainEventBalloonChangeNewFromDom(dom,
+                                                                       i * 1024));
+        virDomainEventStateQueue(state,
+                                 virDomainEventBlockJobNewFromDom(dom, "vda", type,
+                                                                  VIR_DOMAIN_BLOCK_JOB_COMPLETED));
+        testQueueLifecycle(state, 1);
+    }
+    /* Nor is a different status of the job */
+    virDomainEventStateQueue(state,
+                             virDomainEventBlockJobNewFromDom(dom, "vda", type,
+                                                              VIR_DOMAIN_BLOCK_JOB_FAILED));
+
+    if (testWaitStats(state, 0, 6) < 0)
+        goto cleanup;
+
+    testRelease();
+    if (testWaitCalls(&lifecycle, 4) < 0 ||
+        testWaitCalls(&rtc, 2) < 0 ||
+        testWaitCalls(&balloon, 1) < 0 ||
+        testWaitCalls(&blockjob, 2) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testRelease();
+    virDomainEventStateFree(state);
+    if (ret == 0 &&
+        (testCheckCallback("lifecycle", &lifecycle, 4,
+                           VIR_DOMAIN_EVENT_STARTED) < 0 ||
+         testCheckCallback("RTC change", &rtc, 2, 3) < 0 ||
+         testCheckCallback("balloon change", &balloon, 1, 3 * 1024) < 0 ||
+         testCheckCallback("block job", &blockjob, 2,
+                           VIR_DOMAIN_BLOCK_JOB_FAILED) < 0))
+        ret = -1;
+    return ret;
+}
+
+
+/* A callback removed while a worker delivers events isn't called any
+ * more, and is freed once the worker is done */
+static int
+testRemoveDuringDispatch(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainEventStatePtr state;
+    struct testCallback first = { .block = true };
+    struct testCallback second = { .block = false };
+    int secondID;
+    int ret = -1;
+
+    if (!(state = testStateNew()))
+        return -1;
+
+    if (testRegister(state, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                     VIR_DOMAIN_EVENT_CALLBACK(testLifecycleCallback),
+                     &first) < 0 ||
+        (secondID = testRegister(state, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                 VIR_DOMAIN_EVENT_CALLBACK(testLifecycleCallback2),
+                                 &second)) < 0)
+        goto cleanup;
+
+    /* Both events are handed to the worker at once, which blocks in
+     * the first callback for the first event */
+    testQueueLifecycle(state, 2);
+    if (testWaitFor(testCheckBlocked, NULL, "the callback") < 0)
+        goto cleanup;
+
+    if (virDomainEventStateDeregisterID(conn, state, secondID) < 0)
+        goto cleanup;
+
+    virMutexLock(&lock);
+    if (second.freed) {
+        virMutexUnlock(&lock);
+        if (virTestGetVerbose())
+            fprintf(stderr, "callback freed while dispatching\n");
+        goto cleanup;
+    }
+    virMutexUnlock(&lock);
+
+    testRelease();
+    if (testWaitCalls(&first, 2) < 0 ||
+        testWaitFor(testCheckFreed, &second, "the callback to be freed") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testRelease();
+    virDomainEventStateFree(state);
+    if (ret == 0 &&
+        (testCheckCallback("first", &first, 2, VIR_DOMAIN_EVENT_STARTED) < 0 ||
+         testCheckCallback("second", &second, 0, 0) < 0))
+        ret = -1;
+    return ret;
+}
+
+
+static void
+testTimer(int timer ATTRIBUTE_UNUSED, void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+static int
+mymain(void)
+{
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    int ret = 0;
+
+    memset(uuid, 0x42, sizeof(uuid));
+
+    if (virMutexInit(&lock) < 0 ||
+        virCondInit(&cond) < 0 ||
+        virEventRegisterDefaultImpl() < 0 ||
+        /* keeps the event loop from blocking while the test waits */
+        virEventAddTimeout(10, testTimer, NULL, NULL) < 0 ||
+        !(conn = virGetConnect()) ||
+        !(dom = virGetDomain(conn, "test", uuid)))
+        return EXIT_FAILURE;
+
+    uuid[0] = 0x43;
+    if (!(otherdom = virGetDomain(conn, "other", uuid)))
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Queue bound", 1, testQueueBound, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Coalesce", 1, testCoalesce, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Remove during dispatch", 1,
+                    testRemoveDuringDispatch, NULL) < 0)
+        ret = -1;
+
+    virObjectUnref(otherdom);
+    virObjectUnref(dom);
+    virObjectUnref(conn);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
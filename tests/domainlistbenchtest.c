@@ -0,0 +1,283 @@
+/*
+ * domainlistbenchtest.c: Measure lookup throughput of the domain list
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virthread.h"
+#include "viralloc.h"
+#include "virutil.h"
+#include "capabilities.h"
+#include "domain_conf.h"
+
+#define NUM_DOMAINS 5000
+#define NUM_LOOKUPS 200000
+
+static virCapsPtr caps;
+static virDomainObjListPtr doms;
+
+/* Every fourth domain is inactive */
+#define DOMAIN_ID(i, gen) \
+    ((i) % 4 == 3 ? -1 : (i) + 1 + (gen) * NUM_DOMAINS)
+
+static void
+testDomainUUID(int i, unsigned char *uuid)
+{
+    memset(uuid, 0, VIR_UUID_BUFLEN);
+    uuid[0] = 0x42;
+    uuid[VIR_UUID_BUFLEN - 2] = (i >> 8) & 0xff;
+    uuid[VIR_UUID_BUFLEN - 1] = i & 0xff;
+}
+
+static int
+testListPopulate(const void *data ATTRIBUTE_UNUSED)
+{
+    int i;
+
+    for (i = 0 ; i < NUM_DOMAINS ; i++) {
+        virDomainDefPtr def;
+        virDomainObjPtr vm;
+
+        if (VIR_ALLOC(def) < 0 ||
+            virAsprintf(&def->name, "dom%d", i) < 0) {
+            VIR_FREE(def);
+            return -1;
+        }
+        testDomainUUID(i, def->uuid);
+        def->virtType = VIR_DOMAIN_VIRT_QEMU;
+        def->id = DOMAIN_ID(i, 0);
+
+        if (!(vm = virDomainObjListAdd(doms, caps, def, 0, NULL))) {
+            virDomainDefFree(def);
+            return -1;
+        }
+        virObjectUnlock(vm);
+    }
+
+    return 0;
+}
+
+static int
+testListCheck(int i, int gen)
+{
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char name[32];
+    virDomainObjPtr vm;
+    int id = DOMAIN_ID(i, gen);
+
+    snprintf(name, sizeof(name), "dom%d", i);
+    testDomainUUID(i, uuid);
+
+    if (!(vm = virDomainObjListFindByName(doms, name)))
+        return -1;
+    virObjectUnlock(vm);
+
+    if (!(vm = virDomainObjListFindByUUID(doms, uuid)) ||
+        STRNEQ(vm->def->name, name)) {
+        if (vm)
+            virObjectUnlock(vm);
+        return -1;
+    }
+    virObjectUnlock(vm);
+
+    if (id == -1)
+        return 0;
+
+    if (!(vm = virDomainObjListFindByID(doms, id)) ||
+        STRNEQ(vm->def->name, name)) {
+        if (vm)
+            virObjectUnlock(vm);
+        return -1;
+    }
+    virObjectUnlock(vm);
+
+    return 0;
+}
+
+static int
+testListLookup(const void *data ATTRIBUTE_UNUSED)
+{
+    int i;
+
+    for (i = 0 ; i < NUM_DOMAINS ; i++) {
+        if (testListCheck(i, 0) < 0) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "\nLookup of dom%d failed\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Drivers change domain IDs behind the list's back when
+ * restarting domains, make sure lookups keep up */
+static int
+testListChangeID(const void *data ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    int i;
+
+    for (i = 0 ; i < NUM_DOMAINS ; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "dom%d", i);
+        if (!(vm = virDomainObjListFindByName(doms, name)))
+            return -1;
+        vm->def->id = DOMAIN_ID(i, 1);
+        virObjectUnlock(vm);
+    }
+
+    for (i = 0 ; i < NUM_DOMAINS ; i++) {
+        int oldid = DOMAIN_ID(i, 0);
+
+        if (oldid != -1 &&
+            (vm = virDomainObjListFindByID(doms, oldid))) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "\nStale ID %d still found\n", oldid);
+            virObjectUnlock(vm);
+            return -1;
+        }
+
+        if (testListCheck(i, 1) < 0) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "\nLookup of dom%d failed\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+struct testWorkerData {
+    virThread thread;
+    int seed;
+    int failed;
+};
+
+static void
+testListWorker(void *opaque)
+{
+    struct testWorkerData *data = opaque;
+    int i;
+
+    for (i = 0 ; i < NUM_LOOKUPS ; i++) {
+        int idx = (i * 7919 + data->seed) % NUM_DOMAINS;
+
+        if (testListCheck(idx, 1) < 0) {
+            data->failed = 1;
+            return;
+        }
+    }
+}
+
+static unsigned long long
+testListNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int
+testListThroughput(const void *data)
+{
+    int nthreads = *(const int *)data;
+    struct testWorkerData *workers;
+    unsigned long long start;
+    unsigned long long elapsed;
+    int ret = 0;
+    int i;
+
+    if (VIR_ALLOC_N(workers, nthreads) < 0)
+        return -1;
+
+    start = testListNow();
+    for (i = 0 ; i < nthreads ; i++) {
+        workers[i].seed = i * 13;
+        if (virThreadCreate(&workers[i].thread, true,
+                            testListWorker, &workers[i]) < 0) {
+            nthreads = i;
+            ret = -1;
+            break;
+        }
+    }
+
+    for (i = 0 ; i < nthreads ; i++) {
+        virThreadJoin(&workers[i].thread);
+        if (workers[i].failed)
+            ret = -1;
+    }
+    elapsed = testListNow() - start;
+
+    /* Each check does a name, UUID and (mostly) ID lookup */
+    if (ret == 0 && virTestGetVerbose())
+        fprintf(stderr, "\n%d threads: %llu lookups/sec with %d domains\n",
+                nthreads,
+                3ull * NUM_LOOKUPS * nthreads * 1000000ull / MAX(elapsed, 1),
+                NUM_DOMAINS);
+
+    VIR_FREE(workers);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virThreadInitialize() < 0 ||
+        !(caps = virCapabilitiesNew(VIR_ARCH_X86_64, 0, 0)) ||
+        !(doms = virDomainObjListNew()))
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Populate", 1, testListPopulate, NULL) < 0 ||
+        virtTestRun("Lookup", 1, testListLookup, NULL) < 0 ||
+        virtTestRun("Lookup after ID change", 1, testListChangeID, NULL) < 0)
+        ret = -1;
+
+#define DO_TEST(nthreads)                                               \
+    do {                                                                \
+        int n = nthreads;                                               \
+        if (virtTestRun("Throughput with " #nthreads " threads",        \
+                        1, testListThroughput, &n) < 0)                 \
+            ret = -1;                                                   \
+    } while (0)
+
+    if (ret == 0) {
+        DO_TEST(1);
+        DO_TEST(2);
+        DO_TEST(4);
+        DO_TEST(8);
+    }
+
+    virObjectUnref(doms);
+    virObjectUnref(caps);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
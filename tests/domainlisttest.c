@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virthread.h"
+#include "viralloc.h"
+#include "virutil.h"
+#include "virerror.h"
+#include "capabilities.h"
+#include "domain_conf.h"
+
+#define NUM_DOMAINS 64
+#define NUM_THREADS 4
+#define NUM_ROUNDS 200
+
+static virCapsPtr caps;
+static virDomainObjListPtr doms;
+
+/* Every fourth domain is inactive. Generation 1 is what the IDs
+ * become once every domain has been restarted. */
+#define DOMAIN_ID(i, gen) \
+    ((i) % 4 == 3 ? -1 : (i) + 1 + (gen) * NUM_DOMAINS)
+#define NUM_ACTIVE (NUM_DOMAINS - NUM_DOMAINS / 4)
+
+static void
+testDomainUUID(int i, unsigned char *uuid)
+{
+    memset(uuid, 0, VIR_UUID_BUFLEN);
+    uuid[0] = 0x42;
+    uuid[VIR_UUID_BUFLEN - 1] = i & 0xff;
+}
+
+static virDomainDefPtr
+testDomainDef(const char *name, int i, int id)
+{
+    virDomainDefPtr def;
+
+    if (VIR_ALLOC(def) < 0 || !(def->name = strdup(name))) {
+        VIR_FREE(def);
+        return NULL;
+    }
+    testDomainUUID(i, def->uuid);
+    def->virtType = VIR_DOMAIN_VIRT_QEMU;
+    def->id = id;
+
+    return def;
+}
+
+static int
+testDomainAdd(const char *name, int i, int id)
+{
+    virDomainDefPtr def;
+    virDomainObjPtr vm;
+
+    if (!(def = testDomainDef(name, i, id)))
+        return -1;
+
+    if (!(vm = virDomainObjListAdd(doms, caps, def, 0, NULL))) {
+        virDomainDefFree(def);
+        return -1;
+    }
+    virObjectUnlock(vm);
+
+    return 0;
+}
+
+/* Check that domain @i is found by name, UUID and ID @id */
+static int
+testDomainFind(int i, int id)
+{
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char name[32];
+    virDomainObjPtr vm;
+    int ret = -1;
+
+    snprintf(name, sizeof(name), "dom%d", i);
+    testDomainUUID(i, uuid);
+
+    if (!(vm = virDomainObjListFindByName(doms, name)))
+        goto cleanup;
+    virObjectUnlock(vm);
+
+    if (!(vm = virDomainObjListFindByUUID(doms, uuid)) ||
+        STRNEQ(vm->def->name, name))
+        goto cleanup;
+    virObjectUnlock(vm);
+    vm = NULL;
+
+    if (id != -1 &&
+        (!(vm = virDomainObjListFindByID(doms, id)) ||
+         STRNEQ(vm->def->name, name)))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (vm)
+        virObjectUnlock(vm);
+    if (ret < 0 && virTestGetVerbose())
+        fprintf(stderr, "\nLookup of %s failed\n", name);
+    return ret;
+}
+
+static int
+testDomainNotFoundByID(int id)
+{
+    virDomainObjPtr vm;
+
+    if (!(vm = virDomainObjListFindByID(doms, id)))
+        return 0;
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "\nStale ID %d still finds %s\n", id, vm->def->name);
+    virObjectUnlock(vm);
+    return -1;
+}
+
+static int
+testListPopulate(const void *data ATTRIBUTE_UNUSED)
+{
+    int i;
+
+    for (i = 0 ; i < NUM_DOMAINS ; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "dom%d", i);
+        if (testDomainAdd(name, i, DOMAIN_ID(i, 0)) < 0)
+            return -1;
+    }
+
+    for (i = 0 ; i < NUM_DOMAINS ; i++) {
+        if (testDomainFind(i, DOMAIN_ID(i, 0)) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Drivers change domain IDs behind the list's back when
+ * restarting domains, lookups by ID must keep up */
+static int
+testListChangeID(const void *data ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    int i;
+
+    for (i = 0 ; i < NUM_DOMAINS ; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "dom%d", i);
+        if (!(vm = virDomainObjListFindByName(doms, name)))
+            return -1;
+        vm->def->id = DOMAIN_ID(i, 1);
+        virObjectUnlock(vm);
+    }
+
+    for (i = 0 ; i < NUM_DOMAINS ; i++) {
+        int oldid = DOMAIN_ID(i, 0);
+
+        if ((oldid != -1 && testDomainNotFoundByID(oldid) < 0) ||
+            testDomainFind(i, DOMAIN_ID(i, 1)) < 0)
+            return -1;
+    }
+
+    /* Stopping a domain must make its ID go away too */
+    if (!(vm = virDomainObjListFindByName(doms, "dom0")))
+        return -1;
+    vm->def->id = -1;
+    virObjectUnlock(vm);
+
+    if (testDomainNotFoundByID(DOMAIN_ID(0, 1)) < 0)
+        return -1;
+
+    if (!(vm = virDomainObjListFindByName(doms, "dom0")))
+        return -1;
+    vm->def->id = DOMAIN_ID(0, 1);
+    virObjectUnlock(vm);
+
+    return testDomainFind(0, DOMAIN_ID(0, 1));
+}
+
+/* A removed domain must be gone from every index, and its name free
+ * for another domain to take */
+static int
+testListRemove(const void *data ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    virDomainDefPtr def;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+
+    if (!(vm = virDomainObjListFindByName(doms, "dom5")))
+        return -1;
+    virDomainObjListRemove(doms, vm);
+
+    testDomainUUID(5, uuid);
+    if ((vm = virDomainObjListFindByName(doms, "dom5")) ||
+        (vm = virDomainObjListFindByUUID(doms, uuid)) ||
+        testDomainNotFoundByID(DOMAIN_ID(5, 1)) < 0) {
+        if (vm)
+            virObjectUnlock(vm);
+        return -1;
+    }
+
+    /* A name still in use can't be taken by another UUID */
+    if (!(def = testDomainDef("dom6", 5, -1)))
+        return -1;
+    if ((vm = virDomainObjListAdd(doms, caps, def, 0, NULL))) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "\nDuplicate name dom6 was accepted\n");
+        virObjectUnlock(vm);
+        return -1;
+    }
+    virDomainDefFree(def);
+    virResetLastError();
+
+    if (testDomainAdd("dom5", 5, DOMAIN_ID(5, 1)) < 0)
+        return -1;
+
+    return testDomainFind(5, DOMAIN_ID(5, 1));
+}
+
+static int
+testListCountIter(virDomainObjPtr vm ATTRIBUTE_UNUSED,
+                  void *opaque)
+{
+    int *count = opaque;
+
+    (*count)++;
+    return 0;
+}
+
+/* Check every listing API against the domains known to exist */
+static int
+testListCheckAll(void)
+{
+    int ids[NUM_DOMAINS];
+    char *names[NUM_DOMAINS];
+    bool seen[NUM_DOMAINS];
+    int nids;
+    int nnames;
+    int count = 0;
+    int ret = -1;
+    int i;
+
+    memset(seen, 0, sizeof(seen));
+
+    if (virDomainObjListNumOfDomains(doms, 1) != NUM_ACTIVE ||
+        virDomainObjListNumOfDomains(doms, 0) != NUM_DOMAINS - NUM_ACTIVE)
+        return -1;
+
+    if (virDomainObjListForEach(doms, testListCountIter, &count) < 0 ||
+        count != NUM_DOMAINS)
+        return -1;
+
+    nids = virDomainObjListGetActiveIDs(doms, ids, NUM_DOMAINS);
+    if (nids != NUM_ACTIVE)
+        return -1;
+    for (i = 0 ; i < nids ; i++) {
+        int idx = ids[i] - 1 - NUM_DOMAINS;
+
+        if (idx < 0 || idx >= NUM_DOMAINS || seen[idx] ||
+            DOMAIN_ID(idx, 1) != ids[i])
+            return -1;
+        seen[idx] = true;
+    }
+
+    nnames = virDomainObjListGetInactiveNames(doms, names, NUM_DOMAINS);
+    if (nnames != NUM_DOMAINS - NUM_ACTIVE)
+        goto cleanup;
+    for (i = 0 ; i < nnames ; i++) {
+        int idx;
+
+        if (sscanf(names[i], "dom%d", &idx) != 1 ||
+            idx < 0 || idx >= NUM_DOMAINS || seen[idx] ||
+            DOMAIN_ID(idx, 1) != -1)
+            goto cleanup;
+        seen[idx] = true;
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0 ; i < nnames ; i++)
+        VIR_FREE(names[i]);
+    return ret;
+}
+
+static int
+testListListing(const void *data ATTRIBUTE_UNUSED)
+{
+    return testListCheckAll();
+}
+
+struct testWorkerData {
+    virThread thread;
+    int failed;
+};
+
+static void
+testListWorker(void *opaque)
+{
+    struct testWorkerData *data = opaque;
+    int i;
+
+    for (i = 0 ; i < NUM_ROUNDS ; i++) {
+        int idx = i % NUM_DOMAINS;
+
+        if (testListCheckAll() < 0 ||
+            testDomainFind(idx, DOMAIN_ID(idx, 1)) < 0) {
+            data->failed = 1;
+            return;
+        }
+    }
+}
+
+/* Listing only takes the list lock for reading, so several threads
+ * must be able to list and look up domains at once */
+static int
+testListConcurrent(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testWorkerData workers[NUM_THREADS];
+    int nthreads;
+    int ret = 0;
+    int i;
+
+    memset(workers, 0, sizeof(workers));
+
+    for (nthreads = 0 ; nthreads < NUM_THREADS ; nthreads++) {
+        if (virThreadCreate(&workers[nthreads].thread, true,
+                            testListWorker, &workers[nthreads]) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+
+    for (i = 0 ; i < nthreads ; i++) {
+        virThreadJoin(&workers[i].thread);
+        if (workers[i].failed)
+            ret = -1;
+    }
+
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virThreadInitialize() < 0 ||
+        !(caps = virCapabilitiesNew(VIR_ARCH_X86_64, 0, 0)) ||
+        !(doms = virDomainObjListNew()))
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Populate", 1, testListPopulate, NULL) < 0 ||
+        virtTestRun("Lookup after ID change", 1, testListChangeID, NULL) < 0 ||
+        virtTestRun("Remove", 1, testListRemove, NULL) < 0 ||
+        virtTestRun("Listing", 1, testListListing, NULL) < 0 ||
+        virtTestRun("Concurrent listing", 1, testListConcurrent, NULL) < 0)
+        ret = -1;
+
+    virObjectUnref(doms);
+    virObjectUnref(caps);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
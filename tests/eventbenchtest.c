@@ -0,0 +1,219 @@
+/*
+ * eventbenchtest.c: Measure dispatch latency of the event loop impls
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virthread.h"
+#include "virlog.h"
+#include "virutil.h"
+#include "virfile.h"
+#include "viralloc.h"
+#include "vireventpoll.h"
+#include "vireventepoll.h"
+
+/* Every handle needs both ends of a pipe, so the number actually
+ * used is lowered if the file limit can't be raised far enough */
+#define NUM_HANDLES 10000
+#define NUM_TIMERS 1000
+#define NUM_ITERATIONS 500
+
+struct testEventImpl {
+    const char *name;
+    int (*init)(void);
+    int (*addHandle)(int, int, virEventHandleCallback, void *, virFreeCallback);
+    int (*addTimeout)(int, virEventTimeoutCallback, void *, virFreeCallback);
+    int (*runOnce)(void);
+};
+
+static struct testEventImpl impls[] = {
+    { "poll", virEventPollInit, virEventPollAddHandle,
+      virEventPollAddTimeout, virEventPollRunOnce },
+#ifdef HAVE_SYS_EPOLL_H
+    { "epoll", virEventEpollInit, virEventEpollAddHandle,
+      virEventEpollAddTimeout, virEventEpollRunOnce },
+#endif
+};
+
+static int (*pipes)[2];
+static int npipes;
+static int lastFired;
+static int timerFired;
+
+static void
+testBenchReader(int watch ATTRIBUTE_UNUSED,
+                int fd,
+                int events ATTRIBUTE_UNUSED,
+                void *opaque)
+{
+    char c;
+
+    ignore_value(saferead(fd, &c, 1));
+    lastFired = (intptr_t)opaque;
+}
+
+static void
+testBenchTimer(int timer ATTRIBUTE_UNUSED,
+               void *opaque ATTRIBUTE_UNUSED)
+{
+    timerFired = 1;
+}
+
+static unsigned long long
+testBenchNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int
+testBenchSetup(const void *data)
+{
+    const struct testEventImpl *impl = data;
+    int i;
+
+    if (impl->init() < 0)
+        return -1;
+
+    for (i = 0 ; i < npipes ; i++) {
+        if (impl->addHandle(pipes[i][0], VIR_EVENT_HANDLE_READABLE,
+                            testBenchReader, (void *)(intptr_t)i, NULL) < 0)
+            return -1;
+    }
+
+    /* Armed, but far enough in the future never to fire */
+    for (i = 0 ; i < NUM_TIMERS ; i++) {
+        if (impl->addTimeout(3600 * 1000, testBenchTimer, NULL, NULL) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+testBenchDispatch(const void *data)
+{
+    const struct testEventImpl *impl = data;
+    unsigned long long total = 0;
+    int i;
+
+    for (i = 0 ; i < NUM_ITERATIONS ; i++) {
+        int idx = (i * 7919) % npipes;
+        unsigned long long start;
+        char c = '1';
+
+        lastFired = -1;
+        start = testBenchNow();
+        if (safewrite(pipes[idx][1], &c, 1) != 1)
+            return -1;
+        if (impl->runOnce() < 0)
+            return -1;
+        total += testBenchNow() - start;
+
+        if (lastFired != idx) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "\nExpected handle %d to fire, got %d\n",
+                        idx, lastFired);
+            return -1;
+        }
+    }
+
+    if (timerFired)
+        return -1;
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "\n%s: %d handles, %d timers, "
+                "average dispatch latency %llu us\n",
+                impl->name, npipes, NUM_TIMERS, total / NUM_ITERATIONS);
+
+    return 0;
+}
+
+static int
+mymain(void)
+{
+    struct rlimit rlim;
+    char *name = NULL;
+    int ret = 0;
+    int i;
+
+    if (virThreadInitialize() < 0)
+        return EXIT_FAILURE;
+
+    /* Both loops are set up side by side, each also needing
+     * a wakeup pipe and the test harness a few more fds */
+    if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+        return EXIT_FAILURE;
+    if (rlim.rlim_cur < NUM_HANDLES * 2 + 64) {
+        rlim.rlim_cur = MIN(rlim.rlim_max, NUM_HANDLES * 2 + 64);
+        ignore_value(setrlimit(RLIMIT_NOFILE, &rlim));
+        if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+            return EXIT_FAILURE;
+    }
+    npipes = MIN(NUM_HANDLES, ((int)rlim.rlim_cur - 64) / 2);
+    if (npipes < 100)
+        return EXIT_AM_SKIP;
+
+    if (VIR_ALLOC_N(pipes, npipes) < 0)
+        return EXIT_FAILURE;
+
+    for (i = 0 ; i < npipes ; i++) {
+        if (pipe(pipes[i]) < 0) {
+            fprintf(stderr, "Cannot create pipe: %d", errno);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(impls) ; i++) {
+        VIR_FREE(name);
+        if (virAsprintf(&name, "%s setup", impls[i].name) < 0)
+            return EXIT_FAILURE;
+        if (virtTestRun(name, 1, testBenchSetup, &impls[i]) < 0) {
+            ret = -1;
+            continue;
+        }
+
+        VIR_FREE(name);
+        if (virAsprintf(&name, "%s dispatch latency with %d handles",
+                        impls[i].name, npipes) < 0)
+            return EXIT_FAILURE;
+        if (virtTestRun(name, 1, testBenchDispatch, &impls[i]) < 0)
+            ret = -1;
+    }
+
+    VIR_FREE(name);
+    for (i = 0 ; i < npipes ; i++) {
+        VIR_FORCE_CLOSE(pipes[i][0]);
+        VIR_FORCE_CLOSE(pipes[i][1]);
+    }
+    VIR_FREE(pipes);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
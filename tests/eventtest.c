@@ -32,6 +32,27 @@
 #include "virlog.h"
 #include "virutil.h"
 #include "vireventpoll.h"
+#include "vireventepoll.h"
+
+/* The same suite is built twice, once against each event loop
+ * implementation */
+#ifdef TEST_EVENT_EPOLL
+# define testEventInit virEventEpollInit
+# define testEventAddHandle virEventEpollAddHandle
+# define testEventRemoveHandle virEventEpollRemoveHandle
+# define testEventAddTimeout virEventEpollAddTimeout
+# define testEventUpdateTimeout virEventEpollUpdateTimeout
+# define testEventRemoveTimeout virEventEpollRemoveTimeout
+# define testEventRunOnce virEventEpollRunOnce
+#else
+# define testEventInit virEventPollInit
+# define testEventAddHandle virEventPollAddHandle
+# define testEventRemoveHandle virEventPollRemoveHandle
+# define testEventAddTimeout virEventPollAddTimeout
+# define testEventUpdateTimeout virEventPollUpdateTimeout
+# define testEventRemoveTimeout virEventPollRemoveTimeout
+# define testEventRunOnce virEventPollRunOnce
+#endif
 
 #define NUM_FDS 31
 #define NUM_TIME 31
@@ -89,7 +110,7 @@ testPipeReader(int watch, int fd, int events, void *data)
     info->error = EV_ERROR_NONE;
 
     if (info->delete != -1)
-        virEventPollRemoveHandle(info->delete);
+        testEventRemoveHandle(info->delete);
 }
 
 
@@ -108,7 +129,7 @@ testTimer(int timer, void *data)
     info->error = EV_ERROR_NONE;
 
     if (info->delete != -1)
-        virEventPollRemoveTimeout(info->delete);
+        testEventRemoveTimeout(info->delete);
 }
 
 static pthread_mutex_t eventThreadMutex = PTHREAD_MUTEX_INITIALIZER;
@@ -127,7 +148,7 @@ ATTRIBUTE_NORETURN static void *eventThreadLoop(void *data ATTRIBUTE_UNUSED) {
         eventThreadRunOnce = 0;
         pthread_mutex_unlock(&eventThreadMutex);
 
-        virEventPollRunOnce();
+        testEventRunOnce();
 
         pthread_mutex_lock(&eventThreadMutex);
         eventThreadJobDone = 1;
@@ -264,6 +285,10 @@ mymain(void)
     pthread_t eventThread;
     char one = '1';
 
+#if defined(TEST_EVENT_EPOLL) && !defined(HAVE_SYS_EPOLL_H)
+    return EXIT_AM_SKIP;
+#endif
+
     for (i = 0 ; i < NUM_FDS ; i++) {
         if (pipe(handles[i].pipeFD) < 0) {
             fprintf(stderr, "Cannot create pipe: %d", errno);
@@ -279,24 +304,24 @@ mymain(void)
         return EXIT_FAILURE;
     }
 
-    virEventPollInit();
+    testEventInit();
 
     for (i = 0 ; i < NUM_FDS ; i++) {
         handles[i].delete = -1;
         handles[i].watch =
-            virEventPollAddHandle(handles[i].pipeFD[0],
-                                  VIR_EVENT_HANDLE_READABLE,
-                                  testPipeReader,
-                                  &handles[i], NULL);
+            testEventAddHandle(handles[i].pipeFD[0],
+                               VIR_EVENT_HANDLE_READABLE,
+                               testPipeReader,
+                               &handles[i], NULL);
     }
 
     for (i = 0 ; i < NUM_TIME ; i++) {
         timers[i].delete = -1;
         timers[i].timeout = -1;
         timers[i].timer =
-            virEventPollAddTimeout(timers[i].timeout,
-                                   testTimer,
-                                   &timers[i], NULL);
+            testEventAddTimeout(timers[i].timeout,
+                                testTimer,
+                                &timers[i], NULL);
     }
 
     pthread_create(&eventThread, NULL, eventThreadLoop, NULL);
@@ -315,7 +340,7 @@ mymain(void)
 
     /* Now lets delete one before starting poll(), and
      * try triggering another handle */
-    virEventPollRemoveHandle(handles[0].watch);
+    testEventRemoveHandle(handles[0].watch);
     startJob();
     if (safewrite(handles[1].pipeFD[1], &one, 1) != 1)
         return EXIT_FAILURE;
@@ -335,7 +360,7 @@ mymain(void)
     sched_yield();
     usleep(100 * 1000);
     pthread_mutex_lock(&eventThreadMutex);
-    virEventPollRemoveHandle(handles[1].watch);
+    testEventRemoveHandle(handles[1].watch);
     if (finishJob("Interrupted during poll", -1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
@@ -371,22 +396,22 @@ mymain(void)
 
 
     /* Run a timer on its own */
-    virEventPollUpdateTimeout(timers[1].timer, 100);
+    testEventUpdateTimeout(timers[1].timer, 100);
     startJob();
     if (finishJob("Firing a timer", -1, 1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[1].timer, -1);
+    testEventUpdateTimeout(timers[1].timer, -1);
 
     resetAll();
 
     /* Now lets delete one before starting poll(), and
      * try triggering another timer */
-    virEventPollUpdateTimeout(timers[1].timer, 100);
-    virEventPollRemoveTimeout(timers[0].timer);
+    testEventUpdateTimeout(timers[1].timer, 100);
+    testEventRemoveTimeout(timers[0].timer);
     startJob();
     if (finishJob("Deleted before poll", -1, 1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[1].timer, -1);
+    testEventUpdateTimeout(timers[1].timer, -1);
 
     resetAll();
 
@@ -401,7 +426,7 @@ mymain(void)
     sched_yield();
     usleep(100 * 1000);
     pthread_mutex_lock(&eventThreadMutex);
-    virEventPollRemoveTimeout(timers[1].timer);
+    testEventRemoveTimeout(timers[1].timer);
     if (finishJob("Interrupted during poll", -1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
@@ -414,27 +439,27 @@ mymain(void)
      * before poll() exits for the first safewrite(). We don't
      * see a hard failure in other cases, so nothing to worry
      * about */
-    virEventPollUpdateTimeout(timers[2].timer, 100);
-    virEventPollUpdateTimeout(timers[3].timer, 100);
+    testEventUpdateTimeout(timers[2].timer, 100);
+    testEventUpdateTimeout(timers[3].timer, 100);
     startJob();
     timers[2].delete = timers[3].timer;
     if (finishJob("Deleted during dispatch", -1, 2) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[2].timer, -1);
+    testEventUpdateTimeout(timers[2].timer, -1);
 
     resetAll();
 
     /* Extreme fun, lets delete ourselves during dispatch */
-    virEventPollUpdateTimeout(timers[2].timer, 100);
+    testEventUpdateTimeout(timers[2].timer, 100);
     startJob();
     timers[2].delete = timers[2].timer;
     if (finishJob("Deleted during dispatch", -1, 2) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
     for (i = 0 ; i < NUM_FDS - 1 ; i++)
-        virEventPollRemoveHandle(handles[i].watch);
+        testEventRemoveHandle(handles[i].watch);
     for (i = 0 ; i < NUM_TIME - 1 ; i++)
-        virEventPollRemoveTimeout(timers[i].timer);
+        testEventRemoveTimeout(timers[i].timer);
 
     resetAll();
 
@@ -455,14 +480,14 @@ mymain(void)
     handles[0].pipeFD[0] = handles[1].pipeFD[0];
     handles[0].pipeFD[1] = handles[1].pipeFD[1];
 
-    handles[0].watch = virEventPollAddHandle(handles[0].pipeFD[0],
-                                             0,
-                                             testPipeReader,
-                                             &handles[0], NULL);
-    handles[1].watch = virEventPollAddHandle(handles[1].pipeFD[0],
-                                             VIR_EVENT_HANDLE_READABLE,
-                                             testPipeReader,
-                                             &handles[1], NULL);
+    handles[0].watch = testEventAddHandle(handles[0].pipeFD[0],
+                                          0,
+                                          testPipeReader,
+                                          &handles[0], NULL);
+    handles[1].watch = testEventAddHandle(handles[1].pipeFD[0],
+                                          VIR_EVENT_HANDLE_READABLE,
+                                          testPipeReader,
+                                          &handles[1], NULL);
     startJob();
     if (safewrite(handles[1].pipeFD[1], &one, 1) != 1)
         return EXIT_FAILURE;
@@ -7,6 +7,8 @@
 
 #include "internal.h"
 #include "virjson.h"
+#include "viralloc.h"
+#include "virutil.h"
 #include "testutils.h"
 
 struct testInfo {
@@ -54,6 +56,90 @@ cleanup:
 }
 
 
+/* Feed two copies of the document to a stream parser a few bytes
+ * at a time, the way the qemu monitor receives replies */
+static int
+testJSONStreamParse(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONStreamParserPtr stream = NULL;
+    virJSONValuePtr json = NULL;
+    char *doc = NULL;
+    char *orig = NULL;
+    size_t len;
+    size_t start = 0;
+    size_t avail = 0;
+    size_t chunk;
+    int nvalues = 0;
+    int ret = -1;
+
+    if (virAsprintf(&doc, "%s\r\n%s\r\n", info->doc, info->doc) < 0)
+        goto cleanup;
+    len = strlen(doc);
+
+    if (!(json = virJSONValueFromString(info->doc)) ||
+        !(orig = virJSONValueToString(json, false)))
+        goto cleanup;
+    virJSONValueFree(json);
+    json = NULL;
+
+    if (!(stream = virJSONStreamParserNew()))
+        goto cleanup;
+
+    for (chunk = 1 ; avail < len ; chunk++) {
+        size_t used;
+        int rc;
+
+        avail = MIN(avail + chunk, len);
+        while ((rc = virJSONStreamParserFeed(stream, doc + start,
+                                             avail - start,
+                                             &used, &json)) == 1) {
+            char *str = virJSONValueToString(json, false);
+            bool same;
+
+            virJSONValueFree(json);
+            json = NULL;
+            if (!str)
+                goto cleanup;
+
+            /* Should match what parsing the whole document gives */
+            same = STREQ(str, orig);
+            VIR_FREE(str);
+            if (!same) {
+                if (virTestGetVerbose())
+                    fprintf(stderr, "Stream value %d differs from %s\n",
+                            nvalues, info->doc);
+                goto cleanup;
+            }
+
+            start += used;
+            nvalues++;
+        }
+        if (rc < 0) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "Fail to stream parse %s\n", info->doc);
+            goto cleanup;
+        }
+    }
+
+    if (nvalues != 2) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "Expected 2 values from stream, got %d\n",
+                    nvalues);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virJSONValueFree(json);
+    virJSONStreamParserFree(stream);
+    VIR_FREE(orig);
+    VIR_FREE(doc);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -67,7 +153,8 @@ mymain(void)
     } while (0)
 
 #define DO_TEST_PARSE(name, doc)                \
-    DO_TEST_FULL(name, FromString, doc, true)
+    DO_TEST_FULL(name, FromString, doc, true);  \
+    DO_TEST_FULL(name " stream", StreamParse, doc, true)
 
     DO_TEST_PARSE("Simple", "{\"return\": {}, \"id\": \"libvirt-1\"}");
     DO_TEST_PARSE("NotSoSimple", "{\"QMP\": {\"version\": {\"qemu\":"
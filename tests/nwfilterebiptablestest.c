@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "viralloc.h"
+#include "virbuffer.h"
+#include "nwfilter_conf.h"
+#include "nwfilter/nwfilter_ebiptables_driver.h"
+
+/* Templates in the form the driver creates them: a shell variable
+ * holding the command, followed by its execution */
+#define TEMPLATE(cmd) \
+    "cmd='" cmd "'\n" \
+    "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n"
+
+#define TCP_IN "$IPT -%c FI-vnet0 %s -p tcp --dport 80 -j RETURN"
+#define UDP_OUT "$IPT -%c FO-vnet0 %s -p udp --sport 53 -j ACCEPT"
+#define ICMP6_IN "$IPT -%c FI-vnet0 %s -p icmpv6 -j DROP"
+
+struct testCompileRule {
+    const char *template;
+    enum RuleType ruleType;
+};
+
+struct testCompileData {
+    const struct testCompileRule *rules;
+    size_t nrules;
+    enum RuleType ruleType;
+    const char *expect;     /* NULL if the rules need the shell */
+};
+
+static int
+testCompileRules(const void *opaque)
+{
+    const struct testCompileData *data = opaque;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    ebiptablesRuleInst *insts = NULL;
+    ebiptablesRuleInstPtr *inst = NULL;
+    char *actual = NULL;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(insts, data->nrules) < 0 ||
+        VIR_ALLOC_N(inst, data->nrules) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < data->nrules ; i++) {
+        insts[i].commandTemplate = (char *) data->rules[i].template;
+        insts[i].ruleType = data->rules[i].ruleType;
+        inst[i] = &insts[i];
+    }
+
+    rc = iptablesCompileRules(&buf, data->nrules, inst, data->ruleType);
+
+    if (!data->expect) {
+        if (rc == 0) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "rules needing the shell were compiled\n");
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (rc < 0 || !(actual = virBufferContentAndReset(&buf)))
+        goto cleanup;
+
+    if (STRNEQ(actual, data->expect)) {
+        virtTestDifference(stderr, data->expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(actual);
+    VIR_FREE(inst);
+    VIR_FREE(insts);
+    return ret;
+}
+
+static const struct testCompileRule mixedRules[] = {
+    { TEMPLATE(TCP_IN), RT_IPTABLES },
+    { TEMPLATE(ICMP6_IN), RT_IP6TABLES },
+    { TEMPLATE("$EBT -t nat -%c libvirt-I-vnet0 %s -j ACCEPT"),
+      RT_EBTABLES },
+    { TEMPLATE(UDP_OUT), RT_IPTABLES },
+};
+
+/* A variable expanded by the shell can't go to iptables-restore */
+static const struct testCompileRule variableRules[] = {
+    { TEMPLATE(TCP_IN), RT_IPTABLES },
+    { TEMPLATE("$IPT -%c FI-vnet0 %s -s $IP -j RETURN"), RT_IPTABLES },
+};
+
+/* Neither can a command substitution */
+static const struct testCompileRule substRules[] = {
+    { TEMPLATE("$IPT -%c FI-vnet0 %s -s `cat ip` -j RETURN"), RT_IPTABLES },
+};
+
+/* Nor a rule guarded by a shell test */
+static const struct testCompileRule prefixRules[] = {
+    { "if [ 1 -eq 1 ]; then\n" TEMPLATE(TCP_IN) "fi\n", RT_IPTABLES },
+};
+
+/* Nor anything run after the rule */
+static const struct testCompileRule suffixRules[] = {
+    { TEMPLATE(TCP_IN) "echo done\n", RT_IPTABLES },
+};
+
+/* Nor something other than the iptables command */
+static const struct testCompileRule otherRules[] = {
+    { TEMPLATE("$EBT -t nat -%c libvirt-I-vnet0 %s -j ACCEPT"),
+      RT_IPTABLES },
+};
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(name, rules, ruleType, expect)                          \
+    do {                                                                \
+        struct testCompileData data = {                                 \
+            rules, ARRAY_CARDINALITY(rules), ruleType, expect,          \
+        };                                                              \
+        if (virtTestRun("Compile " name, 1,                             \
+                        testCompileRules, &data) < 0)                   \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("iptables rules", mixedRules, RT_IPTABLES,
+            "*filter\n"
+            "-A FI-vnet0  -p tcp --dport 80 -j RETURN\n"
+            "-A FO-vnet0  -p udp --sport 53 -j ACCEPT\n"
+            "COMMIT\n");
+    DO_TEST("ip6tables rules", mixedRules, RT_IP6TABLES,
+            "*filter\n"
+            "-A FI-vnet0  -p icmpv6 -j DROP\n"
+            "COMMIT\n");
+    DO_TEST("shell variable", variableRules, RT_IPTABLES, NULL);
+    DO_TEST("command substitution", substRules, RT_IPTABLES, NULL);
+    DO_TEST("guarded rule", prefixRules, RT_IPTABLES, NULL);
+    DO_TEST("trailing command", suffixRules, RT_IPTABLES, NULL);
+    DO_TEST("other command", otherRules, RT_IPTABLES, NULL);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
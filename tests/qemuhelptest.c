@@ -122,6 +122,46 @@ cleanup:
     return ret;
 }
 
+static int testCacheRoundTrip(const void *data)
+{
+    const struct testInfo *info = data;
+    virQEMUCapsPtr loaded = NULL;
+    unsigned long libvirtVersion;
+    char *xml = NULL;
+    char *xml2 = NULL;
+    int ret = -1;
+
+    if (!(xml = virQEMUCapsFormatCache(info->flags)))
+        goto cleanup;
+
+    if (!(loaded = virQEMUCapsNew()))
+        goto cleanup;
+
+    if (virQEMUCapsParseCacheString(loaded, xml, &libvirtVersion) < 0)
+        goto cleanup;
+
+    if (libvirtVersion != LIBVIR_VERSION_NUMBER) {
+        fprintf(stderr, "%s: cached libvirt version mismatch: got %lu\n",
+                info->name, libvirtVersion);
+        goto cleanup;
+    }
+
+    if (!(xml2 = virQEMUCapsFormatCache(loaded)))
+        goto cleanup;
+
+    if (STRNEQ(xml, xml2)) {
+        virtTestDifference(stderr, xml, xml2);
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virObjectUnref(loaded);
+    VIR_FREE(xml);
+    VIR_FREE(xml2);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -138,6 +178,9 @@ mymain(void)
         if (virtTestRun("QEMU Help String Parsing " name,                   \
                         1, testHelpStrParsing, &info) < 0)                  \
             ret = -1;                                                       \
+        if (virtTestRun("QEMU Capabilities Cache " name,                    \
+                        1, testCacheRoundTrip, &info) < 0)                  \
+            ret = -1;                                                       \
         virObjectUnref(info.flags);                                         \
     } while (0)
 
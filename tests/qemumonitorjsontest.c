@@ -438,6 +438,70 @@ cleanup:
 }
 
 
+/* A malformed entry for one disk must not hide the stats of another */
+static int
+testQemuMonitorJSONGetBlockStatsInfo(const void *data)
+{
+    virCapsPtr caps = (virCapsPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNew(true, caps);
+    int ret = -1;
+    long long rd_req, rd_bytes, rd_total_times;
+    long long wr_req, wr_bytes, wr_total_times;
+    long long flush_req, flush_total_times, errs;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-blockstats",
+                               "{ "
+                               "  \"return\": [ "
+                               "   { "
+                               "     \"device\": \"drive-ide0-0-0\", "
+                               "     \"stats\": { "
+                               "       \"rd_bytes\": \"bogus\" "
+                               "     } "
+                               "   }, "
+                               "   { "
+                               "     \"device\": \"drive-virtio-disk0\", "
+                               "     \"stats\": { "
+                               "       \"rd_bytes\": 1024, "
+                               "       \"rd_operations\": 2, "
+                               "       \"rd_total_time_ns\": 300, "
+                               "       \"wr_bytes\": 4096, "
+                               "       \"wr_operations\": 5, "
+                               "       \"wr_total_time_ns\": 600, "
+                               "       \"flush_operations\": 7, "
+                               "       \"flush_total_time_ns\": 800 "
+                               "     } "
+                               "   } "
+                               "  ]"
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetBlockStatsInfo(qemuMonitorTestGetMonitor(test),
+                                     "virtio-disk0",
+                                     &rd_req, &rd_bytes, &rd_total_times,
+                                     &wr_req, &wr_bytes, &wr_total_times,
+                                     &flush_req, &flush_total_times,
+                                     &errs) < 0)
+        goto cleanup;
+
+    if (rd_req != 2 || rd_bytes != 1024 || rd_total_times != 300 ||
+        wr_req != 5 || wr_bytes != 4096 || wr_total_times != 600 ||
+        flush_req != 7 || flush_total_times != 800) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected stats for virtio-disk0");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -461,6 +525,7 @@ mymain(void)
     DO_TEST(GetMachines);
     DO_TEST(GetCPUDefinitions);
     DO_TEST(GetCommands);
+    DO_TEST(GetBlockStatsInfo);
 
     virObjectUnref(caps);
 
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "storage/storage_backend.h"
+
+#define datadir abs_builddir "/storagebackendcopydata"
+#define inputpath datadir "/input.img"
+#define outputpath datadir "/output.img"
+
+/* Must match the chunk size the copy is split up by */
+#define CHUNK_SIZE (8 * 1024 * 1024)
+
+/* Three chunks, the last one short */
+#define INPUT_SIZE (2 * CHUNK_SIZE + 12345)
+
+/* Where the input has data. The rest of it is holes, apart from
+ * the explicitly written zeros, which sparse copies skip too. */
+struct testExtent {
+    off_t offset;
+    size_t len;
+    bool zero;
+};
+
+static const struct testExtent inputExtents[] = {
+    { 0, 64 * 1024, false },
+    { CHUNK_SIZE - 4096, 8192, false },          /* across chunks */
+    { CHUNK_SIZE + CHUNK_SIZE / 2, 1024 * 1024, true },
+    { 2 * CHUNK_SIZE, 12345, false },            /* the tail */
+};
+
+struct testCopyData {
+    const char *input;
+    unsigned long long allocation;
+    const char *error;          /* expected in the error, or NULL */
+};
+
+
+static int
+testWriteInput(void)
+{
+    char *buf = NULL;
+    int fd = -1;
+    int ret = -1;
+    size_t i, j;
+
+    if ((fd = open(inputpath, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        ftruncate(fd, INPUT_SIZE) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(inputExtents) ; i++) {
+        const struct testExtent *ext = inputExtents + i;
+
+        if (VIR_ALLOC_N(buf, ext->len) < 0)
+            goto cleanup;
+        if (!ext->zero) {
+            for (j = 0 ; j < ext->len ; j++)
+                buf[j] = (ext->offset + j) % 251 + 1;
+        }
+        if (lseek(fd, ext->offset, SEEK_SET) < 0 ||
+            safewrite(fd, buf, ext->len) != ext->len)
+            goto cleanup;
+        VIR_FREE(buf);
+    }
+
+    if (VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(buf);
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
+/* The first @len bytes of the output must match the input, and
+ * everything after them must read back as zeros */
+static int
+testCompareOutput(unsigned long long len)
+{
+    char *inbuf = NULL;
+    char *outbuf = NULL;
+    int infd = -1;
+    int outfd = -1;
+    off_t offset = 0;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(inbuf, CHUNK_SIZE) < 0 ||
+        VIR_ALLOC_N(outbuf, CHUNK_SIZE) < 0)
+        goto cleanup;
+
+    if ((infd = open(inputpath, O_RDONLY)) < 0 ||
+        (outfd = open(outputpath, O_RDONLY)) < 0)
+        goto cleanup;
+
+    while (offset < INPUT_SIZE) {
+        size_t want = MIN(CHUNK_SIZE, INPUT_SIZE - offset);
+
+        if (saferead(infd, inbuf, want) != want ||
+            saferead(outfd, outbuf, want) != want)
+            goto cleanup;
+
+        if (offset + want > len)
+            memset(inbuf + (len > offset ? len - offset : 0), 0,
+                   offset + want - MAX(len, offset));
+
+        if (memcmp(inbuf, outbuf, want) != 0) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "output differs in the chunk at %llu\n",
+                        (unsigned long long) offset);
+            goto cleanup;
+        }
+        offset += want;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(infd);
+    VIR_FORCE_CLOSE(outfd);
+    VIR_FREE(inbuf);
+    VIR_FREE(outbuf);
+    return ret;
+}
+
+
+static int
+testStorageCopy(const void *opaque)
+{
+    const struct testCopyData *data = opaque;
+    virStoragePoolDef pooldef;
+    virStoragePoolObj pool;
+    virStorageVolDef vol;
+    virStorageVolDef inputvol;
+    virErrorPtr err;
+    struct stat sb;
+    size_t datalen = 0;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    memset(&pooldef, 0, sizeof(pooldef));
+    memset(&pool, 0, sizeof(pool));
+    memset(&vol, 0, sizeof(vol));
+    memset(&inputvol, 0, sizeof(inputvol));
+
+    pooldef.type = VIR_STORAGE_POOL_DIR;
+    pool.def = &pooldef;
+
+    vol.target.path = (char *) outputpath;
+    vol.target.perms.mode = 0600;
+    vol.target.perms.uid = getuid();
+    vol.target.perms.gid = getgid();
+    vol.capacity = INPUT_SIZE;
+    vol.allocation = data->allocation;
+    inputvol.target.path = (char *) data->input;
+
+    unlink(outputpath);
+    virResetLastError();
+
+    rc = virStorageBackendCreateRaw(NULL, &pool, &vol, &inputvol, 0);
+
+    if (data->error) {
+        err = virGetLastError();
+        if (rc == 0 || !err || !err->message ||
+            !strstr(err->message, data->error)) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "expected an error with '%s', got '%s'\n",
+                        data->error,
+                        err && err->message ? err->message : "none");
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (rc < 0 ||
+        testCompareOutput(data->allocation) < 0 ||
+        stat(outputpath, &sb) < 0)
+        goto cleanup;
+
+    /* Only the non-zero data may have been written out, allowing for
+     * filesystem blocks being bigger than the extents */
+    for (i = 0 ; i < ARRAY_CARDINALITY(inputExtents) ; i++) {
+        if (!inputExtents[i].zero)
+            datalen += inputExtents[i].len;
+    }
+    if ((unsigned long long) sb.st_blocks * 512 > datalen + 1024 * 1024) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "holes were filled in, %llu bytes allocated\n",
+                    (unsigned long long) sb.st_blocks * 512);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    unlink(outputpath);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (mkdir(datadir, 0700) < 0 && errno != EEXIST) {
+        fprintf(stderr, "unable to create %s\n", datadir);
+        return EXIT_FAILURE;
+    }
+    if (testWriteInput() < 0) {
+        fprintf(stderr, "unable to create %s\n", inputpath);
+        ret = -1;
+        goto cleanup;
+    }
+
+#define DO_TEST(name, input, allocation, error)                         \
+    do {                                                                \
+        struct testCopyData data = { input, allocation, error };        \
+        if (virtTestRun("Storage copy " name, 1,                        \
+                        testStorageCopy, &data) < 0)                    \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("whole sparse file", inputpath, INPUT_SIZE, NULL);
+    DO_TEST("up to a partial chunk", inputpath, CHUNK_SIZE + 100, NULL);
+    DO_TEST("from a missing file", datadir "/missing.img", INPUT_SIZE,
+            "could not open input path");
+    DO_TEST("from a directory", datadir, INPUT_SIZE,
+            "failed reading from file");
+
+cleanup:
+    unlink(inputpath);
+    rmdir(datadir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
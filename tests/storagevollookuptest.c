@@ -0,0 +1,284 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "storage_conf.h"
+#include "viralloc.h"
+
+static const char *poolXML =
+    "<pool type='dir'>"
+    "  <name>lookup</name>"
+    "  <uuid>e4a2a7a5-8b8f-4a1c-9d0e-5e6f7a8b9c0d</uuid>"
+    "  <target><path>/var/lib/lookup</path></target>"
+    "</pool>";
+
+static virStorageVolDefPtr
+testVolNew(const char *name, const char *key, const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if (VIR_ALLOC(vol) < 0)
+        return NULL;
+
+    if (!(vol->name = strdup(name)) ||
+        (key && !(vol->key = strdup(key))) ||
+        (path && !(vol->target.path = strdup(path)))) {
+        virStorageVolDefFree(vol);
+        return NULL;
+    }
+
+    return vol;
+}
+
+static int
+testVolAdd(virStoragePoolObjPtr pool,
+           const char *name, const char *key, const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if (!(vol = testVolNew(name, key, path)))
+        return -1;
+
+    if (virStoragePoolObjAddVol(pool, vol) < 0) {
+        virStorageVolDefFree(vol);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Check that @key and @path lead to volume @name, or to none if NULL */
+static int
+testVolFind(virStoragePoolObjPtr pool,
+            const char *key, const char *path, const char *name)
+{
+    virStorageVolDefPtr vol;
+    const char *found;
+
+    if (key) {
+        vol = virStorageVolDefFindByKey(pool, key);
+        found = vol ? vol->name : NULL;
+        if (STRNEQ_NULLABLE(found, name)) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "key %s found %s, expected %s\n", key,
+                        NULLSTR(found), NULLSTR(name));
+            return -1;
+        }
+    }
+
+    if (path) {
+        vol = virStorageVolDefFindByPath(pool, path);
+        found = vol ? vol->name : NULL;
+        if (STRNEQ_NULLABLE(found, name)) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "path %s found %s, expected %s\n", path,
+                        NULLSTR(found), NULLSTR(name));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static virStoragePoolObjPtr
+testPoolNew(virStoragePoolObjListPtr pools)
+{
+    virStoragePoolDefPtr def;
+    virStoragePoolObjPtr pool;
+
+    if (!(def = virStoragePoolDefParseString(poolXML)))
+        return NULL;
+
+    if (!(pool = virStoragePoolObjAssignDef(pools, def))) {
+        virStoragePoolDefFree(def);
+        return NULL;
+    }
+
+    return pool;
+}
+
+static int
+testLookup(const void *data ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjList pools = { 0, NULL };
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    if (!(pool = testPoolNew(&pools)))
+        goto cleanup;
+
+    if (testVolAdd(pool, "a.img", "/var/lib/lookup/a.img",
+                   "/var/lib/lookup/a.img") < 0 ||
+        testVolAdd(pool, "b.img", "/var/lib/lookup/b.img",
+                   "/var/lib/lookup/b.img") < 0 ||
+        testVolAdd(pool, "nokey", NULL, "/var/lib/lookup/nokey") < 0)
+        goto cleanup;
+
+    if (testVolFind(pool, "/var/lib/lookup/a.img",
+                    "/var/lib/lookup/a.img", "a.img") < 0 ||
+        testVolFind(pool, "/var/lib/lookup/b.img",
+                    "/var/lib/lookup/b.img", "b.img") < 0 ||
+        testVolFind(pool, NULL, "/var/lib/lookup/nokey", "nokey") < 0 ||
+        testVolFind(pool, "/var/lib/lookup/c.img",
+                    "/var/lib/lookup/c.img", NULL) < 0)
+        goto cleanup;
+
+    if (!(vol = virStorageVolDefFindByName(pool, "b.img")) ||
+        virStorageVolDefFindByName(pool, "c.img"))
+        goto cleanup;
+
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
+
+    if (virStorageVolDefFindByName(pool, "b.img") ||
+        testVolFind(pool, "/var/lib/lookup/b.img",
+                    "/var/lib/lookup/b.img", NULL) < 0 ||
+        testVolFind(pool, "/var/lib/lookup/a.img",
+                    "/var/lib/lookup/a.img", "a.img") < 0)
+        goto cleanup;
+
+    virStoragePoolObjClearVols(pool);
+
+    if (virStorageVolDefFindByName(pool, "a.img") ||
+        testVolFind(pool, "/var/lib/lookup/a.img",
+                    "/var/lib/lookup/a.img", NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    virStoragePoolObjListFree(&pools);
+    return ret;
+}
+
+/* Multipath LUNs share their serial: the first one added wins, and
+ * the next one takes over once it is gone */
+static int
+testLookupShared(const void *data ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjList pools = { 0, NULL };
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    if (!(pool = testPoolNew(&pools)))
+        goto cleanup;
+
+    if (testVolAdd(pool, "sda", "serial0", "/dev/sda") < 0 ||
+        testVolAdd(pool, "sdb", "serial0", "/dev/sdb") < 0 ||
+        testVolAdd(pool, "sdc", "serial0", "/dev/sdc") < 0)
+        goto cleanup;
+
+    if (testVolFind(pool, "serial0", NULL, "sda") < 0 ||
+        testVolFind(pool, NULL, "/dev/sdb", "sdb") < 0)
+        goto cleanup;
+
+    vol = virStorageVolDefFindByName(pool, "sda");
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
+
+    if (testVolFind(pool, "serial0", NULL, "sdb") < 0)
+        goto cleanup;
+
+    vol = virStorageVolDefFindByName(pool, "sdb");
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
+
+    if (testVolFind(pool, "serial0", NULL, "sdc") < 0 ||
+        testVolFind(pool, NULL, "/dev/sdb", NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    virStoragePoolObjListFree(&pools);
+    return ret;
+}
+
+/* Refreshing a network volume rebuilds its key and path */
+static int
+testLookupRekey(const void *data ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjList pools = { 0, NULL };
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    char *oldkey = NULL;
+    char *oldpath = NULL;
+    int ret = -1;
+
+    if (!(pool = testPoolNew(&pools)))
+        goto cleanup;
+
+    if (testVolAdd(pool, "img", "rbd/img", "rbd/img") < 0 ||
+        testVolAdd(pool, "dup", "pool/img", "pool/img") < 0 ||
+        !(vol = virStorageVolDefFindByName(pool, "img")))
+        goto cleanup;
+
+    oldkey = vol->key;
+    oldpath = vol->target.path;
+    if (!(vol->key = strdup("pool/img")) ||
+        !(vol->target.path = strdup("pool/img.new")))
+        goto cleanup;
+
+    if (virStoragePoolObjRekeyVol(pool, vol, oldkey, oldpath) < 0)
+        goto cleanup;
+
+    /* "dup" was indexed under that key first and keeps it */
+    if (testVolFind(pool, "rbd/img", "rbd/img", NULL) < 0 ||
+        testVolFind(pool, "pool/img", "pool/img", "dup") < 0 ||
+        testVolFind(pool, NULL, "pool/img.new", "img") < 0)
+        goto cleanup;
+
+    vol = virStorageVolDefFindByName(pool, "dup");
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
+
+    if (testVolFind(pool, "pool/img", NULL, "img") < 0 ||
+        testVolFind(pool, NULL, "pool/img", NULL) < 0)
+        goto cleanup;
+
+    /* Nothing changed, nothing moves */
+    vol = virStorageVolDefFindByName(pool, "img");
+    if (virStoragePoolObjRekeyVol(pool, vol, "pool/img", "pool/img.new") < 0 ||
+        testVolFind(pool, "pool/img", "pool/img.new", "img") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(oldkey);
+    VIR_FREE(oldpath);
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    virStoragePoolObjListFree(&pools);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Storage vol lookup", 1, testLookup, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Storage vol lookup shared key", 1,
+                    testLookupShared, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Storage vol lookup rekey", 1,
+                    testLookupRekey, NULL) < 0)
+        ret = -1;
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
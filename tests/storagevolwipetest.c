@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "libvirt_internal.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virtime.h"
+#include "storage/storage_driver.h"
+
+#define datadir abs_builddir "/storagevolwipedata"
+#define pooldir datadir "/pool"
+
+#define TEST_TIMEOUT_MS 10000
+
+/* The sparse volume is cut down in several steps, the other one
+ * spans more than one chunk of writes */
+#define SPARSE_SIZE (3ULL * 1024 * 1024 * 1024 + 4096)
+#define FULL_SIZE (65 * 1024 * 1024)
+#define DATA_SIZE (64 * 1024)
+
+static const char *poolXML =
+    "<pool type='dir'>"
+    "  <name>wipe</name>"
+    "  <target><path>" pooldir "</path></target>"
+    "</pool>";
+
+static virConnectPtr conn;
+static virStoragePoolPtr pool;
+
+struct testWipeData {
+    const char *name;
+    unsigned int flags;
+};
+
+
+/* Data at the start of @name, then up to @size either a hole or more
+ * data */
+static int
+testCreateVolume(const char *name, unsigned long long size, bool sparse)
+{
+    char *path = NULL;
+    char *buf = NULL;
+    unsigned long long offset;
+    int fd = -1;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/%s", pooldir, name) < 0 ||
+        VIR_ALLOC_N(buf, DATA_SIZE) < 0)
+        goto cleanup;
+    memset(buf, 0x5a, DATA_SIZE);
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        goto cleanup;
+
+    for (offset = 0 ; offset < (sparse ? DATA_SIZE : size) ;
+         offset += DATA_SIZE) {
+        if (safewrite(fd, buf, DATA_SIZE) != DATA_SIZE)
+            goto cleanup;
+    }
+    if (ftruncate(fd, size) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(buf);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+/* After a wipe @vol must have its size, and its data must be gone */
+static int
+testCheckWiped(virStorageVolPtr vol, unsigned long long size)
+{
+    char *path = NULL;
+    char *buf = NULL;
+    struct stat sb;
+    int fd = -1;
+    int ret = -1;
+
+    if (!(path = virStorageVolGetPath(vol)) ||
+        VIR_ALLOC_N(buf, DATA_SIZE) < 0)
+        goto cleanup;
+
+    if ((fd = open(path, O_RDONLY)) < 0 ||
+        fstat(fd, &sb) < 0 ||
+        saferead(fd, buf, DATA_SIZE) != DATA_SIZE)
+        goto cleanup;
+
+    if (sb.st_size != size) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "%s is %llu bytes after the wipe, not %llu\n",
+                    path, (unsigned long long) sb.st_size, size);
+        goto cleanup;
+    }
+    if (!virMemIsZero(buf, DATA_SIZE)) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "%s still has data after the wipe\n", path);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(buf);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+/* Wait for the job on @vol to end, returning its final info */
+static int
+testWaitJob(virStorageVolPtr vol, virStorageVolJobInfoPtr info)
+{
+    unsigned long long start;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+
+    while (true) {
+        if (virStorageVolGetJobInfo(vol, info, 0) < 0 ||
+            virTimeMillisNow(&now) < 0)
+            return -1;
+        if (info->state != VIR_STORAGE_VOL_JOB_STATE_RUNNING)
+            return 0;
+        if (now - start > TEST_TIMEOUT_MS) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "wipe still running after %d ms\n",
+                        TEST_TIMEOUT_MS);
+            return -1;
+        }
+        usleep(10 * 1000);
+    }
+}
+
+
+static int
+testWipe(const void *opaque)
+{
+    const struct testWipeData *data = opaque;
+    virStorageVolPtr vol = NULL;
+    virStorageVolInfo volinfo;
+    virStorageVolJobInfo info;
+    int ret = -1;
+
+    if (!(vol = virStorageVolLookupByName(pool, data->name)) ||
+        virStorageVolGetInfo(vol, &volinfo) < 0)
+        goto cleanup;
+
+    if (virStorageVolWipe(vol, data->flags) < 0 ||
+        testWaitJob(vol, &info) < 0)
+        goto cleanup;
+
+    if (info.type != VIR_STORAGE_VOL_JOB_WIPE ||
+        info.state != VIR_STORAGE_VOL_JOB_STATE_COMPLETED ||
+        info.dataTotal != volinfo.allocation ||
+        info.dataProcessed != info.dataTotal) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "job type %d state %d, %llu of %llu bytes, "
+                    "expected %llu\n", info.type, info.state,
+                    info.dataProcessed, info.dataTotal, volinfo.allocation);
+        goto cleanup;
+    }
+
+    if (testCheckWiped(vol, volinfo.capacity) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (vol)
+        virStorageVolFree(vol);
+    return ret;
+}
+
+
+/* Until a job runs on a volume, there is nothing to report */
+static int
+testNoJob(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStorageVolPtr vol;
+    virStorageVolJobInfo info;
+    int ret = -1;
+
+    if (!(vol = virStorageVolLookupByName(pool, "untouched.img")))
+        return -1;
+
+    if (virStorageVolGetJobInfo(vol, &info, 0) < 0)
+        goto cleanup;
+
+    if (info.type != VIR_STORAGE_VOL_JOB_NONE ||
+        info.state != VIR_STORAGE_VOL_JOB_STATE_NONE ||
+        info.dataTotal != 0 || info.dataProcessed != 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virStorageVolFree(vol);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if ((mkdir(datadir, 0700) < 0 && errno != EEXIST) ||
+        (mkdir(pooldir, 0700) < 0 && errno != EEXIST)) {
+        fprintf(stderr, "unable to create %s\n", pooldir);
+        return EXIT_FAILURE;
+    }
+
+    if (testCreateVolume("sparse.img", SPARSE_SIZE, true) < 0 ||
+        testCreateVolume("full.img", FULL_SIZE, false) < 0 ||
+        testCreateVolume("async.img", FULL_SIZE, false) < 0 ||
+        testCreateVolume("untouched.img", DATA_SIZE, false) < 0) {
+        fprintf(stderr, "unable to create volumes in %s\n", pooldir);
+        ret = -1;
+        goto cleanup;
+    }
+
+    /* The storage driver must come before the test driver's own,
+     * which would take the test:/// connection otherwise */
+    if (setenv("XDG_CONFIG_HOME", datadir, 1) < 0 ||
+        storageRegister() < 0 ||
+        virStateInitialize(false, NULL, NULL) < 0 ||
+        !(conn = virConnectOpen("test:///default")) ||
+        !(pool = virStoragePoolCreateXML(conn, poolXML, 0))) {
+        fprintf(stderr, "unable to start the storage driver\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+#define DO_TEST(name, flags)                                            \
+    do {                                                                \
+        struct testWipeData data = { name, flags };                     \
+        if (virtTestRun("Wipe " name, 1, testWipe, &data) < 0)          \
+            ret = -1;                                                   \
+    } while (0)
+
+    if (virtTestRun("Job info without a job", 1, testNoJob, NULL) < 0)
+        ret = -1;
+    DO_TEST("sparse.img", 0);
+    DO_TEST("full.img", 0);
+    DO_TEST("async.img", VIR_STORAGE_VOL_WIPE_ASYNC);
+
+cleanup:
+    if (pool) {
+        virStoragePoolDestroy(pool);
+        virStoragePoolFree(pool);
+    }
+    if (conn)
+        virConnectClose(conn);
+    virStateCleanup();
+
+    unlink(pooldir "/sparse.img");
+    unlink(pooldir "/full.img");
+    unlink(pooldir "/async.img");
+    unlink(pooldir "/untouched.img");
+    rmdir(pooldir);
+    rmdir(datadir "/libvirt/storage/autostart");
+    rmdir(datadir "/libvirt/storage");
+    rmdir(datadir "/libvirt");
+    rmdir(datadir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,152 @@
+/*
+ * threadpoolbenchtest.c: Measure job throughput of the thread pool
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virthread.h"
+#include "virthreadpool.h"
+#include "viratomic.h"
+#include "virutil.h"
+
+#define NUM_JOBS 100000
+
+struct testPoolInfo {
+    size_t workers;
+    size_t prioWorkers;
+    /* Every Nth job is sent with priority, 0 for none */
+    size_t prioInterval;
+};
+
+static virMutex lock;
+static virCond done;
+static int jobsLeft;
+static int jobsSum;
+
+static void
+testPoolJob(void *jobdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    virAtomicIntAdd(&jobsSum, (intptr_t)jobdata);
+
+    if (virAtomicIntDecAndTest(&jobsLeft)) {
+        virMutexLock(&lock);
+        virCondSignal(&done);
+        virMutexUnlock(&lock);
+    }
+}
+
+static unsigned long long
+testPoolNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int
+testPoolThroughput(const void *data)
+{
+    const struct testPoolInfo *info = data;
+    virThreadPoolPtr pool;
+    unsigned long long start;
+    unsigned long long elapsed;
+    int expected = 0;
+    int ret = -1;
+    int i;
+
+    if (!(pool = virThreadPoolNew(info->workers, info->workers,
+                                  info->prioWorkers, testPoolJob, NULL)))
+        return -1;
+
+    virAtomicIntSet(&jobsLeft, NUM_JOBS);
+    virAtomicIntSet(&jobsSum, 0);
+
+    start = testPoolNow();
+    for (i = 0 ; i < NUM_JOBS ; i++) {
+        unsigned int priority = info->prioInterval &&
+            (i % info->prioInterval) == 0;
+        expected += i % 7;
+        if (virThreadPoolSendJob(pool, priority,
+                                 (void *)(intptr_t)(i % 7)) < 0)
+            goto cleanup;
+    }
+
+    virMutexLock(&lock);
+    while (virAtomicIntGet(&jobsLeft) > 0)
+        ignore_value(virCondWait(&done, &lock));
+    virMutexUnlock(&lock);
+    elapsed = testPoolNow() - start;
+
+    if (virAtomicIntGet(&jobsSum) != expected) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "\nExpected job sum %d, got %d\n",
+                    expected, virAtomicIntGet(&jobsSum));
+        goto cleanup;
+    }
+
+    if (virTestGetVerbose())
+        fprintf(stderr, "\n%zu workers, %zu priority workers: %llu jobs/sec\n",
+                info->workers, info->prioWorkers,
+                NUM_JOBS * 1000000ull / MAX(elapsed, 1));
+
+    ret = 0;
+
+cleanup:
+    virThreadPoolFree(pool);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virThreadInitialize() < 0 ||
+        virMutexInit(&lock) < 0 ||
+        virCondInit(&done) < 0)
+        return EXIT_FAILURE;
+
+#define DO_TEST(workers, prioWorkers, prioInterval)                     \
+    do {                                                                \
+        struct testPoolInfo info = { workers, prioWorkers, prioInterval }; \
+        if (virtTestRun("Throughput with " #workers " workers, "        \
+                        #prioWorkers " priority workers",               \
+                        1, testPoolThroughput, &info) < 0)              \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST(1, 0, 0);
+    DO_TEST(2, 0, 0);
+    DO_TEST(4, 0, 0);
+    DO_TEST(8, 0, 0);
+    DO_TEST(16, 0, 0);
+    DO_TEST(4, 2, 10);
+    DO_TEST(0, 2, 1);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
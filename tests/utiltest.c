@@ -152,6 +152,57 @@ testParseVersionString(const void *data ATTRIBUTE_UNUSED)
 
 
 
+static int
+testMemIsZero(const void *data ATTRIBUTE_UNUSED)
+{
+    /* Room for misaligned starts on either side of the block size */
+    char buf[128 + 16];
+    size_t start, len, pos;
+
+    memset(buf, 0, sizeof(buf));
+
+    for (start = 0; start < 16; start++) {
+        for (len = 0; len <= 128; len++) {
+            if (!virMemIsZero(buf + start, len)) {
+                if (virTestGetDebug() > 0)
+                    fprintf(stderr, "\nZeros at %zu+%zu not detected\n",
+                            start, len);
+                return -1;
+            }
+
+            /* Any single non-zero byte, the last one in particular */
+            for (pos = 0; pos < len; pos++) {
+                buf[start + pos] = 1;
+                if (virMemIsZero(buf + start, len)) {
+                    if (virTestGetDebug() > 0)
+                        fprintf(stderr, "\nByte %zu of %zu+%zu missed\n",
+                                pos, start, len);
+                    return -1;
+                }
+                buf[start + pos] = 0;
+            }
+
+            /* Bytes just outside the range do not count */
+            if (start)
+                buf[start - 1] = 1;
+            buf[start + len] = 1;
+            if (!virMemIsZero(buf + start, len)) {
+                if (virTestGetDebug() > 0)
+                    fprintf(stderr, "\nBytes around %zu+%zu counted\n",
+                            start, len);
+                return -1;
+            }
+            if (start)
+                buf[start - 1] = 0;
+            buf[start + len] = 0;
+        }
+    }
+
+    return 0;
+}
+
+
+
 
 static int
 mymain(void)
@@ -171,6 +222,7 @@ mymain(void)
     DO_TEST(IndexToDiskName);
     DO_TEST(DiskNameToIndex);
     DO_TEST(ParseVersionString);
+    DO_TEST(MemIsZero);
 
     return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -195,6 +195,146 @@ cleanup:
     return ret;
 }
 
+struct testEscapeData {
+    const char *format;
+    const char *str;
+    const char *expect;
+};
+
+static int testBufEscapeString(const void *data ATTRIBUTE_UNUSED)
+{
+    /* Formats with a single %s are escaped in place, others go
+     * through vsnprintf; both must give the same result */
+    static const struct testEscapeData tests[] = {
+        { "<a>%s</a>", "plain text", "<a>plain text</a>" },
+        { "%s", "<&>\"'", "&lt;&amp;&gt;&quot;&apos;" },
+        { "[%s]", "a<b>c", "[a&lt;b&gt;c]" },
+        { "%s", "", "" },
+        { "<a>%s</a>", NULL, "" },
+        /* control characters other than whitespace are dropped,
+         * whether or not the string needs escaping otherwise */
+        { "%s", "a\x01" "b\nc\td\re\x1f", "ab\nc\td\re" },
+        { "%s", "\x02<\x03", "&lt;" },
+        { "<a>%s</a>\n", "x\x7fy", "<a>x\x7fy</a>\n" },
+        /* not split, another conversion or an escaped % */
+        { "100%% %s", "<b>", "100% &lt;b&gt;" },
+        { "%4s|", "&", "&amp;|" },
+    };
+    size_t i;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(tests) ; i++) {
+        virBuffer buf = VIR_BUFFER_INITIALIZER;
+        const char *result;
+        int ret = 0;
+
+        virBufferEscapeString(&buf, tests[i].format, tests[i].str);
+
+        if (!(result = virBufferCurrentContent(&buf))) {
+            TEST_ERROR("Buffer had error set for case %zu\n", i);
+            ret = -1;
+        } else if (STRNEQ(result, tests[i].expect)) {
+            virtTestDifference(stderr, tests[i].expect, result);
+            ret = -1;
+        }
+        virBufferFreeAndReset(&buf);
+        if (ret < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int testBufEscape(const void *data ATTRIBUTE_UNUSED)
+{
+    static const struct testEscapeData tests[] = {
+        { "'%s'", "a'b\\c", "'a\\'b\\\\c'" },
+        { "%s", "''", "\\'\\'" },
+        { "%s", "", "" },
+        { "x%sy", "plain", "xplainy" },
+        { "%%%s", "'", "%\\'" },
+    };
+    size_t i;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(tests) ; i++) {
+        virBuffer buf = VIR_BUFFER_INITIALIZER;
+        const char *result;
+        int ret = 0;
+
+        virBufferEscape(&buf, '\\', "\\'", tests[i].format, tests[i].str);
+
+        if (!(result = virBufferCurrentContent(&buf))) {
+            TEST_ERROR("Buffer had error set for case %zu\n", i);
+            ret = -1;
+        } else if (STRNEQ(result, tests[i].expect)) {
+            virtTestDifference(stderr, tests[i].expect, result);
+            ret = -1;
+        }
+        virBufferFreeAndReset(&buf);
+        if (ret < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int testBufEscapeIndent(const void *data ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *expected =
+        "  <name>a&amp;b</name>\n"
+        "  <path>'x'</path>\n";
+    char *result;
+    int ret = 0;
+
+    virBufferAdjustIndent(&buf, 2);
+    virBufferEscapeString(&buf, "<name>%s</name>\n", "a&b");
+    virBufferEscape(&buf, '\\', ",", "<path>'%s'</path>\n", "x");
+
+    if (!(result = virBufferContentAndReset(&buf))) {
+        TEST_ERROR("Buffer had error set\n");
+        return -1;
+    }
+
+    if (STRNEQ(result, expected)) {
+        virtTestDifference(stderr, expected, result);
+        ret = -1;
+    }
+    VIR_FREE(result);
+    return ret;
+}
+
+static int testBufGrow(const void *data ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *result;
+    size_t i;
+    int ret = 0;
+
+    /* escaping may need more room than a single growth step */
+    for (i = 0 ; i < 10000 ; i++) {
+        virBufferEscapeString(&buf, "%s", "<&>");
+        virBufferAddChar(&buf, '.');
+    }
+
+    if (!(result = virBufferContentAndReset(&buf))) {
+        TEST_ERROR("Buffer had error set\n");
+        return -1;
+    }
+
+    if (strlen(result) != 10000 * strlen("&lt;&amp;&gt;.")) {
+        TEST_ERROR("Unexpected length %zu\n", strlen(result));
+        ret = -1;
+    }
+    for (i = 0 ; ret == 0 && i < 10000 ; i++) {
+        if (!STRPREFIX(result + i * 14, "&lt;&amp;&gt;.")) {
+            TEST_ERROR("Unexpected content at %zu\n", i);
+            ret = -1;
+        }
+    }
+    VIR_FREE(result);
+    return ret;
+}
+
 
 static int
 mymain(void)
@@ -213,6 +353,10 @@ mymain(void)
     DO_TEST("VSprintf infinite loop", testBufInfiniteLoop, 0);
     DO_TEST("Auto-indentation", testBufAutoIndent, 0);
     DO_TEST("Trim", testBufTrim, 0);
+    DO_TEST("EscapeString", testBufEscapeString, 0);
+    DO_TEST("Escape", testBufEscape, 0);
+    DO_TEST("Escape auto-indentation", testBufEscapeIndent, 0);
+    DO_TEST("Growth", testBufGrow, 0);
 
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
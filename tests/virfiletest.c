@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#include "virfile.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Large enough for any file system to keep the holes as such */
+#define BLOCK (1024 * 1024)
+
+static const char *datafile = abs_builddir "/virfiletest.data";
+
+struct testSegment {
+    bool inData;
+    unsigned long long length;
+};
+
+/* A leading hole, data, a hole in the middle, and a trailing hole */
+static const struct testSegment layout[] = {
+    { false, 2 * BLOCK },
+    { true, BLOCK },
+    { false, 3 * BLOCK },
+    { true, 2 * BLOCK },
+    { false, BLOCK },
+};
+
+static int
+testFileInDataCreate(void)
+{
+    char buf[4096];
+    unsigned long long pos = 0;
+    int fd;
+    size_t i;
+
+    unlink(datafile);
+    if ((fd = open(datafile, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+        return -1;
+
+    memset(buf, 'x', sizeof(buf));
+    for (i = 0 ; i < ARRAY_CARDINALITY(layout) ; i++) {
+        unsigned long long end = pos + layout[i].length;
+
+        if (layout[i].inData) {
+            if (lseek(fd, pos, SEEK_SET) < 0)
+                goto error;
+            for (; pos < end ; pos += sizeof(buf)) {
+                if (safewrite(fd, buf, sizeof(buf)) < 0)
+                    goto error;
+            }
+        }
+        pos = end;
+    }
+
+    if (ftruncate(fd, pos) < 0 ||
+        lseek(fd, 0, SEEK_SET) < 0)
+        goto error;
+
+    return fd;
+
+error:
+    VIR_FORCE_CLOSE(fd);
+    unlink(datafile);
+    return -1;
+}
+
+static int
+testFileInData(const void *data ATTRIBUTE_UNUSED)
+{
+    unsigned long long size = 0;
+    unsigned long long pos = 0;
+    unsigned long long length;
+    bool inData;
+    int fd;
+    int ret = -1;
+    size_t i;
+
+    if ((fd = testFileInDataCreate()) < 0)
+        return -1;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(layout) ; i++)
+        size += layout[i].length;
+
+    if (virFileInData(fd, &inData, &length) < 0)
+        goto cleanup;
+
+    /* All of it is data if the file system can't tell holes */
+    if (inData && length == size) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "holes are not reported, skipping layout\n");
+        pos = size;
+        if (lseek(fd, pos, SEEK_SET) < 0)
+            goto cleanup;
+        i = ARRAY_CARDINALITY(layout);
+    } else {
+        i = 0;
+    }
+
+    for (; i < ARRAY_CARDINALITY(layout) ; i++) {
+        if (virFileInData(fd, &inData, &length) < 0)
+            goto cleanup;
+
+        if (inData != layout[i].inData ||
+            length != layout[i].length) {
+            if (virTestGetVerbose())
+                fprintf(stderr,
+                        "at %llu expected %s of %llu, got %s of %llu\n",
+                        pos, layout[i].inData ? "data" : "hole",
+                        layout[i].length, inData ? "data" : "hole", length);
+            goto cleanup;
+        }
+
+        /* The offset is left alone */
+        if (lseek(fd, 0, SEEK_CUR) != pos) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "offset moved from %llu\n", pos);
+            goto cleanup;
+        }
+
+        /* Starting within a segment only finds the rest of it */
+        pos += length / 2;
+        if (lseek(fd, pos, SEEK_SET) < 0 ||
+            virFileInData(fd, &inData, &length) < 0)
+            goto cleanup;
+        if (inData != layout[i].inData ||
+            length != layout[i].length - layout[i].length / 2) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "unexpected %s of %llu at %llu\n",
+                        inData ? "data" : "hole", length, pos);
+            goto cleanup;
+        }
+
+        pos += length;
+        if (lseek(fd, pos, SEEK_SET) < 0)
+            goto cleanup;
+    }
+
+    /* Nothing left at the end of the file */
+    if (virFileInData(fd, &inData, &length) < 0)
+        goto cleanup;
+    if (length != 0) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "%llu bytes past the end\n", length);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    unlink(datafile);
+    return ret;
+}
+
+static int
+testFileSparseRecord(const void *data ATTRIBUTE_UNUSED)
+{
+    static const unsigned long long lengths[] = {
+        0, 1, 4096, 0xffffffffULL, 0x100000000ULL, 0x0123456789abcdefULL,
+        ~0ULL,
+    };
+    static const int types[] = {
+        VIR_FILE_SPARSE_RECORD_DATA, VIR_FILE_SPARSE_RECORD_HOLE,
+    };
+    /* Type 1 and a length of 258, big endian */
+    static const char expect[VIR_FILE_SPARSE_RECORD_HEADER_LEN] = {
+        0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 2,
+    };
+    char hdr[VIR_FILE_SPARSE_RECORD_HEADER_LEN];
+    unsigned long long length;
+    int type;
+    size_t i, j;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(types) ; i++) {
+        for (j = 0 ; j < ARRAY_CARDINALITY(lengths) ; j++) {
+            virFileSparseRecordEncode(hdr, types[i], lengths[j]);
+            if (virFileSparseRecordDecode(hdr, &type, &length) < 0 ||
+                type != types[i] || length != lengths[j]) {
+                if (virTestGetVerbose())
+                    fprintf(stderr, "record %d of %llu came back as "
+                            "%d of %llu\n", types[i], lengths[j],
+                            type, length);
+                return -1;
+            }
+        }
+    }
+
+    virFileSparseRecordEncode(hdr, VIR_FILE_SPARSE_RECORD_HOLE, 258);
+    if (memcmp(hdr, expect, sizeof(hdr)) != 0) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "unexpected record header encoding\n");
+        return -1;
+    }
+
+    /* Unknown record types are refused */
+    virFileSparseRecordEncode(hdr, 2, 1);
+    if (virFileSparseRecordDecode(hdr, &type, &length) == 0)
+        return -1;
+    virFileSparseRecordEncode(hdr, -1, 1);
+    if (virFileSparseRecordDecode(hdr, &type, &length) == 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("InData", 1, testFileInData, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("SparseRecord", 1, testFileSparseRecord, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -396,6 +396,62 @@ cleanup:
 }
 
 
+struct testHashReadOnlyData {
+    virHashTablePtr hash;
+    bool failed;
+};
+
+static void
+testHashForEachReadOnlyIter(void *payload ATTRIBUTE_UNUSED,
+                            const void *name,
+                            void *opaque)
+{
+    struct testHashReadOnlyData *data = opaque;
+
+    /* Read-only iterations and lookups may nest */
+    if (!virHashLookup(data->hash, name) ||
+        virHashForEachReadOnly(data->hash, testHashIter, NULL) !=
+        ARRAY_CARDINALITY(uuids)) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "\nnested read-only access failed for %s",
+                    (const char *) name);
+        data->failed = true;
+    }
+}
+
+static int
+testHashForEachReadOnly(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testHashReadOnlyData iter = { NULL, false };
+    int count;
+    int ret = -1;
+
+    if (!(iter.hash = testHashInit(0)))
+        return -1;
+
+    count = virHashForEachReadOnly(iter.hash, testHashForEachReadOnlyIter,
+                                   &iter);
+
+    if (count != ARRAY_CARDINALITY(uuids)) {
+        if (virTestGetVerbose()) {
+            testError("\nvirHashForEachReadOnly didn't go through all"
+                      " entries, %d != %zu\n",
+                      count, ARRAY_CARDINALITY(uuids));
+        }
+        goto cleanup;
+    }
+
+    if (iter.failed)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virHashFree(iter.hash);
+    return ret;
+}
+
+
 static int
 testHashRemoveSetIter(const void *payload ATTRIBUTE_UNUSED,
                       const void *name,
@@ -693,6 +749,7 @@ mymain(void)
     DO_TEST_DATA("Remove in ForEach", RemoveForEach, Forbidden);
     DO_TEST("Steal", Steal);
     DO_TEST("Forbidden ops in ForEach", ForEach);
+    DO_TEST("ForEachReadOnly", ForEachReadOnly);
     DO_TEST("RemoveSet", RemoveSet);
     DO_TEST("Search", Search);
     DO_TEST("GetItems", GetItems);
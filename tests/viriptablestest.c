@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+/* The mock replaces running commands: each one is appended to the
+ * file named by $VIR_IPTABLES_TEST_LOG, followed by its input, and
+ * fails if it contains $VIR_IPTABLES_TEST_FAIL */
+#define TEST_LOG_ENV "VIR_IPTABLES_TEST_LOG"
+#define TEST_FAIL_ENV "VIR_IPTABLES_TEST_FAIL"
+
+#ifdef MOCK_HELPER
+# include <stdio.h>
+# include <stdlib.h>
+
+# include "internal.h"
+# include "vircommand.h"
+# include "viralloc.h"
+# include "virutil.h"
+
+static char *mockInput;
+
+/* The restore binaries always exist, firewall-cmd never does */
+bool
+virFileIsExecutable(const char *file)
+{
+    return strstr(file, "-restore") != NULL;
+}
+
+void
+virCommandSetInputBuffer(virCommandPtr cmd ATTRIBUTE_UNUSED,
+                         const char *inbuf)
+{
+    VIR_FREE(mockInput);
+    mockInput = strdup(inbuf);
+}
+
+int
+virCommandRun(virCommandPtr cmd, int *exitstatus)
+{
+    const char *logfile = getenv(TEST_LOG_ENV);
+    const char *fail = getenv(TEST_FAIL_ENV);
+    char *str;
+    FILE *log;
+    bool failed;
+
+    if (!(str = virCommandToString(cmd)))
+        return -1;
+
+    failed = fail && (strstr(str, fail) ||
+                      (mockInput && strstr(mockInput, fail)));
+
+    if (logfile && (log = fopen(logfile, "a"))) {
+        fprintf(log, "%s\n%s", str, mockInput ? mockInput : "");
+        fclose(log);
+    }
+    VIR_FREE(str);
+    VIR_FREE(mockInput);
+
+    if (exitstatus) {
+        *exitstatus = failed;
+        return 0;
+    }
+    return failed ? -1 : 0;
+}
+
+#else
+# include <stdlib.h>
+
+# include "testutils.h"
+# include "internal.h"
+# include "viriptables.h"
+# include "viralloc.h"
+# include "virutil.h"
+
+# define logfile abs_builddir "/viriptablestest.log"
+
+# define RESTORE IPTABLES_RESTORE_PATH " --noflush\n"
+# define RESTORE6 IP6TABLES_RESTORE_PATH " --noflush\n"
+# define RULE IPTABLES_PATH " --table "
+# define RULE6 IP6TABLES_PATH " --table "
+
+# define TCP_53_IN "INPUT --in-interface virbr0 --protocol tcp " \
+    "--destination-port 53 --jump ACCEPT"
+# define UDP_67_IN "INPUT --in-interface virbr0 --protocol udp " \
+    "--destination-port 67 --jump ACCEPT"
+# define UDP_53_IN6 "INPUT --in-interface virbr0 --protocol udp " \
+    "--destination-port 53 --jump ACCEPT"
+# define REJECT_OUT "FORWARD --in-interface virbr0 --jump REJECT"
+# define CHECKSUM "POSTROUTING --out-interface virbr0 --protocol udp " \
+    "--destination-port 68 --jump CHECKSUM --checksum-fill"
+
+struct testTransactionData {
+    const char *fail;       /* make commands containing this fail */
+    bool abort;
+    int ret;                /* expected from the commit */
+    const char *expect;     /* commands run, with their input */
+};
+
+/* Queues a few rules across tables and families */
+static int
+testQueueRules(iptablesContext *ctx)
+{
+    if (iptablesAddTcpInput(ctx, AF_INET, "virbr0", 53) < 0 ||
+        iptablesAddOutputFixUdpChecksum(ctx, "virbr0", 68) < 0 ||
+        iptablesAddUdpInput(ctx, AF_INET6, "virbr0", 53) < 0 ||
+        iptablesAddUdpInput(ctx, AF_INET, "virbr0", 67) < 0 ||
+        iptablesRemoveForwardRejectOut(ctx, AF_INET, "virbr0") < 0)
+        return -1;
+    return 0;
+}
+
+static int
+testTransaction(const void *opaque)
+{
+    const struct testTransactionData *data = opaque;
+    iptablesContext *ctx = NULL;
+    char *actual = NULL;
+    int ret = -1;
+    int rc = 0;
+
+    unlink(logfile);
+    if (data->fail)
+        setenv(TEST_FAIL_ENV, data->fail, 1);
+    else
+        unsetenv(TEST_FAIL_ENV);
+
+    if (!(ctx = iptablesContextNew()))
+        goto cleanup;
+
+    iptablesTransactionBegin(ctx);
+    if (testQueueRules(ctx) < 0)
+        goto cleanup;
+
+    /* Nothing may run before the commit */
+    if (virFileExists(logfile)) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "rules ran before the commit\n");
+        goto cleanup;
+    }
+
+    if (data->abort) {
+        iptablesTransactionAbort(ctx);
+        /* Back to applying rules straight away */
+        if (iptablesAddTcpInput(ctx, AF_INET, "virbr0", 53) < 0)
+            goto cleanup;
+    } else {
+        rc = iptablesTransactionCommit(ctx);
+    }
+
+    if (rc != data->ret) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "commit returned %d, expected %d\n",
+                    rc, data->ret);
+        goto cleanup;
+    }
+
+    if (virFileReadAll(logfile, 1024 * 1024, &actual) < 0)
+        goto cleanup;
+
+    if (STRNEQ(actual, data->expect)) {
+        virtTestDifference(stderr, data->expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    iptablesContextFree(ctx);
+    VIR_FREE(actual);
+    unlink(logfile);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    setenv(TEST_LOG_ENV, logfile, 1);
+
+# define DO_TEST(name, fail, abort, rc, expect)                         \
+    do {                                                                \
+        struct testTransactionData data = { fail, abort, rc, expect };  \
+        if (virtTestRun("iptables transaction " name, 1,                \
+                        testTransaction, &data) < 0)                    \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* One restore per table and family, rules in queued order */
+    DO_TEST("commit", NULL, false, 0,
+            RESTORE
+            "*filter\n"
+            "--insert " TCP_53_IN "\n"
+            "--insert " UDP_67_IN "\n"
+            "--delete " REJECT_OUT "\n"
+            "COMMIT\n"
+            RESTORE
+            "*mangle\n"
+            "--insert " CHECKSUM "\n"
+            "COMMIT\n"
+            RESTORE6
+            "*filter\n"
+            "--insert " UDP_53_IN6 "\n"
+            "COMMIT\n");
+
+    /* A failed restore leaves its table to be done rule by rule */
+    DO_TEST("fallback", "*mangle", false, 0,
+            RESTORE
+            "*filter\n"
+            "--insert " TCP_53_IN "\n"
+            "--insert " UDP_67_IN "\n"
+            "--delete " REJECT_OUT "\n"
+            "COMMIT\n"
+            RESTORE
+            "*mangle\n"
+            "--insert " CHECKSUM "\n"
+            "COMMIT\n"
+            RESTORE6
+            "*filter\n"
+            "--insert " UDP_53_IN6 "\n"
+            "COMMIT\n"
+            RULE "mangle --insert " CHECKSUM "\n");
+
+    /* A rule failing to be added one at a time takes the rules added
+     * before it out again, newest first */
+    DO_TEST("fallback undo", "--destination-port 67", false, -1,
+            RESTORE
+            "*filter\n"
+            "--insert " TCP_53_IN "\n"
+            "--insert " UDP_67_IN "\n"
+            "--delete " REJECT_OUT "\n"
+            "COMMIT\n"
+            RESTORE
+            "*mangle\n"
+            "--insert " CHECKSUM "\n"
+            "COMMIT\n"
+            RESTORE6
+            "*filter\n"
+            "--insert " UDP_53_IN6 "\n"
+            "COMMIT\n"
+            RULE "filter --insert " TCP_53_IN "\n"
+            RULE "filter --insert " UDP_67_IN "\n"
+            RULE6 "filter --delete " UDP_53_IN6 "\n"
+            RULE "mangle --delete " CHECKSUM "\n"
+            RULE "filter --delete " TCP_53_IN "\n");
+
+    /* Aborting runs nothing, the next rule is applied at once */
+    DO_TEST("abort", NULL, true, 0,
+            RULE "filter --insert " TCP_53_IN "\n");
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/libviriptablesmock.so")
+#endif
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#include "virlog.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virthread.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define NUM_THREADS 4
+#define NUM_MESSAGES 20
+#define NUM_WRAP_MESSAGES 1000
+
+static const char *logfile = abs_builddir "/virlogtest.log";
+
+/*
+ * Only keep messages in the history buffer, and send its dumps
+ * to a file we can check
+ */
+static int
+testLogSetup(void)
+{
+    char *outputs = NULL;
+    int ret = -1;
+
+    unlink(logfile);
+
+    if (virAsprintf(&outputs, "%d:file:%s", VIR_LOG_ERROR, logfile) < 0)
+        goto cleanup;
+
+    if (virLogReset() < 0 ||
+        virLogSetDefaultPriority(VIR_LOG_ERROR) < 0 ||
+        virLogSetBufferSize(8) < 0 ||
+        virLogParseOutputs(outputs) != 1)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(outputs);
+    return ret;
+}
+
+static char *
+testLogDump(void)
+{
+    char *content = NULL;
+
+    virLogEmergencyDumpAll(SIGUSR2);
+
+    if (virFileReadAll(logfile, 1024 * 1024, &content) < 0)
+        return NULL;
+
+    return content;
+}
+
+/* VIR_DEBUG may be compiled out */
+#define TEST_LOG(...)                                           \
+    virLogMessage(VIR_LOG_FROM_FILE, VIR_LOG_DEBUG,             \
+                  __FILE__, __LINE__, __func__, NULL, __VA_ARGS__)
+
+static void
+testLogWorker(void *opaque)
+{
+    int *thread = opaque;
+    int i;
+
+    for (i = 0 ; i < NUM_MESSAGES ; i++)
+        TEST_LOG("thread %d message %d", *thread, i);
+}
+
+/* Each thread logs into its own buffer, the dump merges them */
+static int
+testLogThreads(const void *data ATTRIBUTE_UNUSED)
+{
+    virThread threads[NUM_THREADS];
+    int ids[NUM_THREADS];
+    char *content = NULL;
+    const char *last = NULL;
+    char msg[64];
+    int ret = -1;
+    int i, j;
+
+    if (testLogSetup() < 0)
+        return -1;
+
+    for (i = 0 ; i < NUM_THREADS ; i++) {
+        ids[i] = i;
+        if (virThreadCreate(&threads[i], true, testLogWorker, &ids[i]) < 0) {
+            while (--i >= 0)
+                virThreadJoin(&threads[i]);
+            return -1;
+        }
+    }
+    for (i = 0 ; i < NUM_THREADS ; i++)
+        virThreadJoin(&threads[i]);
+
+    TEST_LOG("all threads done");
+
+    if (!(content = testLogDump()))
+        goto cleanup;
+
+    /* The history of threads which exited is kept, in order */
+    for (i = 0 ; i < NUM_THREADS ; i++) {
+        const char *pos = content;
+
+        for (j = 0 ; j < NUM_MESSAGES ; j++) {
+            snprintf(msg, sizeof(msg), "thread %d message %d\n", i, j);
+            if (!(pos = strstr(pos, msg))) {
+                if (virTestGetVerbose())
+                    fprintf(stderr, "'%s' missing or out of order\n", msg);
+                goto cleanup;
+            }
+        }
+        if (pos > last)
+            last = pos;
+    }
+
+    if (!last || !strstr(last, "all threads done\n")) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "latest message not dumped last\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(content);
+    unlink(logfile);
+    return ret;
+}
+
+/* A full buffer drops the oldest messages first */
+static int
+testLogWrap(const void *data ATTRIBUTE_UNUSED)
+{
+    char *content = NULL;
+    const char *pos;
+    char msg[64];
+    int first = -1;
+    int ret = -1;
+    int i;
+
+    if (testLogSetup() < 0)
+        return -1;
+
+    for (i = 0 ; i < NUM_WRAP_MESSAGES ; i++)
+        TEST_LOG("wrap %04d", i);
+
+    if (!(content = testLogDump()))
+        goto cleanup;
+
+    for (i = 0 ; i < NUM_WRAP_MESSAGES ; i++) {
+        snprintf(msg, sizeof(msg), "wrap %04d\n", i);
+        if (strstr(content, msg)) {
+            first = i;
+            break;
+        }
+    }
+
+    if (first <= 0) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "expected the oldest messages to be dropped\n");
+        goto cleanup;
+    }
+
+    pos = content;
+    for (i = first ; i < NUM_WRAP_MESSAGES ; i++) {
+        snprintf(msg, sizeof(msg), "wrap %04d\n", i);
+        if (!(pos = strstr(pos, msg))) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "'%s' missing or out of order\n", msg);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(content);
+    unlink(logfile);
+    return ret;
+}
+
+/* Changing the buffer size throws away the history */
+static int
+testLogResize(const void *data ATTRIBUTE_UNUSED)
+{
+    char *content = NULL;
+    int ret = -1;
+
+    if (testLogSetup() < 0)
+        return -1;
+
+    TEST_LOG("before resize");
+    if (virLogSetBufferSize(16) < 0)
+        goto cleanup;
+
+    /* Before this thread logs again and drops its old buffer */
+    if (!(content = testLogDump()))
+        goto cleanup;
+
+    if (strstr(content, "before resize\n")) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "history kept across resize\n");
+        goto cleanup;
+    }
+    VIR_FREE(content);
+
+    TEST_LOG("after resize");
+
+    if (!(content = testLogDump()))
+        goto cleanup;
+
+    if (!strstr(content, "after resize\n")) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "history lost after resize\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(content);
+    unlink(logfile);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Threads", 1, testLogThreads, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Wrap", 1, testLogWrap, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Resize", 1, testLogResize, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <signal.h>
+
+#include "testutils.h"
+#include "virutil.h"
+#include "virerror.h"
+#include "viralloc.h"
+#include "virlog.h"
+#include "virfile.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#include "rpc/virnetsocket.h"
+#include "rpc/virnetclient.h"
+#include "rpc/virnetclientprogram.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+#define TEST_PROGRAM 0x20130301
+#define TEST_VERSION 1
+#define TEST_PROC 1
+
+#define TEST_TIMEOUT_MS 10000
+
+/* The fake server reads all the calls before answering any of them,
+ * so they must all be in flight at once */
+struct testServer {
+    virNetSocketPtr lsock;
+    size_t ncalls;
+    bool reply;         /* false to close the connection instead */
+    int ret;
+};
+
+struct testCall {
+    int arg;
+    int result;
+    int rv;
+    bool done;
+};
+
+struct testCalls {
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+};
+
+struct testCallData {
+    struct testCalls *calls;
+    struct testCall *call;
+};
+
+struct testAsyncData {
+    size_t ncalls;
+    bool reply;
+};
+
+
+static virNetMessagePtr
+testServerReadCall(int fd)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(false)) ||
+        virNetMessageReserveBuffer(msg, VIR_NET_MESSAGE_LEN_MAX) < 0)
+        goto error;
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+
+    if (saferead(fd, msg->buffer, msg->bufferLength) != msg->bufferLength ||
+        virNetMessageDecodeLength(msg) < 0 ||
+        saferead(fd, msg->buffer + msg->bufferOffset,
+                 msg->bufferLength - msg->bufferOffset) !=
+        msg->bufferLength - msg->bufferOffset ||
+        virNetMessageDecodeHeader(msg) < 0)
+        goto error;
+
+    if (msg->header.prog != TEST_PROGRAM ||
+        msg->header.type != VIR_NET_CALL)
+        goto error;
+
+    return msg;
+
+error:
+    virNetMessageFree(msg);
+    return NULL;
+}
+
+
+/* Answers the calls newest first, each with twice its argument */
+static void
+testServerRun(void *opaque)
+{
+    struct testServer *server = opaque;
+    virNetSocketPtr ssock = NULL;
+    virNetMessagePtr *msgs = NULL;
+    size_t nmsgs = 0;
+    size_t i;
+    int fd;
+    int val;
+    char c;
+
+    /* Wait for the client to connect */
+    if (virSetBlocking(virNetSocketGetFD(server->lsock), true) < 0 ||
+        virNetSocketAccept(server->lsock, &ssock) < 0 || !ssock)
+        goto cleanup;
+    fd = virNetSocketGetFD(ssock);
+    if (virSetBlocking(fd, true) < 0 ||
+        VIR_ALLOC_N(msgs, server->ncalls) < 0)
+        goto cleanup;
+
+    for (nmsgs = 0 ; nmsgs < server->ncalls ; nmsgs++) {
+        if (!(msgs[nmsgs] = testServerReadCall(fd)))
+            goto cleanup;
+    }
+
+    if (!server->reply) {
+        server->ret = 0;
+        goto cleanup;
+    }
+
+    for (i = nmsgs ; i > 0 ; i--) {
+        virNetMessagePtr msg = msgs[i - 1];
+
+        if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_int, &val) < 0)
+            goto cleanup;
+        val *= 2;
+
+        msg->header.type = VIR_NET_REPLY;
+        msg->header.status = VIR_NET_OK;
+        if (virNetMessageEncodeHeader(msg) < 0 ||
+            virNetMessageEncodePayload(msg, (xdrproc_t)xdr_int, &val) < 0 ||
+            safewrite(fd, msg->buffer, msg->bufferLength) !=
+            msg->bufferLength)
+            goto cleanup;
+    }
+
+    /* Hanging up would lose the replies not read yet */
+    if (saferead(fd, &c, 1) != 0)
+        goto cleanup;
+
+    server->ret = 0;
+
+cleanup:
+    for (i = 0 ; i < nmsgs ; i++)
+        virNetMessageFree(msgs[i]);
+    VIR_FREE(msgs);
+    virObjectUnref(ssock);
+}
+
+
+static void
+testCallDone(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+             virNetClientPtr client ATTRIBUTE_UNUSED,
+             int rv,
+             void *opaque)
+{
+    struct testCallData *data = opaque;
+
+    virMutexLock(&data->calls->lock);
+    data->call->rv = rv;
+    data->call->done = true;
+    if (--data->calls->pending == 0)
+        virCondSignal(&data->calls->cond);
+    virMutexUnlock(&data->calls->lock);
+}
+
+
+static int
+testWaitCalls(struct testCalls *calls)
+{
+    unsigned long long now;
+    int ret = 0;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    virMutexLock(&calls->lock);
+    while (calls->pending) {
+        if (virCondWaitUntil(&calls->cond, &calls->lock,
+                             now + TEST_TIMEOUT_MS) < 0) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "%zu calls still pending\n", calls->pending);
+            ret = -1;
+            break;
+        }
+    }
+    virMutexUnlock(&calls->lock);
+
+    return ret;
+}
+
+
+/*
+ * Queue @ncalls asynchronous calls on one client, then make a
+ * synchronous one. The server replies in reverse order, so the
+ * synchronous call is answered first, and every asynchronous one
+ * must be matched to its reply by serial. Without replies, all of
+ * them must fail once the server hangs up.
+ */
+static int
+testAsyncCalls(const void *opaque)
+{
+    const struct testAsyncData *test = opaque;
+    struct testServer server = {
+        NULL, test->ncalls + (test->reply ? 1 : 0), test->reply, -1,
+    };
+    struct testCalls calls;
+    struct testCall *call = NULL;
+    struct testCallData *data = NULL;
+    virNetClientPtr client = NULL;
+    virNetClientProgramPtr prog = NULL;
+    virThread thread;
+    bool haveThread = false;
+    char *path = NULL;
+    char *tmpdir;
+    char template[] = "/tmp/libvirt_XXXXXX";
+    size_t queued = 0;
+    size_t i;
+    int arg = test->ncalls;
+    int result = 0;
+    int ret = -1;
+
+    if (virMutexInit(&calls.lock) < 0)
+        return -1;
+    if (virCondInit(&calls.cond) < 0) {
+        virMutexDestroy(&calls.lock);
+        return -1;
+    }
+    calls.pending = 0;
+
+    if (!(tmpdir = mkdtemp(template))) {
+        VIR_WARN("Failed to create temporary directory");
+        goto cleanup;
+    }
+    if (virAsprintf(&path, "%s/test.sock", tmpdir) < 0 ||
+        VIR_ALLOC_N(call, test->ncalls) < 0 ||
+        VIR_ALLOC_N(data, test->ncalls) < 0)
+        goto cleanup;
+
+    if (virNetSocketNewListenUNIX(path, 0700, -1, getgid(),
+                                  &server.lsock) < 0 ||
+        virNetSocketListen(server.lsock, 0) < 0)
+        goto cleanup;
+
+    if (virThreadCreate(&thread, true, testServerRun, &server) < 0)
+        goto cleanup;
+    haveThread = true;
+
+    if (!(client = virNetClientNewUNIX(path, false, NULL)) ||
+        !(prog = virNetClientProgramNew(TEST_PROGRAM, TEST_VERSION,
+                                        NULL, 0, NULL)) ||
+        virNetClientAddProgram(client, prog) < 0 ||
+        virNetClientStartIOThread(client) < 0)
+        goto cleanup;
+
+    for (queued = 0 ; queued < test->ncalls ; queued++) {
+        call[queued].arg = queued;
+        data[queued].calls = &calls;
+        data[queued].call = &call[queued];
+
+        virMutexLock(&calls.lock);
+        calls.pending++;
+        virMutexUnlock(&calls.lock);
+
+        if (virNetClientProgramCallAsync(prog, client, queued, TEST_PROC,
+                                         (xdrproc_t)xdr_int,
+                                         &call[queued].arg,
+                                         (xdrproc_t)xdr_int,
+                                         &call[queued].result,
+                                         testCallDone, &data[queued]) < 0) {
+            virMutexLock(&calls.lock);
+            calls.pending--;
+            virMutexUnlock(&calls.lock);
+            goto wait;
+        }
+    }
+
+    if (test->reply) {
+        if (virNetClientProgramCall(prog, client, queued, TEST_PROC,
+                                    0, NULL, NULL, NULL,
+                                    (xdrproc_t)xdr_int, (char *)&arg,
+                                    (xdrproc_t)xdr_int, (char *)&result) < 0)
+            goto wait;
+        if (result != arg * 2) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "synchronous call got %d\n", result);
+            goto wait;
+        }
+    }
+
+    ret = 0;
+
+wait:
+    /* The calls queued reference the test's data until completed */
+    if (testWaitCalls(&calls) < 0) {
+        virNetClientClose(client);
+        ignore_value(testWaitCalls(&calls));
+        ret = -1;
+    }
+
+    for (i = 0 ; i < queued && ret == 0 ; i++) {
+        if (!call[i].done ||
+            (test->reply && (call[i].rv != 0 ||
+                             call[i].result != call[i].arg * 2)) ||
+            (!test->reply && call[i].rv != -1)) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "call %zu: done=%d rv=%d result=%d\n",
+                        i, call[i].done, call[i].rv, call[i].result);
+            ret = -1;
+        }
+    }
+
+cleanup:
+    if (client)
+        virNetClientClose(client);
+    /* Without a client, the server is still waiting to accept one */
+    if (haveThread && client) {
+        virThreadJoin(&thread);
+        if (server.ret < 0)
+            ret = -1;
+    }
+    virObjectUnref(prog);
+    virObjectUnref(client);
+    virObjectUnref(server.lsock);
+    VIR_FREE(data);
+    VIR_FREE(call);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    if (tmpdir)
+        rmdir(tmpdir);
+    virCondDestroy(&calls.cond);
+    virMutexDestroy(&calls.lock);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+
+#define DO_TEST(name, ncalls, reply)                                    \
+    do {                                                                \
+        struct testAsyncData data = { ncalls, reply };                  \
+        if (virtTestRun(name, 1, testAsyncCalls, &data) < 0)            \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("Many calls in flight", 500, true);
+    DO_TEST("Calls failed on hangup", 50, false);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
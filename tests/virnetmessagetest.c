@@ -46,7 +46,7 @@ static int testMessageHeaderEncode(const void *args ATTRIBUTE_UNUSED)
         0x00, 0x00, 0x00, 0x00,  /* Status */
     };
     /* According to doc to virNetMessageEncodeHeader(&msg):
-     * msg->buffer will be this long */
+     * msg->buffer will be at most this long */
     unsigned long msg_buf_size = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX;
     int ret = -1;
 
@@ -71,8 +71,9 @@ static int testMessageHeaderEncode(const void *args ATTRIBUTE_UNUSED)
         goto cleanup;
     }
 
-    if (msg->bufferLength != msg_buf_size) {
-        VIR_DEBUG("Expect message offset %lu got %zu",
+    if (msg->bufferLength > msg_buf_size ||
+        msg->bufferLength > msg->bufferSize) {
+        VIR_DEBUG("Expect message length at most %lu got %zu",
                   msg_buf_size, msg->bufferLength);
         goto cleanup;
     }
@@ -526,6 +527,147 @@ cleanup:
     return ret;
 }
 
+static int testMessagePayloadEncodeLarge(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageError err;
+    virNetMessageError decoded;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    char *str = NULL;
+    size_t len = 512 * 1024;
+    int ret = -1;
+
+    memset(&err, 0, sizeof(err));
+    memset(&decoded, 0, sizeof(decoded));
+
+    if (!msg)
+        return -1;
+
+    /* Needs far more than the initial buffer */
+    if (VIR_ALLOC_N(str, len + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    memset(str, 'x', len);
+
+    err.code = VIR_ERR_INTERNAL_ERROR;
+    err.domain = VIR_FROM_RPC;
+    err.level = VIR_ERR_ERROR;
+    err.message = &str;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
+        goto cleanup;
+
+    if (msg->bufferLength < len) {
+        VIR_DEBUG("Expect message length at least %zu got %zu",
+                  len, msg->bufferLength);
+        goto cleanup;
+    }
+
+    /* Read it back */
+    if (virNetMessageDecodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &decoded) < 0)
+        goto cleanup;
+
+    if (!decoded.message || STRNEQ(*decoded.message, str)) {
+        VIR_DEBUG("Expect message to survive growing the buffer");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&decoded);
+    VIR_FREE(str);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+static int testMessagePayloadStreamEncodeRef(const void *args ATTRIBUTE_UNUSED)
+{
+    char stream[] = "The quick brown fox jumps over the lazy dog";
+    virNetMessagePtr msg = virNetMessageNew(true);
+    static const char expect[] = {
+        0x00, 0x00, 0x00, 0x47,  /* Length */
+        0x11, 0x22, 0x33, 0x44,  /* Program */
+        0x00, 0x00, 0x00, 0x01,  /* Version */
+        0x00, 0x00, 0x06, 0x66,  /* Procedure */
+        0x00, 0x00, 0x00, 0x03,  /* Type */
+        0x00, 0x00, 0x00, 0x99,  /* Serial */
+        0x00, 0x00, 0x00, 0x02,  /* Status */
+    };
+    struct iovec iov[2];
+    int niov;
+    int ret = -1;
+
+    if (!msg)
+        return -1;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayloadRawRef(msg, stream, strlen(stream)) < 0)
+        goto cleanup;
+
+    if (ARRAY_CARDINALITY(expect) != msg->bufferLength) {
+        VIR_DEBUG("Expect message length %zu got %zu",
+                  sizeof(expect), msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (memcmp(expect, msg->buffer, sizeof(expect)) != 0) {
+        virtTestDifferenceBin(stderr, expect, msg->buffer, sizeof(expect));
+        goto cleanup;
+    }
+
+    /* The data must be sent from the caller's buffer */
+    niov = virNetMessageGetTxIOV(msg, iov);
+    if (niov != 2 ||
+        iov[0].iov_len != sizeof(expect) ||
+        iov[1].iov_base != stream ||
+        iov[1].iov_len != strlen(stream)) {
+        VIR_DEBUG("Unexpected iov for referenced stream data");
+        goto cleanup;
+    }
+
+    /* A partial write spanning both segments */
+    if (virNetMessageTxAdvance(msg, sizeof(expect) + 4))
+        goto cleanup;
+
+    niov = virNetMessageGetTxIOV(msg, iov);
+    if (niov != 1 ||
+        iov[0].iov_base != stream + 4 ||
+        iov[0].iov_len != strlen(stream) - 4) {
+        VIR_DEBUG("Unexpected iov after partial write");
+        goto cleanup;
+    }
+
+    if (!virNetMessageTxAdvance(msg, strlen(stream) - 4))
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
 
 static int
 mymain(void)
@@ -549,6 +691,12 @@ mymain(void)
     if (virtTestRun("Message Payload Stream Encode", 1, testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Message Payload Encode Large", 1, testMessagePayloadEncodeLarge, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Payload Stream Encode Ref", 1, testMessagePayloadStreamEncodeRef, NULL) < 0)
+        ret = -1;
+
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+
+#include "rpc/virnetserverdispatch.h"
+#include "viralloc.h"
+#include "virbuffer.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/*
+ * Fake clients, which only have a queue and a name. Like the real
+ * ones, they are kept alive by their jobs, and free their queue when
+ * the last reference goes away.
+ */
+typedef struct _testClient testClient;
+typedef testClient *testClientPtr;
+
+struct _testClient {
+    char name;
+    int refs;
+    int njobs;
+    virNetServerDispatchQueuePtr queue;
+};
+
+typedef struct _testJob testJob;
+typedef testJob *testJobPtr;
+
+struct _testJob {
+    testClientPtr client;
+    int seq;
+};
+
+/* What the workers were told */
+struct testSend {
+    int fail;
+    size_t nwakeups;
+    void *job;
+    unsigned int priority;
+};
+
+static testClientPtr
+testClientNew(char name)
+{
+    testClientPtr client;
+
+    if (VIR_ALLOC(client) < 0)
+        return NULL;
+
+    if (!(client->queue = virNetServerDispatchQueueNew())) {
+        VIR_FREE(client);
+        return NULL;
+    }
+
+    client->name = name;
+    client->refs = 1;
+
+    return client;
+}
+
+static void
+testClientUnref(testClientPtr client)
+{
+    if (!client || --client->refs > 0)
+        return;
+
+    virNetServerDispatchQueueFree(client->queue);
+    VIR_FREE(client);
+}
+
+static void
+testJobFree(void *opaque)
+{
+    testJobPtr job = opaque;
+
+    testClientUnref(job->client);
+    VIR_FREE(job);
+}
+
+static int
+testSendJob(void *job, unsigned int priority, void *opaque)
+{
+    struct testSend *send = opaque;
+
+    if (send->fail)
+        return -1;
+
+    if (job) {
+        send->job = job;
+        send->priority = priority;
+    } else {
+        send->nwakeups++;
+    }
+
+    return 0;
+}
+
+static int
+testQueueJob(virNetServerDispatchPtr dispatch,
+             testClientPtr client,
+             unsigned int priority)
+{
+    testJobPtr job;
+
+    if (VIR_ALLOC(job) < 0)
+        return -1;
+
+    job->client = client;
+    job->seq = ++client->njobs;
+    client->refs++;
+
+    if (virNetServerDispatchQueueJob(dispatch, client->queue,
+                                     job, priority) < 0) {
+        testJobFree(job);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Run the jobs in line, writing down who they came from */
+static char *
+testRunJobs(virNetServerDispatchPtr dispatch)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    testJobPtr job;
+
+    while ((job = virNetServerDispatchNextJob(dispatch))) {
+        virBufferAsprintf(&buf, " %c%d", job->client->name, job->seq);
+        testJobFree(job);
+    }
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+static int
+testCheckJobs(virNetServerDispatchPtr dispatch, const char *expect)
+{
+    char *actual;
+    int ret = -1;
+
+    if (!(actual = testRunJobs(dispatch)))
+        return -1;
+
+    if (STRNEQ(actual, expect)) {
+        virtTestDifference(stderr, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(actual);
+    return ret;
+}
+
+/* Each client starts as many calls as its weight on its turn */
+static int
+testDispatchWeights(const void *data ATTRIBUTE_UNUSED)
+{
+    const char *const identities[] = { "bob=2", "c*=3", "*=5", NULL };
+    struct testSend send = { 0 };
+    virNetServerDispatchPtr dispatch;
+    testClientPtr clients[3] = { NULL };
+    size_t i;
+    int j;
+    int ret = -1;
+
+    if (!(dispatch = virNetServerDispatchNew(testSendJob, testJobFree,
+                                             &send)))
+        return -1;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(clients) ; i++) {
+        if (!(clients[i] = testClientNew('A' + i)))
+            goto cleanup;
+    }
+
+    /* The first match wins, and read-only clients without one get
+     * their own weight */
+    if (virNetServerDispatchSetWeights(dispatch, 4, 1, identities) < 0 ||
+        !virNetServerDispatchHasIdentities(dispatch))
+        goto cleanup;
+    virNetServerDispatchUpdateWeight(dispatch, clients[0]->queue,
+                                     NULL, true);
+    virNetServerDispatchUpdateWeight(dispatch, clients[1]->queue,
+                                     "bob", true);
+    virNetServerDispatchUpdateWeight(dispatch, clients[2]->queue,
+                                     "carol", false);
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(clients) ; i++) {
+        for (j = 0 ; j < 6 ; j++) {
+            if (testQueueJob(dispatch, clients[i], 0) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (send.nwakeups != 18 || send.job) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "expected 18 wakeups, got %zu\n",
+                    send.nwakeups);
+        goto cleanup;
+    }
+
+    if (testCheckJobs(dispatch,
+                      " A1 B1 B2 C1 C2 C3 A2 B3 B4 C4 C5 C6"
+                      " A3 B5 B6 A4 A5 A6") < 0)
+        goto cleanup;
+
+    /* A client going back to an empty line gets a full turn, and a
+     * new weight applies from its next turn on */
+    if (testQueueJob(dispatch, clients[2], 0) < 0 ||
+        testQueueJob(dispatch, clients[2], 0) < 0 ||
+        testQueueJob(dispatch, clients[0], 0) < 0 ||
+        testQueueJob(dispatch, clients[0], 0) < 0 ||
+        testQueueJob(dispatch, clients[1], 0) < 0)
+        goto cleanup;
+    for (j = 0 ; j < 3 ; j++) {
+        if (testQueueJob(dispatch, clients[2], 0) < 0)
+            goto cleanup;
+    }
+    virNetServerDispatchUpdateWeight(dispatch, clients[2]->queue,
+                                     NULL, true);
+    if (testCheckJobs(dispatch, " C7 C8 C9 A7 B7 C10 A8 C11") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    for (i = 0 ; i < ARRAY_CARDINALITY(clients) ; i++)
+        testClientUnref(clients[i]);
+    virNetServerDispatchFree(dispatch);
+    return ret;
+}
+
+/* High priority calls go straight to the workers */
+static int
+testDispatchPriority(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testSend send = { 0 };
+    virNetServerDispatchPtr dispatch;
+    testClientPtr client = NULL;
+    testJobPtr job;
+    int ret = -1;
+
+    if (!(dispatch = virNetServerDispatchNew(testSendJob, testJobFree,
+                                             &send)))
+        return -1;
+
+    if (!(client = testClientNew('A')))
+        goto cleanup;
+
+    if (testQueueJob(dispatch, client, 0) < 0 ||
+        testQueueJob(dispatch, client, 3) < 0 ||
+        testQueueJob(dispatch, client, 0) < 0)
+        goto cleanup;
+
+    if (!(job = send.job) || send.priority != 3 || job->seq != 2 ||
+        send.nwakeups != 2) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "priority job was not sent right away\n");
+        goto cleanup;
+    }
+    testJobFree(job);
+
+    if (testCheckJobs(dispatch, " A1 A3") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testClientUnref(client);
+    virNetServerDispatchFree(dispatch);
+    return ret;
+}
+
+/* A job the workers can't be told about is not queued */
+static int
+testDispatchSendFail(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testSend send = { 0 };
+    virNetServerDispatchPtr dispatch;
+    testClientPtr client = NULL;
+    int ret = -1;
+
+    if (!(dispatch = virNetServerDispatchNew(testSendJob, testJobFree,
+                                             &send)))
+        return -1;
+
+    if (!(client = testClientNew('A')))
+        goto cleanup;
+
+    if (testQueueJob(dispatch, client, 0) < 0)
+        goto cleanup;
+
+    send.fail = 1;
+    if (testQueueJob(dispatch, client, 0) == 0 ||
+        testQueueJob(dispatch, client, 1) == 0)
+        goto cleanup;
+    send.fail = 0;
+
+    if (testQueueJob(dispatch, client, 0) < 0 ||
+        testCheckJobs(dispatch, " A1 A4") < 0)
+        goto cleanup;
+
+    if (client->refs != 1) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "client has %d references left\n", client->refs);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    testClientUnref(client);
+    virNetServerDispatchFree(dispatch);
+    return ret;
+}
+
+/* The queue of a client which left goes away with its last job */
+static int
+testDispatchClientGone(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testSend send = { 0 };
+    virNetServerDispatchPtr dispatch;
+    testClientPtr a = NULL;
+    testClientPtr b = NULL;
+    testClientPtr c = NULL;
+    int ret = -1;
+
+    if (!(dispatch = virNetServerDispatchNew(testSendJob, testJobFree,
+                                             &send)))
+        return -1;
+
+    if (!(a = testClientNew('A')) ||
+        !(b = testClientNew('B')) ||
+        !(c = testClientNew('C')))
+        goto cleanup;
+
+    if (testQueueJob(dispatch, a, 0) < 0 ||
+        testQueueJob(dispatch, b, 0) < 0 ||
+        testQueueJob(dispatch, a, 0) < 0 ||
+        testQueueJob(dispatch, b, 0) < 0 ||
+        testQueueJob(dispatch, b, 0) < 0)
+        goto cleanup;
+
+    /* A leaves with calls still waiting, which keep it around */
+    testClientUnref(a);
+    a = NULL;
+
+    if (testQueueJob(dispatch, c, 0) < 0 ||
+        testCheckJobs(dispatch, " A1 B1 C1 A2 B2 B3") < 0)
+        goto cleanup;
+
+    /* The others carry on without it */
+    if (testQueueJob(dispatch, c, 0) < 0 ||
+        testQueueJob(dispatch, b, 0) < 0 ||
+        testCheckJobs(dispatch, " C2 B4") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testClientUnref(a);
+    testClientUnref(b);
+    testClientUnref(c);
+    virNetServerDispatchFree(dispatch);
+    return ret;
+}
+
+/* Jobs nobody ran are freed along with the dispatcher, even when
+ * that frees their client and its queue */
+static int
+testDispatchFreePending(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testSend send = { 0 };
+    virNetServerDispatchPtr dispatch;
+    testClientPtr a = NULL;
+    testClientPtr b = NULL;
+    int ret = -1;
+
+    if (!(dispatch = virNetServerDispatchNew(testSendJob, testJobFree,
+                                             &send)))
+        return -1;
+
+    if (!(a = testClientNew('A')) ||
+        !(b = testClientNew('B')))
+        goto cleanup;
+
+    if (testQueueJob(dispatch, a, 0) < 0 ||
+        testQueueJob(dispatch, a, 0) < 0 ||
+        testQueueJob(dispatch, b, 0) < 0)
+        goto cleanup;
+
+    /* A is only kept alive by its jobs */
+    testClientUnref(a);
+    a = NULL;
+
+    virNetServerDispatchFree(dispatch);
+    dispatch = NULL;
+
+    if (b->refs != 1) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "pending jobs were not freed\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    testClientUnref(a);
+    testClientUnref(b);
+    virNetServerDispatchFree(dispatch);
+    return ret;
+}
+
+static int
+testDispatchBadWeights(const void *data ATTRIBUTE_UNUSED)
+{
+    static const char *const bad[] = {
+        "bob", "=2", "bob=", "bob=0", "bob=two", "bob=2x",
+    };
+    struct testSend send = { 0 };
+    virNetServerDispatchPtr dispatch;
+    const char *identities[2] = { NULL, NULL };
+    size_t i;
+    int ret = -1;
+
+    if (!(dispatch = virNetServerDispatchNew(testSendJob, testJobFree,
+                                             &send)))
+        return -1;
+
+    if (virNetServerDispatchSetWeights(dispatch, 0, 1, NULL) == 0 ||
+        virNetServerDispatchSetWeights(dispatch, 1, 0, NULL) == 0)
+        goto cleanup;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(bad) ; i++) {
+        identities[0] = bad[i];
+        if (virNetServerDispatchSetWeights(dispatch, 1, 1,
+                                           identities) == 0) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "'%s' was accepted\n", bad[i]);
+            goto cleanup;
+        }
+    }
+
+    /* The wildcard is the part before the last '=' */
+    identities[0] = "a=b=3";
+    if (virNetServerDispatchSetWeights(dispatch, 1, 1, identities) < 0 ||
+        !virNetServerDispatchHasIdentities(dispatch) ||
+        virNetServerDispatchSetWeights(dispatch, 1, 1, NULL) < 0 ||
+        virNetServerDispatchHasIdentities(dispatch))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virNetServerDispatchFree(dispatch);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Weights", 1, testDispatchWeights, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Priority", 1, testDispatchPriority, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("SendFail", 1, testDispatchSendFail, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("ClientGone", 1, testDispatchClientGone, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("FreePending", 1, testDispatchFreePending, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("BadWeights", 1, testDispatchBadWeights, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
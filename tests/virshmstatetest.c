@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <fcntl.h>
+
+#include "testutils.h"
+
+#include "virshmstate.h"
+#include "viralloc.h"
+#include "virfile.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static void
+testFillDomain(virShmStateDomainPtr dom, size_t n, bool active)
+{
+    memset(dom, 0, sizeof(*dom));
+    dom->uuid[0] = 0xff - (n & 0xff);
+    dom->uuid[1] = n >> 8;
+    dom->id = active ? (int) n + 1 : -1;
+    dom->state = active ? VIR_DOMAIN_RUNNING : VIR_DOMAIN_SHUTOFF;
+    dom->reason = active ? VIR_DOMAIN_RUNNING_BOOTED :
+                           VIR_DOMAIN_SHUTOFF_SHUTDOWN;
+    dom->nrVirtCpu = n + 1;
+    dom->maxMem = 1024 * (n + 1);
+    dom->memory = 512 * (n + 1);
+    dom->cpuTime = 1000000ull * n;
+    snprintf(dom->name, sizeof(dom->name), "dom%zu", n);
+}
+
+static int
+testShmStateUnpublished(const void *data ATTRIBUTE_UNUSED)
+{
+    virShmStatePtr writer = NULL;
+    virShmStatePtr reader = NULL;
+    virShmStateDomain dom;
+    unsigned char uuid[VIR_UUID_BUFLEN] = { 0 };
+    int rofd = -1;
+    int ret = -1;
+
+    if (!(writer = virShmStateNew(abs_builddir, &rofd)))
+        goto cleanup;
+
+    if ((fcntl(rofd, F_GETFL) & O_ACCMODE) != O_RDONLY) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "descriptor for clients is writable\n");
+        goto cleanup;
+    }
+
+    if (!(reader = virShmStateOpen(rofd)))
+        goto cleanup;
+
+    /* Never refreshed, so too old to be trusted */
+    if (virShmStateNumOfDomains(reader) != -1 ||
+        virShmStateGetDomain(reader, uuid, &dom) != 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virShmStateClose(reader);
+    virShmStateClose(writer);
+    VIR_FORCE_CLOSE(rofd);
+    return ret;
+}
+
+static int
+testShmStateLookup(const void *data ATTRIBUTE_UNUSED)
+{
+    virShmStatePtr writer = NULL;
+    virShmStatePtr reader = NULL;
+    virShmStateDomain domains[5];
+    virShmStateDomain expect;
+    virShmStateDomain dom;
+    int rofd = -1;
+    int ret = -1;
+    size_t i;
+
+    if (!(writer = virShmStateNew(abs_builddir, &rofd)))
+        goto cleanup;
+
+    if (!(reader = virShmStateOpen(rofd)))
+        goto cleanup;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(domains) ; i++)
+        testFillDomain(&domains[i], i, i % 2 == 0);
+
+    virShmStatePublish(writer, domains, ARRAY_CARDINALITY(domains));
+
+    if (virShmStateNumOfDomains(reader) != 3) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "expected 3 active domains, got %d\n",
+                    virShmStateNumOfDomains(reader));
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(domains) ; i++) {
+        testFillDomain(&expect, i, i % 2 == 0);
+
+        if (virShmStateGetDomain(reader, expect.uuid, &dom) != 1 ||
+            memcmp(&dom, &expect, sizeof(dom)) != 0) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "lookup of %s failed\n", expect.name);
+            goto cleanup;
+        }
+    }
+
+    testFillDomain(&expect, ARRAY_CARDINALITY(domains), true);
+    if (virShmStateGetDomain(reader, expect.uuid, &dom) != 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virShmStateClose(reader);
+    virShmStateClose(writer);
+    VIR_FORCE_CLOSE(rofd);
+    return ret;
+}
+
+static int
+testShmStateTruncated(const void *data ATTRIBUTE_UNUSED)
+{
+    virShmStatePtr writer = NULL;
+    virShmStatePtr reader = NULL;
+    virShmStateDomainPtr domains = NULL;
+    virShmStateDomain dom;
+    size_t ndomains = VIR_SHM_STATE_MAX_DOMAINS + 1;
+    int rofd = -1;
+    int ret = -1;
+    size_t i;
+
+    if (VIR_ALLOC_N(domains, ndomains) < 0)
+        goto cleanup;
+
+    if (!(writer = virShmStateNew(abs_builddir, &rofd)))
+        goto cleanup;
+
+    if (!(reader = virShmStateOpen(rofd)))
+        goto cleanup;
+
+    for (i = 0 ; i < ndomains ; i++)
+        testFillDomain(&domains[i], i, true);
+
+    virShmStatePublish(writer, domains, ndomains);
+
+    /* The count would be wrong, individual lookups still work */
+    if (virShmStateNumOfDomains(reader) != -1 ||
+        virShmStateGetDomain(reader, domains[0].uuid, &dom) != 1)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virShmStateClose(reader);
+    virShmStateClose(writer);
+    VIR_FORCE_CLOSE(rofd);
+    VIR_FREE(domains);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Unpublished", 1, testShmStateUnpublished, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Lookup", 1, testShmStateLookup, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Truncated", 1, testShmStateTruncated, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -38,6 +38,20 @@ static const char *domuuid_fc4 = DOM_UUID "\n\n";
 static const char *domid_fc4 = "2\n\n";
 static const char *domname_fc4 = "fc4\n\n";
 static const char *domstate_fc4 = "running\n\n";
+static const char *domstats_fc4 = "\
+Domain: 'fc4'\n\
+  state.state=1\n\
+  state.reason=1\n\
+  balloon.current=131072\n\
+  balloon.maximum=261072\n\
+  vcpu.current=1\n\
+  vcpu.maximum=1\n\
+\n";
+static const char *domstats_state_fc4 = "\
+Domain: 'fc4'\n\
+  state.state=1\n\
+  state.reason=1\n\
+\n";
 
 static int testFilterLine(char *buffer,
                           const char *toRemove) {
@@ -218,6 +232,19 @@ static int testCompareDomstateByName(const void *data ATTRIBUTE_UNUSED) {
   return testCompareOutputLit(exp, NULL, argv);
 }
 
+static int testCompareDomstatsByName(const void *data ATTRIBUTE_UNUSED) {
+  const char *const argv[] = { VIRSH_CUSTOM, "domstats", "fc4", NULL };
+  const char *exp = domstats_fc4;
+  return testCompareOutputLit(exp, NULL, argv);
+}
+
+static int testCompareDomstatsState(const void *data ATTRIBUTE_UNUSED) {
+  const char *const argv[] = { VIRSH_CUSTOM, "domstats", "--state",
+                               "--enforce", "fc4", NULL };
+  const char *exp = domstats_state_fc4;
+  return testCompareOutputLit(exp, NULL, argv);
+}
+
 struct testInfo {
     const char *const *argv;
     const char *result;
@@ -302,6 +329,14 @@ mymain(void)
                     1, testCompareDomstateByName, NULL) != 0)
         ret = -1;
 
+    if (virtTestRun("virsh domstats (by name)",
+                    1, testCompareDomstatsByName, NULL) != 0)
+        ret = -1;
+
+    if (virtTestRun("virsh domstats (state only)",
+                    1, testCompareDomstatsState, NULL) != 0)
+        ret = -1;
+
     /* It's a bit awkward listing result before argument, but that's a
      * limitation of C99 vararg macros.  */
 # define DO_TEST(i, result, ...)                                         \
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virthread.h"
+#include "virthreadpool.h"
+#include "virtime.h"
+
+/* How long to wait for something which should happen, and for
+ * something which should not */
+#define TEST_TIMEOUT_MS 10000
+#define TEST_SETTLE_MS 200
+
+struct testPoolState {
+    virMutex lock;
+    virCond cond;
+    bool released;
+    int blocked;   /* Jobs waiting for release */
+    int finished;
+    int prioFinished;
+};
+
+static struct testPoolState state;
+
+/* Jobs are NULL to block until released, &state for a priority job
+ * and any other pointer for a job which finishes right away */
+static void
+testPoolJob(void *jobdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&state.lock);
+    if (!jobdata) {
+        state.blocked++;
+        virCondBroadcast(&state.cond);
+        while (!state.released)
+            ignore_value(virCondWait(&state.cond, &state.lock));
+        state.blocked--;
+    } else if (jobdata == &state) {
+        state.prioFinished++;
+    }
+    state.finished++;
+    virCondBroadcast(&state.cond);
+    virMutexUnlock(&state.lock);
+}
+
+/* Wait for *@counter to reach @value. With @settle it is not
+ * expected to, so give up sooner. Called with the lock held. */
+static bool
+testPoolWaitFor(int *counter, int value, bool settle)
+{
+    unsigned long long deadline;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        return false;
+    deadline += settle ? TEST_SETTLE_MS : TEST_TIMEOUT_MS;
+
+    while (*counter < value) {
+        if (virCondWaitUntil(&state.cond, &state.lock, deadline) < 0)
+            return false;
+    }
+    return true;
+}
+
+static int
+testPoolStateInit(void)
+{
+    memset(&state, 0, sizeof(state));
+    if (virMutexInit(&state.lock) < 0)
+        return -1;
+    if (virCondInit(&state.cond) < 0) {
+        virMutexDestroy(&state.lock);
+        return -1;
+    }
+    return 0;
+}
+
+/* Release the blocked jobs and wait until all @njobs are done */
+static bool
+testPoolRelease(int njobs)
+{
+    bool ret;
+
+    virMutexLock(&state.lock);
+    state.released = true;
+    virCondBroadcast(&state.cond);
+    ret = testPoolWaitFor(&state.finished, njobs, false);
+    virMutexUnlock(&state.lock);
+
+    return ret;
+}
+
+
+/*
+ * Starting with a single worker, blocking jobs must each get a worker
+ * of their own up to the maximum, and no further.
+ */
+static int
+testPoolSpawn(const void *data ATTRIBUTE_UNUSED)
+{
+    virThreadPoolPtr pool = NULL;
+    size_t maxWorkers = 4;
+    size_t i;
+    int ret = -1;
+
+    if (testPoolStateInit() < 0)
+        return -1;
+
+    if (!(pool = virThreadPoolNew(1, maxWorkers, 0, testPoolJob, NULL)))
+        goto cleanup;
+
+    for (i = 0 ; i < maxWorkers + 2 ; i++) {
+        if (virThreadPoolSendJob(pool, 0, NULL) < 0)
+            goto release;
+    }
+
+    virMutexLock(&state.lock);
+    if (!testPoolWaitFor(&state.blocked, maxWorkers, false)) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "only %d of %zu workers started\n",
+                    state.blocked, maxWorkers);
+        virMutexUnlock(&state.lock);
+        goto release;
+    }
+    if (testPoolWaitFor(&state.blocked, maxWorkers + 1, true)) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "more than %zu workers started\n", maxWorkers);
+        virMutexUnlock(&state.lock);
+        goto release;
+    }
+    virMutexUnlock(&state.lock);
+
+    ret = 0;
+
+release:
+    if (!testPoolRelease(i))
+        ret = -1;
+cleanup:
+    virThreadPoolFree(pool);
+    virCondDestroy(&state.cond);
+    virMutexDestroy(&state.lock);
+    return ret;
+}
+
+
+/*
+ * With every normal worker stuck in a job, priority jobs must still
+ * run, while normal jobs wait.
+ */
+static int
+testPoolPriority(const void *data ATTRIBUTE_UNUSED)
+{
+    virThreadPoolPtr pool = NULL;
+    size_t workers = 2;
+    size_t njobs = 0;
+    size_t i;
+    int ret = -1;
+
+    if (testPoolStateInit() < 0)
+        return -1;
+
+    if (!(pool = virThreadPoolNew(workers, workers, 1, testPoolJob, NULL)))
+        goto cleanup;
+
+    for (i = 0 ; i < workers ; i++, njobs++) {
+        if (virThreadPoolSendJob(pool, 0, NULL) < 0)
+            goto release;
+    }
+
+    virMutexLock(&state.lock);
+    if (!testPoolWaitFor(&state.blocked, workers, false)) {
+        virMutexUnlock(&state.lock);
+        goto release;
+    }
+    virMutexUnlock(&state.lock);
+
+    if (virThreadPoolSendJob(pool, 0, &njobs) < 0)
+        goto release;
+    njobs++;
+
+    for (i = 0 ; i < 3 ; i++, njobs++) {
+        if (virThreadPoolSendJob(pool, 1, &state) < 0)
+            goto release;
+    }
+
+    virMutexLock(&state.lock);
+    if (!testPoolWaitFor(&state.prioFinished, 3, false)) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "only %d of 3 priority jobs ran\n",
+                    state.prioFinished);
+        virMutexUnlock(&state.lock);
+        goto release;
+    }
+    if (state.finished != 3) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "a normal job ran while the workers were busy\n");
+        virMutexUnlock(&state.lock);
+        goto release;
+    }
+    virMutexUnlock(&state.lock);
+
+    ret = 0;
+
+release:
+    if (!testPoolRelease(njobs))
+        ret = -1;
+cleanup:
+    virThreadPoolFree(pool);
+    virCondDestroy(&state.cond);
+    virMutexDestroy(&state.lock);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Spawn up to max workers", 1, testPoolSpawn, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Priority jobs with busy workers", 1,
+                    testPoolPriority, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -27,6 +27,7 @@
 #include "virsh-volume.h"
 
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -634,6 +635,11 @@ static const vshCmdOptDef opts_vol_upload[] = {
      .flags = 0,
      .help = N_("amount of data to upload")
     },
+    {.name = "sparse",
+     .type = VSH_OT_BOOL,
+     .flags = 0,
+     .help = N_("preserve holes instead of transferring zeros")
+    },
     {.name = NULL}
 };
 
@@ -646,6 +652,64 @@ cmdVolUploadSource(virStreamPtr st ATTRIBUTE_UNUSED,
     return saferead(*fd, bytes, nbytes);
 }
 
+#define VSH_VOL_SPARSE_BUF (64 * 1024)
+
+/* Like virStreamSendAll, but sends the holes in @fd as such */
+static int
+cmdVolUploadSparse(vshControl *ctl, virStreamPtr st, int fd)
+{
+    char *buf = vshMalloc(ctl, VSH_VOL_SPARSE_BUF);
+    int ret = -1;
+
+    for (;;) {
+        bool inData;
+        unsigned long long sectionLen;
+
+        if (virFileInData(fd, &inData, &sectionLen) < 0)
+            goto cleanup;
+
+        if (!sectionLen)
+            break;
+
+        if (!inData) {
+            if (virStreamSendHole(st, sectionLen, 0) < 0 ||
+                lseek(fd, sectionLen, SEEK_CUR) == (off_t) -1)
+                goto cleanup;
+            continue;
+        }
+
+        while (sectionLen) {
+            size_t want = MIN(VSH_VOL_SPARSE_BUF, sectionLen);
+            ssize_t got = saferead(fd, buf, want);
+            size_t offset = 0;
+
+            if (got < 0)
+                goto cleanup;
+            if (got == 0) {
+                /* File shrunk under us */
+                sectionLen = 0;
+                break;
+            }
+
+            while (offset < (size_t) got) {
+                int done = virStreamSend(st, buf + offset, got - offset);
+                if (done < 0)
+                    goto cleanup;
+                offset += done;
+            }
+            sectionLen -= got;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0)
+        virStreamAbort(st);
+    VIR_FREE(buf);
+    return ret;
+}
+
 static bool
 cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
 {
@@ -656,6 +720,11 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
     virStreamPtr st = NULL;
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
+    bool sparse = vshCommandOptBool(cmd, "sparse");
+    unsigned int flags = 0;
+
+    if (sparse)
+        flags |= VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
 
     if (vshCommandOptULongLong(cmd, "offset", &offset) < 0) {
         vshError(ctl, _("Unable to parse integer"));
@@ -680,12 +749,13 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
     }
 
     st = virStreamNew(ctl->conn, 0);
-    if (virStorageVolUpload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolUpload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot upload to volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamSendAll(st, cmdVolUploadSource, &fd) < 0) {
+    if (sparse ? cmdVolUploadSparse(ctl, st, fd) < 0 :
+        virStreamSendAll(st, cmdVolUploadSource, &fd) < 0) {
         vshError(ctl, _("cannot send data to volume %s"), name);
         goto cleanup;
     }
@@ -751,9 +821,84 @@ static const vshCmdOptDef opts_vol_download[] = {
      .flags = 0,
      .help = N_("amount of data to download")
     },
+    {.name = "sparse",
+     .type = VSH_OT_BOOL,
+     .flags = 0,
+     .help = N_("preserve holes instead of transferring zeros")
+    },
     {.name = NULL}
 };
 
+/* Write @len zeros to @fd, using @buf as scratch space */
+static int
+cmdVolDownloadZeros(int fd, char *buf, long long len)
+{
+    memset(buf, 0, MIN(len, VSH_VOL_SPARSE_BUF));
+    while (len > 0) {
+        size_t n = MIN(len, VSH_VOL_SPARSE_BUF);
+
+        if (safewrite(fd, buf, n) < 0)
+            return -1;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Like virStreamRecvAll, but leaves the holes in the stream
+ * unallocated in @fd if it is a regular file */
+static int
+cmdVolDownloadSparse(vshControl *ctl, virStreamPtr st, int fd)
+{
+    char *buf = vshMalloc(ctl, VSH_VOL_SPARSE_BUF);
+    struct stat sb;
+    bool isReg;
+    off_t pos;
+    int ret = -1;
+
+    /* Pipes can't seek, and seeking on a device would leave
+     * whatever it held before in place of the holes */
+    if (fstat(fd, &sb) < 0)
+        goto cleanup;
+    isReg = S_ISREG(sb.st_mode);
+
+    for (;;) {
+        long long holeLen;
+        int got = virStreamRecvFlags(st, buf, VSH_VOL_SPARSE_BUF,
+                                     VIR_STREAM_RECV_STOP_AT_HOLE);
+
+        if (got == -3) {
+            if (virStreamRecvHole(st, &holeLen, 0) < 0)
+                goto cleanup;
+            if (isReg ?
+                lseek(fd, holeLen, SEEK_CUR) == (off_t) -1 :
+                cmdVolDownloadZeros(fd, buf, holeLen) < 0)
+                goto cleanup;
+            continue;
+        }
+        if (got < 0)
+            goto cleanup;
+        if (got == 0)
+            break;
+        if (safewrite(fd, buf, got) < 0)
+            goto cleanup;
+    }
+
+    /* A trailing hole was only seeked over */
+    if (isReg &&
+        ((pos = lseek(fd, 0, SEEK_CUR)) == (off_t) -1 ||
+         ftruncate(fd, pos) < 0))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0)
+        virStreamAbort(st);
+    VIR_FREE(buf);
+    return ret;
+}
+
 static bool
 cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
 {
@@ -765,6 +910,11 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
     bool created = false;
+    bool sparse = vshCommandOptBool(cmd, "sparse");
+    unsigned int flags = 0;
+
+    if (sparse)
+        flags |= VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
 
     if (vshCommandOptULongLong(cmd, "offset", &offset) < 0) {
         vshError(ctl, _("Unable to parse integer"));
@@ -793,12 +943,13 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
     }
 
     st = virStreamNew(ctl->conn, 0);
-    if (virStorageVolDownload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolDownload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot download from volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamRecvAll(st, vshStreamSink, &fd) < 0) {
+    if (sparse ? cmdVolDownloadSparse(ctl, st, fd) < 0 :
+        virStreamRecvAll(st, vshStreamSink, &fd) < 0) {
         vshError(ctl, _("cannot receive data from volume %s"), name);
         goto cleanup;
     }
@@ -905,6 +1056,10 @@ static const vshCmdOptDef opts_vol_wipe[] = {
      .flags = 0,
      .help = N_("perform selected wiping algorithm")
     },
+    {.name = "async",
+     .type = VSH_OT_BOOL,
+     .help = N_("return once the wipe has started, see vol-jobinfo")
+    },
     {.name = NULL}
 };
 
@@ -922,6 +1077,10 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
     const char *algorithm_str = NULL;
     int algorithm = VIR_STORAGE_VOL_WIPE_ALG_ZERO;
     int funcRet;
+    unsigned int flags = 0;
+
+    if (vshCommandOptBool(cmd, "async"))
+        flags |= VIR_STORAGE_VOL_WIPE_ASYNC;
 
     if (!(vol = vshCommandOptVol(ctl, cmd, "vol", "pool", &name))) {
         return false;
@@ -936,10 +1095,10 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
         goto out;
     }
 
-    if ((funcRet = virStorageVolWipePattern(vol, algorithm, 0)) < 0) {
+    if ((funcRet = virStorageVolWipePattern(vol, algorithm, flags)) < 0) {
         if (last_error->code == VIR_ERR_NO_SUPPORT &&
             algorithm == VIR_STORAGE_VOL_WIPE_ALG_ZERO)
-            funcRet = virStorageVolWipe(vol, 0);
+            funcRet = virStorageVolWipe(vol, flags);
     }
 
     if (funcRet < 0) {
@@ -947,7 +1106,10 @@ cmdVolWipe(vshControl *ctl, const vshCmd *cmd)
         goto out;
     }
 
-    vshPrint(ctl, _("Vol %s wiped\n"), name);
+    if (flags & VIR_STORAGE_VOL_WIPE_ASYNC)
+        vshPrint(ctl, _("Wipe of vol %s started\n"), name);
+    else
+        vshPrint(ctl, _("Vol %s wiped\n"), name);
     ret = true;
 out:
     virStorageVolFree(vol);
@@ -1030,6 +1192,90 @@ cmdVolInfo(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/*
+ * "vol-jobinfo" command
+ */
+static const vshCmdInfo info_vol_jobinfo[] = {
+    {.name = "help",
+     .data = N_("storage vol job information")
+    },
+    {.name = "desc",
+     .data = N_("Returns progress of the last job started on the storage vol.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_vol_jobinfo[] = {
+    {.name = "vol",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("vol name, key or path")
+    },
+    {.name = "pool",
+     .type = VSH_OT_STRING,
+     .flags = 0,
+     .help = N_("pool name or uuid")
+    },
+    {.name = NULL}
+};
+
+VIR_ENUM_DECL(vshStorageVolJobType)
+VIR_ENUM_IMPL(vshStorageVolJobType, VIR_STORAGE_VOL_JOB_LAST,
+              N_("None"),
+              N_("Wipe"))
+
+VIR_ENUM_DECL(vshStorageVolJobState)
+VIR_ENUM_IMPL(vshStorageVolJobState, VIR_STORAGE_VOL_JOB_STATE_LAST,
+              N_("None"),
+              N_("Running"),
+              N_("Completed"),
+              N_("Failed"))
+
+static bool
+cmdVolJobInfo(vshControl *ctl, const vshCmd *cmd)
+{
+    virStorageVolJobInfo info;
+    virStorageVolPtr vol;
+    const char *str;
+    double val;
+    const char *unit;
+    bool ret = false;
+
+    if (!(vol = vshCommandOptVol(ctl, cmd, "vol", "pool", NULL)))
+        return false;
+
+    if (virStorageVolGetJobInfo(vol, &info, 0) < 0)
+        goto cleanup;
+
+    if (!(str = vshStorageVolJobTypeTypeToString(info.type)))
+        str = N_("unknown");
+    vshPrint(ctl, "%-17s %-12s\n", _("Job type:"), _(str));
+
+    if (info.type == VIR_STORAGE_VOL_JOB_NONE) {
+        ret = true;
+        goto cleanup;
+    }
+
+    if (!(str = vshStorageVolJobStateTypeToString(info.state)))
+        str = N_("unknown");
+    vshPrint(ctl, "%-17s %-12s\n", _("Job state:"), _(str));
+
+    vshPrint(ctl, "%-17s %-12llu ms\n", _("Time elapsed:"), info.timeElapsed);
+
+    val = vshPrettyCapacity(info.dataProcessed, &unit);
+    vshPrint(ctl, "%-17s %-.3lf %s\n", _("Data processed:"), val, unit);
+    val = vshPrettyCapacity(info.dataTotal, &unit);
+    vshPrint(ctl, "%-17s %-.3lf %s\n", _("Data total:"), val, unit);
+    val = vshPrettyCapacity(info.rate, &unit);
+    vshPrint(ctl, "%-17s %-.3lf %s/s\n", _("Rate:"), val, unit);
+
+    ret = true;
+
+cleanup:
+    virStorageVolFree(vol);
+    return ret;
+}
+
 /*
  * "vol-resize" command
  */
@@ -1829,6 +2075,12 @@ const vshCmdDef storageVolCmds[] = {
      .info = info_vol_info,
      .flags = 0
     },
+    {.name = "vol-jobinfo",
+     .handler = cmdVolJobInfo,
+     .opts = opts_vol_jobinfo,
+     .info = info_vol_jobinfo,
+     .flags = 0
+    },
     {.name = "vol-key",
      .handler = cmdVolKey,
      .opts = opts_vol_key,